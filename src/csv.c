@@ -17,8 +17,15 @@
 
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "utils.h"
 #include "csv.h"
 
@@ -250,3 +257,278 @@ csv_next_key_value(FILE *file, const char delimiter, char **key, char **value)
     errno = 0;
 }
 
+
+/**
+ * @brief Initializes a CSV scanner over a buffer
+ *
+ * The buffer must stay valid and unchanged while the scanner is used.
+ *
+ * @param scan pointer to the struct csv_scanner
+ * @param data pointer to the CSV data
+ * @param len length of the CSV data
+ */
+
+void
+csv_scan_init(struct csv_scanner *scan, const char *data, size_t len)
+{
+    memset(scan, 0, sizeof(*scan));
+    scan->cur = data;
+    scan->end = data + len;
+}
+
+/**
+ * @brief Releases the memory held by a CSV scanner
+ *
+ * Fields returned by the scanner are no longer valid afterwards.
+ *
+ * @param scan pointer to the struct csv_scanner
+ */
+
+void
+csv_scan_done(struct csv_scanner *scan)
+{
+    xfree(scan->buf);
+    scan->buf = NULL;
+    scan->size = 0;
+}
+
+int
+csv_scan_eof(const struct csv_scanner *scan)
+{
+    return scan->cur >= scan->end;
+}
+
+/*
+ * Returns a pointer to the first byte in [p, end) that is a or b, or
+ * end if there is none. With SSE2 or NEON, 16 bytes are compared at
+ * a time, the scalar loop finishes the tail.
+ */
+
+static const char *
+find2(const char *p, const char *end, const char a, const char b)
+{
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    while (end - p >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+						  _mm_cmpeq_epi8(v, vb)));
+	if (mask) {
+	    return p + __builtin_ctz((unsigned int) mask);
+	}
+	p += 16;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t va = vdupq_n_u8((uint8_t) a);
+    const uint8x16_t vb = vdupq_n_u8((uint8_t) b);
+
+    while (end - p >= 16) {
+	uint8x16_t v = vld1q_u8((const uint8_t *) p);
+	if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)))) {
+	    break;
+	}
+	p += 16;
+    }
+#endif
+    while (p < end && *p != a && *p != b) {
+	p++;
+    }
+    return p;
+}
+
+/* Appends len bytes to the scanner's field buffer, which has n bytes. */
+
+static int
+scan_append(struct csv_scanner *scan, size_t n, const char *s, size_t len)
+{
+    size_t size;
+    char *p;
+
+    if (n + len >= scan->size) {
+	size = scan->size ? scan->size : 64;
+	while (n + len >= size) {
+	    size *= 2;
+	}
+	p = realloc(scan->buf, size);
+	if (! p) {
+	    lmap_err("failed to allocate memory");
+	    errno = ENOMEM;
+	    return -1;
+	}
+	scan->buf = p;
+	scan->size = size;
+    }
+    memcpy(scan->buf + n, s, len);
+    return 0;
+}
+
+/**
+ * @brief Scans the next field of a CSV buffer
+ *
+ * Returns the same fields as csv_next() would for the same data:
+ * leading white space of unquoted fields is skipped, a quote escapes
+ * the following character in quoted fields, and an empty field as
+ * well as the end of a record (aka line) produce no field.
+ *
+ * The field is not NUL terminated. It points into the buffer or, if
+ * it contained escaped characters, into memory owned by the scanner,
+ * and remains valid until the next call.
+ *
+ * @param scan pointer to the struct csv_scanner
+ * @param delimiter delimiter character
+ * @param field pointer used to return the field
+ * @param len pointer used to return the length of the field
+ * @return 1 if a field was returned, 0 on an empty field, at the end
+ *         of a record or at the end of the buffer, -1 on error
+ */
+
+int
+csv_scan_next(struct csv_scanner *scan, const char delimiter,
+	      const char **field, size_t *len)
+{
+    const char quote = '"';
+    const char *p = scan->cur, *end = scan->end, *run, *q;
+    size_t n = 0;
+    int quoted = 0, copied = 0;
+
+    while (p < end) {
+	if ((!quoted && *p == delimiter) || *p == '\n') {
+	    scan->cur = p + 1;
+	    return 0;
+	}
+	if (*p == quote) {
+	    quoted = 1;
+	} else if (quoted || !isspace((unsigned char) *p)) {
+	    break;
+	}
+	p++;
+    }
+    if (p == end) {
+	scan->cur = p;
+	return 0;
+    }
+
+    run = p;
+    if (! quoted) {
+	p = find2(p, end, delimiter, '\n');
+	*field = run;
+	*len = (size_t) (p - run);
+	if (p < end && *p == delimiter) {
+	    p++;
+	}
+	scan->cur = p;
+	return 1;
+    }
+
+    while (1) {
+	q = find2(p, end, quote, '\n');
+	if (q == end || *q == '\n') {
+	    p = q;
+	    break;
+	}
+	p = q + 1;
+	if (p == end || *p == delimiter || *p == '\n') {
+	    if (p < end) {
+		p++;
+	    }
+	    break;
+	}
+	/* drop the quote, the next character is taken literally */
+	if (scan_append(scan, n, run, (size_t) (q - run))) {
+	    return -1;
+	}
+	n += (size_t) (q - run);
+	copied = 1;
+	run = p++;
+    }
+
+    scan->cur = p;
+    if (! copied) {
+	*field = run;
+	*len = (size_t) (q - run);
+	return 1;
+    }
+    if (scan_append(scan, n, run, (size_t) (q - run))) {
+	return -1;
+    }
+    *field = scan->buf;
+    *len = n + (size_t) (q - run);
+    return 1;
+}
+
+/**
+ * @brief Scans the next key and value of a CSV buffer
+ *
+ * Works like csv_next_key_value(): empty records are skipped, the key
+ * and the value are the first two fields of the next record. The key
+ * and the value are allocated and must be freed by the caller.
+ *
+ * @param scan pointer to the struct csv_scanner
+ * @param delimiter delimiter character
+ * @param key pointer used to return the key or NULL
+ * @param value pointer used to return the value or NULL
+ * @return 0 on success, -1 on error
+ */
+
+int
+csv_scan_next_key_value(struct csv_scanner *scan, const char delimiter,
+			char **key, char **value)
+{
+    const char *field;
+    size_t len;
+    char *k, *v = NULL;
+    int n;
+
+    if (key) {
+	*key = NULL;
+    }
+    if (value) {
+	*value = NULL;
+    }
+
+    do {
+	if (csv_scan_eof(scan)) {
+	    return 0;
+	}
+	n = csv_scan_next(scan, delimiter, &field, &len);
+	if (n < 0) {
+	    return -1;
+	}
+    } while (n == 0);
+
+    k = strndup(field, len);
+    if (! k) {
+	goto enomem;
+    }
+    n = csv_scan_next(scan, delimiter, &field, &len);
+    if (n < 0) {
+	xfree(k);
+	return -1;
+    }
+    if (n > 0) {
+	v = strndup(field, len);
+	if (! v) {
+	    xfree(k);
+	    goto enomem;
+	}
+    }
+
+    if (key) {
+	*key = k;
+    } else {
+	xfree(k);
+    }
+    if (value) {
+	*value = v;
+    } else {
+	xfree(v);
+    }
+    return 0;
+
+enomem:
+    lmap_err("failed to allocate memory");
+    errno = ENOMEM;
+    return -1;
+}
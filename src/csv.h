@@ -29,5 +29,28 @@ extern void csv_append_key_value(FILE *file, char delimiter,
 				 const char *key, const char *value);
 extern void csv_next_key_value(FILE *file, char delimiter,
 			       char **key, char **value);
+
+/**
+ * A CSV scanner over a buffer in memory, typically an mmap()ed file.
+ * Fields are returned as slices of the buffer whenever they contain no
+ * escaped quotes, the buffer is never modified. The fields are the
+ * same as the ones returned by csv_next().
+ */
+
+struct csv_scanner {
+    const char *cur;		/* next byte to scan */
+    const char *end;		/* end of the buffer */
+    char *buf;			/* unescaped copy of a quoted field */
+    size_t size;		/* allocated size of buf */
+};
+
+extern void csv_scan_init(struct csv_scanner *scan,
+			  const char *data, size_t len);
+extern void csv_scan_done(struct csv_scanner *scan);
+extern int csv_scan_eof(const struct csv_scanner *scan);
+extern int csv_scan_next(struct csv_scanner *scan, char delimiter,
+			 const char **field, size_t *len);
+extern int csv_scan_next_key_value(struct csv_scanner *scan, char delimiter,
+				   char **key, char **value);
     
 #endif
@@ -33,6 +33,8 @@
 #include "lmapd.h"
 #include "utils.h"
 #include "lmap-io.h"
+#include "pidtab.h"
+#include "qindex.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -416,6 +418,24 @@ lmap_find_schedule(struct lmap *lmap, const char *name)
     return NULL;
 }
 
+struct supp *
+lmap_find_supp(struct lmap *lmap, const char *name)
+{
+    struct supp *supp;
+
+    if (! lmap || !name) {
+	return NULL;
+    }
+
+    for (supp = lmap->supps; supp; supp = supp->next) {
+	if (supp->name && strcmp(supp->name, name) == 0) {
+	    return supp;
+	}
+    }
+
+    return NULL;
+}
+
 /*
  * struct lmap functions...
  */
@@ -518,6 +538,572 @@ lmap_valid(struct lmap *lmap)
     return valid;
 }
 
+/*
+ * Per event subscriber counters used while linking events.
+ */
+
+struct event_link {
+    struct event *event;
+    size_t start_schedules;
+    size_t end_schedules;
+    size_t start_supps;
+    size_t end_supps;
+};
+
+static struct event_link *
+find_event_link(struct event_link *links, size_t n, const char *name)
+{
+    size_t i;
+
+    if (! name) {
+	return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+	if (links[i].event->name && strcmp(links[i].event->name, name) == 0) {
+	    return &links[i];
+	}
+    }
+
+    return NULL;
+}
+
+static void
+unlink_event(struct event *event)
+{
+    xfree(event->start_schedules);
+    xfree(event->end_schedules);
+    xfree(event->start_supps);
+    xfree(event->end_supps);
+    event->start_schedules = NULL;
+    event->end_schedules = NULL;
+    event->start_supps = NULL;
+    event->end_supps = NULL;
+}
+
+/**
+ * @brief Build the subscriber lists of all events
+ *
+ * Builds for every event the lists of schedules and suppressions
+ * that are started or ended by the event, so that firing an event
+ * does not need to look at any other schedules or suppressions.
+ * The lists keep the order of the schedules and suppressions in
+ * the configuration. This must be called again whenever schedules,
+ * suppressions or events are added or removed.
+ *
+ * @param lmap pointer to the struct lmap
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_link_events(struct lmap *lmap)
+{
+    struct event_link *links, *l;
+    struct event *event;
+    struct schedule *sched;
+    struct supp *supp;
+    size_t i, n = 0;
+    int ret = -1;
+
+    for (event = lmap->events; event; event = event->next) {
+	unlink_event(event);
+	n++;
+    }
+    if (! n) {
+	return 0;
+    }
+
+    links = xcalloc(n, sizeof(struct event_link), __FUNCTION__);
+    if (! links) {
+	return -1;
+    }
+    for (i = 0, event = lmap->events; event; event = event->next, i++) {
+	links[i].event = event;
+    }
+
+    /* first pass: count the subscribers of each event */
+    for (sched = lmap->schedules; sched; sched = sched->next) {
+	if ((l = find_event_link(links, n, sched->start))) {
+	    l->start_schedules++;
+	}
+	if ((l = find_event_link(links, n, sched->end))) {
+	    l->end_schedules++;
+	}
+    }
+    for (supp = lmap->supps; supp; supp = supp->next) {
+	if ((l = find_event_link(links, n, supp->start))) {
+	    l->start_supps++;
+	}
+	if ((l = find_event_link(links, n, supp->end))) {
+	    l->end_supps++;
+	}
+    }
+
+    for (i = 0; i < n; i++) {
+	event = links[i].event;
+	event->start_schedules = xcalloc(links[i].start_schedules + 1,
+					 sizeof(struct schedule *), __FUNCTION__);
+	event->end_schedules = xcalloc(links[i].end_schedules + 1,
+				       sizeof(struct schedule *), __FUNCTION__);
+	event->start_supps = xcalloc(links[i].start_supps + 1,
+				     sizeof(struct supp *), __FUNCTION__);
+	event->end_supps = xcalloc(links[i].end_supps + 1,
+				   sizeof(struct supp *), __FUNCTION__);
+	if (!event->start_schedules || !event->end_schedules
+	    || !event->start_supps || !event->end_supps) {
+	    goto done;
+	}
+	links[i].start_schedules = links[i].end_schedules = 0;
+	links[i].start_supps = links[i].end_supps = 0;
+    }
+
+    /* second pass: fill the subscriber lists */
+    for (sched = lmap->schedules; sched; sched = sched->next) {
+	if ((l = find_event_link(links, n, sched->start))) {
+	    l->event->start_schedules[l->start_schedules++] = sched;
+	}
+	if ((l = find_event_link(links, n, sched->end))) {
+	    l->event->end_schedules[l->end_schedules++] = sched;
+	}
+    }
+    for (supp = lmap->supps; supp; supp = supp->next) {
+	if ((l = find_event_link(links, n, supp->start))) {
+	    l->event->start_supps[l->start_supps++] = supp;
+	}
+	if ((l = find_event_link(links, n, supp->end))) {
+	    l->event->end_supps[l->end_supps++] = supp;
+	}
+    }
+    ret = 0;
+
+done:
+    if (ret) {
+	for (event = lmap->events; event; event = event->next) {
+	    unlink_event(event);
+	}
+    }
+    xfree(links);
+    return ret;
+}
+
+static void
+unlink_action(struct action *action)
+{
+    xfree(action->argv);
+    xfree(action->destination_schedules);
+    action->argv = NULL;
+    action->destination_schedules = NULL;
+    action->linked_task = NULL;
+    action->capability = NULL;
+}
+
+static int
+count_options(struct option *options)
+{
+    struct option *option;
+    int n = 0;
+
+    for (option = options; option; option = option->next) {
+	n += (option->name != NULL) + (option->value != NULL);
+    }
+    return n;
+}
+
+static char **
+fill_options(char **argv, struct option *options)
+{
+    struct option *option;
+
+    for (option = options; option; option = option->next) {
+	if (option->name) {
+	    *argv++ = option->name;
+	}
+	if (option->value) {
+	    *argv++ = option->value;
+	}
+    }
+    return argv;
+}
+
+/*
+ * Resolve the task, the capability and the destinations of an
+ * action and build its argument vector. Broken references are
+ * reported here and leave action->argv NULL so that the runner
+ * simply skips the action. Returns -1 only on memory shortage.
+ */
+
+static int
+link_action(struct lmap *lmap, struct action *action)
+{
+    struct task *task, *cap = NULL;
+    struct tag *tag;
+    char **argv;
+    int n;
+
+    unlink_action(action);
+
+    for (n = 0, tag = action->destinations; tag; tag = tag->next) {
+	n++;
+    }
+    action->destination_schedules = xcalloc(n + 1, sizeof(struct schedule *),
+					    __FUNCTION__);
+    if (! action->destination_schedules) {
+	return -1;
+    }
+    for (n = 0, tag = action->destinations; tag; tag = tag->next) {
+	struct schedule *dst = lmap_find_schedule(lmap, tag->tag);
+	if (! dst) {
+	    lmap_err("destination '%s' for action '%s' does not exist",
+		     tag->tag, action->name);
+	    continue;
+	}
+	action->destination_schedules[n++] = dst;
+    }
+
+    if (! action->task) {
+	return 0;
+    }
+
+    task = lmap_find_task(lmap, action->task);
+    if (! task) {
+	lmap_err("task '%s' for action '%s' does not exist",
+		 action->task, action->name);
+	return 0;
+    }
+    action->linked_task = task;
+
+    if (! task->program) {
+	lmap_err("task '%s' has no program", task->name);
+	return 0;
+    }
+
+    /*
+     * Check that the program of the task is listed as a valid
+     * capability; we do not want to run arbitrary commands.
+     */
+
+    if (lmap->capabilities) {
+	for (cap = lmap->capabilities->tasks; cap; cap = cap->next) {
+	    if (cap->program && strcmp(task->program, cap->program) == 0) {
+		break;
+	    }
+	}
+    }
+    if (! cap) {
+	lmap_err("task '%s' does not match capabilities", task->name);
+	return 0;
+    }
+    action->capability = cap;
+
+    n = 1 + count_options(task->options) + count_options(action->options);
+    action->argv = xcalloc(n + 1, sizeof(char *), __FUNCTION__);
+    if (! action->argv) {
+	return -1;
+    }
+    argv = action->argv;
+    *argv++ = task->program;
+    argv = fill_options(argv, task->options);
+    (void) fill_options(argv, action->options);
+
+    return 0;
+}
+
+/**
+ * @brief Resolve all references of a configuration
+ *
+ * Replaces the name based references of a configuration by
+ * pointers: the subscriber lists of the events (see
+ * lmap_link_events()) and the task, capability, destination
+ * schedules and argument vector of every action. Broken references
+ * are reported once while linking; the affected actions are left
+ * without an argument vector and will not be executed. This must be
+ * called again whenever the configuration changes.
+ *
+ * @param lmap pointer to the struct lmap
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_link(struct lmap *lmap)
+{
+    struct schedule *sched;
+    struct action *action;
+
+    if (lmap_link_events(lmap)) {
+	return -1;
+    }
+
+    for (sched = lmap->schedules; sched; sched = sched->next) {
+	for (action = sched->actions; action; action = action->next) {
+	    if (link_action(lmap, action)) {
+		return -1;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Helpers comparing the configuration of two objects, used to find
+ * out what changed when the configuration is reloaded.
+ */
+
+static int
+str_equal(const char *a, const char *b)
+{
+    if (!a || !b) {
+	return a == b;
+    }
+    return strcmp(a, b) == 0;
+}
+
+static int
+tags_equal(struct tag *a, struct tag *b)
+{
+    for (; a && b; a = a->next, b = b->next) {
+	if (! str_equal(a->tag, b->tag)) {
+	    return 0;
+	}
+    }
+    return a == b;
+}
+
+static int
+options_equal(struct option *a, struct option *b)
+{
+    for (; a && b; a = a->next, b = b->next) {
+	if (! str_equal(a->id, b->id)
+	    || ! str_equal(a->name, b->name)
+	    || ! str_equal(a->value, b->value)) {
+	    return 0;
+	}
+    }
+    return a == b;
+}
+
+#define LMAP_ACTION_CONFIG_FLAGS	(LMAP_ACTION_FLAG_TIMEOUT_SET)
+#define LMAP_SCHEDULE_CONFIG_FLAGS	(LMAP_SCHEDULE_FLAG_END_SET \
+					 | LMAP_SCHEDULE_FLAG_DURATION_SET \
+					 | LMAP_SCHEDULE_FLAG_EXEC_MODE_SET \
+					 | LMAP_SCHEDULE_FLAG_PRIORITY_SET \
+					 | LMAP_SCHEDULE_FLAG_STAGGER_SET \
+					 | LMAP_SCHEDULE_FLAG_OVERFLOW_SET \
+					 | LMAP_SCHEDULE_FLAG_COMPRESSION_SET \
+					 | LMAP_SCHEDULE_FLAG_FORMAT_SET)
+
+static int
+action_equal(struct action *a, struct action *b)
+{
+    return str_equal(a->name, b->name)
+	&& str_equal(a->task, b->task)
+	&& tags_equal(a->destinations, b->destinations)
+	&& options_equal(a->options, b->options)
+	&& tags_equal(a->tags, b->tags)
+	&& tags_equal(a->suppression_tags, b->suppression_tags)
+	&& a->timeout == b->timeout
+	&& a->output_memory_limit == b->output_memory_limit
+	&& (a->flags & LMAP_ACTION_CONFIG_FLAGS) == (b->flags & LMAP_ACTION_CONFIG_FLAGS);
+}
+
+/**
+ * @brief Compares the configuration of two schedules
+ *
+ * Compares the configuration of two schedules, including their
+ * actions, ignoring all state information. Tasks are referenced by
+ * name only, a changed task does not change the schedules using it.
+ *
+ * @param a pointer to the first struct schedule
+ * @param b pointer to the second struct schedule
+ * @return 1 if the configuration is the same, 0 otherwise
+ */
+
+int
+lmap_schedule_equal(struct schedule *a, struct schedule *b)
+{
+    struct action *x, *y;
+
+    if (! str_equal(a->name, b->name)
+	|| ! str_equal(a->start, b->start)
+	|| ! str_equal(a->end, b->end)
+	|| a->duration != b->duration
+	|| a->mode != b->mode
+	|| a->priority != b->priority
+	|| a->stagger != b->stagger
+	|| a->incoming_max_bytes != b->incoming_max_bytes
+	|| a->incoming_max_files != b->incoming_max_files
+	|| a->incoming_overflow != b->incoming_overflow
+	|| a->incoming_compression != b->incoming_compression
+	|| a->incoming_format != b->incoming_format
+	|| (a->flags & LMAP_SCHEDULE_CONFIG_FLAGS) != (b->flags & LMAP_SCHEDULE_CONFIG_FLAGS)
+	|| ! tags_equal(a->tags, b->tags)
+	|| ! tags_equal(a->suppression_tags, b->suppression_tags)) {
+	return 0;
+    }
+
+    for (x = a->actions, y = b->actions; x && y; x = x->next, y = y->next) {
+	if (! action_equal(x, y)) {
+	    return 0;
+	}
+    }
+    return x == y;
+}
+
+/**
+ * @brief Compares the configuration of two suppressions
+ *
+ * @param a pointer to the first struct supp
+ * @param b pointer to the second struct supp
+ * @return 1 if the configuration is the same, 0 otherwise
+ */
+
+int
+lmap_supp_equal(struct supp *a, struct supp *b)
+{
+    return str_equal(a->name, b->name)
+	&& str_equal(a->start, b->start)
+	&& str_equal(a->end, b->end)
+	&& tags_equal(a->match, b->match)
+	&& a->stop_running == b->stop_running
+	&& a->flags == b->flags;
+}
+
+/**
+ * @brief Compares the configuration of two events
+ *
+ * @param a pointer to the first struct event
+ * @param b pointer to the second struct event
+ * @return 1 if the configuration is the same, 0 otherwise
+ */
+
+int
+lmap_event_equal(struct event *a, struct event *b)
+{
+    return str_equal(a->name, b->name)
+	&& a->type == b->type
+	&& a->flags == b->flags
+	&& a->interval == b->interval
+	&& a->start == b->start
+	&& a->end == b->end
+	&& a->random_spread == b->random_spread
+	&& a->cycle_interval == b->cycle_interval
+	&& a->months == b->months
+	&& a->days_of_month == b->days_of_month
+	&& a->days_of_week == b->days_of_week
+	&& a->hours == b->hours
+	&& a->minutes == b->minutes
+	&& a->seconds == b->seconds
+	&& a->timezone_offset == b->timezone_offset;
+}
+
+/*
+ * FNV-1a hashes of the configuration of schedules and actions, used
+ * to recognize saved state that still belongs to the same config.
+ */
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+static uint64_t
+hash_bytes(uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len--) {
+	h ^= *p++;
+	h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t
+hash_str(uint64_t h, const char *s)
+{
+    /* the terminating NUL separates the fields, 0xff marks NULL */
+    if (! s) {
+	return hash_bytes(h, "\xff", 1);
+    }
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+static uint64_t
+hash_u64(uint64_t h, uint64_t v)
+{
+    return hash_bytes(h, &v, sizeof(v));
+}
+
+static uint64_t
+hash_tags(uint64_t h, struct tag *tag)
+{
+    for (; tag; tag = tag->next) {
+	h = hash_str(h, tag->tag);
+    }
+    return hash_str(h, NULL);
+}
+
+/**
+ * @brief Hashes the configuration of an action
+ *
+ * @param action pointer to the struct action
+ * @return hash of the configuration, ignoring all state information
+ */
+
+uint64_t
+lmap_action_hash(struct action *action)
+{
+    struct option *option;
+    uint64_t h = FNV_OFFSET;
+
+    h = hash_str(h, action->name);
+    h = hash_str(h, action->task);
+    h = hash_tags(h, action->destinations);
+    for (option = action->options; option; option = option->next) {
+	h = hash_str(h, option->id);
+	h = hash_str(h, option->name);
+	h = hash_str(h, option->value);
+    }
+    h = hash_str(h, NULL);
+    h = hash_tags(h, action->tags);
+    h = hash_tags(h, action->suppression_tags);
+    h = hash_u64(h, action->timeout);
+    h = hash_u64(h, action->output_memory_limit);
+    h = hash_u64(h, action->flags & LMAP_ACTION_CONFIG_FLAGS);
+    return h;
+}
+
+/**
+ * @brief Hashes the configuration of a schedule
+ *
+ * Unlike lmap_schedule_equal(), the actions of the schedule are not
+ * included, see lmap_action_hash().
+ *
+ * @param schedule pointer to the struct schedule
+ * @return hash of the configuration, ignoring all state information
+ */
+
+uint64_t
+lmap_schedule_hash(struct schedule *schedule)
+{
+    uint64_t h = FNV_OFFSET;
+
+    h = hash_str(h, schedule->name);
+    h = hash_str(h, schedule->start);
+    h = hash_str(h, schedule->end);
+    h = hash_u64(h, schedule->duration);
+    h = hash_u64(h, schedule->mode);
+    h = hash_u64(h, (uint64_t) (int64_t) schedule->priority);
+    h = hash_u64(h, schedule->stagger);
+    h = hash_u64(h, schedule->incoming_max_bytes);
+    h = hash_u64(h, schedule->incoming_max_files);
+    h = hash_u64(h, schedule->incoming_overflow);
+    h = hash_u64(h, schedule->incoming_compression);
+    h = hash_u64(h, schedule->incoming_format);
+    h = hash_u64(h, schedule->flags & LMAP_SCHEDULE_CONFIG_FLAGS);
+    h = hash_tags(h, schedule->tags);
+    h = hash_tags(h, schedule->suppression_tags);
+    return h;
+}
+
 int
 lmap_add_schedule(struct lmap *lmap, struct schedule *schedule)
 {
@@ -622,6 +1208,61 @@ lmap_add_event(struct lmap *lmap, struct event *event)
     return 0;
 }
 
+/**
+ * @brief Removes objects from a struct lmap
+ *
+ * Unlinks a schedule, suppression or event from the lists of a
+ * struct lmap without freeing it.
+ *
+ * @param lmap pointer to the struct lmap
+ * @return 0 if the object was removed, -1 if it was not found
+ */
+
+int
+lmap_remove_schedule(struct lmap *lmap, struct schedule *schedule)
+{
+    struct schedule **cur;
+
+    for (cur = &lmap->schedules; *cur; cur = &(*cur)->next) {
+	if (*cur == schedule) {
+	    *cur = schedule->next;
+	    schedule->next = NULL;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+int
+lmap_remove_supp(struct lmap *lmap, struct supp *supp)
+{
+    struct supp **cur;
+
+    for (cur = &lmap->supps; *cur; cur = &(*cur)->next) {
+	if (*cur == supp) {
+	    *cur = supp->next;
+	    supp->next = NULL;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
+int
+lmap_remove_event(struct lmap *lmap, struct event *event)
+{
+    struct event **cur;
+
+    for (cur = &lmap->events; *cur; cur = &(*cur)->next) {
+	if (*cur == event) {
+	    *cur = event->next;
+	    event->next = NULL;
+	    return 0;
+	}
+    }
+    return -1;
+}
+
 int
 lmap_add_result(struct lmap *lmap, struct result *res)
 {
@@ -647,6 +1288,7 @@ lmap_agent_new(void)
     agent = (struct agent*) xcalloc(1, sizeof(struct agent), __FUNCTION__);
     if (agent) {
         agent->controller_timeout = 604800;	/* one week in seconds */
+	agent->commit_window = 50;		/* milliseconds */
     }
     return agent;
 }
@@ -764,27 +1406,132 @@ lmap_agent_set_report_measurement_point(struct agent *agent, const char *value)
 }
 
 int
-lmap_agent_set_controller_timeout(struct agent *agent, const char *value)
+lmap_agent_set_controller_timeout(struct agent *agent, const char *value)
+{
+    int ret;
+
+    ret = set_uint32(&agent->controller_timeout, value, __FUNCTION__);
+    if (ret == 0) {
+	agent->flags |= LMAP_AGENT_FLAG_CONTROLLER_TIMEOUT_SET;
+    }
+    return ret;
+}
+
+int
+lmap_agent_set_last_started(struct agent *agent, const char *value)
+{
+    return set_dateandtime(&agent->last_started, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_report_date(struct agent *agent, const char *value)
+{
+    return set_dateandtime(&agent->report_date, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_max_concurrent_actions(struct agent *agent, const char *value)
+{
+    int ret;
+
+    ret = set_uint32(&agent->max_concurrent_actions, value, __FUNCTION__);
+    if (ret == 0) {
+	agent->flags |= LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET;
+    }
+    return ret;
+}
+
+int
+lmap_agent_set_admission_queue_depth(struct agent *agent, const char *value)
+{
+    return set_uint32(&agent->admission_queue_depth, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_admissions(struct agent *agent, const char *value)
+{
+    return set_uint32(&agent->cnt_admissions, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_admission_wait(struct agent *agent, const char *value)
+{
+    return set_uint64(&agent->admission_wait, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_admission_max_wait(struct agent *agent, const char *value)
+{
+    return set_uint64(&agent->admission_max_wait, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_loop_lag(struct agent *agent, const char *value)
+{
+    return set_uint64(&agent->loop_lag, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_loop_max_lag(struct agent *agent, const char *value)
+{
+    return set_uint64(&agent->loop_max_lag, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_durability(struct agent *agent, const char *value)
+{
+    if (strcmp("none", value) == 0) {
+	agent->durability = LMAP_AGENT_DURABILITY_NONE;
+    } else if (strcmp("group", value) == 0) {
+	agent->durability = LMAP_AGENT_DURABILITY_GROUP;
+    } else {
+	lmap_err("illegal durability '%s'", value);
+	return -1;
+    }
+    agent->flags |= LMAP_AGENT_FLAG_DURABILITY_SET;
+    return 0;
+}
+
+int
+lmap_agent_set_commit_window(struct agent *agent, const char *value)
 {
     int ret;
 
-    ret = set_uint32(&agent->controller_timeout, value, __FUNCTION__);
+    ret = set_uint32(&agent->commit_window, value, __FUNCTION__);
     if (ret == 0) {
-	agent->flags |= LMAP_AGENT_FLAG_CONTROLLER_TIMEOUT_SET;
+	agent->flags |= LMAP_AGENT_FLAG_COMMIT_WINDOW_SET;
     }
     return ret;
 }
 
 int
-lmap_agent_set_last_started(struct agent *agent, const char *value)
+lmap_agent_set_commits(struct agent *agent, const char *value)
 {
-    return set_dateandtime(&agent->last_started, value, __FUNCTION__);
+    return set_uint32(&agent->cnt_commits, value, __FUNCTION__);
 }
 
 int
-lmap_agent_set_report_date(struct agent *agent, const char *value)
+lmap_agent_set_commit_latency(struct agent *agent, const char *value)
 {
-    return set_dateandtime(&agent->report_date, value, __FUNCTION__);
+    return set_uint64(&agent->commit_latency, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_commit_max_latency(struct agent *agent, const char *value)
+{
+    return set_uint64(&agent->commit_max_latency, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_commit_batch(struct agent *agent, const char *value)
+{
+    return set_uint32(&agent->commit_batch, value, __FUNCTION__);
+}
+
+int
+lmap_agent_set_commit_max_batch(struct agent *agent, const char *value)
+{
+    return set_uint32(&agent->commit_max_batch, value, __FUNCTION__);
 }
 
 /*
@@ -988,6 +1735,85 @@ lmap_option_set_value(struct option *option, const char *value)
     return set_string(&option->value, value, __FUNCTION__);
 }
 
+/*
+ * struct usage functions...
+ */
+
+int
+lmap_usage_isset(const struct usage *usage)
+{
+    return usage->user_time || usage->system_time || usage->max_rss
+	|| usage->block_input || usage->block_output
+	|| usage->voluntary_switches || usage->involuntary_switches;
+}
+
+/**
+ * @brief Accumulate resource usage
+ *
+ * Adds the resource usage in usage to the resource usage in total.
+ * The max_rss of total becomes the larger of both, all other fields
+ * are summed up.
+ *
+ * @param total pointer to the accumulated struct usage
+ * @param usage pointer to the struct usage to add
+ */
+
+void
+lmap_usage_add(struct usage *total, const struct usage *usage)
+{
+    total->user_time += usage->user_time;
+    total->system_time += usage->system_time;
+    if (usage->max_rss > total->max_rss) {
+	total->max_rss = usage->max_rss;
+    }
+    total->block_input += usage->block_input;
+    total->block_output += usage->block_output;
+    total->voluntary_switches += usage->voluntary_switches;
+    total->involuntary_switches += usage->involuntary_switches;
+}
+
+int
+lmap_usage_set_user_time(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->user_time, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_system_time(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->system_time, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_max_rss(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->max_rss, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_block_input(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->block_input, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_block_output(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->block_output, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_voluntary_switches(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->voluntary_switches, value, __FUNCTION__);
+}
+
+int
+lmap_usage_set_involuntary_switches(struct usage *usage, const char *value)
+{
+    return set_uint64(&usage->involuntary_switches, value, __FUNCTION__);
+}
+
 /*
  * struct tag functions...
  */
@@ -1159,6 +1985,7 @@ lmap_event_free(struct event *event)
 {
     if (event) {
 	xfree(event->name);
+	unlink_event(event);
 	xfree(event);
     }
 }
@@ -1537,68 +2364,176 @@ lmap_event_set_timezone_offset(struct event *event, const char *value)
     return 0;
 }
 
+/*
+ * Check a broken down local time against the bit sets of a calendar
+ * event. Wildcards are represented by all bits set.
+ */
+
+static int
+calendar_match_month(struct event *event, struct tm *tm)
+{
+    return (event->months & (1u << tm->tm_mon)) != 0;
+}
+
+static int
+calendar_match_day(struct event *event, struct tm *tm)
+{
+    int wday;
+
+    if (!(event->days_of_month & (1ul << tm->tm_mday))) {
+	return 0;
+    }
+
+    /*
+     * Weekdays are counted differently, struct tm has the week
+     * starting with sunday while our lmap week starts with
+     * monday.
+     */
+
+    wday = (tm->tm_wday == 0) ? 6 : (tm->tm_wday -1);
+    return (event->days_of_week & (1u << wday)) != 0;
+}
+
+static int
+calendar_match_hour(struct event *event, struct tm *tm)
+{
+    return (event->hours & (1ul << tm->tm_hour)) != 0;
+}
+
+static int
+calendar_match_minute(struct event *event, struct tm *tm)
+{
+    return (event->minutes & (1ull << tm->tm_min)) != 0;
+}
+
+static int
+calendar_match_second(struct event *event, struct tm *tm)
+{
+    return (event->seconds & (1ull << tm->tm_sec)) != 0;
+}
+
+/*
+ * Return the smallest bit position in [from, limit) that is set in
+ * mask, or limit if there is none.
+ */
+
+static int
+calendar_next_bit(uint64_t mask, int from, int limit)
+{
+    int i;
+
+    for (i = from; i < limit; i++) {
+	if (mask & (1ull << i)) {
+	    break;
+	}
+    }
+    return i;
+}
+
 int
 lmap_event_calendar_match(struct event *event, time_t *now)
 {
-    struct tm *tm;
-    int wday;
+    struct tm tm;
 
     if (event->type != LMAP_EVENT_TYPE_CALENDAR) {
 	return -1;
     }
 
-    tm = localtime(now);
-    if (! tm) {
+    if (! localtime_r(now, &tm)) {
 	lmap_err("failed to obtain localtime");
 	return -1;
     }
 
-    if (event->months != UINT16_MAX
-	&& !((1 << tm->tm_mon) & event->months)) {
-	// lmap_dbg("%s: month does not match", event->name);
+    if (!calendar_match_month(event, &tm)
+	|| !calendar_match_day(event, &tm)
+	|| !calendar_match_hour(event, &tm)
+	|| !calendar_match_minute(event, &tm)
+	|| !calendar_match_second(event, &tm)) {
 	return 0;
     }
 
-    if (event->days_of_month != UINT32_MAX
-	&&  !(1 << (tm->tm_mday) & event->days_of_month)) {
-	// lmap_dbg("%s: day of month does not match", event->name);
-	return 0;
-    }
+    return 1;
+}
 
-    /*
-     * Weekdays are counted differently, struct tm has the week
-     * starting with sunday while our lmap week starts with
-     * monday.
-     */
+/* upper bound of search steps before we give up on a calendar */
+#define CALENDAR_SEARCH_LIMIT	100000
 
-    wday = (tm->tm_wday == 0) ? 6 : (tm->tm_wday -1);
-    if (event->days_of_week != UINT8_MAX
-	&&  !(1 << (wday) & event->days_of_week)) {
-	// lmap_dbg("%s: day of week does not match", event->name);
-	return 0;
-    }
+/**
+ * @brief Calculate the next point in time matching a calendar event
+ *
+ * Searches for the first point in time strictly after now whose
+ * local time matches all bit sets of the calendar event. Instead of
+ * probing every second, the search skips to the start of the next
+ * month or day if the month or day does not match, and to the next
+ * candidate minute or second otherwise.
+ *
+ * Hour and minute skips never cross a quarter-hour boundary so that
+ * local time discontinuities (daylight saving time changes) cannot
+ * make the search jump over a matching point in time.
+ *
+ * @param event pointer to a calendar event
+ * @param now point in time to start the search from
+ * @param next pointer to the result
+ * @return 0 on success, -1 if there is no matching point in time
+ */
 
-    if (event->hours != UINT32_MAX
-	&&  !(1 << (tm->tm_hour) & event->hours)) {
-	// lmap_dbg("%s: hour does not match", event->name);
-	return 0;
+int
+lmap_event_calendar_next(struct event *event, time_t now, time_t *next)
+{
+    struct tm tm;
+    time_t t, n;
+    int i, x, limit;
+
+    if (!event || !next || event->type != LMAP_EVENT_TYPE_CALENDAR) {
+	return -1;
     }
 
-    if (event->minutes != UINT64_MAX
-	&&  !(1ull << (tm->tm_min) & event->minutes)) {
-	// lmap_dbg("%s: minute does not match", event->name);
-	return 0;
+    if (!event->months || !event->days_of_month || !event->days_of_week
+	|| !event->hours || !event->minutes || !event->seconds) {
+	return -1;
     }
 
-    if (event->seconds != UINT64_MAX
-	&&  !(1ull << (tm->tm_sec) & event->seconds)) {
-	// lmap_dbg("%s: second does not match", event->name);
-	return 0;
+    t = now + 1;
+    for (i = 0; i < CALENDAR_SEARCH_LIMIT; i++) {
+	if (! localtime_r(&t, &tm)) {
+	    lmap_err("failed to obtain localtime");
+	    return -1;
+	}
+
+	if (!calendar_match_month(event, &tm)) {
+	    tm.tm_mon++;
+	    tm.tm_mday = 1;
+	    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	    tm.tm_isdst = -1;
+	    n = mktime(&tm);
+	} else if (!calendar_match_day(event, &tm)) {
+	    tm.tm_mday++;
+	    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	    tm.tm_isdst = -1;
+	    n = mktime(&tm);
+	} else if (!calendar_match_hour(event, &tm)) {
+	    x = tm.tm_min - (tm.tm_min % 15) + 15;
+	    n = t + (x - tm.tm_min) * 60 - tm.tm_sec;
+	} else if (!calendar_match_minute(event, &tm)) {
+	    limit = tm.tm_min - (tm.tm_min % 15) + 15;
+	    x = calendar_next_bit(event->minutes, tm.tm_min + 1, limit);
+	    n = t + (x - tm.tm_min) * 60 - tm.tm_sec;
+	} else if (!calendar_match_second(event, &tm)) {
+	    x = calendar_next_bit(event->seconds, tm.tm_sec + 1, 60);
+	    n = t + (x - tm.tm_sec);
+	} else {
+	    *next = t;
+	    return 0;
+	}
+
+	/* mktime() failures or local time going backwards */
+	if (n == (time_t) -1 || n <= t) {
+	    n = t + 1;
+	}
+	t = n;
     }
 
-    /* XXX calculate the number of seconds until it is reasonable
-       to check again */
-    return 1;
+    return -1;
 }
 
 /*
@@ -1724,6 +2659,8 @@ lmap_schedule_new(void)
     if (schedule) {
 	schedule->mode = LMAP_SCHEDULE_EXEC_MODE_PIPELINED;
 	schedule->state = LMAP_SCHEDULE_STATE_ENABLED;
+	schedule->workspace_fd = -1;
+	schedule->incoming_fd = -1;
     }
     return schedule;
 }
@@ -1743,6 +2680,14 @@ lmap_schedule_free(struct schedule *schedule)
 	free_all_tags(schedule->tags);
 	free_all_tags(schedule->suppression_tags);
 	xfree(schedule->workspace);
+	xfree(schedule->safe_name);
+	if (schedule->workspace_fd != -1) {
+	    (void) close(schedule->workspace_fd);
+	}
+	if (schedule->incoming_fd != -1) {
+	    (void) close(schedule->incoming_fd);
+	}
+	lmapd_qindex_unref(schedule->qindex);
 	xfree(schedule);
     }
 }
@@ -1900,6 +2845,12 @@ lmap_schedule_set_overlaps(struct schedule *schedule, const char *value)
     return set_uint32(&schedule->cnt_overlaps, value, __FUNCTION__);
 }
 
+int
+lmap_schedule_set_timeouts(struct schedule *schedule, const char *value)
+{
+    return set_uint32(&schedule->cnt_timeouts, value, __FUNCTION__);
+}
+
 int
 lmap_schedule_set_failures(struct schedule *schedule, const char *value)
 {
@@ -1912,6 +2863,104 @@ lmap_schedule_set_last_invocation(struct schedule *schedule, const char *value)
     return set_dateandtime(&schedule->last_invocation, value, __FUNCTION__);
 }
 
+int
+lmap_schedule_set_priority(struct schedule *schedule, const char *value)
+{
+    int ret;
+
+    ret = set_int32(&schedule->priority, value, __FUNCTION__);
+    if (ret == 0) {
+	schedule->flags |= LMAP_SCHEDULE_FLAG_PRIORITY_SET;
+    }
+    return ret;
+}
+
+int
+lmap_schedule_set_stagger(struct schedule *schedule, const char *value)
+{
+    int ret;
+
+    ret = set_uint32(&schedule->stagger, value, __FUNCTION__);
+    if (ret == 0) {
+	schedule->flags |= LMAP_SCHEDULE_FLAG_STAGGER_SET;
+    }
+    return ret;
+}
+
+int
+lmap_schedule_set_incoming_max_bytes(struct schedule *schedule, const char *value)
+{
+    return set_uint64(&schedule->incoming_max_bytes, value, __FUNCTION__);
+}
+
+int
+lmap_schedule_set_incoming_max_files(struct schedule *schedule, const char *value)
+{
+    return set_uint32(&schedule->incoming_max_files, value, __FUNCTION__);
+}
+
+int
+lmap_schedule_set_incoming_overflow(struct schedule *schedule, const char *value)
+{
+    if (strcmp("drop-oldest", value) == 0) {
+	schedule->incoming_overflow = LMAP_SCHEDULE_OVERFLOW_DROP_OLDEST;
+    } else if (strcmp("refuse", value) == 0) {
+	schedule->incoming_overflow = LMAP_SCHEDULE_OVERFLOW_REFUSE;
+    } else {
+	lmap_err("illegal incoming overflow policy '%s'", value);
+	return -1;
+    }
+    schedule->flags |= LMAP_SCHEDULE_FLAG_OVERFLOW_SET;
+    return 0;
+}
+
+int
+lmap_schedule_set_incoming_compression(struct schedule *schedule, const char *value)
+{
+    if (strcmp("none", value) == 0) {
+	schedule->incoming_compression = LMAP_SCHEDULE_COMPRESSION_NONE;
+    } else if (strcmp("gzip", value) == 0) {
+#ifdef WITH_ZLIB
+	schedule->incoming_compression = LMAP_SCHEDULE_COMPRESSION_GZIP;
+#else
+	lmap_err("incoming compression '%s' not supported by this build", value);
+	return -1;
+#endif
+    } else {
+	lmap_err("illegal incoming compression '%s'", value);
+	return -1;
+    }
+    schedule->flags |= LMAP_SCHEDULE_FLAG_COMPRESSION_SET;
+    return 0;
+}
+
+int
+lmap_schedule_set_incoming_format(struct schedule *schedule, const char *value)
+{
+    if (strcmp("files", value) == 0) {
+	schedule->incoming_format = LMAP_SCHEDULE_FORMAT_FILES;
+    } else if (strcmp("log", value) == 0) {
+	schedule->incoming_format = LMAP_SCHEDULE_FORMAT_LOG;
+    } else {
+	lmap_err("illegal incoming format '%s'", value);
+	return -1;
+    }
+    schedule->flags |= LMAP_SCHEDULE_FLAG_FORMAT_SET;
+    return 0;
+}
+
+int
+lmap_schedule_set_quota_hits(struct schedule *schedule, const char *value)
+{
+    return set_uint32(&schedule->cnt_quota_hits, value, __FUNCTION__);
+}
+
+int
+lmap_schedule_set_evicted_bytes(struct schedule *schedule, const char *value)
+{
+    return set_uint64(&schedule->evicted_bytes, value, __FUNCTION__);
+}
+
 int
 lmap_schedule_add_tag(struct schedule *schedule, const char *value)
 {
@@ -1968,6 +3017,8 @@ lmap_action_new(void)
     action = (struct action*) xcalloc(1, sizeof(struct action), __FUNCTION__);
     if (action) {
 	action->state = LMAP_ACTION_STATE_ENABLED;
+	action->workspace_fd = -1;
+	action->output_fd = -1;
     }
     return action;
 }
@@ -1985,6 +3036,14 @@ lmap_action_free(struct action *action)
 	xfree(action->last_message);
 	xfree(action->last_failed_message);
 	xfree(action->workspace);
+	xfree(action->safe_name);
+	if (action->workspace_fd != -1) {
+	    (void) close(action->workspace_fd);
+	}
+	if (action->output_fd != -1) {
+	    (void) close(action->output_fd);
+	}
+	unlink_action(action);
 	xfree(action);
     }
 }
@@ -2108,6 +3167,12 @@ lmap_action_set_overlaps(struct action *action, const char *value)
     return set_uint32(&action->cnt_overlaps, value, __FUNCTION__);
 }
 
+int
+lmap_action_set_timeouts(struct action *action, const char *value)
+{
+    return set_uint32(&action->cnt_timeouts, value, __FUNCTION__);
+}
+
 int
 lmap_action_set_failures(struct action *action, const char *value)
 {
@@ -2156,6 +3221,24 @@ lmap_action_set_last_failed_message(struct action *action, const char *value)
     return set_string(&action->last_failed_message, value, __FUNCTION__);
 }
 
+int
+lmap_action_set_timeout(struct action *action, const char *value)
+{
+    int ret;
+
+    ret = set_uint32(&action->timeout, value, __FUNCTION__);
+    if (ret == 0) {
+	action->flags |= LMAP_ACTION_FLAG_TIMEOUT_SET;
+    }
+    return ret;
+}
+
+int
+lmap_action_set_output_memory_limit(struct action *action, const char *value)
+{
+    return set_uint64(&action->output_memory_limit, value, __FUNCTION__);
+}
+
 int
 lmap_action_set_workspace(struct action *action, const char *value)
 {
@@ -2172,6 +3255,16 @@ lmapd_new(void)
     struct lmapd *lmapd;
 
     lmapd = (struct lmapd*) xcalloc(1, sizeof(struct lmapd), __FUNCTION__);
+    if (lmapd) {
+	lmapd->pidtab = lmapd_pidtab_new();
+	if (! lmapd->pidtab) {
+	    xfree(lmapd);
+	    lmapd = NULL;
+	}
+    }
+    if (lmapd) {
+	lmapd->snapshot_interval = LMAPD_SNAPSHOT_INTERVAL;
+    }
     return lmapd;
 }
 
@@ -2199,6 +3292,7 @@ lmapd_free(struct lmapd *lmapd)
 {
     if (lmapd) {
 	lmap_free(lmapd->lmap);
+	lmapd_pidtab_free(lmapd->pidtab);
 	lmapd_flush_config_paths(lmapd);
 	xfree(lmapd->queue_path);
 	xfree(lmapd->run_path);
@@ -2277,6 +3371,12 @@ lmapd_set_run_path(struct lmapd *lmapd, const char *value)
     return set_string(&lmapd->run_path, value, __FUNCTION__);
 }
 
+int
+lmapd_set_snapshot_interval(struct lmapd *lmapd, const char *value)
+{
+    return set_uint32(&lmapd->snapshot_interval, value, __FUNCTION__);
+}
+
 /*
  * struct val functions...
  */
@@ -2320,6 +3420,31 @@ lmap_value_set_value(struct value *val, const char *value)
     return set_string(&val->value, value, __FUNCTION__);
 }
 
+/**
+ * @brief Sets the value from a string slice that is not terminated
+ *
+ * Like lmap_value_set_value(), but copies at most len bytes (and
+ * stops at the first NUL byte). This lets a parser hand a field
+ * straight from its input buffer to the value.
+ *
+ * @param val pointer to the struct value
+ * @param value pointer to the first byte of the value
+ * @param len number of bytes available at value
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_value_set_value_len(struct value *val, const char *value, size_t len)
+{
+    xfree(val->value);
+    val->value = strndup(value, len);
+    if (! val->value) {
+	lmap_err("failed to allocate memory");
+	return -1;
+    }
+    return 0;
+}
+
 /*
  * struct row functions...
  */
@@ -53,6 +53,9 @@
 #include "lmap.h"
 #include "utils.h"
 #include "json-io.h"
+#include "jsonw.h"
+#include "lmap-io.h"
+#include "zio.h"
 
 #define JSON_READ_BUFFER_SZ     64000
 
@@ -602,9 +605,51 @@ static int xx_lcas_report_measurement_point(void *p, const char *s)
 static int xx_lcas_controller_timeout(void *p, const char *s)
 { struct agent *agent = p; return lmap_agent_set_controller_timeout(agent, s); }
 
+static int xx_lcas_max_concurrent_actions(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_max_concurrent_actions(agent, s); }
+
+static int xx_lcas_durability(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_durability(agent, s); }
+
+static int xx_lcas_commit_window(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commit_window(agent, s); }
+
 static int xx_lcas_last_started(void *p, const char *s)
 { struct agent *agent = p; return lmap_agent_set_last_started(agent, s); }
 
+static int xx_lcas_admission_queue_depth(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_admission_queue_depth(agent, s); }
+
+static int xx_lcas_admissions(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_admissions(agent, s); }
+
+static int xx_lcas_admission_wait(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_admission_wait(agent, s); }
+
+static int xx_lcas_admission_max_wait(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_admission_max_wait(agent, s); }
+
+static int xx_lcas_loop_lag(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_loop_lag(agent, s); }
+
+static int xx_lcas_loop_max_lag(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_loop_max_lag(agent, s); }
+
+static int xx_lcas_commits(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commits(agent, s); }
+
+static int xx_lcas_commit_latency(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commit_latency(agent, s); }
+
+static int xx_lcas_commit_max_latency(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commit_max_latency(agent, s); }
+
+static int xx_lcas_commit_batch(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commit_batch(agent, s); }
+
+static int xx_lcas_commit_max_batch(void *p, const char *s)
+{ struct agent *agent = p; return lmap_agent_set_commit_max_batch(agent, s); }
+
 static int
 xx_lctrl_agent(void *p, json_object *ctx, int what)
 {
@@ -619,7 +664,21 @@ xx_lctrl_agent(void *p, json_object *ctx, int what)
 	JSONMAP_ENTRY_BOOL2STR_X(report-group-id,   YANG_CONFIG_TRUE, xx_lcas_report_group_id),
 	JSONMAP_ENTRY_BOOL2STR_X(report-measurement-point, YANG_CONFIG_TRUE, xx_lcas_report_measurement_point),
 	JSONMAP_ENTRY_INT2STR_X(controller-timeout, YANG_CONFIG_TRUE, xx_lcas_controller_timeout),
+	JSONMAP_ENTRY_INT2STR_X(max-concurrent-actions, YANG_CONFIG_TRUE, xx_lcas_max_concurrent_actions),
+	JSONMAP_ENTRY_STRING_X(durability,          YANG_CONFIG_TRUE, xx_lcas_durability),
+	JSONMAP_ENTRY_INT2STR_X(commit-window,      YANG_CONFIG_TRUE, xx_lcas_commit_window),
 	JSONMAP_ENTRY_STRING_X(last-started,        YANG_CONFIG_FALSE, xx_lcas_last_started),
+	JSONMAP_ENTRY_INT2STR_X(admission-queue-depth, YANG_CONFIG_FALSE, xx_lcas_admission_queue_depth),
+	JSONMAP_ENTRY_INT2STR_X(admissions,         YANG_CONFIG_FALSE, xx_lcas_admissions),
+	JSONMAP_ENTRY_STRING_X(admission-wait,      YANG_CONFIG_FALSE, xx_lcas_admission_wait),
+	JSONMAP_ENTRY_STRING_X(admission-max-wait,  YANG_CONFIG_FALSE, xx_lcas_admission_max_wait),
+	JSONMAP_ENTRY_STRING_X(event-loop-lag,      YANG_CONFIG_FALSE, xx_lcas_loop_lag),
+	JSONMAP_ENTRY_STRING_X(event-loop-max-lag,  YANG_CONFIG_FALSE, xx_lcas_loop_max_lag),
+	JSONMAP_ENTRY_INT2STR_X(commits,            YANG_CONFIG_FALSE, xx_lcas_commits),
+	JSONMAP_ENTRY_STRING_X(commit-latency,      YANG_CONFIG_FALSE, xx_lcas_commit_latency),
+	JSONMAP_ENTRY_STRING_X(commit-max-latency,  YANG_CONFIG_FALSE, xx_lcas_commit_max_latency),
+	JSONMAP_ENTRY_INT2STR_X(commit-batch,       YANG_CONFIG_FALSE, xx_lcas_commit_batch),
+	JSONMAP_ENTRY_INT2STR_X(commit-max-batch,   YANG_CONFIG_FALSE, xx_lcas_commit_max_batch),
 	{ .name = NULL }
     };
 
@@ -947,6 +1006,57 @@ xx_lctrl_suppressions(void *p, json_object *ctx, int what)
     return res;
 }
 
+/* lmap-control :: lmap :: schedules :: resource-usage */
+
+static int xx_lusg_user_time(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_user_time(usage, s); }
+
+static int xx_lusg_system_time(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_system_time(usage, s); }
+
+static int xx_lusg_max_rss(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_max_rss(usage, s); }
+
+static int xx_lusg_block_input(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_block_input(usage, s); }
+
+static int xx_lusg_block_output(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_block_output(usage, s); }
+
+static int xx_lusg_voluntary_switches(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_voluntary_switches(usage, s); }
+
+static int xx_lusg_involuntary_switches(void *p, const char *s)
+{ struct usage *usage = p; return lmap_usage_set_involuntary_switches(usage, s); }
+
+static int
+parse_usage(struct usage *usage, json_object *ctx, int what)
+{
+    int res = 0;
+
+    const struct lmap_jsonmap tab[] = {
+	JSONMAP_ENTRY_STRING_X(user-time,    YANG_CONFIG_FALSE, xx_lusg_user_time),
+	JSONMAP_ENTRY_STRING_X(system-time,  YANG_CONFIG_FALSE, xx_lusg_system_time),
+	JSONMAP_ENTRY_STRING_X(max-rss,      YANG_CONFIG_FALSE, xx_lusg_max_rss),
+	JSONMAP_ENTRY_STRING_X(block-input,  YANG_CONFIG_FALSE, xx_lusg_block_input),
+	JSONMAP_ENTRY_STRING_X(block-output, YANG_CONFIG_FALSE, xx_lusg_block_output),
+	JSONMAP_ENTRY_STRING_X(voluntary-context-switches,   YANG_CONFIG_FALSE, xx_lusg_voluntary_switches),
+	JSONMAP_ENTRY_STRING_X(involuntary-context-switches, YANG_CONFIG_FALSE, xx_lusg_involuntary_switches),
+	{ .name = NULL }
+    };
+
+    if (!usage || !ctx)
+	return -1;
+
+    json_object_object_foreach(ctx, key, jo) {
+	res = lookup_jsonmap(usage, what, key, jo, tab);
+	if (res)
+	    break;
+    }
+
+    return res;
+}
+
 /* lmap-control :: lmap :: schedules :: action */
 
 static int xx_lact_name(void *p, const char *s)
@@ -996,6 +1106,15 @@ static int xx_lact_overlaps(void *p, const char *s)
 static int xx_lact_failures(void *p, const char *s)
 { struct action *sch = p; return lmap_action_set_failures(sch, s); }
 
+static int xx_lact_timeouts(void *p, const char *s)
+{ struct action *sch = p; return lmap_action_set_timeouts(sch, s); }
+
+static int xx_lact_timeout(void *p, const char *s)
+{ struct action *action = p; return lmap_action_set_timeout(action, s); }
+
+static int xx_lact_output_memory_limit(void *p, const char *s)
+{ struct action *action = p; return lmap_action_set_output_memory_limit(action, s); }
+
 static int xx_lact_last_invocation(void *p, const char *s)
 { struct action *sch = p; return lmap_action_set_last_invocation(sch, s); }
 
@@ -1017,6 +1136,12 @@ static int xx_lact_last_failed_status(void *p, const char *s)
 static int xx_lact_last_failed_message(void *p, const char *s)
 { struct action *action = p; return lmap_action_set_last_failed_message(action, s); }
 
+static int xx_lact_last_usage(void *p, json_object *ctx, int what)
+{ struct action *action = p; return parse_usage(&action->last_usage, ctx, what); }
+
+static int xx_lact_usage(void *p, json_object *ctx, int what)
+{ struct action *action = p; return parse_usage(&action->usage, ctx, what); }
+
 static struct action *
 parse_action(json_object *ctx, int what)
 {
@@ -1030,12 +1155,15 @@ parse_action(json_object *ctx, int what)
 	JSONMAP_ENTRY_STRARRAY(destination,       YANG_CONFIG_TRUE,  xx_lact),
 	JSONMAP_ENTRY_STRARRAY(tag,               YANG_CONFIG_TRUE,  xx_lact),
 	JSONMAP_ENTRY_STRARRAY_X(suppression-tag, YANG_CONFIG_TRUE,  xx_lact_supp_tag),
+	JSONMAP_ENTRY_INT2STR(timeout,            YANG_CONFIG_TRUE,  xx_lact),
+	JSONMAP_ENTRY_STRING_X(output-memory-limit, YANG_CONFIG_TRUE, xx_lact_output_memory_limit),
 	JSONMAP_ENTRY_STRING(state,               YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_STRING(storage,             YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_INT2STR(invocations,        YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_INT2STR(suppressions,       YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_INT2STR(overlaps,           YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_INT2STR(failures,           YANG_CONFIG_FALSE, xx_lact),
+	JSONMAP_ENTRY_INT2STR(timeouts,           YANG_CONFIG_FALSE, xx_lact),
 	JSONMAP_ENTRY_STRING_X(last-invocation,   YANG_CONFIG_FALSE, xx_lact_last_invocation),
 	JSONMAP_ENTRY_STRING_X(last-completion,   YANG_CONFIG_FALSE, xx_lact_last_completion),
 	JSONMAP_ENTRY_INT2STR_X(last-status,      YANG_CONFIG_FALSE, xx_lact_last_status),
@@ -1043,6 +1171,8 @@ parse_action(json_object *ctx, int what)
 	JSONMAP_ENTRY_STRING_X(last-failed-completion, YANG_CONFIG_FALSE, xx_lact_last_failed_completion),
 	JSONMAP_ENTRY_INT2STR_X(last-failed-status,    YANG_CONFIG_FALSE, xx_lact_last_failed_status),
 	JSONMAP_ENTRY_STRING_X(last-failed-message,    YANG_CONFIG_FALSE, xx_lact_last_failed_message),
+	JSONMAP_ENTRY_OBJECT_X(last-resource-usage,    YANG_CONFIG_FALSE, xx_lact_last_usage),
+	JSONMAP_ENTRY_OBJECT_X(resource-usage,         YANG_CONFIG_FALSE, xx_lact_usage),
 	{ .name = NULL }
     };
 
@@ -1102,6 +1232,12 @@ static int xx_lsch_duration(void *p, const char *s)
 static int xx_lsch_exec_mode(void *p, const char *s)
 { struct schedule *sch = p; return lmap_schedule_set_exec_mode(sch, s); }
 
+static int xx_lsch_priority(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_priority(sch, s); }
+
+static int xx_lsch_stagger(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_stagger(sch, s); }
+
 static int xx_lsch_tag(void *p, const char *s)
 { struct schedule *sch = p; return lmap_schedule_add_tag(sch, s); }
 
@@ -1126,9 +1262,39 @@ static int xx_lsch_overlaps(void *p, const char *s)
 static int xx_lsch_failures(void *p, const char *s)
 { struct schedule *sch = p; return lmap_schedule_set_failures(sch, s); }
 
+static int xx_lsch_timeouts(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_timeouts(sch, s); }
+
+static int xx_lsch_max_bytes(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_incoming_max_bytes(sch, s); }
+
+static int xx_lsch_max_files(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_incoming_max_files(sch, s); }
+
+static int xx_lsch_overflow(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_incoming_overflow(sch, s); }
+
+static int xx_lsch_compression(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_incoming_compression(sch, s); }
+
+static int xx_lsch_format(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_incoming_format(sch, s); }
+
+static int xx_lsch_quota_hits(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_quota_hits(sch, s); }
+
+static int xx_lsch_evicted_bytes(void *p, const char *s)
+{ struct schedule *sch = p; return lmap_schedule_set_evicted_bytes(sch, s); }
+
 static int xx_lsch_last_invocation(void *p, const char *s)
 { struct schedule *sch = p; return lmap_schedule_set_last_invocation(sch, s); }
 
+static int xx_lsch_last_usage(void *p, json_object *ctx, int what)
+{ struct schedule *sch = p; return parse_usage(&sch->last_usage, ctx, what); }
+
+static int xx_lsch_usage(void *p, json_object *ctx, int what)
+{ struct schedule *sch = p; return parse_usage(&sch->usage, ctx, what); }
+
 static struct schedule*
 parse_schedule(json_object *ctx, int what)
 {
@@ -1141,6 +1307,13 @@ parse_schedule(json_object *ctx, int what)
 	JSONMAP_ENTRY_STRING(end,      YANG_CONFIG_TRUE, xx_lsch),
 	JSONMAP_ENTRY_STRING(duration, YANG_CONFIG_TRUE, xx_lsch),
 	JSONMAP_ENTRY_STRING_X(execution-mode,    YANG_CONFIG_TRUE, xx_lsch_exec_mode),
+	JSONMAP_ENTRY_INT2STR(priority,           YANG_CONFIG_TRUE, xx_lsch),
+	JSONMAP_ENTRY_INT2STR_X(stagger-interval, YANG_CONFIG_TRUE, xx_lsch_stagger),
+	JSONMAP_ENTRY_STRING_X(incoming-max-bytes, YANG_CONFIG_TRUE, xx_lsch_max_bytes),
+	JSONMAP_ENTRY_INT2STR_X(incoming-max-files, YANG_CONFIG_TRUE, xx_lsch_max_files),
+	JSONMAP_ENTRY_STRING_X(incoming-overflow, YANG_CONFIG_TRUE, xx_lsch_overflow),
+	JSONMAP_ENTRY_STRING_X(incoming-compression, YANG_CONFIG_TRUE, xx_lsch_compression),
+	JSONMAP_ENTRY_STRING_X(incoming-format, YANG_CONFIG_TRUE, xx_lsch_format),
 	JSONMAP_ENTRY_STRARRAY_X(tag,             YANG_CONFIG_TRUE, xx_lsch_tag),
 	JSONMAP_ENTRY_STRARRAY_X(suppression-tag, YANG_CONFIG_TRUE, xx_lsch_supp_tag),
 	JSONMAP_ENTRY_OBJARRAY_X(action,          YANG_CONFIG_TRUE, xx_lsch_action),
@@ -1150,7 +1323,12 @@ parse_schedule(json_object *ctx, int what)
 	JSONMAP_ENTRY_INT2STR(suppressions,       YANG_CONFIG_FALSE, xx_lsch),
 	JSONMAP_ENTRY_INT2STR(overlaps,           YANG_CONFIG_FALSE, xx_lsch),
 	JSONMAP_ENTRY_INT2STR(failures,           YANG_CONFIG_FALSE, xx_lsch),
+	JSONMAP_ENTRY_INT2STR(timeouts,           YANG_CONFIG_FALSE, xx_lsch),
+	JSONMAP_ENTRY_INT2STR_X(incoming-quota-hits, YANG_CONFIG_FALSE, xx_lsch_quota_hits),
+	JSONMAP_ENTRY_STRING_X(incoming-evicted-bytes, YANG_CONFIG_FALSE, xx_lsch_evicted_bytes),
 	JSONMAP_ENTRY_STRING_X(last-invocation,   YANG_CONFIG_FALSE, xx_lsch_last_invocation),
+	JSONMAP_ENTRY_OBJECT_X(last-resource-usage, YANG_CONFIG_FALSE, xx_lsch_last_usage),
+	JSONMAP_ENTRY_OBJECT_X(resource-usage,    YANG_CONFIG_FALSE, xx_lsch_usage),
 	{ .name = NULL }
     };
 
@@ -1769,19 +1947,63 @@ lmap_json_parse_report_string(struct lmap *lmap, const char *string)
  *   to handle objects back-to-back without an array, but that means
  *   poking into json-c internals due to their incomplete API.
  *
- * Adds any parsed table(s) to result.
+ * Adds any parsed table(s) to result, and drops the reference to jobj.
  */
+static int
+parse_task_results_object(json_object *jobj, struct result *result)
+{
+    int rc = -1;
+    jsonarray_len_type i, al;
+    json_object *jo;
+
+    if (json_object_is_type(jobj, json_type_null)
+	    || lmap_json_object_is_empty(jobj)) {
+	json_object_put(jobj);
+	return 0;
+    }
+    while (jobj) {
+	if (json_object_is_type(jobj, json_type_array)) {
+	    for (i = 0, al = json_object_array_length(jobj); i < al; i++) {
+		jo = json_object_array_get_idx(jobj, i);
+		if (parse_report_result_table(result, jo, 0))
+		    break;
+	    }
+	} else if (json_object_is_type(jobj, json_type_object)) {
+	    /* note: we are quite lax here, on purpose */
+	    if (json_object_object_get_ex(jobj, "table", &jo)) {
+		if (!json_object_is_type(jo, json_type_array))
+		    break;
+		jo = json_object_get(jo); /* increase refcounter */
+		json_object_put(jobj); /* drop outer object */
+		jobj = jo;
+		continue;
+	    } else {
+		/* naked valid object? */
+		if (parse_report_result_table(result, jobj, 0))
+		    break;
+	    }
+	} else {
+	    break;
+	}
+
+	json_object_put(jobj);
+	jobj = NULL;
+	rc = 0;
+    }
+    json_object_put(jobj);
+    return rc;
+}
+
 int
 lmap_json_parse_task_results_fd(int fd, struct result *result)
 {
     char *buf = NULL;
     ssize_t res;
     int rc = -1;
-    jsonarray_len_type i, al;
+    struct zio *zio = NULL;
 
     enum json_tokener_error jerr;
     json_object *jobj = NULL;
-    json_object *jo;
     struct json_tokener *jtk = NULL;
 
     if (fd == -1 || !result)
@@ -1789,7 +2011,8 @@ lmap_json_parse_task_results_fd(int fd, struct result *result)
 
     buf = malloc(JSON_READ_BUFFER_SZ);
     jtk = json_tokener_new();
-    if (!buf || !jtk) {
+    zio = lmapd_zio_open(fd);
+    if (!buf || !jtk || !zio) {
 	lmap_err("out of memory while reading task result file");
 	goto err_exit;
     }
@@ -1799,7 +2022,7 @@ lmap_json_parse_task_results_fd(int fd, struct result *result)
     jerr = json_tokener_success;
     do {
 	do {
-	    res = read(fd, buf, JSON_READ_BUFFER_SZ);
+	    res = lmapd_zio_read(zio, buf, JSON_READ_BUFFER_SZ);
 	} while (res == -1 && (errno == EAGAIN || errno == EINTR));
 	if (res == -1) {
 	    lmap_err("error while reading report data file: %s", strerror(errno));
@@ -1813,41 +2036,8 @@ lmap_json_parse_task_results_fd(int fd, struct result *result)
     } while (jerr == json_tokener_continue && res > 0);
 
     if (jerr == json_tokener_success) {
-	if (json_object_is_type(jobj, json_type_null)
-		|| lmap_json_object_is_empty(jobj)) {
-	    json_object_put(jobj);
-	    jobj = NULL;
-	    rc = 0;
-	}
-	while (jobj) {
-	    if (json_object_is_type(jobj, json_type_array)) {
-		for (i = 0, al = json_object_array_length(jobj); i < al; i++) {
-		    jo = json_object_array_get_idx(jobj, i);
-		    if (parse_report_result_table(result, jo, 0))
-			break;
-		}
-	    } else if (json_object_is_type(jobj, json_type_object)) {
-		/* note: we are quite lax here, on purpose */
-		if (json_object_object_get_ex(jobj, "table", &jo)) {
-		    if (!json_object_is_type(jo, json_type_array))
-			break;
-		    jo = json_object_get(jo); /* increase refcounter */
-		    json_object_put(jobj); /* drop outer object */
-		    jobj = jo;
-		    continue;
-		} else {
-		    /* naked valid object? */
-		    if (parse_report_result_table(result, jobj, 0))
-			break;
-		}
-	    } else {
-		break;
-	    }
-
-	    json_object_put(jobj);
-	    jobj = NULL;
-	    rc = 0;
-	}
+	rc = parse_task_results_object(jobj, result);
+	jobj = NULL;
     }
 
     if (rc)
@@ -1857,95 +2047,107 @@ err_exit:
     if (jtk)
 	json_tokener_free(jtk);
     json_object_put(jobj);
+    lmapd_zio_close(zio);
     free(buf);
     return rc;
 }
 
-/*
- * JSON output I/O and rendering/serializing
- */
-
-static void
-json_object_objarray_add(json_object *jobj,
-			const char *key,
-			json_object *val)
+/* same as lmap_json_parse_task_results_fd(), for task output in memory */
+int
+lmap_json_parse_task_results_mem(const char *buf, size_t len, struct result *result)
 {
-    if (jobj) {
-	if (json_object_is_type(jobj, json_type_object)) {
-	    json_object_object_add(jobj, key, val);
-	} else if (json_object_is_type(jobj, json_type_array)) {
-	    json_object_array_add(jobj, val);
-	} /* else "internal error!" */
+    int rc = -1;
+    enum json_tokener_error jerr = json_tokener_success;
+    json_object *jobj = NULL;
+    struct json_tokener *jtk;
+
+    if (!buf || !result || len > INT_MAX)
+	return -1;
+
+    jtk = json_tokener_new();
+    if (!jtk) {
+	lmap_err("out of memory while reading task result");
+	return -1;
+    }
+    json_tokener_set_flags(jtk, JSON_TOKENER_STRICT);
+
+    if (len) {
+	jobj = json_tokener_parse_ex(jtk, buf, (int)len);
+	jerr = json_tokener_get_error(jtk);
+    }
+    if (jerr == json_tokener_success) {
+	rc = parse_task_results_object(jobj, result);
+	jobj = NULL;
     }
+
+    if (rc)
+	lmap_err("invalid JSON in task result: %s", lmapd_json_tokener_error_desc(jerr));
+
+    json_object_put(jobj);
+    json_tokener_free(jtk);
+    return rc;
 }
 
+/*
+ * JSON output I/O and rendering/serializing
+ *
+ * The output is streamed with the jsonw writer while the lmap lists
+ * are walked, no JSON object tree is built.
+ */
+
 static void
-render_empty_leaf(json_object *jobj, const char * const name)
+render_empty_leaf(struct jsonw *w, const char * const name)
 {
     /* RFC7951 section 6.9 maps YANG empty to [null] */
-    json_object *ja = json_object_new_array();
-    if (ja) {
-	json_object_array_add(ja, NULL);
-	json_object_object_add(jobj, name, ja);
-    }
+    lmap_jsonw_array_start(w, name);
+    lmap_jsonw_null(w, NULL);
+    lmap_jsonw_array_end(w);
 }
 
+/* name is NULL for array elements */
 static void
-render_leaf(json_object *jobj, const char *name, const char * const content)
+render_leaf(struct jsonw *w, const char *name, const char * const content)
 {
-    assert(jobj);
+    assert(w);
 
-    if (name && content) {
-	json_object_objarray_add(jobj, name, json_object_new_string(content));
+    if (content) {
+	lmap_jsonw_string(w, name, content);
     }
 }
 
 static void
-render_leaf_boolean(json_object *jobj, const char * const name, const int content)
+render_leaf_boolean(struct jsonw *w, const char * const name, const int content)
 {
-    assert(jobj);
+    assert(w);
 
     if (name) {
-	json_object_objarray_add(jobj, name,
-		json_object_new_boolean(content ? (json_bool)1 : (json_bool)0));
+	lmap_jsonw_boolean(w, name, content);
     }
 }
 
 static void
-render_leaf_int32(json_object *jobj, const char * const name, int32_t value)
-{
-    json_object_objarray_add(jobj, name, json_object_new_int(value));
-}
-
-static void
-render_leaf_uint32(json_object *jobj, const char * const name, uint32_t value)
+render_leaf_int32(struct jsonw *w, const char * const name, int32_t value)
 {
-    /* JSON-C does not know uint32, but int64 can hold an uint32 */
-    json_object_objarray_add(jobj, name, json_object_new_int64(value));
+    lmap_jsonw_int64(w, name, value);
 }
 
-#if 0
-/* I-JSON demands this */
 static void
-render_leaf_int64(json_object *jobj, const char * const name, int64_t value)
+render_leaf_uint32(struct jsonw *w, const char * const name, uint32_t value)
 {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%"PRIi64, value);
-    json_object_objarray_add(jobj, name, json_object_new_string(buf));
+    lmap_jsonw_int64(w, name, value);
 }
-#endif
 
 /* I-JSON demands this */
 static void
-render_leaf_uint64(json_object *jobj, const char * const name, uint64_t value)
+render_leaf_uint64(struct jsonw *w, const char * const name, uint64_t value)
 {
     char buf[64];
     snprintf(buf, sizeof(buf), "%"PRIu64, value);
-    json_object_objarray_add(jobj, name, json_object_new_string(buf));
+    lmap_jsonw_string(w, name, buf);
 }
 
 static void
-render_leaf_datetime(json_object *jobj, const char * const name, time_t *tp)
+render_leaf_datetime(struct jsonw *w, const char * const name, time_t *tp)
 {
     char buf[32];
     struct tm *tmp;
@@ -1965,39 +2167,33 @@ render_leaf_datetime(json_object *jobj, const char * const name, time_t *tp)
 	buf[22] = ':';
     }
 
-    render_leaf(jobj, name, buf);
+    render_leaf(w, name, buf);
 }
 
 static void
-render_leaf_days_of_month(json_object *jobj, const char * const name, uint32_t days_of_month)
+render_leaf_days_of_month(struct jsonw *w, const char * const name, uint32_t days_of_month)
 {
     int i;
-    json_object *ja;
 
     if (!days_of_month)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
-
+    lmap_jsonw_array_start(w, name);
     if (days_of_month == UINT32_MAX) {
-	render_leaf(ja, name, "*");
-	return;
-    }
-
-    for (i = 1; i < 32; i++) {
-	if (days_of_month & (1 << i)) {
-	    render_leaf_int32(ja, name, i);
+	render_leaf(w, NULL, "*");
+    } else {
+	for (i = 1; i < 32; i++) {
+	    if (days_of_month & (1 << i)) {
+		render_leaf_int32(w, NULL, i);
+	    }
 	}
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_leaf_months(json_object *jobj, const char * const name, uint16_t months)
+render_leaf_months(struct jsonw *w, const char * const name, uint16_t months)
 {
-    json_object *ja;
     int i;
     const struct {
 	const char * const name;
@@ -2021,27 +2217,22 @@ render_leaf_months(json_object *jobj, const char * const name, uint16_t months)
     if (!months)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
-
+    lmap_jsonw_array_start(w, name);
     if (months == UINT16_MAX) {
-	render_leaf(ja, name, "*");
-	return;
-    }
-
-    for (i = 0; tab[i].name; i++) {
-	if (months & tab[i].value) {
-	    render_leaf(ja, name, tab[i].name);
+	render_leaf(w, NULL, "*");
+    } else {
+	for (i = 0; tab[i].name; i++) {
+	    if (months & tab[i].value) {
+		render_leaf(w, NULL, tab[i].name);
+	    }
 	}
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_leaf_days_of_week(json_object *jobj, const char * const name, uint8_t days_of_week)
+render_leaf_days_of_week(struct jsonw *w, const char * const name, uint8_t days_of_week)
 {
-    json_object *ja;
     int i;
     const struct {
 	const char * const name;
@@ -2060,346 +2251,329 @@ render_leaf_days_of_week(json_object *jobj, const char * const name, uint8_t day
     if (!days_of_week)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
-
+    lmap_jsonw_array_start(w, name);
     if (days_of_week == UINT8_MAX) {
-	render_leaf(ja, name, "*");
-	return;
-    }
-
-    for (i = 0; tab[i].name; i++) {
-	if (days_of_week & tab[i].value) {
-	    render_leaf(ja, name, tab[i].name);
+	render_leaf(w, NULL, "*");
+    } else {
+	for (i = 0; tab[i].name; i++) {
+	    if (days_of_week & tab[i].value) {
+		render_leaf(w, NULL, tab[i].name);
+	    }
 	}
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_leaf_hours(json_object *jobj, const char * const name, uint32_t hours)
+render_leaf_hours(struct jsonw *w, const char * const name, uint32_t hours)
 {
     int i;
-    json_object *ja;
 
     if (!hours)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
-
+    lmap_jsonw_array_start(w, name);
     if (hours == UINT32_MAX) {
-	render_leaf(ja, name, "*");
-	return;
-    }
-
-    for (i = 0; i < 24; i++) {
-	if (hours & (1 << i)) {
-	    render_leaf_int32(ja, name, i);
+	render_leaf(w, NULL, "*");
+    } else {
+	for (i = 0; i < 24; i++) {
+	    if (hours & (1 << i)) {
+		render_leaf_int32(w, NULL, i);
+	    }
 	}
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_leaf_minsecs(json_object *jobj, const char * const name, uint64_t minsecs)
+render_leaf_minsecs(struct jsonw *w, const char * const name, uint64_t minsecs)
 {
     int i;
-    json_object *ja;
 
     if (!minsecs)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
-
+    lmap_jsonw_array_start(w, name);
     if (minsecs == UINT64_MAX) {
-	render_leaf(ja, name, "*");
-	return;
-    }
-
-    for (i = 0; i < 60; i++) {
-	if (minsecs & (1ull << i)) {
-	    render_leaf_int32(ja, name, i);
+	render_leaf(w, NULL, "*");
+    } else {
+	for (i = 0; i < 60; i++) {
+	    if (minsecs & (1ull << i)) {
+		render_leaf_int32(w, NULL, i);
+	    }
 	}
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_tags(struct tag *tags, const char * const name, json_object *jobj)
+render_tags(struct tag *tags, const char * const name, struct jsonw *w)
 {
-    json_object *ja;
     struct tag *t;
 
     if (!tags)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, name, ja);
+    lmap_jsonw_array_start(w, name);
     for (t = tags; t; t = t->next) {
-	json_object_array_add(ja, json_object_new_string(t->tag));
+	render_leaf(w, NULL, t->tag);
     }
+    lmap_jsonw_array_end(w);
 }
 
-/* jobj is the option array */
+/* w is in the option array */
 static void
-render_option(struct option *option, json_object *jobj)
+render_option(struct option *option, struct jsonw *w)
 {
-    json_object *robj;
-
     if (! option) {
 	return;
     }
 
-    robj = json_object_new_object();
-    if (! robj) {
-	return;
-    }
-    json_object_array_add(jobj, robj);
-
-    render_leaf(robj, "id", option->id);
-    render_leaf(robj, "name", option->name);
-    render_leaf(robj, "value", option->value);
+    lmap_jsonw_object_start(w, NULL);
+    render_leaf(w, "id", option->id);
+    render_leaf(w, "name", option->name);
+    render_leaf(w, "value", option->value);
+    lmap_jsonw_object_end(w);
 }
 
 static void
-render_options(struct option *options, json_object *jobj)
+render_options(struct option *options, struct jsonw *w)
 {
     struct option *opt;
-    json_object *ja;
 
     if (!options)
 	return;
 
-    ja = json_object_new_array();
-    if (ja) {
-	json_object_object_add(jobj, "option", ja);
-	for (opt = options; opt; opt = opt->next) {
-	    render_option(opt, ja);
-	}
+    lmap_jsonw_array_start(w, "option");
+    for (opt = options; opt; opt = opt->next) {
+	render_option(opt, w);
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_registries(struct registry *registries, json_object *jobj)
+render_registries(struct registry *registries, struct jsonw *w)
 {
-    json_object *ja, *jf;
     struct registry *r;
 
     if (!registries)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, "function", ja);
-
+    lmap_jsonw_array_start(w, "function");
     for (r = registries; r; r = r->next) {
-	jf = json_object_new_object();
-	if (!jf)
-	    return;
-	json_object_array_add(ja, jf);
-	render_leaf(jf, "uri", r->uri);
-	render_tags(r->roles, "role", jf);
+	lmap_jsonw_object_start(w, NULL);
+	render_leaf(w, "uri", r->uri);
+	render_tags(r->roles, "role", w);
+	lmap_jsonw_object_end(w);
     }
+    lmap_jsonw_array_end(w);
 }
 
 static void
-render_agent_report(struct agent *agent, json_object *jobj)
+render_agent_report(struct agent *agent, struct jsonw *w)
 {
     if (! agent) {
 	return;
     }
 
-    render_leaf_datetime(jobj, "date", &agent->report_date);
+    render_leaf_datetime(w, "date", &agent->report_date);
     if (agent->agent_id && agent->report_agent_id) {
-	render_leaf(jobj, "agent-id", agent->agent_id);
+	render_leaf(w, "agent-id", agent->agent_id);
     }
     if (agent->group_id && agent->report_group_id) {
-	render_leaf(jobj, "group-id", agent->group_id);
+	render_leaf(w, "group-id", agent->group_id);
     }
     if (agent->measurement_point && agent->report_measurement_point) {
-	render_leaf(jobj, "measurement-point", agent->measurement_point);
+	render_leaf(w, "measurement-point", agent->measurement_point);
     }
 }
 
 static void
-render_row(struct row *row, json_object *jobj)
+render_row(struct row *row, struct jsonw *w)
 {
-    json_object *robj;
-    json_object *aobj;
     struct value *val;
 
-    robj = json_object_new_object();
-    if (! robj) {
-	return;
-    }
-    json_object_array_add(jobj, robj);
+    lmap_jsonw_object_start(w, NULL);
 
     /* empty row, leave the object empty */
-    if (!row || !row->values) {
-	return;
-    }
-
-    aobj = json_object_new_array();
-    if (!aobj) {
-	return;
+    if (row && row->values) {
+	lmap_jsonw_array_start(w, "value");
+	for (val = row->values; val; val = val->next) {
+	    lmap_jsonw_string(w, NULL, val->value ? val->value : "");
+	}
+	lmap_jsonw_array_end(w);
     }
 
-    json_object_object_add(robj, "value", aobj);
-    for (val = row->values; val; val = val->next) {
-	json_object_array_add(aobj, json_object_new_string(val->value ? val->value : ""));
-    }
+    lmap_jsonw_object_end(w);
 }
 
 static void
-render_table(struct table *tab, json_object *jobj)
+render_table(struct table *tab, struct jsonw *w)
 {
-    json_object *robj, *aobj;
     struct row *row;
     struct value *val;
 
-    robj = json_object_new_object();
-    if (! robj) {
-	return;
-    }
-    json_object_array_add(jobj, robj);
+    lmap_jsonw_object_start(w, NULL);
 
     /* empty table: leave the object empty */
-    if (!tab) {
-	return;
-    }
-
-    if (tab->registries)
-        render_registries(tab->registries, robj);
-
-    if (tab->columns) {
-	if (!(aobj = json_object_new_array()))
-	    return;
-	json_object_object_add(robj, "column", aobj);
-	for (val = tab->columns; val; val = val->next) {
-	    json_object_array_add(aobj, json_object_new_string(val->value ? val->value : ""));
-	}
-    }
-
-    if (tab->rows) {
-	aobj = json_object_new_array();
-	if (! aobj) {
-	    return;
+    if (tab) {
+	if (tab->registries)
+	    render_registries(tab->registries, w);
+
+	if (tab->columns) {
+	    lmap_jsonw_array_start(w, "column");
+	    for (val = tab->columns; val; val = val->next) {
+		lmap_jsonw_string(w, NULL, val->value ? val->value : "");
+	    }
+	    lmap_jsonw_array_end(w);
 	}
 
-	json_object_object_add(robj, "row", aobj);
-	for (row = tab->rows; row; row = row->next) {
-	    render_row(row, aobj);
+	if (tab->rows) {
+	    lmap_jsonw_array_start(w, "row");
+	    for (row = tab->rows; row; row = row->next) {
+		render_row(row, w);
+	    }
+	    lmap_jsonw_array_end(w);
 	}
     }
+
+    lmap_jsonw_object_end(w);
 }
 
 static void
-render_result(struct result *res, json_object *jobj)
+render_result(struct result *res, struct jsonw *w)
 {
-    json_object *robj;
-    json_object *aobj;
     struct table *tab;
 
-    robj = json_object_new_object();
-    if (! robj) {
-	return;
-    }
-    json_object_array_add(jobj, robj);
+    lmap_jsonw_object_start(w, NULL);
 
-    render_leaf(robj, "schedule", res->schedule);
-    render_leaf(robj, "action", res->action);
-    render_leaf(robj, "task", res->task);
-    render_options(res->options, robj);
-    render_tags(res->tags, "tag", robj);
+    render_leaf(w, "schedule", res->schedule);
+    render_leaf(w, "action", res->action);
+    render_leaf(w, "task", res->task);
+    render_options(res->options, w);
+    render_tags(res->tags, "tag", w);
 
     if (res->event) {
-	render_leaf_datetime(robj, "event", &res->event);
+	render_leaf_datetime(w, "event", &res->event);
     }
 
     if (res->start) {
-	render_leaf_datetime(robj, "start", &res->start);
+	render_leaf_datetime(w, "start", &res->start);
     }
 
     if (res->end) {
-	render_leaf_datetime(robj, "end", &res->end);
+	render_leaf_datetime(w, "end", &res->end);
     }
 
     if (res->cycle_number) {
-	render_leaf(robj, "cycle-number", res->cycle_number);
+	render_leaf(w, "cycle-number", res->cycle_number);
     }
 
     if (res->flags & LMAP_RESULT_FLAG_STATUS_SET) {
-	render_leaf_int32(robj, "status", res->status);
+	render_leaf_int32(w, "status", res->status);
     }
 
     if (res->tables) {
-	aobj = json_object_new_array();
-	if (aobj) {
-	    json_object_object_add(robj, "table", aobj);
-	    for (tab = res->tables; tab; tab = tab->next) {
-		render_table(tab, aobj);
-	    }
+	lmap_jsonw_array_start(w, "table");
+	for (tab = res->tables; tab; tab = tab->next) {
+	    render_table(tab, w);
 	}
+	lmap_jsonw_array_end(w);
     }
+
+    lmap_jsonw_object_end(w);
 }
 
-static int
-render_agent(struct agent *agent, json_object *jobj, int what)
+static void
+render_agent(struct agent *agent, struct jsonw *w, int what)
 {
-    assert(jobj);
-    json_object *ja;
+    assert(w);
 
     if (!agent)
-	return 0;
+	return;
 
-    ja = json_object_new_object();
-    if (!ja)
-	return -1;
-    json_object_object_add(jobj, "agent", ja);
+    lmap_jsonw_object_start(w, "agent");
 
     if (what & RENDER_CONFIG_TRUE) {
-	render_leaf(ja, "agent-id", agent->agent_id);
-	render_leaf(ja, "group-id", agent->group_id);
-	render_leaf(ja, "measurement-point", agent->measurement_point);
+	render_leaf(w, "agent-id", agent->agent_id);
+	render_leaf(w, "group-id", agent->group_id);
+	render_leaf(w, "measurement-point", agent->measurement_point);
 	if (agent->flags & LMAP_AGENT_FLAG_REPORT_AGENT_ID_SET)
-	    render_leaf_boolean(ja, "report-agent-id", agent->report_agent_id);
+	    render_leaf_boolean(w, "report-agent-id", agent->report_agent_id);
         if (agent->flags & LMAP_AGENT_FLAG_REPORT_GROUP_ID_SET)
-	    render_leaf_boolean(ja, "report-group-id", agent->report_group_id);
+	    render_leaf_boolean(w, "report-group-id", agent->report_group_id);
 	if (agent->flags & LMAP_AGENT_FLAG_REPORT_MEASUREMENT_POINT_SET)
-	    render_leaf_boolean(ja, "report-measurement-point", agent->report_measurement_point);
+	    render_leaf_boolean(w, "report-measurement-point", agent->report_measurement_point);
 	if (agent->flags & LMAP_AGENT_FLAG_CONTROLLER_TIMEOUT_SET)
-	    render_leaf_uint32(ja, "controller-timeout", agent->controller_timeout);
+	    render_leaf_uint32(w, "controller-timeout", agent->controller_timeout);
+	if (agent->flags & LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET)
+	    render_leaf_uint32(w, "max-concurrent-actions", agent->max_concurrent_actions);
+	if (agent->flags & LMAP_AGENT_FLAG_DURABILITY_SET)
+	    render_leaf(w, "durability",
+			agent->durability == LMAP_AGENT_DURABILITY_GROUP ? "group" : "none");
+	if (agent->flags & LMAP_AGENT_FLAG_COMMIT_WINDOW_SET)
+	    render_leaf_uint32(w, "commit-window", agent->commit_window);
     }
 
     if (what & RENDER_CONFIG_FALSE) {
 	if (agent->last_started)
-	    render_leaf_datetime(ja, "last-started", &agent->last_started);
+	    render_leaf_datetime(w, "last-started", &agent->last_started);
+	if (agent->cnt_admissions || agent->admission_queue_depth) {
+	    render_leaf_uint32(w, "admission-queue-depth", agent->admission_queue_depth);
+	    render_leaf_uint32(w, "admissions", agent->cnt_admissions);
+	    render_leaf_uint64(w, "admission-wait", agent->admission_wait);
+	    render_leaf_uint64(w, "admission-max-wait", agent->admission_max_wait);
+	}
+	if (agent->loop_lag || agent->loop_max_lag) {
+	    render_leaf_uint64(w, "event-loop-lag", agent->loop_lag);
+	    render_leaf_uint64(w, "event-loop-max-lag", agent->loop_max_lag);
+	}
+	if (agent->cnt_commits) {
+	    render_leaf_uint32(w, "commits", agent->cnt_commits);
+	    render_leaf_uint64(w, "commit-latency", agent->commit_latency);
+	    render_leaf_uint64(w, "commit-max-latency", agent->commit_max_latency);
+	    render_leaf_uint32(w, "commit-batch", agent->commit_batch);
+	    render_leaf_uint32(w, "commit-max-batch", agent->commit_max_batch);
+	}
     }
 
-    return 0;
+    lmap_jsonw_object_end(w);
+}
+
+static void
+render_usage(struct usage *usage, struct jsonw *w, const char * const name)
+{
+    if (!lmap_usage_isset(usage))
+	return;
+
+    lmap_jsonw_object_start(w, name);
+    render_leaf_uint64(w, "user-time", usage->user_time);
+    render_leaf_uint64(w, "system-time", usage->system_time);
+    render_leaf_uint64(w, "max-rss", usage->max_rss);
+    render_leaf_uint64(w, "block-input", usage->block_input);
+    render_leaf_uint64(w, "block-output", usage->block_output);
+    render_leaf_uint64(w, "voluntary-context-switches", usage->voluntary_switches);
+    render_leaf_uint64(w, "involuntary-context-switches", usage->involuntary_switches);
+    lmap_jsonw_object_end(w);
 }
 
 static void
-render_action(struct action *action, json_object *jobj, int what)
+render_action(struct action *action, struct jsonw *w, int what)
 {
     if(!action || !action->name)
 	return;
 
-    render_leaf(jobj, "name", action->name);
+    render_leaf(w, "name", action->name);
     if (what & RENDER_CONFIG_TRUE) {
-	render_leaf(jobj, "task", action->task);
-        render_options(action->options, jobj);
-	render_tags(action->destinations, "destination", jobj);
-	render_tags(action->tags, "tag", jobj);
-	render_tags(action->suppression_tags, "suppression-tag", jobj);
+	render_leaf(w, "task", action->task);
+        render_options(action->options, w);
+	render_tags(action->destinations, "destination", w);
+	render_tags(action->tags, "tag", w);
+	render_tags(action->suppression_tags, "suppression-tag", w);
+	if (action->flags & LMAP_ACTION_FLAG_TIMEOUT_SET)
+	    render_leaf_uint32(w, "timeout", action->timeout);
+	if (action->output_memory_limit)
+	    render_leaf_uint64(w, "output-memory-limit", action->output_memory_limit);
     }
     if (what & RENDER_CONFIG_FALSE) {
 	const char *state = NULL;
@@ -2417,93 +2591,75 @@ render_action(struct action *action, json_object *jobj, int what)
 	    state = "suppressed";
 	    break;
 	}
-	render_leaf(jobj, "state", state);
+	render_leaf(w, "state", state);
 
-	render_leaf_uint64(jobj, "storage", action->storage);
-	render_leaf_uint32(jobj, "invocations", action->cnt_invocations);
-	render_leaf_uint32(jobj, "suppressions", action->cnt_suppressions);
-	render_leaf_uint32(jobj, "overlaps", action->cnt_overlaps);
-	render_leaf_uint32(jobj, "failures", action->cnt_failures);
+	render_leaf_uint64(w, "storage", action->storage);
+	render_leaf_uint32(w, "invocations", action->cnt_invocations);
+	render_leaf_uint32(w, "suppressions", action->cnt_suppressions);
+	render_leaf_uint32(w, "overlaps", action->cnt_overlaps);
+	render_leaf_uint32(w, "failures", action->cnt_failures);
+	if (action->cnt_timeouts)
+	    render_leaf_uint32(w, "timeouts", action->cnt_timeouts);
 
 	if (action->last_invocation)
-	    render_leaf_datetime(jobj, "last-invocation", &action->last_invocation);
+	    render_leaf_datetime(w, "last-invocation", &action->last_invocation);
 	if (action->last_completion) {
-	    render_leaf_datetime(jobj, "last-completion", &action->last_completion);
-	    render_leaf_int32(jobj, "last-status", action->last_status);
+	    render_leaf_datetime(w, "last-completion", &action->last_completion);
+	    render_leaf_int32(w, "last-status", action->last_status);
 	    if (action->last_message)
-		render_leaf(jobj, "last-message", action->last_message);
+		render_leaf(w, "last-message", action->last_message);
 	}
 	if (action->last_failed_completion) {
-	    render_leaf_datetime(jobj, "last-failed-completion", &action->last_failed_completion);
-	    render_leaf_int32(jobj, "last-failed-status", action->last_failed_status);
+	    render_leaf_datetime(w, "last-failed-completion", &action->last_failed_completion);
+	    render_leaf_int32(w, "last-failed-status", action->last_failed_status);
 	    if (action->last_failed_message)
-		render_leaf(jobj, "last-failed-message", action->last_failed_message);
+		render_leaf(w, "last-failed-message", action->last_failed_message);
 	}
+	render_usage(&action->last_usage, w, "last-resource-usage");
+	render_usage(&action->usage, w, "resource-usage");
     }
 }
 
 static void
-render_actions(struct action *actions, json_object *jobj, int what)
+render_actions(struct action *actions, struct jsonw *w, int what)
 {
-    json_object *ja, *jact;
     struct action *a;
 
     if (!actions)
 	return;
 
-    ja = json_object_new_array();
-    if (!ja)
-	return;
-    json_object_object_add(jobj, "action", ja);
-
+    lmap_jsonw_array_start(w, "action");
     for (a = actions; a; a = a->next) {
 	if (!a->name)
 	    continue;
 
-	jact = json_object_new_object();
-	if (!jact)
-	    return;
-	json_object_array_add(ja, jact);
-	render_action(a, jact, what);
+	lmap_jsonw_object_start(w, NULL);
+	render_action(a, w, what);
+	lmap_jsonw_object_end(w);
     }
+    lmap_jsonw_array_end(w);
 }
 
-
-static int
-render_schedules(struct schedule *schedule, json_object *jobj, int what)
+static void
+render_schedules(struct schedule *schedule, struct jsonw *w, int what)
 {
-    json_object *jss, *ja, *js;
-
     if (!schedule)
-	return 0;
-    if (!jobj)
-	return -1;
-
-    jss = json_object_new_object();
-    if (!jss)
-	return -1;
-    json_object_object_add(jobj, "schedules", jss);
-    ja = json_object_new_array();
-    if (!ja)
-	return -1;
-    json_object_object_add(jss, "schedule", ja);
+	return;
 
+    lmap_jsonw_object_start(w, "schedules");
+    lmap_jsonw_array_start(w, "schedule");
     for (; schedule; schedule = schedule->next) {
 	if (!schedule->name)
 	    continue;
 
-	js = json_object_new_object();
-	if (!js)
-	    return -1;
-	json_object_array_add(ja, js);
-
-	render_leaf(js, "name", schedule->name);
+	lmap_jsonw_object_start(w, NULL);
+	render_leaf(w, "name", schedule->name);
 	if (what & RENDER_CONFIG_TRUE) {
-	    render_leaf(js, "start", schedule->start);
+	    render_leaf(w, "start", schedule->start);
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_END_SET)
-		render_leaf(js, "end", schedule->end);
+		render_leaf(w, "end", schedule->end);
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_DURATION_SET)
-		render_leaf_uint64(js, "duration", schedule->duration);
+		render_leaf_uint64(w, "duration", schedule->duration);
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_EXEC_MODE_SET) {
 		const char *mode = NULL;
 		switch (schedule->mode) {
@@ -2517,10 +2673,30 @@ render_schedules(struct schedule *schedule, json_object *jobj, int what)
 		    mode = "pipelined";
 		    break;
 		}
-		render_leaf(js, "execution-mode", mode);
+		render_leaf(w, "execution-mode", mode);
 	    }
-	    render_tags(schedule->tags, "tag", js);
-	    render_tags(schedule->suppression_tags, "suppression-tag", js);
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_PRIORITY_SET)
+		render_leaf_int32(w, "priority", schedule->priority);
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_STAGGER_SET)
+		render_leaf_uint32(w, "stagger-interval", schedule->stagger);
+	    if (schedule->incoming_max_bytes)
+		render_leaf_uint64(w, "incoming-max-bytes", schedule->incoming_max_bytes);
+	    if (schedule->incoming_max_files)
+		render_leaf_uint32(w, "incoming-max-files", schedule->incoming_max_files);
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_OVERFLOW_SET)
+		render_leaf(w, "incoming-overflow",
+			    schedule->incoming_overflow == LMAP_SCHEDULE_OVERFLOW_REFUSE
+			    ? "refuse" : "drop-oldest");
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_COMPRESSION_SET)
+		render_leaf(w, "incoming-compression",
+			    schedule->incoming_compression == LMAP_SCHEDULE_COMPRESSION_GZIP
+			    ? "gzip" : "none");
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_FORMAT_SET)
+		render_leaf(w, "incoming-format",
+			    schedule->incoming_format == LMAP_SCHEDULE_FORMAT_LOG
+			    ? "log" : "files");
+	    render_tags(schedule->tags, "tag", w);
+	    render_tags(schedule->suppression_tags, "suppression-tag", w);
 	}
 	if (what & RENDER_CONFIG_FALSE) {
 	    const char *state = NULL;
@@ -2538,57 +2714,52 @@ render_schedules(struct schedule *schedule, json_object *jobj, int what)
 		state = "suppressed";
 		break;
 	    }
-	    render_leaf(js, "state", state);
-
-	    render_leaf_uint64(js, "storage", schedule->storage);
-	    render_leaf_uint32(js, "invocations", schedule->cnt_invocations);
-	    render_leaf_uint32(js, "suppressions", schedule->cnt_suppressions);
-	    render_leaf_uint32(js, "overlaps", schedule->cnt_overlaps);
-	    render_leaf_uint32(js, "failures", schedule->cnt_failures);
+	    render_leaf(w, "state", state);
+
+	    render_leaf_uint64(w, "storage", schedule->storage);
+	    render_leaf_uint32(w, "invocations", schedule->cnt_invocations);
+	    render_leaf_uint32(w, "suppressions", schedule->cnt_suppressions);
+	    render_leaf_uint32(w, "overlaps", schedule->cnt_overlaps);
+	    render_leaf_uint32(w, "failures", schedule->cnt_failures);
+	    if (schedule->cnt_timeouts)
+		render_leaf_uint32(w, "timeouts", schedule->cnt_timeouts);
+	    if (schedule->cnt_quota_hits)
+		render_leaf_uint32(w, "incoming-quota-hits", schedule->cnt_quota_hits);
+	    if (schedule->evicted_bytes)
+		render_leaf_uint64(w, "incoming-evicted-bytes", schedule->evicted_bytes);
 
 	    if (schedule->last_invocation)
-		render_leaf_datetime(js, "last-invocation", &schedule->last_invocation);
+		render_leaf_datetime(w, "last-invocation", &schedule->last_invocation);
+	    render_usage(&schedule->last_usage, w, "last-resource-usage");
+	    render_usage(&schedule->usage, w, "resource-usage");
 	}
-	render_actions(schedule->actions, js, what);
+	render_actions(schedule->actions, w, what);
+	lmap_jsonw_object_end(w);
     }
-    return 0;
+    lmap_jsonw_array_end(w);
+    lmap_jsonw_object_end(w);
 }
 
-static int
-render_suppressions(struct supp *supp, json_object *jobj, int what)
+static void
+render_suppressions(struct supp *supp, struct jsonw *w, int what)
 {
-    json_object *jss, *ja, *js;
-
     if (!supp)
-	return 0;
-    if (!jobj)
-	return -1;
-
-    jss = json_object_new_object();
-    if (!jss)
-	return -1;
-    json_object_object_add(jobj, "suppressions", jss);
-    ja = json_object_new_array();
-    if (!ja)
-	return -1;
-    json_object_object_add(jss, "suppression", ja);
+	return;
 
+    lmap_jsonw_object_start(w, "suppressions");
+    lmap_jsonw_array_start(w, "suppression");
     for (; supp; supp = supp->next) {
 	if (!supp->name)
 	    continue;
 
-	js = json_object_new_object();
-	if (!js)
-	    return -1;
-	json_object_array_add(ja, js);
-
-	render_leaf(js, "name", supp->name);
+	lmap_jsonw_object_start(w, NULL);
+	render_leaf(w, "name", supp->name);
 	if (what & RENDER_CONFIG_TRUE) {
-	    render_leaf(js, "start", supp->start);
-	    render_leaf(js, "end", supp->end);
-	    render_tags(supp->match, "match", js);
+	    render_leaf(w, "start", supp->start);
+	    render_leaf(w, "end", supp->end);
+	    render_tags(supp->match, "match", w);
 	    if (supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET)
-		render_leaf_boolean(js, "stop-running", supp->stop_running);
+		render_leaf_boolean(w, "stop-running", supp->stop_running);
 	}
 	if (what & RENDER_CONFIG_FALSE) {
 	    const char *state = NULL;
@@ -2603,130 +2774,99 @@ render_suppressions(struct supp *supp, json_object *jobj, int what)
 		state = "active";
 		break;
 	    }
-	    render_leaf(js, "state", state);
+	    render_leaf(w, "state", state);
 	}
+	lmap_jsonw_object_end(w);
     }
-    return 0;
+    lmap_jsonw_array_end(w);
+    lmap_jsonw_object_end(w);
 }
 
-static int
-render_tasks(struct task *task, json_object *jobj, int what)
+static void
+render_tasks(struct task *task, struct jsonw *w, int what)
 {
-    json_object *jtasks, *ja, *jt;
-
-    if (!task || !jobj)
-	return 0;
-
-    jtasks = json_object_new_object();
-    if (!jtasks)
-	return -1;
-    json_object_object_add(jobj, "tasks", jtasks);
-    ja = json_object_new_array();
-    if (!ja)
-	return -1;
-    json_object_object_add(jtasks, "task", ja);
+    if (!task)
+	return;
 
+    lmap_jsonw_object_start(w, "tasks");
+    lmap_jsonw_array_start(w, "task");
     for (; task; task = task->next) {
 	if (!task->name)
 	    continue;
 
-	jt = json_object_new_object();
-	if (!jt)
-	    return -1;
-	json_object_array_add(ja, jt);
-
-	render_leaf(jt, "name", task->name);
-	render_registries(task->registries, jt);
+	lmap_jsonw_object_start(w, NULL);
+	render_leaf(w, "name", task->name);
+	render_registries(task->registries, w);
 	if (what & RENDER_CONFIG_FALSE)
-	    render_leaf(jt, "version", task->version);
-	render_leaf(jt, "program", task->program);
+	    render_leaf(w, "version", task->version);
+	render_leaf(w, "program", task->program);
 	if (what & RENDER_CONFIG_TRUE) {
-	    render_options(task->options, jt);
-	    render_tags(task->tags, "tag", jt);
+	    render_options(task->options, w);
+	    render_tags(task->tags, "tag", w);
 	}
+	lmap_jsonw_object_end(w);
     }
-
-    return 0;
+    lmap_jsonw_array_end(w);
+    lmap_jsonw_object_end(w);
 }
 
-static int
-render_capabilities(struct capability *capability, json_object *jobj, int what)
+static void
+render_capabilities(struct capability *capability, struct jsonw *w, int what)
 {
-    json_object *jo;
-
-    assert(jobj);
+    assert(w);
 
     if (!capability
         || !(what & RENDER_CONFIG_FALSE)
 	|| (!capability->version && !capability->tags && !capability->tasks))
-	return 0;
-
-    jo = json_object_new_object();
-    if (!jo)
-	return -1;
-    json_object_object_add(jobj, "capabilities", jo);
-    render_leaf(jo, "version", capability->version);
-    render_tags(capability->tags, "tag", jo);
+	return;
 
-    return render_tasks(capability->tasks, jo, what);
+    lmap_jsonw_object_start(w, "capabilities");
+    render_leaf(w, "version", capability->version);
+    render_tags(capability->tags, "tag", w);
+    render_tasks(capability->tasks, w, what);
+    lmap_jsonw_object_end(w);
 }
 
-static int
-render_events(struct event *event, json_object *jobj, int what)
+static void
+render_events(struct event *event, struct jsonw *w, int what)
 {
-    json_object *jevents, *ja, *je, *jsub;
-
-    assert (jobj);
+    assert (w);
 
     if (!event)
-	return 0;
-
-    jevents = json_object_new_object();
-    if (!jevents)
-	return -1;
-    json_object_object_add(jobj, "events", jevents);
-    ja = json_object_new_array();
-    if (!ja)
-	return -1;
-    json_object_object_add(jevents, "event", ja);
+	return;
 
+    lmap_jsonw_object_start(w, "events");
+    lmap_jsonw_array_start(w, "event");
     for (; event; event = event->next) {
 	if (!event->name)
 	    continue;
 
-	je = json_object_new_object();
-	if (!je)
-	    return -1;
-	json_object_array_add(ja, je);
-
-	render_leaf(je, "name", event->name);
+	lmap_jsonw_object_start(w, NULL);
+	render_leaf(w, "name", event->name);
 	if (what & RENDER_CONFIG_TRUE) {
 	    if (event->flags & LMAP_EVENT_FLAG_RANDOM_SPREAD_SET)
-		render_leaf_uint32(je, "random-spread", event->random_spread);
+		render_leaf_uint32(w, "random-spread", event->random_spread);
 	    if (event->flags & LMAP_EVENT_FLAG_CYCLE_INTERVAL_SET)
-		render_leaf_uint32(je, "cycle-interval", event->cycle_interval);
+		render_leaf_uint32(w, "cycle-interval", event->cycle_interval);
 	    switch (event->type) {
 	    case LMAP_EVENT_TYPE_PERIODIC:
-		if (!(jsub = json_object_new_object()))
-		    return -1;
-		json_object_object_add(je, "periodic", jsub);
+		lmap_jsonw_object_start(w, "periodic");
 		if (event->flags & LMAP_EVENT_FLAG_INTERVAL_SET)
-		    render_leaf_uint32(jsub, "interval", event->interval);
+		    render_leaf_uint32(w, "interval", event->interval);
 		if (event->flags & LMAP_EVENT_FLAG_START_SET)
-		    render_leaf_datetime(jsub, "start", &event->start);
+		    render_leaf_datetime(w, "start", &event->start);
 		if (event->flags & LMAP_EVENT_FLAG_END_SET)
-		    render_leaf_datetime(jsub, "end", &event->end);
+		    render_leaf_datetime(w, "end", &event->end);
+		lmap_jsonw_object_end(w);
 		break;
 	    case LMAP_EVENT_TYPE_CALENDAR:
-		if (!(jsub = json_object_new_object()))
-		    return -1;
-		json_object_object_add(je, "calendar", jsub);
-		render_leaf_months(jsub, "month", event->months);
-		render_leaf_days_of_month(jsub, "day-of-month", event->days_of_month);
-		render_leaf_days_of_week(jsub, "day-of-week", event->days_of_week);
-		render_leaf_hours(jsub, "hour", event->hours);
-		render_leaf_minsecs(jsub, "minute", event->minutes);
-		render_leaf_minsecs(jsub, "second", event->seconds);
+		lmap_jsonw_object_start(w, "calendar");
+		render_leaf_months(w, "month", event->months);
+		render_leaf_days_of_month(w, "day-of-month", event->days_of_month);
+		render_leaf_days_of_week(w, "day-of-week", event->days_of_week);
+		render_leaf_hours(w, "hour", event->hours);
+		render_leaf_minsecs(w, "minute", event->minutes);
+		render_leaf_minsecs(w, "second", event->seconds);
 		if (event->flags & LMAP_EVENT_FLAG_TIMEZONE_OFFSET_SET) {
 		    char buf[42];
 		    char c = (event->timezone_offset < 0) ? '-' : '+';
@@ -2734,80 +2874,160 @@ render_events(struct event *event, json_object *jobj, int what)
 		    offset = (offset < 0) ? -offset : offset;
 		    snprintf(buf, sizeof(buf), "%c%02d:%02d",
 			     c, offset / 60, offset % 60);
-		    render_leaf(jsub, "timezone-offset", buf);
+		    render_leaf(w, "timezone-offset", buf);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_START_SET)
-		    render_leaf_datetime(jsub, "start", &event->start);
+		    render_leaf_datetime(w, "start", &event->start);
 		if (event->flags & LMAP_EVENT_FLAG_END_SET)
-		    render_leaf_datetime(jsub, "end", &event->end);
+		    render_leaf_datetime(w, "end", &event->end);
+		lmap_jsonw_object_end(w);
 		break;
 	    case LMAP_EVENT_TYPE_ONE_OFF:
-		if (!(jsub = json_object_new_object()))
-		    return -1;
-		json_object_object_add(je, "one-off", jsub);
+		lmap_jsonw_object_start(w, "one-off");
 		if (event->flags & LMAP_EVENT_FLAG_START_SET)
-		    render_leaf_datetime(jsub, "time", &event->start);
+		    render_leaf_datetime(w, "time", &event->start);
+		lmap_jsonw_object_end(w);
 		break;
 	    case LMAP_EVENT_TYPE_STARTUP:
-		render_empty_leaf(je, "startup");
+		render_empty_leaf(w, "startup");
 		break;
 	    case LMAP_EVENT_TYPE_IMMEDIATE:
-		render_empty_leaf(je, "immediate");
+		render_empty_leaf(w, "immediate");
 		break;
 	    case LMAP_EVENT_TYPE_CONTROLLER_LOST:
-		render_empty_leaf(je, "controller-lost");
+		render_empty_leaf(w, "controller-lost");
 		break;
 	    case LMAP_EVENT_TYPE_CONTROLLER_CONNECTED:
-		render_empty_leaf(je, "controller-connected");
+		render_empty_leaf(w, "controller-connected");
 		break;
 	    }
 	}
+	lmap_jsonw_object_end(w);
     }
+    lmap_jsonw_array_end(w);
+    lmap_jsonw_object_end(w);
+}
+
+static int
+render_control(struct lmap *lmap, FILE *file, int what, int flags)
+{
+    struct jsonw w;
+
+    assert(lmap);
+
+    /* FIXME: we cannot differentiate state from config except by context
+     *        or by looking for a CONFIG:FALSE field... */
 
-    return 0;
+    lmap_jsonw_init(&w, file,
+		    (flags & LMAP_IO_FLAG_COMPACT) ? LMAP_JSONW_COMPACT : 0);
+    lmap_jsonw_object_start(&w, NULL);
+    lmap_jsonw_object_start(&w, LMAPC_JSON_NAMESPACE ":lmap");
+    render_capabilities(lmap->capabilities, &w, what);
+    render_agent(lmap->agent, &w, what);
+    render_tasks(lmap->tasks, &w, what);
+    render_schedules(lmap->schedules, &w, what);
+    render_suppressions(lmap->supps, &w, what);
+    render_events(lmap->events, &w, what);
+    lmap_jsonw_object_end(&w);
+    lmap_jsonw_object_end(&w);
+
+    return lmap_jsonw_finish(&w);
+}
+
+typedef int (write_func)(struct lmap *lmap, FILE *file, int flags);
+
+/* Collects the output of a write function in a string. */
+
+static char *
+render_string(struct lmap *lmap, write_func *write_doc)
+{
+    FILE *f;
+    char *doc = NULL;
+    size_t len = 0;
+    int ret;
+
+    f = open_memstream(&doc, &len);
+    if (! f) {
+	lmap_err("failed to open memory stream: %s", strerror(errno));
+	return NULL;
+    }
+    ret = write_doc(lmap, f, 0);
+    if (fclose(f) != 0) {
+	ret = -1;
+    }
+    if (ret) {
+	free(doc);
+	return NULL;
+    }
+    return doc;
 }
 
 /**
- * @brief Returns a JSON rendering of the lmap config or state
+ * @brief Writes a JSON rendering of the lmap config to a FILE
+ *
+ * The document is written while the lmap config is walked, without
+ * building it in memory first.
  *
  * @param lmap The pointer to the lmap config to be rendered.
- * @param what PARSER_CONFIG_* to remove state fields from config
- * @return An JSON document as a string that must be freed by the
- *         caller or NULL on error
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without whitespace
+ * @return 0 on success, -1 on error
  */
-static char *
-render_control(struct lmap *lmap, int what)
+int
+lmap_json_write_config(struct lmap *lmap, FILE *file, int flags)
 {
-    json_object *docobj, *rootobj;
-    char *result = NULL;
-    const char *doc;
+    return render_control(lmap, file, RENDER_CONFIG_TRUE, flags);
+}
 
-    assert(lmap);
+/**
+ * @brief Writes a JSON rendering of the lmap state to a FILE
+ *
+ * @param lmap The pointer to the lmap state to be rendered.
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without whitespace
+ * @return 0 on success, -1 on error
+ */
+int
+lmap_json_write_state(struct lmap *lmap, FILE *file, int flags)
+{
+    return render_control(lmap, file,
+			  RENDER_CONFIG_TRUE | RENDER_CONFIG_FALSE, flags);
+}
 
-    /* FIXME: we cannot differentiate state from config except by context
-     *        or by looking for a CONFIG:FALSE field... */
+/**
+ * @brief Writes a JSON rendering of the lmap report to a FILE
+ *
+ * The results are written one by one as the list is walked.
+ *
+ * @param lmap The pointer to the lmap report to be rendered.
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without whitespace
+ * @return 0 on success, -1 on error
+ */
+int
+lmap_json_write_report(struct lmap *lmap, FILE *file, int flags)
+{
+    struct jsonw w;
+    struct result *res;
 
-    if (!(rootobj = json_object_new_object()))
-	return NULL;
-    if (!(docobj = json_object_new_object()))
-	goto err_exit;
-    json_object_object_add(rootobj, LMAPC_JSON_NAMESPACE ":lmap", docobj);
+    assert(lmap);
 
-    if (!render_capabilities(lmap->capabilities, docobj, what)
-		&& !render_agent(lmap->agent, docobj, what)
-		&& !render_tasks(lmap->tasks, docobj, what)
-		&& !render_schedules(lmap->schedules, docobj, what)
-		&& !render_suppressions(lmap->supps, docobj, what)
-		&& !render_events(lmap->events, docobj, what)) {
-	doc = json_object_to_json_string_ext(rootobj, JSON_C_TO_STRING_PRETTY);
-	if (doc)
-	    result = strdup(doc);
+    lmap_jsonw_init(&w, file,
+		    (flags & LMAP_IO_FLAG_COMPACT) ? LMAP_JSONW_COMPACT : 0);
+    lmap_jsonw_object_start(&w, NULL);
+    lmap_jsonw_object_start(&w, LMAPR_JSON_NAMESPACE ":" "report");
+    render_agent_report(lmap->agent, &w);
+    if (lmap->results) {
+	lmap_jsonw_array_start(&w, "result");
+	for (res = lmap->results; res; res = res->next) {
+	    render_result(res, &w);
+	}
+	lmap_jsonw_array_end(&w);
     }
+    lmap_jsonw_object_end(&w);
+    lmap_jsonw_object_end(&w);
 
-err_exit:
-    json_object_put(rootobj);
-
-    return result;
+    return lmap_jsonw_finish(&w);
 }
 
 /**
@@ -2823,7 +3043,7 @@ err_exit:
 char *
 lmap_json_render_config(struct lmap *lmap)
 {
-    return render_control(lmap, RENDER_CONFIG_TRUE);
+    return render_string(lmap, lmap_json_write_config);
 }
 
 /**
@@ -2839,7 +3059,7 @@ lmap_json_render_config(struct lmap *lmap)
 char *
 lmap_json_render_state(struct lmap *lmap)
 {
-    return render_control(lmap, RENDER_CONFIG_TRUE | RENDER_CONFIG_FALSE);
+    return render_string(lmap, lmap_json_write_state);
 }
 
 /**
@@ -2855,37 +3075,7 @@ lmap_json_render_state(struct lmap *lmap)
 char *
 lmap_json_render_report(struct lmap *lmap)
 {
-    char *report = NULL;
-    json_object *jobj, *aobj, *robj;
-    struct result *res;
-    const char *r1;
-
-    assert(lmap);
-
-    if (!(jobj = json_object_new_object()))
-	return NULL;
-    if (!(robj = json_object_new_object()))
-	goto err_exit;
-
-    json_object_object_add(jobj, LMAPR_JSON_NAMESPACE ":" "report", robj);
-    render_agent_report(lmap->agent, robj);
-
-    if (lmap->results) {
-	if (!(aobj = json_object_new_array()))
-	    goto err_exit;
-	json_object_object_add(robj, "result", aobj);
-	for (res = lmap->results; res; res = res->next) {
-	    render_result(res, aobj);
-	}
-    }
-
-    r1 = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
-    if (r1)
-	report = strdup(r1);
-
-err_exit:
-    json_object_put(jobj);
-    return report;
+    return render_string(lmap, lmap_json_write_report);
 }
 
 #endif /* ifdef WITH_JSON */
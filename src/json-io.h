@@ -18,6 +18,8 @@
 #ifndef LMAP_JSON_IO_H
 #define LMAP_JSON_IO_H
 
+#include <stdio.h>
+
 #include "lmap.h"
 
 #define LMAPC_JSON_NAMESPACE "ietf-lmap-control"
@@ -35,9 +37,14 @@ extern int lmap_json_parse_state_string(struct lmap *lmap, const char *string);
 extern int lmap_json_parse_report_file(struct lmap *lmap, const char *file);
 extern int lmap_json_parse_report_string(struct lmap *lmap, const char *string);
 extern int lmap_json_parse_task_results_fd(int fd, struct result *result);
+extern int lmap_json_parse_task_results_mem(const char *buf, size_t len, struct result *result);
 
 extern char * lmap_json_render_config(struct lmap *lmap);
 extern char * lmap_json_render_state(struct lmap *lmap);
 extern char * lmap_json_render_report(struct lmap *lmap);
 
+extern int lmap_json_write_config(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_json_write_state(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_json_write_report(struct lmap *lmap, FILE *file, int flags);
+
 #endif
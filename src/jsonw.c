@@ -0,0 +1,210 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "jsonw.h"
+
+static void
+put(struct jsonw *w, const char *s, size_t len)
+{
+    if (! w->error && len && fwrite(s, 1, len, w->file) != len) {
+	w->error = 1;
+    }
+}
+
+static void
+newline(struct jsonw *w)
+{
+    int i;
+
+    if (w->flags & LMAP_JSONW_COMPACT) {
+	return;
+    }
+    put(w, "\n", 1);
+    for (i = 0; i < w->level; i++) {
+	put(w, "  ", 2);
+    }
+}
+
+/* Escapes the same characters as json-c does, including the '/'. */
+
+static void
+put_string(struct jsonw *w, const char *s)
+{
+    const char *run = s;
+    char esc[8];
+
+    put(w, "\"", 1);
+    for (; *s; s++) {
+	unsigned char c = (unsigned char) *s;
+	const char *e = NULL;
+
+	switch (c) {
+	case '\b': e = "\\b"; break;
+	case '\n': e = "\\n"; break;
+	case '\r': e = "\\r"; break;
+	case '\t': e = "\\t"; break;
+	case '\f': e = "\\f"; break;
+	case '"':  e = "\\\""; break;
+	case '\\': e = "\\\\"; break;
+	case '/':  e = "\\/"; break;
+	default:
+	    if (c < ' ') {
+		snprintf(esc, sizeof(esc), "\\u%04x", c);
+		e = esc;
+	    }
+	    break;
+	}
+	if (e) {
+	    put(w, run, (size_t) (s - run));
+	    put(w, e, strlen(e));
+	    run = s + 1;
+	}
+    }
+    put(w, run, (size_t) (s - run));
+    put(w, "\"", 1);
+}
+
+/* Starts a value: the separator, the indentation and the key. */
+
+static void
+start_value(struct jsonw *w, const char *key)
+{
+    if (w->level) {
+	if (! w->first) {
+	    put(w, ",", 1);
+	}
+	newline(w);
+    }
+    w->first = 0;
+    if (key) {
+	put_string(w, key);
+	put(w, ":", 1);
+    }
+}
+
+static void
+container_start(struct jsonw *w, const char *key, const char *open)
+{
+    start_value(w, key);
+    put(w, open, 1);
+    w->level++;
+    w->first = 1;
+}
+
+static void
+container_end(struct jsonw *w, const char *close)
+{
+    /* like json-c, this puts even an empty container on two lines */
+    w->level--;
+    newline(w);
+    put(w, close, 1);
+    w->first = 0;
+}
+
+/**
+ * @brief Initializes a struct jsonw to write to a FILE
+ *
+ * @param w pointer to the struct jsonw
+ * @param file the FILE to write to
+ * @param flags LMAP_JSONW_COMPACT or 0
+ */
+
+void
+lmap_jsonw_init(struct jsonw *w, FILE *file, int flags)
+{
+    memset(w, 0, sizeof(*w));
+    w->file = file;
+    w->flags = flags;
+}
+
+/**
+ * @brief Finishes the output of a struct jsonw
+ *
+ * The FILE is not flushed nor closed.
+ *
+ * @param w pointer to the struct jsonw
+ * @return 0 on success, -1 if writing failed or objects or arrays
+ *         were left open
+ */
+
+int
+lmap_jsonw_finish(struct jsonw *w)
+{
+    if (w->error || w->level || ferror(w->file)) {
+	return -1;
+    }
+    return 0;
+}
+
+void
+lmap_jsonw_object_start(struct jsonw *w, const char *key)
+{
+    container_start(w, key, "{");
+}
+
+void
+lmap_jsonw_object_end(struct jsonw *w)
+{
+    container_end(w, "}");
+}
+
+void
+lmap_jsonw_array_start(struct jsonw *w, const char *key)
+{
+    container_start(w, key, "[");
+}
+
+void
+lmap_jsonw_array_end(struct jsonw *w)
+{
+    container_end(w, "]");
+}
+
+void
+lmap_jsonw_string(struct jsonw *w, const char *key, const char *string)
+{
+    start_value(w, key);
+    put_string(w, string);
+}
+
+void
+lmap_jsonw_int64(struct jsonw *w, const char *key, int64_t num)
+{
+    char buf[32];
+
+    start_value(w, key);
+    snprintf(buf, sizeof(buf), "%" PRId64, num);
+    put(w, buf, strlen(buf));
+}
+
+void
+lmap_jsonw_boolean(struct jsonw *w, const char *key, int flag)
+{
+    start_value(w, key);
+    put(w, flag ? "true" : "false", flag ? 4 : 5);
+}
+
+void
+lmap_jsonw_null(struct jsonw *w, const char *key)
+{
+    start_value(w, key);
+    put(w, "null", 4);
+}
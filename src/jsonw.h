@@ -0,0 +1,58 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_JSONW_H
+#define LMAP_JSONW_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * A streaming JSON writer. Values are written to the FILE as they
+ * are added, nothing but the nesting depth is kept in memory. The
+ * pretty output is the same as the one of json-c with the
+ * JSON_C_TO_STRING_PRETTY flag, the compact output has no whitespace.
+ *
+ * Members of objects are added with their key, array elements and the
+ * top-level value with a NULL key. Errors are sticky and reported by
+ * lmap_jsonw_finish().
+ */
+
+#define LMAP_JSONW_COMPACT	0x01
+
+struct jsonw {
+    FILE *file;
+    int flags;
+    int level;			/* number of open objects and arrays */
+    int first;			/* nothing written yet at this level */
+    int error;
+};
+
+extern void lmap_jsonw_init(struct jsonw *w, FILE *file, int flags);
+extern int lmap_jsonw_finish(struct jsonw *w);
+
+extern void lmap_jsonw_object_start(struct jsonw *w, const char *key);
+extern void lmap_jsonw_object_end(struct jsonw *w);
+extern void lmap_jsonw_array_start(struct jsonw *w, const char *key);
+extern void lmap_jsonw_array_end(struct jsonw *w);
+
+extern void lmap_jsonw_string(struct jsonw *w, const char *key, const char *value);
+extern void lmap_jsonw_int64(struct jsonw *w, const char *key, int64_t value);
+extern void lmap_jsonw_boolean(struct jsonw *w, const char *key, int value);
+extern void lmap_jsonw_null(struct jsonw *w, const char *key);
+
+#endif
@@ -101,6 +101,19 @@ int lmap_io_parse_task_results_fd(int fd, int filetype, struct result *result)
     return -1;
 }
 
+int lmap_io_parse_task_results_mem(const char *buf, size_t len, int filetype, struct result *result)
+{
+#ifdef WITH_XML
+    if (filetype == LMAP_FT_XML)
+	return lmap_xml_parse_task_results_mem(buf, len, result);
+#endif
+#ifdef WITH_JSON
+    if (filetype == LMAP_FT_JSON)
+	return lmap_json_parse_task_results_mem(buf, len, result);
+#endif
+    return -1;
+}
+
 #ifdef WITH_XML
 #define lmap_xml_dispatch(suffix, ...) \
     do { if (lmap_io_engine == LMAP_IO_XML) \
@@ -133,6 +146,13 @@ int lmap_io_parse_task_results_fd(int fd, int filetype, struct result *result)
         return NULL; \
     }
 
+#define CREATE_LMAP_IO_WRITE(suffix) \
+    int lmap_io_write_ ## suffix ( struct lmap *lmap, FILE *file, int flags ) { \
+        lmap_xml_dispatch(write_ ## suffix, lmap, file, flags ); \
+        lmap_json_dispatch(write_ ## suffix, lmap, file, flags ); \
+        return -1; \
+    }
+
 /* function generators */
 CREATE_LMAP_IO_PARSE(config_path)
 CREATE_LMAP_IO_PARSE(state_path)
@@ -140,3 +160,6 @@ CREATE_LMAP_IO_PARSE(state_file)
 CREATE_LMAP_IO_RENDER(config)
 CREATE_LMAP_IO_RENDER(state)
 CREATE_LMAP_IO_RENDER(report)
+CREATE_LMAP_IO_WRITE(config)
+CREATE_LMAP_IO_WRITE(state)
+CREATE_LMAP_IO_WRITE(report)
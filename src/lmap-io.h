@@ -18,6 +18,8 @@
 #ifndef LMAP_IO_H
 #define LMAP_IO_H
 
+#include <stdio.h>
+
 #include "lmap.h"
 
 enum lmap_io_engine {
@@ -33,6 +35,9 @@ enum lmap_io_engine {
 #define LMAP_FT_JSON    2
 #define LMAP_FT_CSV     3
 
+/* flags for the write functions */
+#define LMAP_IO_FLAG_COMPACT	0x01	/* no indentation and line breaks */
+
 /* change active engine, call at any point */
 extern int lmap_io_set_engine(enum lmap_io_engine engine);
 
@@ -47,8 +52,12 @@ extern int lmap_io_parse_state_path(struct lmap *lmap, const char *path);
 extern char *lmap_io_render_config(struct lmap *lmap);
 extern char *lmap_io_render_state(struct lmap *lmap);
 extern char *lmap_io_render_report(struct lmap *lmap);
+extern int lmap_io_write_config(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_io_write_state(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_io_write_report(struct lmap *lmap, FILE *file, int flags);
 
 /* for queue IO */
 extern int lmap_io_parse_task_results_fd(int fd, int filetype, struct result *result);
+extern int lmap_io_parse_task_results_mem(const char *buf, size_t len, int filetype, struct result *result);
 
 #endif
@@ -97,7 +97,7 @@ vlog(int level, const char *func, const char *format, va_list args)
 static void
 usage(FILE *f)
 {
-    fprintf(f, "usage: %s [-h] [-j|-x] [-q queue] [-c config] [-C dir] [-w [width]] <command> [command arguments]\n"
+    fprintf(f, "usage: %s [-h] [-j|-x] [-m] [-q queue] [-c config] [-C dir] [-w [width]] <command> [command arguments]\n"
 	    "\t-q path to queue directory\n"
 	    "\t-c path to config directory or file (repeat for more paths or files)\n"
 	    "\t\t(an argument of \"+\" stands for the built-in/default path)\n"
@@ -109,6 +109,7 @@ usage(FILE *f)
 #ifdef WITH_XML
 	    "\t-x use xml format when generating output (default)\n"
 #endif
+	    "\t-m compact output without indentation (config, report)\n"
 	    "\t-i [json|xml] use structured input for reports\n"
 	    "\t-w [<width>] wide output when stdout is a tty\n"
 	    "\t\t(use 0 for unlimited. <width> will be 132 if not specified)\n"
@@ -127,6 +128,12 @@ help(FILE *f)
     }
 }
 
+static int
+io_flags(void)
+{
+    return (lmapd->flags & LMAPD_FLAG_COMPACT) ? LMAP_IO_FLAG_COMPACT : 0;
+}
+
 static const char*
 render_datetime_short(time_t *tp)
 {
@@ -169,6 +176,52 @@ render_storage(uint64_t storage)
     return buf;
 }
 
+/*
+ * Render a count (operations, events) with SI suffixes, unlike
+ * render_storage(), which uses binary ones for bytes.
+ */
+
+static const char*
+render_count(uint64_t count)
+{
+    static char buf[127];
+
+    if (count/1000/1000 > 9999) {
+	snprintf(buf, sizeof(buf), "%" PRIu64 "G",
+		 ((count/1000/1000)+500)/1000);
+    } else if (count/1000 > 9999) {
+	snprintf(buf, sizeof(buf), "%" PRIu64 "M",
+		 ((count/1000)+500)/1000);
+    } else if (count > 9999) {
+	snprintf(buf, sizeof(buf), "%" PRIu64 "k",
+		 (count+500)/1000);
+    } else {
+	snprintf(buf, sizeof(buf), "%" PRIu64, count);
+    }
+    return buf;
+}
+
+/*
+ * Print the CPU times in seconds, the resident set sizes, the block
+ * operations and the context switches of a resource usage.
+ */
+
+static void
+render_usage(struct usage *last, struct usage *total)
+{
+    printf("%8.3f %8.3f %9.3f %9.3f ",
+	   (double) last->user_time / 1000000.0,
+	   (double) last->system_time / 1000000.0,
+	   (double) total->user_time / 1000000.0,
+	   (double) total->system_time / 1000000.0);
+    printf("%5.5s ", render_storage(last->max_rss * 1024));
+    printf("%6.6s ", render_storage(total->max_rss * 1024));
+    printf("%5.5s ", render_count(last->block_input));
+    printf("%5.5s ", render_count(last->block_output));
+    printf("%5.5s\n", render_count(last->voluntary_switches
+				   + last->involuntary_switches));
+}
+
 static const char*
 render_datetime_long(time_t *tp)
 {
@@ -313,8 +366,6 @@ clean_cmd(int argc, char *argv[])
 static int
 config_cmd(int argc, char *argv[])
 {
-    char *doc;
-
     if (argc != 1) {
 	printf("%s: wrong # of args: should be '%s'\n",
 	       LMAPD_LMAPCTL, argv[0]);
@@ -328,12 +379,9 @@ config_cmd(int argc, char *argv[])
 	return 1;
     }
 
-    doc = lmap_io_render_config(lmapd->lmap);
-    if (! doc) {
+    if (lmap_io_write_config(lmapd->lmap, stdout, io_flags())) {
 	return 1;
     }
-    fputs(doc, stdout);
-    free(doc);
     return 0;
 }
 
@@ -378,8 +426,6 @@ reload_cmd(int argc, char *argv[])
 static int
 report_cmd(int argc, char *argv[])
 {
-    char *report = NULL;
-
     if (argc != 1) {
 	printf("%s: wrong # of args: should be '%s'\n",
 	       LMAPD_LMAPCTL, argv[0]);
@@ -407,12 +453,9 @@ report_cmd(int argc, char *argv[])
 	return 0;
     }
 
-    report = lmap_io_render_report(lmapd->lmap);
-    if (! report) {
+    if (lmap_io_write_report(lmapd->lmap, stdout, io_flags())) {
 	return 1;
     }
-    fputs(report, stdout);
-    free(report);
     return 0;
 }
 
@@ -656,6 +699,36 @@ status_cmd(int argc, char *argv[])
 	}
     }
 
+    /* resource usage, only if anything has been reaped yet */
+    if (lmap && lmap->schedules) {
+	struct schedule *schedule;
+	struct action *action;
+	int found = 0;
+
+	for (schedule = lmap->schedules; schedule; schedule = schedule->next) {
+	    found |= lmap_usage_isset(&schedule->usage);
+	}
+
+	if (found) {
+	    printf("\n");
+	    printf("%-*.*s %8s %8s %9s %9s %5s %6s %5s %5s %5s\n",
+		   name_width, name_width,
+		   "SCHEDULE/ACTION", "L-USER", "L-SYS", "T-USER", "T-SYS",
+		   "L-RSS", "MAXRSS", "L-BIN", "L-BOU", "L-CSW");
+
+	    for (schedule = lmap->schedules; schedule; schedule = schedule->next) {
+		printf("%-*.*s ", name_width, name_width,
+		       schedule->name ? schedule->name : "???");
+		render_usage(&schedule->last_usage, &schedule->usage);
+		for (action = schedule->actions; action; action = action->next) {
+		    printf(" %-*.*s ", name_width-1, name_width-1,
+			   action->name ? action->name : "???");
+		    render_usage(&action->last_usage, &action->usage);
+		}
+	    }
+	}
+    }
+
     printf("\n");
     printf("%-15.15s %-1s\n",
 	   "SUPPRESSION", "S");
@@ -814,7 +887,7 @@ main(int argc, char *argv[])
     }
 
     /* glibc, MUSL, uclibc, uclibc-ng, openbsd and freebsd grok :: */
-    while ((opt = getopt(argc, argv, "q:c:r:C:i:hjxw::")) != -1) {
+    while ((opt = getopt(argc, argv, "q:c:r:C:i:hjxmw::")) != -1) {
 	switch (opt) {
 	case 'q':
 	    queue_path = optarg;
@@ -856,6 +929,9 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	    }
 	    break;
+	case 'm':
+	    lmapd->flags |= LMAPD_FLAG_COMPACT;
+	    break;
 	case 'i':
 	    /* FIXME: whitespace trim this, for "-i foo" as a single arg */
 	    if (!strncasecmp(optarg, "json", 5)) {
@@ -30,6 +30,7 @@
 #include "lmapd.h"
 #include "utils.h"
 #include "pidfile.h"
+#include "snapshot.h"
 #include "lmap-io.h"
 #include "runner.h"
 #include "workspace.h"
@@ -51,16 +52,18 @@ atexit_cb(void)
 static void
 usage(FILE *f)
 {
-    fprintf(f, "usage: %s [-j|-x] [-f] [-n] [-s] [-z] [-v] [-h] [-q queue] [-c config] [-s status]\n"
+    fprintf(f, "usage: %s [-j|-x] [-f] [-n] [-s] [-m] [-z] [-v] [-h] [-q queue] [-c config] [-s status] [-t interval]\n"
 	    "\t-f fork (daemonize)\n"
 	    "\t-n parse config and dump config and exit\n"
 	    "\t-s parse config and dump state and exit\n"
+	    "\t-m compact output without indentation (config, state dumps)\n"
 	    "\t-z clean the workspace before starting\n"
 	    "\t-q path to queue directory\n"
 	    "\t-c path to config directory or file (repeat for more paths or files)\n"
 	    "\t\t(an argument of \"+\" stands for the built-in/default path)\n"
 	    "\t-b path to capability directory or file\n"
 	    "\t-r path to run directory (pid file and status file)\n"
+	    "\t-t seconds between state snapshots (0 = only on reload and exit)\n"
 	    "\t-v show version information and exit\n"
 #ifdef WITH_JSON
 	    "\t-j use JSON for config and reports\n"
@@ -193,7 +196,8 @@ daemonize(void)
  * @brief Reads the XML config file
  *
  * Function to read the XML config file and initialize the
- * coresponding data structures with data.
+ * coresponding data structures with data. The runtime state saved
+ * in the snapshot by the previous run is merged back, if there is one.
  *
  * @param lmapd pointer to the lmapd struct
  * @return 0 on success -1 or error
@@ -202,48 +206,11 @@ daemonize(void)
 static int
 read_config(struct lmapd *a_lmapd)
 {
-    int ret = 0;
-    struct paths *paths;
-
-    a_lmapd->lmap = lmap_new();
-    if (! a_lmapd->lmap) {
-	return -1;
-    }
-
-    paths = a_lmapd->config_paths;
-    while(paths && paths->path) {
-	ret = lmap_io_parse_config_path(a_lmapd->lmap, paths->path);
-	if (ret != 0) {
-	    lmap_free(a_lmapd->lmap);
-	    a_lmapd->lmap = NULL;
-	    return -1;
-	}
-	paths = paths->next;
-    }
-
-    if (a_lmapd->lmap->agent) {
-	a_lmapd->lmap->agent->last_started = time(NULL);
-    }
-
-    ret = lmap_io_parse_state_path(a_lmapd->lmap, a_lmapd->capability_path);
-    if (ret != 0) {
-	lmap_free(a_lmapd->lmap);
-	a_lmapd->lmap = NULL;
-	return -1;
-    }
-
-    if (!a_lmapd->lmap->capabilities) {
-	a_lmapd->lmap->capabilities = lmap_capability_new();
+    a_lmapd->lmap = lmapd_read_config(a_lmapd);
+    if (a_lmapd->lmap) {
+	(void) lmapd_snapshot_read(a_lmapd);
     }
-    if (a_lmapd->lmap->capabilities) {
-	char buf[256];
-	snprintf(buf, sizeof(buf), "%s version %d.%d.%d", LMAPD_LMAPD,
-		 LMAP_VERSION_MAJOR, LMAP_VERSION_MINOR, LMAP_VERSION_PATCH);
-	lmap_capability_set_version(a_lmapd->lmap->capabilities, buf);
-	lmap_capability_add_system_tags(a_lmapd->lmap->capabilities);
-    }
-
-    return 0;
+    return a_lmapd->lmap ? 0 : -1;
 }
 
 static int
@@ -268,7 +235,7 @@ add_default_config_path(void)
 int
 main(int argc, char *argv[])
 {
-    int opt, daemon = 0, noop = 0, state = 0, zap = 0, valid = 0, ret = 0;
+    int opt, daemon = 0, noop = 0, state = 0, zap = 0, valid = 0, ret = 0, flags;
     char *capability_path = NULL;
     char *queue_path = NULL;
     char *run_path = NULL;
@@ -284,7 +251,7 @@ main(int argc, char *argv[])
 
     atexit(atexit_cb);
 
-    while ((opt = getopt(argc, argv, "fnszq:c:b:r:vhjx")) != -1) {
+    while ((opt = getopt(argc, argv, "fnsmzq:c:b:r:t:vhjx")) != -1) {
 	switch (opt) {
 	case 'f':
 	    daemon = 1;
@@ -295,6 +262,9 @@ main(int argc, char *argv[])
 	case 's':
 	    state = 1;
 	    break;
+	case 'm':
+	    lmapd->flags |= LMAPD_FLAG_COMPACT;
+	    break;
 	case 'z':
 	    zap = 1;
 	    break;
@@ -318,6 +288,11 @@ main(int argc, char *argv[])
 	case 'r':
 	    run_path = optarg;
 	    break;
+	case 't':
+	    if (lmapd_set_snapshot_interval(lmapd, optarg)) {
+		exit(EXIT_FAILURE);
+	    }
+	    break;
 	case 'v':
 	    printf("%s version %d.%d.%d\n", LMAPD_LMAPD,
 		   LMAP_VERSION_MAJOR, LMAP_VERSION_MINOR, LMAP_VERSION_PATCH);
@@ -356,21 +331,16 @@ main(int argc, char *argv[])
 	    exit(EXIT_FAILURE);
 	}
 	valid = lmap_valid(lmapd->lmap);
+	flags = (lmapd->flags & LMAPD_FLAG_COMPACT) ? LMAP_IO_FLAG_COMPACT : 0;
 	if (valid && noop) {
-	    char *doc = lmap_io_render_config(lmapd->lmap);
-	    if (! doc) {
+	    if (lmap_io_write_config(lmapd->lmap, stdout, flags)) {
 		exit(EXIT_FAILURE);
 	    }
-	    fputs(doc, stdout);
-	    free(doc);
 	}
 	if (valid && state) {
-	    char *doc = lmap_io_render_state(lmapd->lmap);
-	    if (! doc) {
+	    if (lmap_io_write_state(lmapd->lmap, stdout, flags)) {
 		exit(EXIT_FAILURE);
 	    }
-	    fputs(doc, stdout);
-	    free(doc);
 	}
 	if (fflush(stdout) == EOF) {
 	    lmap_err("flushing stdout failed");
@@ -0,0 +1,299 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "lmap.h"
+#include "lmapd.h"
+#include "utils.h"
+#include "pidtab.h"
+
+#define PIDTAB_INITIAL_SIZE	64
+
+static size_t
+pidtab_hash(struct pidtab *pidtab, pid_t pid)
+{
+    /* multiplicative hashing, pids are often allocated sequentially */
+    uint32_t h = (uint32_t) pid * 2654435761u;
+
+    return (size_t)(h ^ (h >> 16)) & (pidtab->size - 1);
+}
+
+static void
+pidtab_entry_free(struct pidtab *pidtab, struct pidtab_entry *entry)
+{
+    if (entry->watch) {
+	event_free(entry->watch);
+    }
+    if (entry->pidfd != -1) {
+	(void) close(entry->pidfd);
+	pidtab->watched--;
+    }
+    free(entry);
+}
+
+static int
+pidtab_grow(struct pidtab *pidtab)
+{
+    struct pidtab_entry **old = pidtab->buckets;
+    struct pidtab_entry *entry, *next;
+    size_t i, old_size = pidtab->size;
+
+    pidtab->buckets = calloc(old_size * 2, sizeof(struct pidtab_entry *));
+    if (! pidtab->buckets) {
+	pidtab->buckets = old;
+	return -1;
+    }
+    pidtab->size = old_size * 2;
+
+    for (i = 0; i < old_size; i++) {
+	for (entry = old[i]; entry; entry = next) {
+	    size_t h = pidtab_hash(pidtab, entry->pid);
+	    next = entry->next;
+	    entry->next = pidtab->buckets[h];
+	    pidtab->buckets[h] = entry;
+	}
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Allocates and initializes a struct pidtab
+ *
+ * @return pointer to a struct pidtab on success, NULL on error
+ */
+
+struct pidtab *
+lmapd_pidtab_new(void)
+{
+    struct pidtab *pidtab;
+
+    pidtab = calloc(1, sizeof(struct pidtab));
+    if (pidtab) {
+	pidtab->size = PIDTAB_INITIAL_SIZE;
+	pidtab->buckets = calloc(pidtab->size, sizeof(struct pidtab_entry *));
+	if (! pidtab->buckets) {
+	    free(pidtab);
+	    pidtab = NULL;
+	}
+    }
+    if (! pidtab) {
+	lmap_err("failed to allocate memory");
+    }
+    return pidtab;
+}
+
+/**
+ * @brief Removes all entries of a struct pidtab
+ *
+ * This must be called whenever the schedules and actions referenced
+ * by the table are released, and before the event base of the
+ * watches is freed. The children of the removed entries are counted
+ * as untracked since they still need to be reaped.
+ *
+ * @param pidtab pointer to the struct pidtab
+ */
+
+void
+lmapd_pidtab_flush(struct pidtab *pidtab)
+{
+    struct pidtab_entry *entry, *next;
+    size_t i;
+
+    if (! pidtab) {
+	return;
+    }
+
+    for (i = 0; i < pidtab->size; i++) {
+	for (entry = pidtab->buckets[i]; entry; entry = next) {
+	    next = entry->next;
+	    pidtab_entry_free(pidtab, entry);
+	}
+	pidtab->buckets[i] = NULL;
+    }
+    pidtab->untracked += pidtab->count;
+    pidtab->count = 0;
+}
+
+void
+lmapd_pidtab_free(struct pidtab *pidtab)
+{
+    if (pidtab) {
+	lmapd_pidtab_flush(pidtab);
+	free(pidtab->buckets);
+	free(pidtab);
+    }
+}
+
+/**
+ * @brief Registers the pid of a running action
+ *
+ * @param pidtab pointer to the struct pidtab
+ * @param pid process identifier of the action
+ * @param schedule pointer to the schedule of the action
+ * @param action pointer to the action
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_pidtab_add(struct pidtab *pidtab, pid_t pid,
+		 struct schedule *schedule, struct action *action)
+{
+    struct pidtab_entry *entry;
+    size_t h;
+
+    assert(pidtab);
+
+    if (pidtab->count >= pidtab->size) {
+	(void) pidtab_grow(pidtab);	/* we can live with longer chains */
+    }
+
+    entry = calloc(1, sizeof(struct pidtab_entry));
+    if (! entry) {
+	lmap_err("failed to allocate memory");
+	pidtab->untracked++;
+	return -1;
+    }
+    entry->pid = pid;
+    entry->pidfd = -1;
+    entry->schedule = schedule;
+    entry->action = action;
+
+    h = pidtab_hash(pidtab, pid);
+    entry->next = pidtab->buckets[h];
+    pidtab->buckets[h] = entry;
+    pidtab->count++;
+    return 0;
+}
+
+/**
+ * @brief Finds the action (and its schedule) of a pid
+ *
+ * @param pidtab pointer to the struct pidtab
+ * @param pid process identifier to look up
+ * @param schedule pointer to store the schedule in (may be NULL)
+ * @return pointer to the action, NULL if the pid is unknown
+ */
+
+struct action *
+lmapd_pidtab_find(struct pidtab *pidtab, pid_t pid, struct schedule **schedule)
+{
+    struct pidtab_entry *entry;
+
+    if (! pidtab) {
+	return NULL;
+    }
+
+    for (entry = pidtab->buckets[pidtab_hash(pidtab, pid)];
+	 entry; entry = entry->next) {
+	if (entry->pid == pid) {
+	    if (schedule) {
+		*schedule = entry->schedule;
+	    }
+	    return entry->action;
+	}
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Removes the entry of a pid
+ *
+ * @param pidtab pointer to the struct pidtab
+ * @param pid process identifier to remove
+ * @return 0 on success, -1 if the pid is unknown
+ */
+
+int
+lmapd_pidtab_remove(struct pidtab *pidtab, pid_t pid)
+{
+    struct pidtab_entry **entryp, *entry;
+
+    if (! pidtab) {
+	return -1;
+    }
+
+    for (entryp = &pidtab->buckets[pidtab_hash(pidtab, pid)];
+	 *entryp; entryp = &(*entryp)->next) {
+	if ((*entryp)->pid == pid) {
+	    entry = *entryp;
+	    *entryp = entry->next;
+	    pidtab_entry_free(pidtab, entry);
+	    pidtab->count--;
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Attaches a pidfd and the event watching it to an entry
+ *
+ * The entry takes ownership of the pidfd and the event.
+ *
+ * @param pidtab pointer to the struct pidtab
+ * @param pid process identifier of the entry
+ * @param pidfd pidfd referring to the process
+ * @param watch event watching the pidfd
+ * @return 0 on success, -1 if the pid is unknown
+ */
+
+int
+lmapd_pidtab_watch(struct pidtab *pidtab, pid_t pid,
+		   int pidfd, struct event *watch)
+{
+    struct pidtab_entry *entry;
+
+    if (! pidtab) {
+	return -1;
+    }
+
+    for (entry = pidtab->buckets[pidtab_hash(pidtab, pid)];
+	 entry; entry = entry->next) {
+	if (entry->pid == pid) {
+	    assert(entry->pidfd == -1 && ! entry->watch);
+	    entry->pidfd = pidfd;
+	    entry->watch = watch;
+	    pidtab->watched++;
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Checks whether there are children not watched by a pidfd
+ *
+ * @param pidtab pointer to the struct pidtab
+ * @return 1 if some children must be reaped on SIGCHLD, 0 otherwise
+ */
+
+int
+lmapd_pidtab_unwatched(struct pidtab *pidtab)
+{
+    if (! pidtab) {
+	return 1;
+    }
+    return pidtab->untracked || pidtab->watched < pidtab->count;
+}
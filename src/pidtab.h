@@ -0,0 +1,66 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_PIDTAB_H
+#define LMAP_PIDTAB_H
+
+#include <sys/types.h>
+
+#include "lmap.h"
+#include "lmapd.h"
+
+/**
+ * A struct pidtab maps the process identifiers of running actions
+ * to the action and the schedule the action belongs to. It is a
+ * chained hash table that grows as more actions are running.
+ *
+ * Entries may own a pidfd and the event watching it, both are
+ * released together with the entry. Children that can not be
+ * watched with a pidfd are counted so that the SIGCHLD handler
+ * knows whether it has to reap anything.
+ */
+
+struct pidtab_entry {
+    pid_t pid;
+    struct schedule *schedule;
+    struct action *action;
+    int pidfd;				/* -1 if not watched */
+    struct event *watch;
+    struct pidtab_entry *next;
+};
+
+struct pidtab {
+    struct pidtab_entry **buckets;
+    size_t size;			/* power of two */
+    size_t count;
+    size_t watched;			/* entries with a pidfd */
+    size_t untracked;			/* children without an entry */
+};
+
+extern struct pidtab * lmapd_pidtab_new(void);
+extern void lmapd_pidtab_free(struct pidtab *pidtab);
+extern void lmapd_pidtab_flush(struct pidtab *pidtab);
+extern int lmapd_pidtab_add(struct pidtab *pidtab, pid_t pid,
+			    struct schedule *schedule, struct action *action);
+extern struct action * lmapd_pidtab_find(struct pidtab *pidtab, pid_t pid,
+					 struct schedule **schedule);
+extern int lmapd_pidtab_remove(struct pidtab *pidtab, pid_t pid);
+extern int lmapd_pidtab_watch(struct pidtab *pidtab, pid_t pid,
+			      int pidfd, struct event *watch);
+extern int lmapd_pidtab_unwatched(struct pidtab *pidtab);
+
+#endif
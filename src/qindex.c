@@ -0,0 +1,437 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "qindex.h"
+
+#define QINDEX_INITIAL_SIZE	64
+
+static size_t
+qindex_hash(struct qindex *qindex, const char *name)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++) {
+	h = (h ^ (unsigned char) *name) * 16777619u;
+    }
+    return (size_t) h & (qindex->size - 1);
+}
+
+static struct qindex_entry *
+qindex_find(struct qindex *qindex, const char *name)
+{
+    struct qindex_entry *entry;
+
+    entry = qindex->buckets[qindex_hash(qindex, name)];
+    for (; entry; entry = entry->hnext) {
+	if (strcmp(entry->name, name) == 0) {
+	    break;
+	}
+    }
+    return entry;
+}
+
+static void
+qindex_grow(struct qindex *qindex)
+{
+    struct qindex_entry **old = qindex->buckets;
+    struct qindex_entry *entry;
+    size_t h;
+
+    qindex->buckets = calloc(qindex->size * 2, sizeof(struct qindex_entry *));
+    if (! qindex->buckets) {
+	/* longer chains, but still correct */
+	qindex->buckets = old;
+	return;
+    }
+    qindex->size *= 2;
+
+    for (entry = qindex->head; entry; entry = entry->next) {
+	h = qindex_hash(qindex, entry->name);
+	entry->hnext = qindex->buckets[h];
+	qindex->buckets[h] = entry;
+    }
+    free(old);
+}
+
+/* Adds an entry as the newest one. */
+
+static void
+qindex_link(struct qindex *qindex, struct qindex_entry *entry)
+{
+    size_t h;
+
+    if (qindex->count >= qindex->size) {
+	qindex_grow(qindex);
+    }
+    h = qindex_hash(qindex, entry->name);
+    entry->hnext = qindex->buckets[h];
+    qindex->buckets[h] = entry;
+
+    entry->next = NULL;
+    entry->prev = qindex->tail;
+    if (qindex->tail) {
+	qindex->tail->next = entry;
+    } else {
+	qindex->head = entry;
+    }
+    qindex->tail = entry;
+    qindex->count++;
+    qindex->bytes += entry->bytes;
+}
+
+static void
+qindex_unlink(struct qindex *qindex, struct qindex_entry *entry)
+{
+    struct qindex_entry **p;
+
+    p = &qindex->buckets[qindex_hash(qindex, entry->name)];
+    while (*p != entry) {
+	p = &(*p)->hnext;
+    }
+    *p = entry->hnext;
+
+    if (entry->prev) {
+	entry->prev->next = entry->next;
+    } else {
+	qindex->head = entry->next;
+    }
+    if (entry->next) {
+	entry->next->prev = entry->prev;
+    } else {
+	qindex->tail = entry->prev;
+    }
+    entry->prev = entry->next = entry->hnext = NULL;
+    qindex->count--;
+    qindex->bytes -= entry->bytes;
+}
+
+static void
+qindex_entry_free(struct qindex_entry *entry)
+{
+    free(entry->name);
+    free(entry);
+}
+
+static void
+qindex_clear(struct qindex *qindex)
+{
+    struct qindex_entry *entry;
+
+    while ((entry = qindex->head)) {
+	qindex_unlink(qindex, entry);
+	qindex_entry_free(entry);
+    }
+}
+
+/**
+ * @brief Allocates an empty struct qindex
+ *
+ * The caller holds the only reference.
+ *
+ * @return pointer to the struct qindex on success, NULL on error
+ */
+
+struct qindex *
+lmapd_qindex_new(void)
+{
+    struct qindex *qindex;
+
+    qindex = calloc(1, sizeof(struct qindex));
+    if (qindex) {
+	qindex->size = QINDEX_INITIAL_SIZE;
+	qindex->buckets = calloc(qindex->size, sizeof(struct qindex_entry *));
+	if (! qindex->buckets || pthread_mutex_init(&qindex->lock, NULL)) {
+	    free(qindex->buckets);
+	    free(qindex);
+	    qindex = NULL;
+	}
+    }
+    if (! qindex) {
+	lmap_err("failed to allocate memory");
+	return NULL;
+    }
+    qindex->refs = 1;
+    return qindex;
+}
+
+/**
+ * @brief Takes another reference to a struct qindex
+ *
+ * @param qindex pointer to the struct qindex, may be NULL
+ * @return qindex
+ */
+
+struct qindex *
+lmapd_qindex_ref(struct qindex *qindex)
+{
+    if (qindex) {
+	pthread_mutex_lock(&qindex->lock);
+	qindex->refs++;
+	pthread_mutex_unlock(&qindex->lock);
+    }
+    return qindex;
+}
+
+/**
+ * @brief Drops a reference to a struct qindex
+ *
+ * The index and all its entries are freed with the last reference.
+ *
+ * @param qindex pointer to the struct qindex, may be NULL
+ */
+
+void
+lmapd_qindex_unref(struct qindex *qindex)
+{
+    unsigned int refs;
+
+    if (! qindex) {
+	return;
+    }
+    pthread_mutex_lock(&qindex->lock);
+    refs = --qindex->refs;
+    pthread_mutex_unlock(&qindex->lock);
+    if (refs) {
+	return;
+    }
+
+    qindex_clear(qindex);
+    pthread_mutex_destroy(&qindex->lock);
+    free(qindex->buckets);
+    free(qindex);
+}
+
+/**
+ * @brief Adds an entry as the newest one
+ *
+ * An entry with the same name is replaced.
+ *
+ * @param qindex pointer to the struct qindex
+ * @param name name of the .meta file of the entry
+ * @param bytes disk usage of the entry
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_qindex_add(struct qindex *qindex, const char *name, uint64_t bytes)
+{
+    struct qindex_entry *entry, *old;
+
+    entry = calloc(1, sizeof(struct qindex_entry));
+    if (entry) {
+	entry->name = strdup(name);
+    }
+    if (! entry || ! entry->name) {
+	lmap_err("failed to allocate memory");
+	free(entry);
+	return -1;
+    }
+    entry->bytes = bytes;
+
+    pthread_mutex_lock(&qindex->lock);
+    old = qindex_find(qindex, name);
+    if (old) {
+	qindex_unlink(qindex, old);
+	qindex_entry_free(old);
+    }
+    qindex_link(qindex, entry);
+    pthread_mutex_unlock(&qindex->lock);
+    return 0;
+}
+
+/**
+ * @brief Removes an entry, if it is there
+ *
+ * @param qindex pointer to the struct qindex
+ * @param name name of the .meta file of the entry
+ */
+
+void
+lmapd_qindex_remove(struct qindex *qindex, const char *name)
+{
+    struct qindex_entry *entry;
+
+    pthread_mutex_lock(&qindex->lock);
+    entry = qindex_find(qindex, name);
+    if (entry) {
+	qindex_unlink(qindex, entry);
+	qindex_entry_free(entry);
+    }
+    pthread_mutex_unlock(&qindex->lock);
+}
+
+/**
+ * @brief The disk usage and the number of files of all entries
+ */
+
+void
+lmapd_qindex_usage(struct qindex *qindex, uint64_t *bytes, uint64_t *files)
+{
+    pthread_mutex_lock(&qindex->lock);
+    *bytes = qindex->bytes;
+    *files = (uint64_t) qindex->count * QINDEX_ENTRY_FILES;
+    pthread_mutex_unlock(&qindex->lock);
+}
+
+static int
+over_quota(uint64_t bytes, uint64_t files, uint64_t max_bytes, uint64_t max_files)
+{
+    return (max_bytes && bytes > max_bytes) || (max_files && files > max_files);
+}
+
+/**
+ * @brief Makes room for new entries
+ *
+ * Checks whether bytes and files more fit into the quota given by
+ * max_bytes and max_files (zero means no limit). If they do not and
+ * evict is set, the oldest entries are removed until they do, and
+ * returned in evicted, oldest first, for the caller to remove their
+ * files and to free them with lmapd_qindex_entries_free().
+ *
+ * @param qindex pointer to the struct qindex
+ * @param bytes disk usage of the new entries
+ * @param files number of files of the new entries
+ * @param max_bytes limit of the disk usage, or 0
+ * @param max_files limit of the number of files, or 0
+ * @param evict whether entries may be evicted
+ * @param evicted set to the list of evicted entries, or NULL
+ * @return 0 if the new entries fit, -1 if not (nothing is evicted then)
+ */
+
+int
+lmapd_qindex_reserve(struct qindex *qindex,
+		     uint64_t bytes, uint64_t files,
+		     uint64_t max_bytes, uint64_t max_files,
+		     int evict, struct qindex_entry **evicted)
+{
+    struct qindex_entry *entry, **tail = evicted;
+    int ret = 0;
+
+    *evicted = NULL;
+
+    /* does not even fit into an empty queue */
+    if (over_quota(bytes, files, max_bytes, max_files)) {
+	return -1;
+    }
+
+    pthread_mutex_lock(&qindex->lock);
+    if (! evict
+	&& over_quota(qindex->bytes + bytes,
+		      (uint64_t) qindex->count * QINDEX_ENTRY_FILES + files,
+		      max_bytes, max_files)) {
+	ret = -1;
+    }
+    while (ret == 0 && (entry = qindex->head)
+	   && over_quota(qindex->bytes + bytes,
+			 (uint64_t) qindex->count * QINDEX_ENTRY_FILES + files,
+			 max_bytes, max_files)) {
+	qindex_unlink(qindex, entry);
+	*tail = entry;
+	tail = &entry->next;
+    }
+    pthread_mutex_unlock(&qindex->lock);
+
+    return ret;
+}
+
+/**
+ * @brief Moves all entries of another index, as the newest ones
+ *
+ * The other index must not be shared, it is empty afterwards.
+ *
+ * @param qindex pointer to the struct qindex
+ * @param from pointer to the struct qindex to take the entries from
+ */
+
+void
+lmapd_qindex_append(struct qindex *qindex, struct qindex *from)
+{
+    struct qindex_entry *entry, *old;
+
+    pthread_mutex_lock(&qindex->lock);
+    while ((entry = from->head)) {
+	qindex_unlink(from, entry);
+	old = qindex_find(qindex, entry->name);
+	if (old) {
+	    qindex_unlink(qindex, old);
+	    qindex_entry_free(old);
+	}
+	qindex_link(qindex, entry);
+    }
+    pthread_mutex_unlock(&qindex->lock);
+}
+
+/**
+ * @brief Replaces all entries with those of another index
+ *
+ * The other index must not be shared, it is empty afterwards.
+ *
+ * @param qindex pointer to the struct qindex
+ * @param from pointer to the struct qindex to take the entries from
+ */
+
+void
+lmapd_qindex_assign(struct qindex *qindex, struct qindex *from)
+{
+    struct qindex tmp;
+
+    pthread_mutex_lock(&qindex->lock);
+    tmp.head = qindex->head;
+    tmp.tail = qindex->tail;
+    tmp.buckets = qindex->buckets;
+    tmp.size = qindex->size;
+    tmp.count = qindex->count;
+    tmp.bytes = qindex->bytes;
+
+    qindex->head = from->head;
+    qindex->tail = from->tail;
+    qindex->buckets = from->buckets;
+    qindex->size = from->size;
+    qindex->count = from->count;
+    qindex->bytes = from->bytes;
+    pthread_mutex_unlock(&qindex->lock);
+
+    from->head = tmp.head;
+    from->tail = tmp.tail;
+    from->buckets = tmp.buckets;
+    from->size = tmp.size;
+    from->count = tmp.count;
+    from->bytes = tmp.bytes;
+    qindex_clear(from);
+}
+
+/**
+ * @brief Frees a list of entries returned by lmapd_qindex_reserve()
+ */
+
+void
+lmapd_qindex_entries_free(struct qindex_entry *entries)
+{
+    struct qindex_entry *entry;
+
+    while ((entry = entries)) {
+	entries = entry->next;
+	qindex_entry_free(entry);
+    }
+}
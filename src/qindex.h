@@ -0,0 +1,75 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_QINDEX_H
+#define LMAP_QINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * A struct qindex is an in-memory index of the complete entries (the
+ * .meta and .data file pairs) in the incoming queue of a schedule with
+ * a quota, oldest first. Each entry is known by the name of its .meta
+ * file and accounts for the disk usage of both files.
+ *
+ * The index is shared by the schedule and the workspace jobs running
+ * on worker threads, so it is reference counted and all functions
+ * lock it. It is hashed by name, so that the entries moved out of
+ * the queue are removed without a scan.
+ */
+
+struct qindex_entry {
+    char *name;
+    uint64_t bytes;
+    struct qindex_entry *prev;		/* older */
+    struct qindex_entry *next;		/* newer */
+    struct qindex_entry *hnext;		/* hash chain */
+};
+
+struct qindex {
+    pthread_mutex_t lock;
+    unsigned int refs;
+    struct qindex_entry *head;		/* oldest */
+    struct qindex_entry *tail;		/* newest */
+    struct qindex_entry **buckets;
+    size_t size;			/* power of two */
+    size_t count;
+    uint64_t bytes;
+};
+
+/* every entry has a .meta and a .data file */
+#define QINDEX_ENTRY_FILES	2
+
+extern struct qindex * lmapd_qindex_new(void);
+extern struct qindex * lmapd_qindex_ref(struct qindex *qindex);
+extern void lmapd_qindex_unref(struct qindex *qindex);
+extern int lmapd_qindex_add(struct qindex *qindex, const char *name,
+			    uint64_t bytes);
+extern void lmapd_qindex_remove(struct qindex *qindex, const char *name);
+extern void lmapd_qindex_usage(struct qindex *qindex,
+			       uint64_t *bytes, uint64_t *files);
+extern int lmapd_qindex_reserve(struct qindex *qindex,
+				uint64_t bytes, uint64_t files,
+				uint64_t max_bytes, uint64_t max_files,
+				int evict, struct qindex_entry **evicted);
+extern void lmapd_qindex_append(struct qindex *qindex, struct qindex *from);
+extern void lmapd_qindex_assign(struct qindex *qindex, struct qindex *from);
+extern void lmapd_qindex_entries_free(struct qindex_entry *entries);
+
+#endif
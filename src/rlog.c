@@ -0,0 +1,541 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "rlog.h"
+
+/*
+ * A segment is a sequence of records:
+ *
+ *   struct rlog_header, name, meta, data, struct rlog_trailer
+ *
+ * followed by the index once it is sealed:
+ *
+ *   uint64_t offsets[count], struct rlog_footer
+ *
+ * Segments never leave the host, so everything is in host byte order.
+ */
+
+#define RLOG_RECORD_MAGIC	0x4c4d5231U	/* "LMR1" */
+#define RLOG_TRAILER_MAGIC	0x4c4d5245U	/* "LMRE" */
+#define RLOG_INDEX_MAGIC	0x4c4d5249U	/* "LMRI" */
+
+#define RLOG_BUFSIZE		65536
+
+struct rlog_header {
+    uint32_t magic;
+    uint32_t name_len;
+    uint32_t meta_len;
+    uint32_t reserved;
+    uint64_t data_len;
+};
+
+struct rlog_trailer {
+    uint32_t sum;		/* FNV-1a of name, meta and data */
+    uint32_t magic;
+};
+
+struct rlog_footer {
+    uint64_t count;
+    uint64_t offset;		/* of the offsets */
+    uint32_t magic;
+    uint32_t reserved;
+};
+
+#define FNV_INIT	2166136261u
+
+static uint32_t
+fnv1a(uint32_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len--) {
+	h = (h ^ *p++) * 16777619u;
+    }
+    return h;
+}
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len) {
+	n = write(fd, p, len);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    return -1;
+	}
+	p += n;
+	len -= (size_t) n;
+    }
+    return 0;
+}
+
+/*
+ * Appends the first len bytes of a file, adding them to the checksum.
+ */
+
+static int
+copy_all(int in, int out, uint64_t len, uint32_t *sum, char *buf)
+{
+    off_t off = 0;
+    ssize_t n;
+
+    while (len) {
+	n = pread(in, buf, len < RLOG_BUFSIZE ? (size_t) len : RLOG_BUFSIZE, off);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    if (n == 0) {
+		errno = EIO;	/* the file was truncated */
+	    }
+	    return -1;
+	}
+	*sum = fnv1a(*sum, buf, (size_t) n);
+	if (write_all(out, buf, (size_t) n)) {
+	    return -1;
+	}
+	off += n;
+	len -= (uint64_t) n;
+    }
+    return 0;
+}
+
+/*
+ * Opens and locks the active segment. The segment might have been
+ * sealed while waiting for the lock, then the new one is opened.
+ */
+
+static int
+active_open(int dirfd)
+{
+    int fd;
+    struct stat st, cur;
+
+    for (;;) {
+	fd = openat(dirfd, LMAPD_RLOG_ACTIVE_NAME,
+		    O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd == -1) {
+	    return -1;
+	}
+	if (flock(fd, LOCK_EX) || fstat(fd, &st)) {
+	    break;
+	}
+	if (fstatat(dirfd, LMAPD_RLOG_ACTIVE_NAME, &cur, AT_SYMLINK_NOFOLLOW) == 0) {
+	    if (cur.st_dev == st.st_dev && cur.st_ino == st.st_ino) {
+		return fd;
+	    }
+	} else if (errno != ENOENT) {
+	    break;
+	}
+	(void) close(fd);
+    }
+    (void) close(fd);
+    return -1;
+}
+
+/**
+ * @brief Appends a result to the active segment of an incoming queue
+ *
+ * The record is written while holding a lock on the segment, which is
+ * truncated to its previous size if the record could not be written
+ * completely.
+ *
+ * @param dirfd descriptor of the incoming directory
+ * @param dir path of the incoming directory, for messages
+ * @param name name of the result (the .meta file without its suffix)
+ * @param metafd descriptor of the .meta file
+ * @param datafd descriptor of the .data file
+ * @param bytes incremented by the size of the record
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_rlog_append(int dirfd, const char *dir, const char *name,
+		  int metafd, int datafd, uint64_t *bytes)
+{
+    int fd, ret = -1;
+    char *buf;
+    size_t name_len = strlen(name);
+    struct stat mst, dst, st;
+    struct rlog_header h;
+    struct rlog_trailer t;
+
+    if (fstat(metafd, &mst) || fstat(datafd, &dst)) {
+	lmap_err("failed to append '%s' to '%s': %s", name, dir, strerror(errno));
+	return -1;
+    }
+    if (name_len > UINT32_MAX || (uint64_t) mst.st_size > UINT32_MAX) {
+	lmap_err("failed to append '%s' to '%s': %s", name, dir, strerror(EFBIG));
+	return -1;
+    }
+
+    buf = malloc(RLOG_BUFSIZE);
+    if (! buf) {
+	lmap_err("failed to allocate memory");
+	return -1;
+    }
+    fd = active_open(dirfd);
+    if (fd == -1 || fstat(fd, &st)) {
+	lmap_err("failed to open '%s/%s': %s",
+		 dir, LMAPD_RLOG_ACTIVE_NAME, strerror(errno));
+	if (fd != -1) {
+	    (void) close(fd);
+	}
+	free(buf);
+	return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.magic = RLOG_RECORD_MAGIC;
+    h.name_len = (uint32_t) name_len;
+    h.meta_len = (uint32_t) mst.st_size;
+    h.data_len = (uint64_t) dst.st_size;
+    t.sum = fnv1a(FNV_INIT, name, name_len);
+    t.magic = RLOG_TRAILER_MAGIC;
+
+    if (write_all(fd, &h, sizeof(h)) == 0
+	&& write_all(fd, name, name_len) == 0
+	&& copy_all(metafd, fd, h.meta_len, &t.sum, buf) == 0
+	&& copy_all(datafd, fd, h.data_len, &t.sum, buf) == 0
+	&& write_all(fd, &t, sizeof(t)) == 0) {
+	ret = 0;
+	*bytes += sizeof(h) + name_len + h.meta_len + h.data_len + sizeof(t);
+    } else {
+	lmap_err("failed to append '%s' to '%s/%s': %s",
+		 name, dir, LMAPD_RLOG_ACTIVE_NAME, strerror(errno));
+	/* do not leave a partial record behind */
+	if (ftruncate(fd, st.st_size)) {
+	    lmap_wrn("failed to truncate '%s/%s': %s",
+		     dir, LMAPD_RLOG_ACTIVE_NAME, strerror(errno));
+	}
+    }
+
+    (void) close(fd);
+    free(buf);
+    return ret;
+}
+
+/*
+ * The length of the complete record at off, 0 if there is none. The
+ * checksum is left to the readers.
+ */
+
+static uint64_t
+record_len(int fd, uint64_t off, uint64_t size)
+{
+    struct rlog_header h;
+    struct rlog_trailer t;
+    uint64_t len;
+
+    if (size - off < sizeof(h) + sizeof(t)
+	|| pread(fd, &h, sizeof(h), (off_t) off) != sizeof(h)
+	|| h.magic != RLOG_RECORD_MAGIC) {
+	return 0;
+    }
+    len = sizeof(h) + (uint64_t) h.name_len + h.meta_len + sizeof(t);
+    if (h.data_len > size - off || len > size - off - h.data_len) {
+	return 0;
+    }
+    len += h.data_len;
+    if (pread(fd, &t, sizeof(t), (off_t) (off + len - sizeof(t))) != sizeof(t)
+	|| t.magic != RLOG_TRAILER_MAGIC) {
+	return 0;
+    }
+    return len;
+}
+
+/*
+ * Appends the index of the records of a sealed segment, dropping a
+ * partial record at its end.
+ */
+
+static void
+seal_index(int fd, const char *path, uint64_t size)
+{
+    uint64_t off = 0, len, *offsets = NULL, *p;
+    size_t count = 0, alloc = 0;
+    struct rlog_footer f;
+
+    while (off < size && (len = record_len(fd, off, size)) > 0) {
+	if (count == alloc) {
+	    alloc = alloc ? 2 * alloc : 64;
+	    p = realloc(offsets, alloc * sizeof(*offsets));
+	    if (! p) {
+		/* readers walk the records instead */
+		lmap_wrn("failed to index '%s'", path);
+		free(offsets);
+		return;
+	    }
+	    offsets = p;
+	}
+	offsets[count++] = off;
+	off += len;
+    }
+    if (off < size) {
+	lmap_wrn("dropping %llu bytes of a partial record in '%s'",
+		 (unsigned long long) (size - off), path);
+	if (ftruncate(fd, (off_t) off)) {
+	    lmap_wrn("failed to truncate '%s': %s", path, strerror(errno));
+	    free(offsets);
+	    return;
+	}
+    }
+
+    memset(&f, 0, sizeof(f));
+    f.count = count;
+    f.offset = off;
+    f.magic = RLOG_INDEX_MAGIC;
+    if (pwrite(fd, offsets, count * sizeof(*offsets), (off_t) off)
+	    != (ssize_t) (count * sizeof(*offsets))
+	|| pwrite(fd, &f, sizeof(f), (off_t) (off + count * sizeof(*offsets)))
+	    != sizeof(f)) {
+	lmap_wrn("failed to index '%s': %s", path, strerror(errno));
+	if (ftruncate(fd, (off_t) off)) {
+	    lmap_wrn("failed to truncate '%s': %s", path, strerror(errno));
+	}
+    }
+    free(offsets);
+}
+
+/**
+ * @brief Seals the active segment of an incoming queue
+ *
+ * Moves the active segment of an incoming queue, if there is one, to
+ * the workspace of the schedule and appends the index of its records.
+ * Results appended later go to a new segment.
+ *
+ * @param incfd descriptor of the incoming directory
+ * @param wsfd descriptor of the workspace directory
+ * @param incoming path of the incoming directory, for messages
+ * @param workspace path of the workspace directory, for messages
+ * @return 0 on success or if there is no active segment, -1 on error
+ */
+
+int
+lmapd_rlog_seal(int incfd, int wsfd, const char *incoming, const char *workspace)
+{
+    int fd;
+    struct stat st;
+    char name[NAME_MAX + 1];
+    char path[PATH_MAX];
+
+    fd = openat(incfd, LMAPD_RLOG_ACTIVE_NAME, O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+	if (errno == ENOENT) {
+	    return 0;
+	}
+	lmap_err("failed to open '%s/%s': %s",
+		 incoming, LMAPD_RLOG_ACTIVE_NAME, strerror(errno));
+	return -1;
+    }
+    if (flock(fd, LOCK_EX) || fstat(fd, &st)) {
+	lmap_err("failed to lock '%s/%s': %s",
+		 incoming, LMAPD_RLOG_ACTIVE_NAME, strerror(errno));
+	(void) close(fd);
+	return -1;
+    }
+    if (st.st_size == 0) {
+	/* writers waiting for the lock create a new one */
+	(void) unlinkat(incfd, LMAPD_RLOG_ACTIVE_NAME, 0);
+	(void) close(fd);
+	return 0;
+    }
+
+    snprintf(name, sizeof(name), "%llu-%llu" LMAPD_RLOG_SUFFIX,
+	     (unsigned long long) time(NULL), (unsigned long long) st.st_ino);
+    if (renameat(incfd, LMAPD_RLOG_ACTIVE_NAME, wsfd, name)) {
+	lmap_err("failed to move '%s/%s' to '%s/%s': %s",
+		 incoming, LMAPD_RLOG_ACTIVE_NAME, workspace, name,
+		 strerror(errno));
+	(void) close(fd);
+	return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", workspace, name);
+    seal_index(fd, path, (uint64_t) st.st_size);
+    (void) close(fd);
+    return 0;
+}
+
+/**
+ * @brief Opens a sealed segment for reading
+ *
+ * The segment is mapped into memory. Segments without an index (e.g.,
+ * lmapd stopped while sealing it) are read as well.
+ *
+ * @param log pointer to the struct rlog to initialize
+ * @param dirfd directory of the segment, or AT_FDCWD
+ * @param name name of the segment
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_rlog_open(struct rlog *log, int dirfd, const char *name)
+{
+    int fd;
+    void *map;
+    struct stat st;
+    struct rlog_footer f;
+    uint64_t len;
+
+    memset(log, 0, sizeof(*log));
+    fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+	return -1;
+    }
+    if (fstat(fd, &st) || (uint64_t) st.st_size > SIZE_MAX) {
+	(void) close(fd);
+	return -1;
+    }
+    if (st.st_size == 0) {
+	(void) close(fd);
+	return 0;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (map == MAP_FAILED) {
+	return -1;
+    }
+    (void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+    log->map = map;
+    log->size = log->end = (size_t) st.st_size;
+
+    if (log->size >= sizeof(f)) {
+	memcpy(&f, log->map + log->size - sizeof(f), sizeof(f));
+	len = log->size - sizeof(f);
+	if (f.magic == RLOG_INDEX_MAGIC && f.offset <= len
+	    && f.count == (len - f.offset) / sizeof(uint64_t)
+	    && (len - f.offset) % sizeof(uint64_t) == 0) {
+	    log->index = log->map + f.offset;
+	    log->count = f.count;
+	    log->end = (size_t) f.offset;
+	}
+    }
+    return 0;
+}
+
+/*
+ * Checks the record at off, returns its length or 0 if it is damaged.
+ */
+
+static size_t
+record_at(struct rlog *log, size_t off, struct rlog_record *rec)
+{
+    struct rlog_header h;
+    struct rlog_trailer t;
+    size_t avail, len;
+    uint32_t sum;
+    const char *p;
+
+    if (off > log->end || log->end - off < sizeof(h) + sizeof(t)) {
+	return 0;
+    }
+    avail = log->end - off - sizeof(h) - sizeof(t);
+    memcpy(&h, log->map + off, sizeof(h));
+    if (h.magic != RLOG_RECORD_MAGIC
+	|| h.data_len > avail
+	|| (uint64_t) h.name_len + h.meta_len > avail - h.data_len) {
+	return 0;
+    }
+    len = h.name_len + h.meta_len + (size_t) h.data_len;
+    p = (const char *) log->map + off + sizeof(h);
+    memcpy(&t, p + len, sizeof(t));
+    sum = fnv1a(FNV_INIT, p, len);
+    if (t.magic != RLOG_TRAILER_MAGIC || t.sum != sum) {
+	return 0;
+    }
+
+    rec->name = p;
+    rec->name_len = h.name_len;
+    rec->meta = p + h.name_len;
+    rec->meta_len = h.meta_len;
+    rec->data = p + h.name_len + h.meta_len;
+    rec->data_len = (size_t) h.data_len;
+    return sizeof(h) + len + sizeof(t);
+}
+
+/**
+ * @brief Reads the next record of a segment
+ *
+ * The record points into the mapping of the segment, it is valid
+ * until the segment is closed.
+ *
+ * @param log pointer to the struct rlog
+ * @param rec pointer to the struct rlog_record to fill in
+ * @return 1 if there was a record, 0 at the end, -1 if the record is
+ * damaged (the records after it can still be read if the segment
+ * has an index)
+ */
+
+int
+lmapd_rlog_next(struct rlog *log, struct rlog_record *rec)
+{
+    uint64_t off;
+    size_t len;
+
+    if (log->index) {
+	if (log->next >= log->count) {
+	    return 0;
+	}
+	memcpy(&off, log->index + log->next * sizeof(off), sizeof(off));
+	log->next++;
+	return (off < log->end && record_at(log, (size_t) off, rec)) ? 1 : -1;
+    }
+
+    if (log->off >= log->end) {
+	return 0;
+    }
+    len = record_at(log, log->off, rec);
+    if (! len) {
+	/* nothing after it can be found */
+	log->off = log->end;
+	return -1;
+    }
+    log->off += len;
+    return 1;
+}
+
+/**
+ * @brief Closes a segment opened with lmapd_rlog_open()
+ */
+
+void
+lmapd_rlog_close(struct rlog *log)
+{
+    if (log->map) {
+	(void) munmap((void *) log->map, log->size);
+    }
+    memset(log, 0, sizeof(*log));
+}
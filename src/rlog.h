@@ -0,0 +1,71 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_RLOG_H
+#define LMAP_RLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The incoming queue of a schedule with the "log" incoming format,
+ * see lmap_schedule_set_incoming_format(), is an append-only result
+ * log instead of a pair of .meta and .data files per result.
+ *
+ * Results are appended as records to the active segment of the queue,
+ * a hidden file in the incoming directory. Moving the incoming queue to
+ * the active queue seals the segment: it is renamed into the workspace
+ * of the schedule as a .seg file, and an index of the offsets of its
+ * records is appended to it. The next result starts a new segment.
+ *
+ * Every record holds the name of the result, the contents of its .meta
+ * and .data files and a checksum, so that a partially written record
+ * (e.g., after a crash) is detected. Sealed segments are read through
+ * a read-only mapping.
+ */
+
+#define LMAPD_RLOG_ACTIVE_NAME	".segment"
+#define LMAPD_RLOG_SUFFIX	".seg"
+
+struct rlog_record {
+    const char *name;		/* not NUL terminated */
+    size_t name_len;
+    const char *meta;
+    size_t meta_len;
+    const char *data;
+    size_t data_len;
+};
+
+struct rlog {
+    const unsigned char *map;
+    size_t size;
+    size_t end;			/* end of the records */
+    const unsigned char *index;	/* offsets of the records, or NULL */
+    uint64_t count;
+    uint64_t next;		/* next record in the index */
+    size_t off;			/* next record without an index */
+};
+
+extern int lmapd_rlog_append(int dirfd, const char *dir, const char *name,
+			     int metafd, int datafd, uint64_t *bytes);
+extern int lmapd_rlog_seal(int incfd, int wsfd,
+			   const char *incoming, const char *workspace);
+extern int lmapd_rlog_open(struct rlog *log, int dirfd, const char *name);
+extern int lmapd_rlog_next(struct rlog *log, struct rlog_record *rec);
+extern void lmapd_rlog_close(struct rlog *log);
+
+#endif
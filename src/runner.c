@@ -23,24 +23,162 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdio.h>
+#include <time.h>
 #include <inttypes.h>
 #include <fnmatch.h>
 #include <errno.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <sys/syscall.h>
 
 #include "lmap.h"
 #include "lmapd.h"
+#include "lmap-io.h"
 #include "utils.h"
 #include "workspace.h"
 #include "runner.h"
 #include "signals.h"
+#include "pidtab.h"
+#include "snapshot.h"
+#include "workers.h"
+#include "qindex.h"
 
 #define UNUSED(x) (void)(x)
 
+extern char **environ;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+#define HAVE_PIDFD
+#define LMAPD_P_PIDFD	((idtype_t) 3)	/* P_PIDFD, unknown to older libcs */
+#endif
+
+static void action_done(struct lmapd *lmapd, struct schedule *schedule,
+			struct action *action, int status,
+			const struct rusage *ru);
+static void schedule_finish(struct lmapd *lmapd, struct schedule *schedule);
+static void schedule_start(struct lmapd *lmapd, struct schedule *schedule);
+static void action_next(struct lmapd *lmapd, struct schedule *schedule,
+			struct action *action);
+static void admission_run(struct lmapd *lmapd);
+static uint64_t monotonic_usec(void);
+
+/*
+ * An admission is an action (or a whole pipelined schedule if action
+ * is NULL) waiting for a free slot. The queue is ordered by schedule
+ * priority and in arrival order within the same priority.
+ */
+
+struct admission {
+    struct schedule *schedule;
+    struct action *action;
+    struct timeval queued;
+    struct timeval not_before;
+    struct admission *next;
+};
+
+/*
+ * A deadline limits the wall-clock time of a running schedule (its
+ * duration) or of a running action (its timeout). When it expires, the
+ * processes are sent SIGTERM, and SIGKILL if they are still around
+ * LMAPD_KILL_GRACE seconds later.
+ */
+
+#define LMAPD_KILL_GRACE	5	/* seconds */
+
+struct deadline {
+    struct lmapd *lmapd;
+    struct schedule *schedule;
+    struct action *action;	/* NULL for the schedule deadline */
+    struct event *timer;
+    int killed;			/* SIGTERM was sent */
+};
+
+/*
+ * An output watch keeps the output of a running action that is held
+ * in memory, see lmapd_workspace_action_open_output(), within the
+ * output memory limit of the action. Every LMAPD_OUTPUT_WATCH
+ * microseconds, the output beyond the limit is written to the .data
+ * file in the workspace by a worker, which releases its memory.
+ */
+
+#define LMAPD_OUTPUT_WATCH	100000	/* microseconds */
+
+struct output_watch {
+    struct lmapd *lmapd;
+    struct schedule *schedule;
+    struct action *action;
+    struct event *timer;
+};
+
+/*
+ * A schedule that was changed or removed by a configuration reload
+ * while it was running keeps its old definition until it finishes.
+ * It is then replaced by its new definition, or removed if that is
+ * NULL.
+ */
+
+struct pending {
+    struct schedule *schedule;
+    struct schedule *replacement;
+    struct pending *next;
+};
+
+/*
+ * A wsjob runs the workspace operations of a schedule on a worker
+ * thread, and continues with the next step once they are done. The
+ * jobs of a schedule run in the order they were submitted, and the
+ * schedule counts as busy until they completed. WSJOB_STORAGE jobs
+ * measure the storage of all schedules and belong to none. WSJOB_SPILL
+ * jobs write the output of an action that is held in memory to its
+ * workspace, see output_watch_cb(), and are always followed by the
+ * WSJOB_OUTPUT job of the action.
+ */
+
+enum wsjob_type {
+    WSJOB_START,		/* move incoming, clean, then start actions */
+    WSJOB_OUTPUT,		/* move action output, then the next action */
+    WSJOB_FINISH,		/* move deferred output, clean */
+    WSJOB_STORAGE,		/* measure the storage */
+    WSJOB_SPILL,		/* write action output to the workspace */
+};
+
+struct wsjob {
+    enum wsjob_type type;
+    struct lmapd *lmapd;
+    struct schedule *schedule;	/* NULL for WSJOB_STORAGE */
+    struct action *action;	/* WSJOB_OUTPUT and WSJOB_SPILL only */
+    struct workspace_job *job;
+    struct workspace_job *after; /* runs once the job is durable */
+    struct wsjob *next;		/* in a struct commit */
+};
+
+static void wsjob_submit(struct lmapd *lmapd, enum wsjob_type type,
+			 struct schedule *schedule, struct action *action,
+			 struct workspace_job *job, struct workspace_job *after);
+
+/*
+ * With group-commit durability, a wsjob stages the results it
+ * delivers, see lmapd_workspace_job_action_stage(), and then waits
+ * in the open commit for the commit window to close, its schedule
+ * counting as busy. A worker then syncs the queue once for all the
+ * wsjobs of the commit, and runs their after jobs, which publish the
+ * results and clean the action workspaces. The wsjobs go on with
+ * their next step once the commit is done.
+ */
+
+struct commit {
+    struct lmapd *lmapd;
+    struct wsjob *wsjobs;	/* oldest first */
+    struct wsjob **tail;
+    uint32_t count;
+    uint64_t latency;		/* microseconds, set by the worker */
+};
+
 #if 1
 static void
 event_gaga(struct event *event, struct event **ev,
@@ -109,8 +247,13 @@ add_random_spread(struct event *event, struct timeval *tv)
     }
 }
 
+/*
+ * Slow path for pids that are not in the pid table, e.g. because
+ * the table could not be updated due to a memory shortage.
+ */
+
 static struct action *
-find_action_by_pid(struct lmap *lmap, pid_t pid)
+find_action_by_pid(struct lmap *lmap, pid_t pid, struct schedule **schedule)
 {
     struct schedule *sched;
     struct action *act;
@@ -120,6 +263,7 @@ find_action_by_pid(struct lmap *lmap, pid_t pid)
     for (sched = lmap->schedules; sched; sched = sched->next) {
 	for (act = sched->actions; act; act = act->next) {
 	    if (act->pid == pid) {
+		*schedule = sched;
 		return act;
 	    }
 	}
@@ -128,25 +272,6 @@ find_action_by_pid(struct lmap *lmap, pid_t pid)
     return NULL;
 }
 
-static struct schedule *
-find_schedule_by_pid(struct lmap *lmap, pid_t pid)
-{
-    struct schedule *sched;
-    struct action *act;
-
-    assert(lmap);
-
-    for (sched = lmap->schedules; sched; sched = sched->next) {
-	for (act = sched->actions; act; act = act->next) {
-	    if (act->pid == pid) {
-		return sched;
-	    }
-	}
-    }
-
-    return NULL;
-}
-
 static int
 big_tag_match(struct tag *match, struct tag *tags)
 {
@@ -163,112 +288,118 @@ big_tag_match(struct tag *match, struct tag *tags)
     return 0;
 }
 
+/*
+ * Check whether a schedule has running or queued actions, or
+ * workspace jobs that did not complete yet.
+ */
+
 static int
-action_exec(struct lmapd *lmapd, struct schedule *schedule, struct action *action)
+schedule_busy(struct schedule *schedule)
 {
-    pid_t pid;
-    char *argv[256];
-    struct timeval t;
-    struct task *task;
-    struct option *option;
-    int i, fd;
-    const int argv_limit = sizeof(argv)/sizeof(argv[0]) - 4;
-
-    assert(lmapd);
+    struct action *action;
 
-    if (!action || !action->name || !action->task || !action->workspace) {
-	return 0;
+    if (schedule->jobs) {
+	return 1;
     }
-
-    if (action->state == LMAP_ACTION_STATE_SUPPRESSED) {
-	action->cnt_suppressions++;
+    for (action = schedule->actions; action; action = action->next) {
+	if (action->state == LMAP_ACTION_STATE_RUNNING
+	    || (action->flags & LMAP_ACTION_FLAG_QUEUED)) {
+	    return 1;
+	}
     }
+    return 0;
+}
 
-    if (action->state == LMAP_ACTION_STATE_DISABLED
-	|| action->state == LMAP_ACTION_STATE_SUPPRESSED) {
-	return 0;
-    }
+/*
+ * Check whether action_exec() would start the action. This is used
+ * to find the neighbours of a stage in a pipelined schedule and must
+ * not have any side effects.
+ */
 
-    task = lmap_find_task(lmapd->lmap, action->task);
-    if (! task) {
-	lmap_err("task '%s' for action '%s' does not exist",
-		 action->task, action->name);
-	return -1;
-    }
+static int
+action_runnable(struct action *action)
+{
+    return action && action->name && action->task && action->workspace
+	&& action->linked_task && action->argv && ! action->pid
+	&& action->state != LMAP_ACTION_STATE_DISABLED
+	&& action->state != LMAP_ACTION_STATE_SUPPRESSED;
+}
 
-    if (!task->program) {
-	lmap_err("task '%s' has no program", task->name);
-	return -1;
-    }
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR)
+#define HAVE_ACTION_SPAWN
+#define spawn_file_actions_addchdir posix_spawn_file_actions_addchdir
+#elif defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+#define HAVE_ACTION_SPAWN
+#define spawn_file_actions_addchdir posix_spawn_file_actions_addchdir_np
+#endif
 
-    /*
-     * Check that the program of the task is listed as a valid
-     * capability; we do not want to run arbitrary commands.
-     */
+#ifdef HAVE_ACTION_SPAWN
+/*
+ * Start the program of an action with posix_spawn(), which does not
+ * need to copy the page tables of the daemon. The file actions
+ * replicate what action_fork() does in the child. A program that
+ * cannot be executed is reported right away (by glibc at least), the
+ * error is returned in exec_err.
+ */
 
-    {
-	struct task *tp = NULL;
+static pid_t
+action_spawn(struct action *action, int in_fd, int out_fd, int *exec_err)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    pid_t pid = -1;
+    int err;
 
-	if (lmapd->lmap->capabilities) {
-	    for (tp = lmapd->lmap->capabilities->tasks; tp; tp = tp->next) {
-		if (tp->program && strcmp(task->program, tp->program) == 0) {
-		    break;
-		}
-	    }
-	}
-	if (! tp) {
-	    lmap_err("task '%s' does not match capabilities", task->name);
-	    return -1;
-	}
+    if ((err = posix_spawn_file_actions_init(&fa)) != 0) {
+	lmap_err("action '%s': spawn init failed: %s", action->name, strerror(err));
+	return -1;
     }
-
-    if (action->pid) {
-	lmap_wrn("action '%s' still running (pid %d) - skipping",
-		 action->name, action->pid);
-	action->cnt_overlaps++;
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+	lmap_err("action '%s': spawn init failed: %s", action->name, strerror(err));
+	(void) posix_spawn_file_actions_destroy(&fa);
 	return -1;
     }
 
-    if (action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED) {
-	lmap_wrn("action '%s' has previous results, coping with it",
-		action->name);
+    if (in_fd != -1) {
+	err = posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    }
+    if (! err) {
+	err = posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+    }
+    if (! err) {
+	err = spawn_file_actions_addchdir(&fa, action->workspace);
+    }
+    if (! err) {
+	err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+    if (! err) {
+	err = posix_spawnattr_setpgroup(&attr, 0);
+    }
+    if (! err) {
+	err = posix_spawnp(&pid, action->linked_task->program, &fa, &attr,
+			   action->argv, environ);
+	*exec_err = err;
+    }
+    if (err) {
+	lmap_err("failed to execute action '%s': %s", action->name, strerror(err));
+	pid = -1;
     }
 
-    event_base_gettimeofday_cached(lmapd->base, &t);
+    (void) posix_spawnattr_destroy(&attr);
+    (void) posix_spawn_file_actions_destroy(&fa);
+    return pid;
+}
+#endif
 
-    /*
-     * Create the argument vector. Note that the max. number of
-     * elements in argv is on some systems a runtime parameter.
-     * Perhaps we should dynamically allocate an argv?
-     */
+/*
+ * Start the program of an action with fork() and execvp(). This is
+ * the fallback if posix_spawn() lacks the chdir file action.
+ */
 
-    i = 0;
-    argv[i] = task->program;
-    for (option = task->options; option; option = option->next) {
-	if (i >= argv_limit) {
-	    lmap_err("action '%s' has too many arguments", action->name);
-	    return -1;
-	}
-	if (option->name) {
-	    argv[++i] = option->name;
-	}
-	if (option->value) {
-	    argv[++i] = option->value;
-	}
-    }
-    for (option = action->options; option; option = option->next) {
-	if (i >= argv_limit) {
-	    lmap_err("action '%s' has too many arguments", action->name);
-	    return -1;
-	}
-	if (option->name) {
-	    argv[++i] = option->name;
-	}
-	if (option->value) {
-	    argv[++i] = option->value;
-	}
-    }
-    argv[++i] = NULL;
+static pid_t
+action_fork(struct action *action, int in_fd, int out_fd)
+{
+    pid_t pid;
 
     pid = fork();
     if (pid < 0) {
@@ -277,705 +408,2763 @@ action_exec(struct lmapd *lmapd, struct schedule *schedule, struct action *actio
     }
 
     if (pid) {
-	action->pid = pid;
-	action->last_invocation = t.tv_sec;
-	action->state = LMAP_ACTION_STATE_RUNNING;
-	action->cnt_invocations++;
-
-	/* In case we run for too long before the child can setpgid() */
-	(void) setpgid(pid, pid);
-
-	return 1;
-    }
-
-    /*
-     * Pass some information to the task via the environment; this is
-     * necessary so that a reporter can create a proper report.
-     */
-#if 0
-    if (lmapd->lmap && lmapd->lmap->agent) {
-	struct agent *agent = lmapd->lmap->agent;
-	if (agent->agent_id && agent->report_agent_id) {
-	    setenv("LMAP_AGENT_ID", lmapd->lmap->agent->agent_id, 1);
-	}
-	if (agent->measurement_point && agent->report_measurement_point) {
-	    setenv("LMAP_MEASUREMENT_POINT", agent->measurement_point, 1);
-	}
-	if (agent->group_id) {
-	    setenv("LMAP_GROUP_ID", agent->group_id, 1);
-	}
-    }
-#endif
-    /*
-     * Save some meta information about the invocation of this action
-     * in the action workspace.
-     */
-
-    action->last_invocation = t.tv_sec;
-    if (lmapd_workspace_action_meta_add_start(schedule, action, task)) {
-	exit(EXIT_FAILURE);
+	return pid;
     }
 
-    /*
-     * Setup redirection. Data goes into .data files.
-     */
-
-    fd = lmapd_workspace_action_open_data(schedule, action,
-					  O_WRONLY | O_CREAT | O_TRUNC);
-    if (fd == -1) {
-	exit(EXIT_FAILURE);
+    if (in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) {
+	lmap_err("failed to redirect stdin");
+	_exit(EXIT_FAILURE);
     }
-    if (dup2(fd, STDOUT_FILENO) == -1) {
+    if (dup2(out_fd, STDOUT_FILENO) == -1) {
 	lmap_err("failed to redirect stdout");
-	exit(EXIT_FAILURE);
+	_exit(EXIT_FAILURE);
     }
-    (void) close(fd);
     if (chdir(action->workspace) == -1) {
 	lmap_err("failed to change directory");
-	exit(EXIT_FAILURE);
+	_exit(EXIT_FAILURE);
     }
     if (setpgid(0, 0) == -1) {
 	lmap_err("action '%s': setpgid failed: %s", action->name, strerror(errno));
-	exit(EXIT_FAILURE);
+	_exit(EXIT_FAILURE);
     }
-    execvp(task->program, argv);
+    execvp(action->linked_task->program, action->argv);
     lmap_err("failed to execute action '%s'", action->name);
-    exit(EXIT_FAILURE);
+    _exit(EXIT_FAILURE);
 }
 
+#ifdef HAVE_PIDFD
+/*
+ * Callback called from the event loop when the pidfd of an action
+ * becomes readable, i.e., the action has terminated.
+ */
+
 static void
-schedule_exec(struct lmapd *lmapd, struct schedule *schedule)
+pidfd_cb(evutil_socket_t fd, short events, void *context)
 {
-    struct timeval t;
-    struct action *act;
-    int rc;
+    struct lmapd *lmapd = (struct lmapd *) context;
+    struct schedule *schedule = NULL;
+    struct action *action;
+    struct rusage ru;
+    siginfo_t info;
+    int status;
+
+    (void) events;
 
     assert(lmapd);
 
-    if (!schedule || !schedule->name) {
+    /*
+     * waitid() cannot return the resource usage, so it only finds
+     * out which child it is and the child is reaped with wait4().
+     */
+
+    memset(&info, 0, sizeof(info));
+    if (waitid(LMAPD_P_PIDFD, (id_t) fd, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+	lmap_err("waitid on pidfd %d failed: %s", (int) fd, strerror(errno));
+	return;
+    }
+    if (! info.si_pid) {
 	return;
     }
 
-    // lmap_dbg("executing schedule '%s'", schedule->name);
+    action = lmapd_pidtab_find(lmapd->pidtab, info.si_pid, &schedule);
+    if (! action || ! schedule) {
+	lmap_dbg("ignoring pid '%d'", info.si_pid);
+	return;
+    }
 
-    /* avoid leftover data (possibly due to a crash) from
-     * previous runs of an action. */
-    for (act = schedule->actions; act; act = act->next) {
-	(void) lmapd_workspace_action_clean(lmapd, act);
+    memset(&ru, 0, sizeof(ru));
+    if (wait4(info.si_pid, &status, WNOHANG, &ru) != info.si_pid) {
+	lmap_err("wait4 on pid %d failed: %s", info.si_pid, strerror(errno));
+	return;
     }
 
-    event_base_gettimeofday_cached(lmapd->base, &t);
+    /* this closes the pidfd and frees the event we are called from */
+    (void) lmapd_pidtab_remove(lmapd->pidtab, info.si_pid);
 
-    switch (schedule->mode) {
-    case LMAP_SCHEDULE_EXEC_MODE_SEQUENTIAL:
-	schedule->last_invocation = t.tv_sec;
-	schedule->cnt_invocations++;
-	if (schedule->actions) {
-	    act = schedule->actions;
-	    rc = action_exec(lmapd, schedule, act);
-	    if (rc == 1) {
-		schedule->state = LMAP_SCHEDULE_STATE_RUNNING;
-	    }
-	}
-	break;
-    case LMAP_SCHEDULE_EXEC_MODE_PARALLEL:
-	schedule->last_invocation = t.tv_sec;
-	schedule->cnt_invocations++;
-	if (schedule->actions) {
-	    for (act = schedule->actions; act; act = act->next) {
-		rc = action_exec(lmapd, schedule, act);
-		if (rc == 1) {
-		    schedule->state = LMAP_SCHEDULE_STATE_RUNNING;
-		}
-	    }
-	}
-	break;
-    case LMAP_SCHEDULE_EXEC_MODE_PIPELINED:
-	lmap_dbg("disabling schedule '%s' (pipelined not yet implemented)",
-		 schedule->name);
-	schedule->state = LMAP_SCHEDULE_STATE_DISABLED;
-	break;
-    }
+    action_done(lmapd, schedule, action,
+		WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status), &ru);
 }
+#endif
+
+/*
+ * Watch a child with a pidfd so that it is reaped by pidfd_cb()
+ * instead of the SIGCHLD handler. If pidfds are not supported, the
+ * child is left to the SIGCHLD handler.
+ */
 
 static void
-action_kill(struct lmapd *lmapd, struct action *action)
+action_watch(struct lmapd *lmapd, pid_t pid)
 {
-    assert(lmapd);
-    UNUSED(lmapd);
+#ifdef HAVE_PIDFD
+    struct event *watch;
+    int pidfd;
 
-    if (!action || !action->name) {
+    if (lmapd->flags & LMAPD_FLAG_NOPIDFD) {
 	return;
     }
 
-    if (action->state == LMAP_ACTION_STATE_RUNNING) {
-	if (action->pid) {
-	    if (kill(-(action->pid), SIGTERM)) {
-		if (errno != ESRCH)
-		    lmap_wrn("action %s, pid %ld: failed to send SIGTERM to process group: %s",
-			     action->name, (long) action->pid, strerror(errno));
-		/* try again, just the direct child this time */
-		(void) kill(action->pid, SIGTERM);
-	    }
+    pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1) {
+	if (errno == ENOSYS) {
+	    lmap_dbg("pidfd not supported - using SIGCHLD");
+	    lmapd->flags |= LMAPD_FLAG_NOPIDFD;
+	} else {
+	    lmap_wrn("pidfd_open for pid %d failed: %s", pid, strerror(errno));
 	}
+	return;
     }
-}
+    (void) fcntl(pidfd, F_SETFD, FD_CLOEXEC);
 
-static void
-schedule_kill(struct lmapd *lmapd, struct schedule *schedule)
-{
-    struct action *act;
-
-    assert(lmapd);
-
-    if (!schedule || !schedule->name) {
+    watch = event_new(lmapd->base, pidfd, EV_READ, pidfd_cb, lmapd);
+    if (! watch || event_add(watch, NULL) < 0) {
+	lmap_err("failed to create/add pidfd event for pid %d", pid);
+	if (watch) {
+	    event_free(watch);
+	}
+	(void) close(pidfd);
 	return;
     }
 
-    for (act = schedule->actions; act; act = act->next) {
-	(void) action_kill(lmapd, act);
+    if (lmapd_pidtab_watch(lmapd->pidtab, pid, pidfd, watch)) {
+	event_free(watch);
+	(void) close(pidfd);
     }
+#else
+    (void) lmapd;
+    (void) pid;
+#endif
 }
 
+static void deadline_cb(evutil_socket_t fd, short events, void *context);
+
+/**
+ * @brief Arms the deadline of a schedule or of an action
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action or NULL for the schedule
+ * @param secs seconds until the deadline expires
+ * @return 0 on success, -1 on error
+ */
+
 static int
-suppression_start(struct lmapd *lmapd, struct supp *supp)
+deadline_arm(struct lmapd *lmapd, struct schedule *schedule,
+	     struct action *action, uint64_t secs)
 {
-    struct lmap *lmap;
-    struct schedule *schedule;
-    struct action *action;
-
-    assert(lmapd);
+    struct deadline *dl;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
 
-    lmap = lmapd->lmap;
-    if (!lmap || !supp || !supp->match || !supp->name) {
-	return 0;
+    dl = calloc(1, sizeof(*dl));
+    if (!dl) {
+	lmap_err("failed to allocate deadline");
+	return -1;
     }
-
-    // lmap_dbg("starting suppression %s", supp->name);
-    supp->state = LMAP_SUPP_STATE_ACTIVE;
-
-    for (schedule = lmap->schedules; schedule; schedule = schedule->next)
-    {
-	if (schedule->state == LMAP_SCHEDULE_STATE_DISABLED) {
-	    continue;
+    dl->lmapd = lmapd;
+    dl->schedule = schedule;
+    dl->action = action;
+    dl->timer = evtimer_new(lmapd->base, deadline_cb, dl);
+    tv.tv_sec = (secs > INT_MAX) ? INT_MAX : (time_t) secs;
+    if (!dl->timer || evtimer_add(dl->timer, &tv)) {
+	lmap_err("failed to arm deadline for %s '%s'",
+		 action ? "action" : "schedule",
+		 action ? action->name : schedule->name);
+	if (dl->timer) {
+	    event_free(dl->timer);
 	}
+	free(dl);
+	return -1;
+    }
+    if (action) {
+	action->deadline = dl;
+    } else {
+	schedule->deadline = dl;
+    }
+    return 0;
+}
 
-	if (big_tag_match(supp->match, schedule->suppression_tags)) {
-	    // lmap_dbg("suppressing %s", schedule->name);
-	    if (schedule->state == LMAP_SCHEDULE_STATE_ENABLED) {
-		schedule->state = LMAP_SCHEDULE_STATE_SUPPRESSED;
-	    }
-	    if (supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET) {
-		schedule->flags |= LMAP_SCHEDULE_FLAG_STOP_RUNNING;
-	    }
-	    schedule->cnt_active_suppressions++;
-	}
+/**
+ * @brief Disarms and releases a deadline
+ *
+ * @param deadline pointer to the deadline pointer, which is cleared
+ */
 
-	for (action = schedule->actions; action; action = action->next) {
-	    if (action->state == LMAP_ACTION_STATE_DISABLED) {
-		continue;
-	    }
+static void
+deadline_disarm(struct deadline **deadline)
+{
+    if (!deadline || !*deadline) {
+	return;
+    }
+    if ((*deadline)->timer) {
+	event_free((*deadline)->timer);
+    }
+    free(*deadline);
+    *deadline = NULL;
+}
 
-	    if (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING) {
-		action_kill(lmapd, action);
-	    }
+static void
+output_watch_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct output_watch *ow = (struct output_watch *) context;
+    struct action *action = ow->action;
+    struct workspace_job *job;
+    struct stat st;
+
+    UNUSED(fd);
+    UNUSED(events);
+
+    if (action->output_fd == -1
+	|| (action->flags & LMAP_ACTION_FLAG_FLUSHING)
+	|| fstat(action->output_fd, &st) == -1
+	|| (uint64_t) st.st_size <= action->output_spilled
+	|| (uint64_t) st.st_size - action->output_spilled
+	   <= action->output_memory_limit) {
+	return;
+    }
+    job = lmapd_workspace_job_new();
+    if (! job) {
+	return;
+    }
+    if (lmapd_workspace_job_action_flush(job, ow->schedule, action,
+					 (uint64_t) st.st_size)) {
+	lmapd_workspace_job_free(job);
+	return;
+    }
+    wsjob_submit(ow->lmapd, WSJOB_SPILL, ow->schedule, action, job, NULL);
+}
 
-	    if (big_tag_match(supp->match, action->suppression_tags)) {
-		// lmap_dbg("suppressing %s", action->name);
-		if (action->state == LMAP_ACTION_STATE_ENABLED) {
-		    action->state = LMAP_ACTION_STATE_SUPPRESSED;
-		}
-		if (action->state == LMAP_ACTION_STATE_RUNNING
-		    && ! (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING)
-		    && supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET) {
-		    action_kill(lmapd, action);
-		    action->state = LMAP_ACTION_STATE_SUPPRESSED;
-		}
-		action->cnt_active_suppressions++;
-	    }
+/**
+ * @brief Arms the output watch of a running action
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @return 0 on success, -1 on error
+ */
+
+static int
+output_watch_arm(struct lmapd *lmapd, struct schedule *schedule,
+		 struct action *action)
+{
+    struct output_watch *ow;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = LMAPD_OUTPUT_WATCH };
+
+    ow = calloc(1, sizeof(*ow));
+    if (!ow) {
+	lmap_err("failed to allocate output watch");
+	return -1;
+    }
+    ow->lmapd = lmapd;
+    ow->schedule = schedule;
+    ow->action = action;
+    ow->timer = event_new(lmapd->base, -1, EV_PERSIST, output_watch_cb, ow);
+    if (!ow->timer || event_add(ow->timer, &tv)) {
+	lmap_err("failed to arm output watch for action '%s'", action->name);
+	if (ow->timer) {
+	    event_free(ow->timer);
 	}
+	free(ow);
+	return -1;
     }
-
+    action->output_watch = ow;
     return 0;
 }
 
-static int
-suppression_end(struct lmapd *lmapd, struct supp *supp)
+/**
+ * @brief Disarms and releases an output watch
+ *
+ * @param output_watch pointer to the output watch pointer, which is cleared
+ */
+
+static void
+output_watch_disarm(struct output_watch **output_watch)
 {
-    struct lmap *lmap;
+    if (!output_watch || !*output_watch) {
+	return;
+    }
+    if ((*output_watch)->timer) {
+	event_free((*output_watch)->timer);
+    }
+    free(*output_watch);
+    *output_watch = NULL;
+}
+
+/*
+ * The completion of an action whose program could not be spawned,
+ * see action_failed().
+ */
+
+struct spawn_failure {
+    struct lmapd *lmapd;
     struct schedule *schedule;
     struct action *action;
+};
 
-    assert(lmapd);
+static void
+spawn_failure_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct spawn_failure *sf = context;
+    struct rusage ru;
 
-    lmap = lmapd->lmap;
-    if (!lmap || !supp || !supp->match || !supp->name) {
-	return 0;
-    }
+    UNUSED(fd);
+    UNUSED(events);
 
-    // lmap_dbg("ending suppression %s", supp->name);
-    supp->state = LMAP_SUPP_STATE_ENABLED;
+    memset(&ru, 0, sizeof(ru));
+    action_done(sf->lmapd, sf->schedule, sf->action, EXIT_FAILURE, &ru);
+    free(sf);
+}
 
-    for (schedule = lmap->schedules; schedule; schedule = schedule->next)
-    {
-	if (schedule->state == LMAP_SCHEDULE_STATE_DISABLED) {
-	    continue;
-	}
+/*
+ * Let an action whose program could not be executed complete with
+ * EXIT_FAILURE from the event loop, like a forked child that failed
+ * in execvp() would, so that it is accounted for as a failed run.
+ */
 
-	if (big_tag_match(supp->match, schedule->suppression_tags)) {
-	    // lmap_dbg("unsuppressing %s", schedule->name);
-	    if (schedule->cnt_active_suppressions) {
-		schedule->cnt_active_suppressions--;
-	    }
-	    if (schedule->cnt_active_suppressions == 0) {
-		if (schedule->state == LMAP_SCHEDULE_STATE_SUPPRESSED) {
-		    schedule->state = LMAP_SCHEDULE_STATE_ENABLED;
-		}
-	    }
-	}
+static int
+action_failed(struct lmapd *lmapd, struct schedule *schedule,
+	      struct action *action)
+{
+    struct spawn_failure *sf;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
 
-	for (action = schedule->actions; action; action = action->next) {
-	    if (action->state == LMAP_ACTION_STATE_DISABLED) {
-		continue;
-	    }
-	    if (big_tag_match(supp->match, action->suppression_tags)) {
-		// lmap_dbg("unsuppressing %s", action->name);
-		if (action->cnt_active_suppressions) {
-		    action->cnt_active_suppressions--;
-		}
-		if (action->cnt_active_suppressions == 0) {
-		    if (action->state == LMAP_ACTION_STATE_SUPPRESSED) {
-			action->state = LMAP_ACTION_STATE_ENABLED;
-		    }
-		}
-	    }
-	}
+    sf = calloc(1, sizeof(*sf));
+    if (! sf) {
+	lmap_err("failed to allocate memory");
+	return -1;
+    }
+    sf->lmapd = lmapd;
+    sf->schedule = schedule;
+    sf->action = action;
+    if (event_base_once(lmapd->base, -1, EV_TIMEOUT,
+			spawn_failure_cb, sf, &tv) < 0) {
+	lmap_err("failed to add completion event for action '%s'", action->name);
+	free(sf);
+	return -1;
     }
-
     return 0;
 }
 
 /**
- * @brief Callback called from the event loop
+ * @brief Start an action
  *
- * Function which is executed by the event loop periodically. It calls
- * waitpid() to see if any children changed their status. Does all the
- * moving of files from action to destination. Start any subsequent
- * actions in sequential schedules.
+ * Writes the meta data of the invocation and starts the program of
+ * an action. The standard output goes into the action's .data file
+ * unless out_fd is a valid file descriptor, the standard input is
+ * inherited unless in_fd is a valid file descriptor. The descriptors
+ * are used by pipelined schedules and are left open for the caller
+ * to close. The program is started with posix_spawn() where possible
+ * and with fork() if LMAPD_FLAG_FORK is set or posix_spawn() cannot
+ * be used.
  *
- * @param lmapd pointer to a struct lmapd
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @param in_fd file descriptor to use as stdin or -1
+ * @param out_fd file descriptor to use as stdout or -1
+ * @return 1 if the action was started, 0 if it was skipped, -1 on error
  */
 
-void
-lmapd_cleanup(struct lmapd *lmapd)
+static int
+action_exec(struct lmapd *lmapd, struct schedule *schedule, struct action *action,
+	    int in_fd, int out_fd)
 {
     pid_t pid;
-    int status, succeeded, still_running;
-    struct lmap *lmap;
     struct timeval t;
-    struct action *action;
-    struct schedule *schedule;
-    struct tag *tag;
+    struct task *task;
+    struct workspace_job *spill = NULL;
+    int data_fd = -1, exec_err = 0;
 
     assert(lmapd);
-    lmap = lmapd->lmap;
-    if (! lmap) {
-	return;
+
+    if (!action || !action->name || !action->task || !action->workspace) {
+	return 0;
+    }
+
+    if (action->state == LMAP_ACTION_STATE_SUPPRESSED) {
+	action->cnt_suppressions++;
+    }
+
+    if (action->state == LMAP_ACTION_STATE_DISABLED
+	|| action->state == LMAP_ACTION_STATE_SUPPRESSED) {
+	return 0;
+    }
+
+    /*
+     * Broken task or capability references have been reported by
+     * lmap_link() and leave the action without an argument vector.
+     */
+
+    task = action->linked_task;
+    if (! task || ! action->argv) {
+	return -1;
+    }
+
+    if (action->pid) {
+	lmap_wrn("action '%s' still running (pid %d) - skipping",
+		 action->name, action->pid);
+	action->cnt_overlaps++;
+	return -1;
+    }
+
+    if (action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED) {
+	lmap_wrn("action '%s' has previous results, coping with it",
+		action->name);
     }
 
     event_base_gettimeofday_cached(lmapd->base, &t);
 
-    while (1) {
-	pid = waitpid(-1, &status, WNOHANG);
-	if (pid == 0 || pid == -1) {
-	    return;
+    /*
+     * Pass some information to the task via the environment; this is
+     * necessary so that a reporter can create a proper report.
+     */
+#if 0
+    if (lmapd->lmap && lmapd->lmap->agent) {
+	struct agent *agent = lmapd->lmap->agent;
+	if (agent->agent_id && agent->report_agent_id) {
+	    setenv("LMAP_AGENT_ID", lmapd->lmap->agent->agent_id, 1);
 	}
-
-	if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
-	    continue;
+	if (agent->measurement_point && agent->report_measurement_point) {
+	    setenv("LMAP_MEASUREMENT_POINT", agent->measurement_point, 1);
 	}
+	if (agent->group_id) {
+	    setenv("LMAP_GROUP_ID", agent->group_id, 1);
+	}
+    }
+#endif
+    /*
+     * Save some meta information about the invocation of this action
+     * in the action workspace.
+     */
 
-	action = find_action_by_pid(lmap, pid);
-	if (! action) {
-	    lmap_dbg("ignoring pid '%d'", pid);
-	    continue;
+    /*
+     * Output of the previous run still waiting to be moved. It is
+     * written to the workspace by a worker once the action started,
+     * and dropped with the workspace if it fails to start.
+     */
+    if (action->output_fd != -1) {
+	spill = lmapd_workspace_job_new();
+	if (! spill || lmapd_workspace_job_action_spill(spill, schedule, action)) {
+	    (void) lmapd_workspace_action_spill(schedule, action);
 	}
-	schedule = find_schedule_by_pid(lmap, pid);
-	if (! schedule) {
-	    lmap_dbg("ignoring pid '%d'", pid);
-	    continue;
+    }
+
+    action->last_invocation = t.tv_sec;
+    if (lmapd_workspace_action_meta_add_start(schedule, action, task)) {
+	lmapd_workspace_job_free(spill);
+	(void) lmapd_workspace_action_clean(lmapd, action);
+	return -1;
+    }
+
+    /*
+     * Setup redirection. Data goes into .data files (or memory, see
+     * lmapd_workspace_action_open_output()), except for all but the
+     * last stage of a pipeline, which write into the pipe.
+     */
+
+    if (out_fd == -1) {
+	data_fd = lmapd_workspace_action_open_output(schedule, action);
+	if (data_fd == -1) {
+	    lmapd_workspace_job_free(spill);
+	    (void) lmapd_workspace_action_clean(lmapd, action);
+	    return -1;
 	}
+	out_fd = data_fd;
+    }
 
-	action->pid = 0;
-	action->state = LMAP_ACTION_STATE_ENABLED;
-	action->last_completion = t.tv_sec;
-	if (WIFEXITED(status)) {
-	    action->last_status = WEXITSTATUS(status);
+#ifdef HAVE_ACTION_SPAWN
+    if (!(lmapd->flags & LMAPD_FLAG_FORK)) {
+	pid = action_spawn(action, in_fd, out_fd, &exec_err);
+    } else
+#endif
+	pid = action_fork(action, in_fd, out_fd);
+
+    if (data_fd != -1) {
+	(void) close(data_fd);
+    }
+    if (pid == -1) {
+	if (! exec_err || action_failed(lmapd, schedule, action)) {
+	    lmapd_workspace_job_free(spill);
+	    (void) lmapd_workspace_action_clean(lmapd, action);
+	    return -1;
 	}
-	if (WIFSIGNALED(status)) {
-	    action->last_status = -WTERMSIG(status);
+    } else {
+	action->pid = pid;
+	if (lmapd_pidtab_add(lmapd->pidtab, pid, schedule, action)) {
+	    lmap_wrn("action '%s': failed to index pid %d", action->name, pid);
+	} else {
+	    action_watch(lmapd, pid);
 	}
+    }
+    action->state = LMAP_ACTION_STATE_RUNNING;
+    action->cnt_invocations++;
+    schedule->flags |= LMAP_SCHEDULE_FLAG_STARTED;
+    lmapd->running++;
 
-	if (action->last_status != 0) {
-	    action->last_failed_completion = action->last_completion;
-	    action->last_failed_status = action->last_status;
-	    action->cnt_failures++;
-	}
+    if (spill) {
+	wsjob_submit(lmapd, WSJOB_SPILL, schedule, action, spill, NULL);
+    }
 
-	/*
-	 * Save some meta information about the completion of this
-	 * action in the action workspace.
-	 */
+    if (pid == -1) {
+	return 1;
+    }
 
-	(void) lmapd_workspace_action_meta_add_end(schedule, action);
+    if ((action->flags & LMAP_ACTION_FLAG_TIMEOUT_SET) && action->timeout) {
+	(void) deadline_arm(lmapd, schedule, action, action->timeout);
+    }
+    if (action->output_fd != -1) {
+	(void) output_watch_arm(lmapd, schedule, action);
+    }
 
-	/*
-	 * Move the action results to the destinations and afterwards
-	 * cleanup the action workspace, unless we need to defer the
-	 * move to after the whole schedule (i.e. all its actions)
-	 * finished.
-	 */
+    /* In case we run for too long before the child can setpgid() */
+    (void) setpgid(pid, pid);
 
-	/*
-	 * we only reset the MOVEDEFERRED FLAG when we move or clean,
-	 * as it is safer (less chance of data loss due to a bug).
-	 *
-	 * action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED;
-	 */
-	if (action->last_status == 0 && action->destinations) {
-	    for (tag = action->destinations; tag; tag = tag->next) {
-		struct schedule * const dst = lmap_find_schedule(lmap, tag->tag);
-		if (dst && lmapd_workspace_action_move(lmapd, schedule, action, dst, 1) > 0) {
-		    action->flags |= LMAP_ACTION_FLAG_MOVEDEFERRED;
-		}
-	    }
+    return 1;
+}
+
+static int
+set_cloexec(int fd)
+{
+    int flags = fcntl(fd, F_GETFD);
+
+    return (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) ? -1 : 0;
+}
+
+/**
+ * @brief Start all actions of a pipelined schedule
+ *
+ * Starts all runnable actions of a schedule at once, connecting the
+ * standard output of each action to the standard input of the next
+ * runnable action with a pipe. Only the last stage writes a .data
+ * file into its workspace, the data of the other stages never hits
+ * the file system. Every stage still has its own meta data and exit
+ * status, which are processed by lmapd_cleanup() as usual, but only
+ * the results of the last stage are delivered to its destinations:
+ * the other stages have nothing but a .meta file, which would never
+ * leave the incoming queue of a destination.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @return the number of started actions
+ */
+
+static int
+pipeline_exec(struct lmapd *lmapd, struct schedule *schedule)
+{
+    struct action *act, *next;
+    int fds[2], in_fd = -1, started = 0;
+
+    for (act = schedule->actions; act && !action_runnable(act); act = act->next) {
+	if (act->state == LMAP_ACTION_STATE_SUPPRESSED) {
+	    act->cnt_suppressions++;
 	}
-	if (!(action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED)) {
-	    /* cleanup early to free space early */
-	    (void) lmapd_workspace_action_clean(lmapd, action);
-	    /* action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED; */
+    }
+
+    for (; act; act = next) {
+	for (next = act->next; next && !action_runnable(next); next = next->next) {
+	    if (next->state == LMAP_ACTION_STATE_SUPPRESSED) {
+		next->cnt_suppressions++;
+	    }
 	}
 
 	/*
-	 * Is there any subsequent action in a sequential schedule?
-	 * If so, execute the next action in sequence except when the
-	 * schedule got meanwhile suppressed and the stop all running
-	 * flag is set.
+	 * The pipe ends must not leak into the other stages, otherwise
+	 * a reader will never see the end of its input.
 	 */
-	if (action->next && schedule
-	    && schedule->mode == LMAP_SCHEDULE_EXEC_MODE_SEQUENTIAL) {
-	    if (schedule->state != LMAP_SCHEDULE_STATE_SUPPRESSED
-		&& ! (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING)) {
-		(void) action_exec(lmapd, schedule, action->next);
+
+	fds[0] = fds[1] = -1;
+	if (next && (pipe(fds) == -1
+		     || set_cloexec(fds[0]) || set_cloexec(fds[1]))) {
+	    lmap_err("schedule '%s': failed to create pipe: %s - truncating pipeline",
+		     schedule->name, strerror(errno));
+	    if (fds[0] != -1) {
+		(void) close(fds[0]);
+		(void) close(fds[1]);
 	    }
+	    fds[0] = fds[1] = -1;
+	    next = NULL;
 	}
 
-	/*
-	 * RUNNING schedules need to be switched to ENABLED when all of
-	 * its actions have left the running state, and processed for
-	 * MOVEDEFERRED.
-	 *
-	 * DISABLED schedules need to be processed for MOVEDEFERRED
-	 * when all of its actions have left the running state.
-	 *
-	 * Cleanup the schedule processing queue if at least one action
-	 * was executed, and every executed action returned success.
-	 */
-	still_running = succeeded = 0;
-	for (action = schedule->actions; action; action = action->next) {
-	    still_running |= (action->state == LMAP_ACTION_STATE_RUNNING);
-	    succeeded     |= (action->last_status == 0);
-	}
-	if (schedule->state == LMAP_SCHEDULE_STATE_RUNNING && !still_running) {
-	    schedule->state = LMAP_SCHEDULE_STATE_ENABLED;
-	    if (schedule->cnt_active_suppressions) {
-		schedule->state = LMAP_SCHEDULE_STATE_SUPPRESSED;
-	    }
-	}
+	act->flags &= ~LMAP_ACTION_FLAG_PIPED;
+	if (action_exec(lmapd, schedule, act, in_fd, fds[1]) == 1) {
+	    if (fds[1] != -1) {
+		act->flags |= LMAP_ACTION_FLAG_PIPED;
+	    }
+	    started++;
+	}
+
+	if (in_fd != -1) {
+	    (void) close(in_fd);
+	}
+	if (fds[1] != -1) {
+	    (void) close(fds[1]);
+	}
+	in_fd = fds[0];
+    }
+
+    return started;
+}
+
+/*
+ * The number of slots an admission needs: pipelined schedules are
+ * admitted as a whole since their stages must run concurrently.
+ */
+
+static uint32_t
+admission_slots(struct admission *adm)
+{
+    struct action *act;
+    uint32_t slots = 0;
+
+    if (adm->action) {
+	return 1;
+    }
+    for (act = adm->schedule->actions; act; act = act->next) {
+	if (action_runnable(act)) {
+	    slots++;
+	}
+    }
+    return slots;
+}
+
+static void
+admission_mark(struct admission *adm, int queued)
+{
+    struct action *act;
+
+    for (act = adm->action ? adm->action : adm->schedule->actions;
+	 act; act = adm->action ? NULL : act->next) {
+	if (queued) {
+	    act->flags |= LMAP_ACTION_FLAG_QUEUED;
+	} else {
+	    act->flags &= ~LMAP_ACTION_FLAG_QUEUED;
+	}
+    }
+}
+
+static void
+admission_account(struct lmapd *lmapd)
+{
+    struct admission *adm;
+    uint32_t depth = 0;
+
+    for (adm = lmapd->admission; adm; adm = adm->next) {
+	depth++;
+    }
+    if (lmapd->lmap && lmapd->lmap->agent) {
+	lmapd->lmap->agent->admission_queue_depth = depth;
+    }
+}
+
+/**
+ * @brief Queue an action for execution
+ *
+ * Adds an action (or a pipelined schedule if action is NULL) to the
+ * admission queue. The entry is inserted after all entries of the
+ * same or a higher schedule priority and will not be admitted
+ * before delay milliseconds have passed.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action or NULL
+ * @param delay minimum time to wait in milliseconds
+ * @return 0 on success, -1 on error
+ */
+
+static int
+admission_enqueue(struct lmapd *lmapd, struct schedule *schedule,
+		  struct action *action, uint32_t delay)
+{
+    struct admission *adm, **p;
+    struct timeval tv;
+
+    adm = calloc(1, sizeof(struct admission));
+    if (! adm) {
+	lmap_err("failed to allocate memory");
+	return -1;
+    }
+    adm->schedule = schedule;
+    adm->action = action;
+    event_base_gettimeofday_cached(lmapd->base, &adm->queued);
+    tv.tv_sec = delay / 1000;
+    tv.tv_usec = (delay % 1000) * 1000;
+    evutil_timeradd(&adm->queued, &tv, &adm->not_before);
+
+    for (p = &lmapd->admission;
+	 *p && (*p)->schedule->priority >= schedule->priority;
+	 p = &(*p)->next) ;
+    adm->next = *p;
+    *p = adm;
+
+    admission_mark(adm, 1);
+    return 0;
+}
+
+/*
+ * Queue an action if it can be started, otherwise let action_exec()
+ * account for it right away. Returns 1 if the action was queued.
+ */
+
+static int
+action_admit(struct lmapd *lmapd, struct schedule *schedule,
+	     struct action *action, uint32_t delay)
+{
+    if (action_runnable(action)
+	&& admission_enqueue(lmapd, schedule, action, delay) == 0) {
+	return 1;
+    }
+    (void) action_exec(lmapd, schedule, action, -1, -1);
+    return 0;
+}
+
+static void
+admission_cb(evutil_socket_t fd, short events, void *context)
+{
+    (void) fd;
+    (void) events;
+
+    admission_run((struct lmapd *) context);
+}
+
+/**
+ * @brief Start queued actions
+ *
+ * Starts the queued actions in priority order as long as the agent's
+ * max-concurrent-actions limit allows. An entry that does not fit
+ * blocks all entries behind it so that lower priority actions cannot
+ * starve higher priority ones; it is always admitted if nothing else
+ * is running. Entries that are delayed by a stagger interval do not
+ * block and are picked up by a timer.
+ *
+ * @param lmapd pointer to the struct lmapd
+ */
+
+static void
+admission_run(struct lmapd *lmapd)
+{
+    struct admission *adm, **p;
+    struct schedule *schedule;
+    struct agent *agent;
+    struct timeval now, wait, next;
+    uint32_t max;
+    uint64_t ms;
+    int started;
+
+    assert(lmapd);
+
+    agent = lmapd->lmap ? lmapd->lmap->agent : NULL;
+    max = agent ? agent->max_concurrent_actions : 0;
+
+    event_base_gettimeofday_cached(lmapd->base, &now);
+    evutil_timerclear(&next);
+
+    p = &lmapd->admission;
+    while ((adm = *p)) {
+	if (evutil_timercmp(&adm->not_before, &now, >)) {
+	    if (! evutil_timerisset(&next)
+		|| evutil_timercmp(&adm->not_before, &next, <)) {
+		next = adm->not_before;
+	    }
+	    p = &adm->next;
+	    continue;
+	}
+	if (max && lmapd->running
+	    && lmapd->running + admission_slots(adm) > max) {
+	    break;
+	}
+
+	*p = adm->next;
+	admission_mark(adm, 0);
+
+	if (agent) {
+	    evutil_timersub(&now, &adm->not_before, &wait);
+	    ms = (uint64_t) wait.tv_sec * 1000 + (uint64_t) wait.tv_usec / 1000;
+	    agent->cnt_admissions++;
+	    agent->admission_wait += ms;
+	    if (ms > agent->admission_max_wait) {
+		agent->admission_max_wait = ms;
+	    }
+	}
+
+	schedule = adm->schedule;
+	if (adm->action) {
+	    started = (action_exec(lmapd, schedule, adm->action, -1, -1) == 1);
+	} else {
+	    started = (pipeline_exec(lmapd, schedule) > 0);
+	}
+	free(adm);
+
+	if (! started) {
+	    schedule_finish(lmapd, schedule);
+	}
+    }
+
+    if (evutil_timerisset(&next)) {
+	if (! lmapd->admission_timer) {
+	    lmapd->admission_timer = evtimer_new(lmapd->base, admission_cb, lmapd);
+	}
+	evutil_timersub(&next, &now, &wait);
+	if (! lmapd->admission_timer
+	    || evtimer_add(lmapd->admission_timer, &wait) < 0) {
+	    lmap_err("failed to create/add admission timer");
+	}
+    }
+
+    admission_account(lmapd);
+}
+
+/*
+ * Drop the queued actions of a schedule, or all queued actions if
+ * schedule is NULL.
+ */
+
+static void
+admission_cancel(struct lmapd *lmapd, struct schedule *schedule)
+{
+    struct admission *adm, **p;
+
+    p = &lmapd->admission;
+    while ((adm = *p)) {
+	if (schedule && adm->schedule != schedule) {
+	    p = &adm->next;
+	    continue;
+	}
+	*p = adm->next;
+	admission_mark(adm, 0);
+	free(adm);
+    }
+
+    admission_account(lmapd);
+}
+
+static void
+wsjob_work(void *arg)
+{
+    struct wsjob *w = arg;
+
+    if (w->job) {
+	lmapd_workspace_job_run(w->job);
+    }
+}
+
+static void
+wsjob_continue(struct lmapd *lmapd, enum wsjob_type type,
+	       struct schedule *schedule, struct action *action)
+{
+    switch (type) {
+    case WSJOB_START:
+	schedule_start(lmapd, schedule);
+	break;
+    case WSJOB_OUTPUT:
+	action_next(lmapd, schedule, action);
+	break;
+    case WSJOB_FINISH:
+	break;
+    case WSJOB_STORAGE:
+    case WSJOB_SPILL:
+	/* the completion of the action continues the schedule */
+	return;
+    }
+    schedule_finish(lmapd, schedule);
+    admission_run(lmapd);
+}
+
+/*
+ * Continues with the next step of a wsjob that is done, and frees it.
+ * Cancelled wsjobs are only freed.
+ */
+
+static void
+wsjob_finish(struct wsjob *w, int cancelled)
+{
+    if (! cancelled && w->schedule) {
+	w->schedule->jobs--;
+	wsjob_continue(w->lmapd, w->type, w->schedule, w->action);
+    }
+    lmapd_workspace_job_free(w->job);
+    lmapd_workspace_job_free(w->after);
+    free(w);
+}
+
+static void commit_add(struct lmapd *lmapd, struct wsjob *w, int cancelled);
+
+/**
+ * @brief Callback called from the event loop
+ *
+ * Function which is executed by the event loop when a worker did the
+ * workspace operations of a wsjob. It continues with the next step
+ * of the schedule, or waits for the commit of the results first.
+ * Jobs cancelled by the shutdown of the event loop are only freed,
+ * but their results are still published, see commit_cancel().
+ */
+
+static void
+wsjob_done(void *arg, int cancelled)
+{
+    struct wsjob *w = arg;
+
+    if (! cancelled) {
+	lmapd_workspace_job_account(w->job, w->lmapd->lmap);
+    }
+    if (w->after) {
+	commit_add(w->lmapd, w, cancelled);
+	return;
+    }
+    wsjob_finish(w, cancelled);
+}
+
+/*
+ * Submit the workspace job of a schedule to the workers. The job may
+ * be NULL if it could not be allocated, the next step is taken anyway.
+ * The after job, if any, runs once the files written by the job are
+ * durable. Without workers, everything but the commit happens before
+ * this returns.
+ */
+
+static void
+wsjob_submit(struct lmapd *lmapd, enum wsjob_type type,
+	     struct schedule *schedule, struct action *action,
+	     struct workspace_job *job, struct workspace_job *after)
+{
+    struct wsjob *w;
+
+    lmapd_workspace_job_after(job, after);
+    w = calloc(1, sizeof(*w));
+    if (! w) {
+	lmap_err("failed to allocate memory");
+	if (job) {
+	    lmapd_workspace_job_run(job);
+	    lmapd_workspace_job_account(job, lmapd->lmap);
+	    lmapd_workspace_job_free(job);
+	}
+	if (after) {
+	    (void) lmapd_workspace_sync(lmapd->queue_path);
+	    lmapd_workspace_job_run(after);
+	    lmapd_workspace_job_account(after, lmapd->lmap);
+	    lmapd_workspace_job_free(after);
+	}
+	wsjob_continue(lmapd, type, schedule, action);
+	return;
+    }
+    w->type = type;
+    w->lmapd = lmapd;
+    w->schedule = schedule;
+    w->action = action;
+    w->job = job;
+    w->after = after;
+
+    schedule->jobs++;
+    (void) lmapd_workers_submit(lmapd->workers, schedule,
+				wsjob_work, wsjob_done, w);
+}
+
+/*
+ * Whether results are delivered with group-commit durability.
+ */
+
+static int
+durable(struct lmapd *lmapd)
+{
+    struct agent *agent = lmapd->lmap ? lmapd->lmap->agent : NULL;
+
+    return agent && agent->durability == LMAP_AGENT_DURABILITY_GROUP
+	&& lmapd->queue_path;
+}
+
+/*
+ * Adds a move of the results of an action to a workspace job. With
+ * group-commit durability, the job stages the results and the after
+ * job, allocated on first use, publishes them.
+ */
+
+static void
+job_deliver(struct lmapd *lmapd, struct workspace_job *job,
+	    struct workspace_job **after, struct schedule *schedule,
+	    struct action *action, struct schedule *destination)
+{
+    if (! *after && durable(lmapd)) {
+	*after = lmapd_workspace_job_new();
+    }
+    if (*after) {
+	(void) lmapd_workspace_job_action_stage(job, schedule, action, destination);
+	(void) lmapd_workspace_job_action_publish(*after, schedule, action,
+						  destination);
+    } else {
+	(void) lmapd_workspace_job_action_move(job, schedule, action, destination);
+    }
+}
+
+/*
+ * Syncs the queue and runs the after jobs of a commit, on a worker.
+ */
+
+static void
+commit_work(void *arg)
+{
+    struct commit *c = arg;
+    struct wsjob *w;
+    uint64_t start;
+
+    start = monotonic_usec();
+    (void) lmapd_workspace_sync(c->lmapd->queue_path);
+    for (w = c->wsjobs; w; w = w->next) {
+	lmapd_workspace_job_run(w->after);
+    }
+    c->latency = monotonic_usec() - start;
+}
+
+/*
+ * Accounts for a commit, and continues with the next steps of its
+ * wsjobs, in the order they were added.
+ */
+
+static void
+commit_done(void *arg, int cancelled)
+{
+    struct commit *c = arg;
+    struct lmapd *lmapd = c->lmapd;
+    struct agent *agent = lmapd->lmap ? lmapd->lmap->agent : NULL;
+    struct wsjob *w;
+
+    if (! cancelled && agent) {
+	agent->cnt_commits++;
+	agent->commit_latency = c->latency;
+	if (c->latency > agent->commit_max_latency) {
+	    agent->commit_max_latency = c->latency;
+	}
+	agent->commit_batch = c->count;
+	if (c->count > agent->commit_max_batch) {
+	    agent->commit_max_batch = c->count;
+	}
+    }
+    while ((w = c->wsjobs)) {
+	c->wsjobs = w->next;
+	if (! cancelled) {
+	    lmapd_workspace_job_account(w->after, lmapd->lmap);
+	}
+	wsjob_finish(w, cancelled);
+    }
+    free(c);
+}
+
+/*
+ * Closes the open commit and submits it to the workers. The key makes
+ * sure that commits run one at a time.
+ */
+
+static void
+commit_flush(struct lmapd *lmapd)
+{
+    struct commit *c = lmapd->commit;
+
+    if (! c) {
+	return;
+    }
+    lmapd->commit = NULL;
+    if (lmapd->commit_timer) {
+	(void) evtimer_del(lmapd->commit_timer);
+    }
+    (void) lmapd_workers_submit(lmapd->workers, &lmapd->commit,
+				commit_work, commit_done, c);
+}
+
+/**
+ * @brief Callback closing the commit window
+ */
+
+static void
+commit_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct lmapd *lmapd = (struct lmapd *) context;
+
+    UNUSED(fd);
+    UNUSED(events);
+
+    commit_flush(lmapd);
+}
+
+/*
+ * Adds a wsjob to the open commit. The first wsjob opens it, and the
+ * commit is flushed after the commit window of the agent. Cancelled
+ * wsjobs wait for commit_cancel().
+ */
+
+static void
+commit_add(struct lmapd *lmapd, struct wsjob *w, int cancelled)
+{
+    struct commit *c = lmapd->commit;
+    struct agent *agent = lmapd->lmap ? lmapd->lmap->agent : NULL;
+    uint32_t window = agent ? agent->commit_window : 0;
+    struct timeval tv = { .tv_sec = window / 1000,
+			  .tv_usec = (window % 1000) * 1000 };
+    int flush = 0;
+
+    if (! c) {
+	c = calloc(1, sizeof(*c));
+	if (! c) {
+	    lmap_err("failed to allocate memory");
+	    (void) lmapd_workspace_sync(lmapd->queue_path);
+	    lmapd_workspace_job_run(w->after);
+	    if (! cancelled) {
+		lmapd_workspace_job_account(w->after, lmapd->lmap);
+	    }
+	    wsjob_finish(w, cancelled);
+	    return;
+	}
+	c->lmapd = lmapd;
+	c->tail = &c->wsjobs;
+	lmapd->commit = c;
+	if (! cancelled && (! lmapd->commit_timer
+			    || evtimer_add(lmapd->commit_timer, &tv) < 0)) {
+	    /* no window then */
+	    flush = 1;
+	}
+    }
+    w->next = NULL;
+    *c->tail = w;
+    c->tail = &w->next;
+    c->count++;
+
+    if (flush) {
+	commit_flush(lmapd);
+    }
+}
+
+/*
+ * Runs the open commit right away, once the workers are gone, without
+ * going on with the schedules, so that staged results are published.
+ */
+
+static void
+commit_cancel(struct lmapd *lmapd)
+{
+    struct commit *c = lmapd->commit;
+
+    if (! c) {
+	return;
+    }
+    lmapd->commit = NULL;
+    commit_work(c);
+    commit_done(c, 1);
+}
+
+/**
+ * @brief Execute a schedule
+ *
+ * Moves the incoming queue of a schedule to its active queue and
+ * cleans the workspaces of its actions on a worker thread, then
+ * starts the schedule, see schedule_start(). The schedule is running
+ * from now on.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ */
+
+void
+lmapd_schedule_exec(struct lmapd *lmapd, struct schedule *schedule)
+{
+    struct workspace_job *job;
+    struct action *act;
+
+    assert(lmapd);
+
+    if (!schedule || !schedule->name) {
+	return;
+    }
+
+    // lmap_dbg("executing schedule '%s'", schedule->name);
+
+    /* avoid leftover data (possibly due to a crash) from
+     * previous runs of an action. */
+    job = lmapd_workspace_job_new();
+    if (job) {
+	(void) lmapd_workspace_job_schedule_move(job, schedule);
+	for (act = schedule->actions; act; act = act->next) {
+	    (void) lmapd_workspace_job_action_clean(job, schedule, act);
+	}
+    }
+
+    schedule->state = LMAP_SCHEDULE_STATE_RUNNING;
+    schedule->flags |= LMAP_SCHEDULE_FLAG_STARTING;
+    wsjob_submit(lmapd, WSJOB_START, schedule, NULL, job, NULL);
+}
+
+/**
+ * @brief Start a schedule
+ *
+ * Queues the actions of a schedule for execution according to its
+ * execution mode. Sequential schedules only queue their first action,
+ * the others are queued by action_next() when their predecessor
+ * finished. The actions of parallel schedules are queued one stagger
+ * interval apart, pipelined schedules are queued as a whole. The
+ * queued actions are started by admission_run().
+ *
+ * Nothing is started if the schedule was stopped while its workspace
+ * was prepared.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ */
+
+static void
+schedule_start(struct lmapd *lmapd, struct schedule *schedule)
+{
+    struct timeval t;
+    struct action *act;
+    uint32_t delay = 0;
+    int queued = 0;
+
+    if (!(schedule->flags & LMAP_SCHEDULE_FLAG_STARTING)) {
+	return;
+    }
+    schedule->flags &= ~LMAP_SCHEDULE_FLAG_STARTING;
+
+    event_base_gettimeofday_cached(lmapd->base, &t);
+    schedule->flags &= ~LMAP_SCHEDULE_FLAG_STARTED;
+    memset(&schedule->last_usage, 0, sizeof(schedule->last_usage));
+
+    switch (schedule->mode) {
+    case LMAP_SCHEDULE_EXEC_MODE_SEQUENTIAL:
+	schedule->last_invocation = t.tv_sec;
+	schedule->cnt_invocations++;
+	if (schedule->actions) {
+	    queued = action_admit(lmapd, schedule, schedule->actions, 0);
+	}
+	break;
+    case LMAP_SCHEDULE_EXEC_MODE_PARALLEL:
+	schedule->last_invocation = t.tv_sec;
+	schedule->cnt_invocations++;
+	for (act = schedule->actions; act; act = act->next) {
+	    if (action_admit(lmapd, schedule, act, delay)) {
+		queued = 1;
+		delay += schedule->stagger;
+	    }
+	}
+	break;
+    case LMAP_SCHEDULE_EXEC_MODE_PIPELINED:
+	schedule->last_invocation = t.tv_sec;
+	schedule->cnt_invocations++;
+	for (act = schedule->actions; act && !action_runnable(act); act = act->next) ;
+	if (act && admission_enqueue(lmapd, schedule, NULL, 0) == 0) {
+	    queued = 1;
+	} else {
+	    (void) pipeline_exec(lmapd, schedule);
+	}
+	break;
+    }
+
+    if (queued) {
+	if ((schedule->flags & LMAP_SCHEDULE_FLAG_DURATION_SET)
+	    && schedule->duration) {
+	    deadline_disarm(&schedule->deadline);
+	    (void) deadline_arm(lmapd, schedule, NULL, schedule->duration);
+	}
+    }
+}
+
+static void
+action_signal(struct action *action, int signum)
+{
+    if (!action || !action->name) {
+	return;
+    }
+
+    if (action->state == LMAP_ACTION_STATE_RUNNING) {
+	if (action->pid) {
+	    if (kill(-(action->pid), signum)) {
+		if (errno != ESRCH)
+		    lmap_wrn("action %s, pid %ld: failed to send %s to process group: %s",
+			     action->name, (long) action->pid,
+			     (signum == SIGKILL) ? "SIGKILL" : "SIGTERM",
+			     strerror(errno));
+		/* try again, just the direct child this time */
+		(void) kill(action->pid, signum);
+	    }
+	}
+    }
+}
+
+static void
+action_kill(struct lmapd *lmapd, struct action *action)
+{
+    assert(lmapd);
+    UNUSED(lmapd);
+
+    action_signal(action, SIGTERM);
+}
+
+static void
+schedule_kill(struct lmapd *lmapd, struct schedule *schedule)
+{
+    struct action *act;
+
+    assert(lmapd);
+
+    if (!schedule || !schedule->name) {
+	return;
+    }
+
+    schedule->flags &= ~LMAP_SCHEDULE_FLAG_STARTING;
+    admission_cancel(lmapd, schedule);
+    for (act = schedule->actions; act; act = act->next) {
+	(void) action_kill(lmapd, act);
+    }
+    schedule_finish(lmapd, schedule);
+}
+
+/*
+ * Apply an active suppression to a schedule and its actions.
+ */
+
+static void
+suppress_schedule(struct lmapd *lmapd, struct supp *supp,
+		  struct schedule *schedule)
+{
+    struct action *action;
+
+    if (schedule->state == LMAP_SCHEDULE_STATE_DISABLED) {
+	return;
+    }
+
+    if (big_tag_match(supp->match, schedule->suppression_tags)) {
+	// lmap_dbg("suppressing %s", schedule->name);
+	if (schedule->state == LMAP_SCHEDULE_STATE_ENABLED) {
+	    schedule->state = LMAP_SCHEDULE_STATE_SUPPRESSED;
+	}
+	if (supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET) {
+	    schedule->flags |= LMAP_SCHEDULE_FLAG_STOP_RUNNING;
+	}
+	schedule->cnt_active_suppressions++;
+    }
+
+    if (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING) {
+	schedule->flags &= ~LMAP_SCHEDULE_FLAG_STARTING;
+	admission_cancel(lmapd, schedule);
+    }
+
+    for (action = schedule->actions; action; action = action->next) {
+	if (action->state == LMAP_ACTION_STATE_DISABLED) {
+	    continue;
+	}
+
+	if (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING) {
+	    action_kill(lmapd, action);
+	}
+
+	if (big_tag_match(supp->match, action->suppression_tags)) {
+	    // lmap_dbg("suppressing %s", action->name);
+	    if (action->state == LMAP_ACTION_STATE_ENABLED) {
+		action->state = LMAP_ACTION_STATE_SUPPRESSED;
+	    }
+	    if (action->state == LMAP_ACTION_STATE_RUNNING
+		&& ! (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING)
+		&& supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET) {
+		action_kill(lmapd, action);
+		action->state = LMAP_ACTION_STATE_SUPPRESSED;
+	    }
+	    action->cnt_active_suppressions++;
+	}
+    }
+}
+
+/**
+ * @brief Callback called when a deadline expires
+ *
+ * The first expiry stops the schedule or the action and rearms the
+ * deadline for the grace period. The second expiry kills whatever
+ * is still running.
+ */
+
+static void
+deadline_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct deadline *dl = (struct deadline *) context;
+    struct lmapd *lmapd = dl->lmapd;
+    struct schedule *schedule = dl->schedule;
+    struct action *act;
+    struct timeval tv = { .tv_sec = LMAPD_KILL_GRACE, .tv_usec = 0 };
+
+    UNUSED(fd);
+    UNUSED(events);
+
+    if (dl->killed) {
+	if (dl->action) {
+	    lmap_wrn("action '%s' did not stop - killing it", dl->action->name);
+	    action_signal(dl->action, SIGKILL);
+	} else {
+	    lmap_wrn("schedule '%s' did not stop - killing it", schedule->name);
+	    for (act = schedule->actions; act; act = act->next) {
+		action_signal(act, SIGKILL);
+	    }
+	}
+	return;
+    }
+
+    /*
+     * Rearm first: stopping a schedule that has nothing running
+     * finishes it right away, which releases the deadline.
+     */
+    dl->killed = 1;
+    (void) evtimer_add(dl->timer, &tv);
+
+    if (dl->action) {
+	lmap_wrn("action '%s' exceeded its timeout of %" PRIu32 " seconds - stopping it",
+		 dl->action->name, dl->action->timeout);
+	dl->action->cnt_timeouts++;
+	action_kill(lmapd, dl->action);
+    } else {
+	lmap_wrn("schedule '%s' exceeded its duration of %" PRIu64 " seconds - stopping it",
+		 schedule->name, schedule->duration);
+	schedule->cnt_timeouts++;
+	schedule_kill(lmapd, schedule);
+    }
+}
+
+static int
+suppression_start(struct lmapd *lmapd, struct supp *supp)
+{
+    struct lmap *lmap;
+    struct schedule *schedule;
+
+    assert(lmapd);
+
+    lmap = lmapd->lmap;
+    if (!lmap || !supp || !supp->match || !supp->name) {
+	return 0;
+    }
+
+    // lmap_dbg("starting suppression %s", supp->name);
+    supp->state = LMAP_SUPP_STATE_ACTIVE;
+
+    for (schedule = lmap->schedules; schedule; schedule = schedule->next) {
+	suppress_schedule(lmapd, supp, schedule);
+    }
+
+    return 0;
+}
+
+static int
+suppression_end(struct lmapd *lmapd, struct supp *supp)
+{
+    struct lmap *lmap;
+    struct schedule *schedule;
+    struct action *action;
+
+    assert(lmapd);
+
+    lmap = lmapd->lmap;
+    if (!lmap || !supp || !supp->match || !supp->name) {
+	return 0;
+    }
+
+    // lmap_dbg("ending suppression %s", supp->name);
+    supp->state = LMAP_SUPP_STATE_ENABLED;
+
+    for (schedule = lmap->schedules; schedule; schedule = schedule->next)
+    {
+	if (schedule->state == LMAP_SCHEDULE_STATE_DISABLED) {
+	    continue;
+	}
+
+	if (big_tag_match(supp->match, schedule->suppression_tags)) {
+	    // lmap_dbg("unsuppressing %s", schedule->name);
+	    if (schedule->cnt_active_suppressions) {
+		schedule->cnt_active_suppressions--;
+	    }
+	    if (schedule->cnt_active_suppressions == 0) {
+		if (schedule->state == LMAP_SCHEDULE_STATE_SUPPRESSED) {
+		    schedule->state = LMAP_SCHEDULE_STATE_ENABLED;
+		}
+	    }
+	}
+
+	for (action = schedule->actions; action; action = action->next) {
+	    if (action->state == LMAP_ACTION_STATE_DISABLED) {
+		continue;
+	    }
+	    if (big_tag_match(supp->match, action->suppression_tags)) {
+		// lmap_dbg("unsuppressing %s", action->name);
+		if (action->cnt_active_suppressions) {
+		    action->cnt_active_suppressions--;
+		}
+		if (action->cnt_active_suppressions == 0) {
+		    if (action->state == LMAP_ACTION_STATE_SUPPRESSED) {
+			action->state = LMAP_ACTION_STATE_ENABLED;
+		    }
+		}
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Convert the resource usage of a reaped child. Linux reports the
+ * maximum resident set size in kilobytes.
+ */
+
+static void
+usage_from_rusage(struct usage *usage, const struct rusage *ru)
+{
+    usage->user_time = (uint64_t) ru->ru_utime.tv_sec * 1000000
+	+ (uint64_t) ru->ru_utime.tv_usec;
+    usage->system_time = (uint64_t) ru->ru_stime.tv_sec * 1000000
+	+ (uint64_t) ru->ru_stime.tv_usec;
+    usage->max_rss = (uint64_t) ru->ru_maxrss;
+    usage->block_input = (uint64_t) ru->ru_inblock;
+    usage->block_output = (uint64_t) ru->ru_oublock;
+    usage->voluntary_switches = (uint64_t) ru->ru_nvcsw;
+    usage->involuntary_switches = (uint64_t) ru->ru_nivcsw;
+}
+
+/**
+ * @brief Process the completion of an action
+ *
+ * Updates the state and the counters of an action that has been
+ * reaped, moves its results to the destinations, starts subsequent
+ * actions of sequential schedules and finishes the schedule if
+ * this was its last running action.
+ *
+ * @param lmapd pointer to a struct lmapd
+ * @param schedule pointer to the schedule of the action
+ * @param action pointer to the completed action
+ * @param status exit status or negated signal number of the action
+ * @param ru resource usage of the action
+ */
+
+static void
+action_done(struct lmapd *lmapd, struct schedule *schedule,
+	    struct action *action, int status, const struct rusage *ru)
+{
+    struct timeval t;
+    struct schedule **dst;
+    struct usage usage;
+    struct workspace_job *job, *after = NULL;
+    struct stat st;
+
+    event_base_gettimeofday_cached(lmapd->base, &t);
+
+    if (lmapd->running) {
+	lmapd->running--;
+    }
+
+    deadline_disarm(&action->deadline);
+    output_watch_disarm(&action->output_watch);
+
+    action->pid = 0;
+    action->state = LMAP_ACTION_STATE_ENABLED;
+    action->last_completion = t.tv_sec;
+    action->last_status = status;
+
+    usage_from_rusage(&usage, ru);
+    action->last_usage = usage;
+    lmap_usage_add(&action->usage, &usage);
+    lmap_usage_add(&schedule->last_usage, &usage);
+    lmap_usage_add(&schedule->usage, &usage);
+
+    if (action->last_status != 0) {
+	action->last_failed_completion = action->last_completion;
+	action->last_failed_status = action->last_status;
+	action->cnt_failures++;
+    }
+
+    /*
+     * Save some meta information about the completion of this
+     * action in the action workspace.
+     */
+
+    (void) lmapd_workspace_action_meta_add_end(schedule, action);
+
+    /*
+     * Move the action results to the destinations and afterwards
+     * cleanup the action workspace, unless we need to defer the
+     * move to after the whole schedule (i.e. all its actions)
+     * finished. Only moves to the action's own schedule happen
+     * right away, see lmapd_workspace_action_move(). This is done
+     * by a worker, and the next action of a sequential schedule is
+     * queued by action_next() once the results were moved (and
+     * committed, see commit_add()).
+     */
+
+    /*
+     * Stages of a pipeline that wrote into the pipe have no results
+     * to deliver, their workspace is only cleaned.
+     *
+     * we only reset the MOVEDEFERRED FLAG when we move or clean,
+     * as it is safer (less chance of data loss due to a bug).
+     *
+     * action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED;
+     */
+    job = lmapd_workspace_job_new();
+    if (job && action->output_fd != -1
+	&& (action->output_spilled
+	    || (action->flags & LMAP_ACTION_FLAG_FLUSHING)
+	    || fstat(action->output_fd, &st) == -1
+	    || (uint64_t) st.st_size > action->output_memory_limit)) {
+	/* too large to be kept in memory, or partly written already */
+	(void) lmapd_workspace_job_action_spill(job, schedule, action);
+    }
+    if (job) {
+	/* account for the files the action wrote */
+	(void) lmapd_workspace_job_action_measure(job, schedule, action);
+    }
+    if (action->last_status == 0 && action->destination_schedules
+	&& !(action->flags & LMAP_ACTION_FLAG_PIPED)) {
+	for (dst = action->destination_schedules; *dst; dst++) {
+	    if (*dst != schedule) {
+		action->flags |= LMAP_ACTION_FLAG_MOVEDEFERRED;
+	    } else if (job) {
+		job_deliver(lmapd, job, &after, schedule, action, *dst);
+	    }
+	}
+    }
+    action->flags &= ~LMAP_ACTION_FLAG_PIPED;
+    if (!(action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED) && job) {
+	/* cleanup early to free space early */
+	(void) lmapd_workspace_job_action_clean(after ? after : job,
+						schedule, action);
+	/* action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED; */
+    }
+
+    wsjob_submit(lmapd, WSJOB_OUTPUT, schedule, action, job, after);
+
+    /* a slot became available */
+    admission_run(lmapd);
+}
+
+/*
+ * Is there any subsequent action in a sequential schedule? If so,
+ * queue the next action in sequence except when the schedule got
+ * meanwhile suppressed and the stop all running flag is set, or when
+ * the schedule ran out of time.
+ */
+
+static void
+action_next(struct lmapd *lmapd, struct schedule *schedule,
+	    struct action *action)
+{
+    if (action->next && schedule
+	&& schedule->mode == LMAP_SCHEDULE_EXEC_MODE_SEQUENTIAL) {
+	if (schedule->state != LMAP_SCHEDULE_STATE_SUPPRESSED
+	    && ! (schedule->flags & LMAP_SCHEDULE_FLAG_STOP_RUNNING)
+	    && ! (schedule->deadline && schedule->deadline->killed)) {
+	    (void) action_admit(lmapd, schedule, action->next, 0);
+	}
+    }
+}
+
+/**
+ * @brief Finish a schedule
+ *
+ * RUNNING schedules need to be switched to ENABLED when all of
+ * its actions have left the running state and the admission queue,
+ * its workspace jobs completed, and it was processed for MOVEDEFERRED.
+ *
+ * DISABLED schedules need to be processed for MOVEDEFERRED
+ * when all of its actions have left the running state.
+ *
+ * Cleanup the schedule processing queue if at least one action
+ * was executed, and every executed action returned success.
+ *
+ * @param lmapd pointer to a struct lmapd
+ * @param schedule pointer to the schedule
+ */
+
+static void
+schedule_finish(struct lmapd *lmapd, struct schedule *schedule)
+{
+    int succeeded;
+    struct action *action;
+    struct schedule **dst;
+    struct pending *p;
+    struct workspace_job *job, *after = NULL;
+
+    if (schedule_busy(schedule)) {
+	return;
+    }
+
+    /* Move the results of any actions that had pending results, and
+     * clean the action workspaces. This is done by a worker, which
+     * calls us again when done. Nothing to account for if no action
+     * was started. */
+    if (schedule->flags & LMAP_SCHEDULE_FLAG_STARTED) {
+	schedule->flags &= ~LMAP_SCHEDULE_FLAG_STARTED;
+	succeeded = 0;
+	for (action = schedule->actions; action; action = action->next) {
+	    succeeded |= (action->last_status == 0);
+	}
+
+	/* FIXME: this will move whatever fraction of a schedule that
+	 * did run before suppresion with SCHEDULE_FLAG_STOP_RUNNING.
+	 * In that case we might want to just drop the results, instead? */
+
+	job = lmapd_workspace_job_new();
+	for (action = schedule->actions; action; action = action->next) {
+	    if ((action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED)
+		&& action->destination_schedules && job) {
+		for (dst = action->destination_schedules; *dst; dst++) {
+		    job_deliver(lmapd, job, &after, schedule, action, *dst);
+		}
+	    }
+	}
+	for (action = schedule->actions; action; action = action->next) {
+	    action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED;
+	    if (job) {
+		(void) lmapd_workspace_job_action_clean(after ? after : job,
+							schedule, action);
+	    }
+	}
+
+	/* account for the schedule run, and cleanup its input queue */
+	if (succeeded) {
+	    /* there was at least one action, and none failed */
+	    if (job) {
+		(void) lmapd_workspace_job_schedule_clean(after ? after : job,
+							  schedule);
+	    }
+	} else {
+	    schedule->cnt_failures++;
+	}
+
+	wsjob_submit(lmapd, WSJOB_FINISH, schedule, NULL, job, after);
+	return;
+    }
+
+    deadline_disarm(&schedule->deadline);
+
+    /* apply a reload that waited for this schedule (not from here,
+     * our callers may still use the schedule) */
+    for (p = lmapd->pending; p && p->schedule != schedule; p = p->next) ;
+    if (p && lmapd->pending_timer) {
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+	(void) evtimer_add(lmapd->pending_timer, &tv);
+    }
+    if (schedule->state == LMAP_SCHEDULE_STATE_RUNNING) {
+	schedule->state = LMAP_SCHEDULE_STATE_ENABLED;
+	if (schedule->cnt_active_suppressions) {
+	    schedule->state = LMAP_SCHEDULE_STATE_SUPPRESSED;
+	}
+    }
+}
+
+/**
+ * @brief Callback called from the event loop
+ *
+ * Function which is executed when SIGCHLD is received. It calls
+ * waitpid() to see if any children changed their status and passes
+ * completed actions to action_done(). Children watched by a pidfd
+ * are reaped by pidfd_cb() instead, so the loop is skipped if all
+ * running children are watched.
+ *
+ * @param lmapd pointer to a struct lmapd
+ */
+
+void
+lmapd_cleanup(struct lmapd *lmapd)
+{
+    pid_t pid;
+    int status;
+    struct rusage ru;
+    struct lmap *lmap;
+    struct action *action;
+    struct schedule *schedule;
+
+    assert(lmapd);
+    lmap = lmapd->lmap;
+    if (! lmap) {
+	return;
+    }
+
+    if (! lmapd_pidtab_unwatched(lmapd->pidtab)) {
+	return;
+    }
+
+    while (1) {
+	memset(&ru, 0, sizeof(ru));
+	pid = wait4(-1, &status, WNOHANG, &ru);
+	if (pid == 0 || pid == -1) {
+	    return;
+	}
+
+	if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+	    continue;
+	}
+
+	schedule = NULL;
+	action = lmapd_pidtab_find(lmapd->pidtab, pid, &schedule);
+	if (action) {
+	    (void) lmapd_pidtab_remove(lmapd->pidtab, pid);
+	} else {
+	    action = find_action_by_pid(lmap, pid, &schedule);
+	    if (lmapd->pidtab && lmapd->pidtab->untracked) {
+		lmapd->pidtab->untracked--;
+	    }
+	}
+	if (! action || ! schedule) {
+	    lmap_dbg("ignoring pid '%d'", pid);
+	    continue;
+	}
+
+	action_done(lmapd, schedule, action,
+		    WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status), &ru);
+    }
+}
+
+/**
+ * @brief Callback called from the event loop
+ *
+ * Function which is executed by the event loop when an event
+ * fires. It loops through the schedules started or ended by the
+ * event (see lmap_link_events()) and executes or stops them.
+ *
+ * @param lmapd pointer to a struct lmapd
+ */
+
+static void
+execute_cb(struct lmapd *lmapd, struct event *event)
+{
+    struct schedule *sched;
+    int i;
+
+    assert(lmapd && event);
+
+    if (! lmapd->lmap || ! event->start_schedules || ! event->end_schedules) {
+	return;
+    }
+
+    for (i = 0; (sched = event->start_schedules[i]); i++) {
+
+	if (sched->state == LMAP_SCHEDULE_STATE_DISABLED) {
+	    continue;
+	}
+
+	if (! sched->name) {
+	    lmap_err("disabling unnamed schedule");
+	    sched->state = LMAP_SCHEDULE_STATE_DISABLED;
+	    continue;
+	}
+
+	if (sched->state == LMAP_SCHEDULE_STATE_SUPPRESSED) {
+	    sched->cnt_suppressions++;
+	    continue;
+	}
+	if (sched->state == LMAP_SCHEDULE_STATE_RUNNING) {
+	    lmap_wrn("schedule '%s' still running - skipping", sched->name);
+	    sched->cnt_overlaps++;
+	    continue;
+	}
+
+	sched->cycle_number = 0;
+	if (event->flags & LMAP_EVENT_FLAG_CYCLE_INTERVAL_SET
+	    && event->cycle_interval) {
+	    struct timeval t;
+	    event_base_gettimeofday_cached(lmapd->base, &t);
+	    sched->cycle_number = (t.tv_sec / event->cycle_interval) * event->cycle_interval;
+	}
+
+	lmapd_schedule_exec(lmapd, sched);
+	if (event->type == LMAP_EVENT_TYPE_ONE_OFF
+	    || event->type == LMAP_EVENT_TYPE_IMMEDIATE
+	    || event->type == LMAP_EVENT_TYPE_STARTUP) {
+	    sched->state = LMAP_SCHEDULE_STATE_DISABLED;
+	}
+	if (event->type == LMAP_EVENT_TYPE_STARTUP) {
+	    lmapd->flags |= LMAPD_FLAG_STARTUPDONE;
+	}
+    }
+
+    for (i = 0; (sched = event->end_schedules[i]); i++) {
+	schedule_kill(lmapd, sched);
+    }
+}
+
+/**
+ * @brief Callback called from the event loop
+ *
+ * Function which is executed by the event loop when an event
+ * fires. It loops through the suppressions started or ended by the
+ * event (see lmap_link_events()) and activates or deactivates them.
+ *
+ * @param lmapd pointer to a struct lmapd
+ */
+
+static void
+suppress_cb(struct lmapd *lmapd, struct event *event)
+{
+    struct supp *supp;
+    int i;
+
+    assert(lmapd && event);
+
+    if (! lmapd->lmap || ! event->start_supps || ! event->end_supps) {
+	return;
+    }
+
+    for (i = 0; (supp = event->start_supps[i]); i++) {
+
+	if (supp->state == LMAP_SUPP_STATE_DISABLED) {
+	    continue;
+	}
+
+	if (! supp->name) {
+	    lmap_err("disabling unnamed suppression");
+	    supp->state = LMAP_SUPP_STATE_DISABLED;
+	    continue;
+	}
+
+	if (supp->state == LMAP_SUPP_STATE_ENABLED) {
+	    suppression_start(lmapd, supp);
+	} else {
+	    lmap_wrn("suppression '%s' not enabled - skipping",
+		     supp->name);
+	}
+    }
+
+    for (i = 0; (supp = event->end_supps[i]); i++) {
+
+	if (supp->state == LMAP_SUPP_STATE_DISABLED || ! supp->name) {
+	    continue;
+	}
+
+	if (supp->state == LMAP_SUPP_STATE_ACTIVE) {
+	    suppression_end(lmapd, supp);
+	} else {
+	    lmap_wrn("suppression '%s' not active - skipping",
+		     supp->name);
+	}
+    }
+}
+
+/**
+ * @brief Callback called from the event loop
+ *
+ * This function is executed when the event passed in the context
+ * fires.
+ *
+ * @param fd unused
+ * @param events unused
+ * @param context pointer to a struct event
+ */
+
+static void
+fire_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct event *event = (struct event *) context;
+
+    (void) fd;
+    (void) events;
+
+    assert(event && event->lmapd);
+
+    suppress_cb(event->lmapd, event);
+    execute_cb(event->lmapd, event);
+
+    safe_event_free(event->fire_event);
+    event->fire_event = NULL;
+}
+
+static void
+trigger_periodic_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct event *event = (struct event *) context;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+    struct timeval t;
+
+    (void) fd;
+    (void) events;
+
+    assert(event && event->lmapd);
+
+    event_base_gettimeofday_cached(event->lmapd->base, &t);
+    if (event->flags & LMAP_EVENT_FLAG_END_SET) {
+	if (t.tv_sec > event->end) {
+	    /* XXX disable related schedules / suppressions */
+	    lmap_wrn("event '%s' ending", event->name);
+	    safe_event_free(event->trigger_event);
+	    event->trigger_event = NULL;
+	    return;
+	}
+    }
+
+    add_random_spread(event, &tv);
+    event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
+}
+
+static void
+trigger_calendar_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct event *event = (struct event *) context;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+    struct timeval t;
+    time_t next;
+    int match;
+
+    (void) fd;
+    (void) events;
+
+    assert(event && event->lmapd);
+
+    event_base_gettimeofday_cached(event->lmapd->base, &t);
+    if (event->flags & LMAP_EVENT_FLAG_END_SET) {
+	if (t.tv_sec > event->end) {
+	    /* XXX disable related schedules / suppressions */
+	    lmap_wrn("event '%s' ending", event->name);
+	    safe_event_free(event->trigger_event);
+	    event->trigger_event = NULL;
+	    return;
+	}
+    }
+
+    match = lmap_event_calendar_match(event, &t.tv_sec);
+    if (match < 0) {
+	lmap_err("shutting down '%s'", event->name);
+	safe_event_free(event->trigger_event);
+	event->trigger_event = NULL;
+	return;
+    }
+
+    if (match) {
+	add_random_spread(event, &tv);
+	event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
+    }
+
+    /*
+     * Sleep until the next matching point in time. If the timer
+     * happens to expire early, we simply do not match and calculate
+     * the next point in time again.
+     */
+
+    if (lmap_event_calendar_next(event, t.tv_sec, &next) != 0) {
+	lmap_err("event '%s' will never match again - shutting down", event->name);
+	safe_event_free(event->trigger_event);
+	event->trigger_event = NULL;
+	return;
+    }
+
+    tv.tv_sec = next - t.tv_sec;
+    tv.tv_usec = 0;
+    event_add(event->trigger_event, &tv);
+}
+
+static void
+startup_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct event *event = (struct event *) context;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+
+    (void) fd;
+    (void) events;
+
+    switch (event->type) {
+    case LMAP_EVENT_TYPE_PERIODIC:
+	tv.tv_sec = event->interval;
+	event_gaga(event, &event->trigger_event, EV_PERSIST, trigger_periodic_cb, &tv);
+	trigger_periodic_cb(-1, 0, event);
+	break;
+    case LMAP_EVENT_TYPE_CALENDAR:
+	event_gaga(event, &event->trigger_event, EV_TIMEOUT, trigger_calendar_cb, &tv);
+	break;
+    default:
+	break;
+    }
+
+    safe_event_free(event->start_event);
+    event->start_event = NULL;
+}
+
+/**
+ * @brief Arms the timers of an event
+ *
+ * Events that are not used by any schedule or suppression are not
+ * armed. Startup events are not armed on a reload, immediate events
+ * fire again on a reload.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param event pointer to the struct event
+ * @param now the current time
+ * @param reload whether the configuration is being reloaded
+ */
+
+static void
+event_arm(struct lmapd *lmapd, struct event *event, time_t now, int reload)
+{
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+    struct schedule *sched;
+    int i;
+
+    if (! event->name) {
+	return;
+    }
+
+
+    /* skip events that are not used by anyone */
+    if (!(event->start_schedules && event->start_schedules[0])
+	&& !(event->end_schedules && event->end_schedules[0])
+	&& !(event->start_supps && event->start_supps[0])
+	&& !(event->end_supps && event->end_supps[0])) {
+	lmap_wrn("event '%s' is not used - skipping", event->name);
+	return;
+    }
+
+    event->lmapd = lmapd;	/* this avoids a new data structure */
+    switch (event->type) {
+    case LMAP_EVENT_TYPE_PERIODIC:
+	if (event->flags & LMAP_EVENT_FLAG_END_SET) {
+	    if (now > event->end) {
+		lmap_wrn("event '%s' ended in the past", event->name);
+		break;
+	    }
+	}
+	if (event->flags & LMAP_EVENT_FLAG_START_SET) {
+	    if (now > event->start) {
+		int64_t delta = (now - event->start) / event->interval;
+		tv.tv_sec = (time_t)((event->start + (delta + 1) * event->interval) - now);
+	    } else {
+		tv.tv_sec = event->start - now;
+	    }
+	}
+	event_gaga(event, &event->start_event, EV_TIMEOUT, startup_cb, &tv);
+	break;
+
+    case LMAP_EVENT_TYPE_CALENDAR:
+	if (event->flags & LMAP_EVENT_FLAG_END_SET) {
+	    if (now > event->end) {
+		lmap_wrn("event '%s' ended in the past", event->name);
+		break;
+	    }
+	}
+	event_gaga(event, &event->start_event, EV_TIMEOUT, startup_cb, &tv);
+	break;
+
+    case LMAP_EVENT_TYPE_ONE_OFF:
+	if (now < event->start) {
+	    lmap_wrn("event '%s' is in the past", event->name);
+	    break;
+	}
+	tv.tv_sec = event->start-now;
+	add_random_spread(event, &tv);
+	event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
+	break;
+
+    case LMAP_EVENT_TYPE_STARTUP:
+	if (reload || (lmapd->flags & LMAPD_FLAG_SKIPSTARTUP)) {
+	    lmap_dbg("skipping startup event '%s' on restart", event->name);
+	    break;
+	}
+	/* fallthrough */
+    case LMAP_EVENT_TYPE_IMMEDIATE:
+	if (event->fire_event) {
+	    break;
+	}
+	if (reload) {
+	    /* schedules disabled by the previous firing run again */
+	    for (i = 0; (sched = event->start_schedules[i]); i++) {
+		if (sched->state == LMAP_SCHEDULE_STATE_DISABLED) {
+		    sched->state = schedule_busy(sched)
+			? LMAP_SCHEDULE_STATE_RUNNING
+			: sched->cnt_active_suppressions
+			? LMAP_SCHEDULE_STATE_SUPPRESSED
+			: LMAP_SCHEDULE_STATE_ENABLED;
+		}
+	    }
+	}
+	add_random_spread(event, &tv);
+	event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
+	break;
+
+    default:
+	lmap_wrn("ignoring event '%s' (not implemented)", event->name);
+	break;
+    }
+
+}
+
+static void
+event_disarm(struct event *event)
+{
+    if (event->start_event) {
+	event_free(event->start_event);
+	event->start_event = NULL;
+    }
+    if (event->trigger_event) {
+	event_free(event->trigger_event);
+	event->trigger_event = NULL;
+    }
+    if (event->fire_event) {
+	event_free(event->fire_event);
+	event->fire_event = NULL;
+    }
+}
+
+/**
+ * @brief Reads the configuration
+ *
+ * Reads the configuration from the config paths and the capabilities
+ * from the capability path into a new struct lmap.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return pointer to a new struct lmap on success, NULL on error
+ */
+
+struct lmap *
+lmapd_read_config(struct lmapd *lmapd)
+{
+    struct lmap *lmap;
+    struct paths *paths;
+
+    lmap = lmap_new();
+    if (! lmap) {
+	return NULL;
+    }
+
+    for (paths = lmapd->config_paths; paths && paths->path; paths = paths->next) {
+	if (lmap_io_parse_config_path(lmap, paths->path) != 0) {
+	    lmap_free(lmap);
+	    return NULL;
+	}
+    }
+
+    if (lmap->agent) {
+	lmap->agent->last_started = time(NULL);
+    }
+
+    if (lmap_io_parse_state_path(lmap, lmapd->capability_path) != 0) {
+	lmap_free(lmap);
+	return NULL;
+    }
+
+    if (!lmap->capabilities) {
+	lmap->capabilities = lmap_capability_new();
+    }
+    if (lmap->capabilities) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s version %d.%d.%d", LMAPD_LMAPD,
+		 LMAP_VERSION_MAJOR, LMAP_VERSION_MINOR, LMAP_VERSION_PATCH);
+	lmap_capability_set_version(lmap->capabilities, buf);
+	lmap_capability_add_system_tags(lmap->capabilities);
+    }
+
+    return lmap;
+}
+
+/*
+ * Carry the counters of a schedule and of its actions (matched by
+ * name) over to a new definition of the schedule.
+ */
+
+static void
+schedule_carry(struct schedule *dst, struct schedule *src)
+{
+    struct action *a, *b;
+
+    dst->storage = src->storage;
+    dst->cnt_invocations = src->cnt_invocations;
+    dst->cnt_failures = src->cnt_failures;
+    dst->cnt_suppressions = src->cnt_suppressions;
+    dst->cnt_overlaps = src->cnt_overlaps;
+    dst->cnt_timeouts = src->cnt_timeouts;
+    dst->cnt_quota_hits = src->cnt_quota_hits;
+    dst->evicted_bytes = src->evicted_bytes;
+    dst->last_invocation = src->last_invocation;
+    dst->last_usage = src->last_usage;
+    dst->usage = src->usage;
+    if (! dst->qindex) {
+	/* jobs still running update the same index */
+	dst->qindex = lmapd_qindex_ref(src->qindex);
+    }
+
+    for (a = dst->actions; a; a = a->next) {
+	for (b = src->actions; b; b = b->next) {
+	    if (a->name && b->name && strcmp(a->name, b->name) == 0) {
+		break;
+	    }
+	}
+	if (! b) {
+	    continue;
+	}
+	a->storage = b->storage;
+	a->last_invocation = b->last_invocation;
+	a->last_completion = b->last_completion;
+	a->last_status = b->last_status;
+	a->last_failed_completion = b->last_failed_completion;
+	a->last_failed_status = b->last_failed_status;
+	a->cnt_invocations = b->cnt_invocations;
+	a->cnt_failures = b->cnt_failures;
+	a->cnt_suppressions = b->cnt_suppressions;
+	a->cnt_overlaps = b->cnt_overlaps;
+	a->cnt_timeouts = b->cnt_timeouts;
+	a->last_usage = b->last_usage;
+	a->usage = b->usage;
+	if (a->output_fd == -1) {
+	    a->output_fd = b->output_fd;
+	    a->output_spilled = b->output_spilled;
+	    a->flags |= b->flags & LMAP_ACTION_FLAG_FLUSHING;
+	    b->output_fd = -1;
+	}
+    }
+}
+
+/*
+ * Apply the active suppressions to a schedule that was not part of
+ * the configuration when they were started.
+ */
+
+static void
+schedule_suppress_active(struct lmapd *lmapd, struct supp *supps,
+			 struct schedule *schedule)
+{
+    struct supp *supp;
+
+    for (supp = supps; supp; supp = supp->next) {
+	if (supp->state == LMAP_SUPP_STATE_ACTIVE && supp->match) {
+	    suppress_schedule(lmapd, supp, schedule);
+	}
+    }
+}
+
+static int
+pending_add(struct lmapd *lmapd, struct schedule *schedule,
+	    struct schedule *replacement)
+{
+    struct pending *p;
+
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+	lmap_err("failed to allocate pending reload");
+	return -1;
+    }
+    p->schedule = schedule;
+    p->replacement = replacement;
+    p->next = lmapd->pending;
+    lmapd->pending = p;
+    return 0;
+}
+
+static void
+pending_flush(struct lmapd *lmapd)
+{
+    struct pending *p;
+
+    while (lmapd->pending) {
+	p = lmapd->pending;
+	lmapd->pending = p->next;
+	lmap_schedule_free(p->replacement);
+	free(p);
+    }
+}
+
+static uint64_t
+monotonic_usec(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Callback measuring the event loop lag
+ *
+ * The timer is due every LMAPD_LAG_INTERVAL seconds. How late it
+ * fires is how long callbacks were blocking the event loop.
+ */
+
+static void
+lag_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct lmapd *lmapd = (struct lmapd *) context;
+    struct timeval tv = { .tv_sec = LMAPD_LAG_INTERVAL, .tv_usec = 0 };
+    struct agent *agent;
+    uint64_t now, lag;
+
+    UNUSED(fd);
+    UNUSED(events);
+
+    now = monotonic_usec();
+    lag = (lmapd->lag_due && now > lmapd->lag_due) ? now - lmapd->lag_due : 0;
+    agent = lmapd->lmap ? lmapd->lmap->agent : NULL;
+    if (agent && lmapd->lag_due) {
+	agent->loop_lag = lag;
+	if (lag > agent->loop_max_lag) {
+	    agent->loop_max_lag = lag;
+	}
+    }
+
+    lmapd->lag_due = now + (uint64_t) LMAPD_LAG_INTERVAL * 1000000;
+    (void) evtimer_add(lmapd->lag_timer, &tv);
+}
+
+/**
+ * @brief Measure the storage of all schedules and actions
+ *
+ * lmapd accounts for the output of actions and for the files it moves
+ * and removes as it goes. This measures the workspaces on a worker
+ * thread, to correct for changes made by anything else. The key makes
+ * sure that only one measurement runs at a time.
+ *
+ * @param lmapd pointer to the struct lmapd
+ */
+
+static void
+storage_update(struct lmapd *lmapd)
+{
+    struct wsjob *w;
+
+    if (! lmapd->lmap) {
+	return;
+    }
+
+    w = calloc(1, sizeof(*w));
+    if (! w) {
+	lmap_err("failed to allocate memory");
+	return;
+    }
+    w->type = WSJOB_STORAGE;
+    w->lmapd = lmapd;
+    w->job = lmapd_workspace_job_new();
+    if (! w->job) {
+	free(w);
+	return;
+    }
+    (void) lmapd_workspace_job_update(w->job, lmapd->lmap);
+    (void) lmapd_workers_submit(lmapd->workers, &lmapd->storage_timer,
+				wsjob_work, wsjob_done, w);
+}
+
+/**
+ * @brief Callback measuring the storage periodically
+ */
+
+static void
+storage_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct lmapd *lmapd = (struct lmapd *) context;
+
+    UNUSED(fd);
+    UNUSED(events);
+
+    storage_update(lmapd);
+}
+
+/*
+ * A snapshot job writes a serialized copy of the runtime state to the
+ * snapshot file on a worker thread, see snapshot_update().
+ */
+
+struct snapshot_job {
+    char *run_path;
+    char *buf;
+    size_t size;
+};
+
+static void
+snapshot_work(void *arg)
+{
+    struct snapshot_job *sj = arg;
+
+    (void) lmapd_snapshot_store(sj->run_path, sj->buf, sj->size);
+}
+
+static void
+snapshot_done(void *arg, int cancelled)
+{
+    struct snapshot_job *sj = arg;
 
-	{
-	    if (!still_running) {
-		/* FIXME: this will move whatever fraction of a schedule that
-		 * did run before suppresion with SCHEDULE_FLAG_STOP_RUNNING.
-		 * In that case we might want to just drop the results, instead? */
-
-		/* Move the results of any actions that had pending results,
-		 * and clean the action workspaces */
-		for (action = schedule->actions; action; action = action->next) {
-		    if (action->flags & LMAP_ACTION_FLAG_MOVEDEFERRED) {
-			for (tag = action->destinations; tag; tag = tag->next) {
-			    struct schedule * const dst = lmap_find_schedule(lmap, tag->tag);
-			    if (dst) {
-				// lmap_dbg("lmap_cleanup: processing deferral for %s::%s destination %s", schedule->name, action->name, dst->name);
-				(void) lmapd_workspace_action_move(lmapd, schedule, action, dst, 0);
-			    }
-			}
-		    }
-		    // lmap_dbg("lmap_cleanup: final cleanup for %s::%s", schedule->name, action->name);
-		    action->flags &= ~LMAP_ACTION_FLAG_MOVEDEFERRED;
-		    (void) lmapd_workspace_action_clean(lmapd, action);
-		}
+    UNUSED(cancelled);
 
-		/* account for the schedule run, and cleanup its input queue */
-		if (succeeded) {
-		    /* there was at least one action, and none failed */
-		    lmapd_workspace_schedule_clean(lmapd, schedule);
-		} else {
-		    schedule->cnt_failures++;
-		}
-	    }
-	}
-    }
+    free(sj->run_path);
+    free(sj->buf);
+    free(sj);
 }
 
 /**
- * @brief Callback called from the event loop
+ * @brief Write the runtime state snapshot
  *
- * Function which is executed by the event loop when an event
- * fires. It loops through the existing schedules and checks which one
- * needs to be executed.
+ * The runtime state is serialized on the event loop, and the copy is
+ * written (and synced) to the snapshot file by a worker thread. The
+ * key makes sure that the snapshots are written one at a time, in
+ * order.
  *
- * @param lmapd pointer to a struct lmapd
+ * @param lmapd pointer to the struct lmapd
  */
 
 static void
-execute_cb(struct lmapd *lmapd, struct event *event)
+snapshot_update(struct lmapd *lmapd)
 {
-    struct schedule *sched;
-
-    assert(lmapd && event);
+    struct snapshot_job *sj;
 
-    if (! lmapd->lmap) {
+    sj = calloc(1, sizeof(*sj));
+    if (! sj) {
+	lmap_err("failed to allocate memory");
 	return;
     }
+    if (lmapd_snapshot_build(lmapd, &sj->buf, &sj->size) || ! sj->buf
+	|| ! (sj->run_path = strdup(lmapd->run_path))) {
+	snapshot_done(sj, 1);
+	return;
+    }
+    (void) lmapd_workers_submit(lmapd->workers, &lmapd->snapshot_timer,
+				snapshot_work, snapshot_done, sj);
+}
 
-    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
-
-	if (sched->state == LMAP_SCHEDULE_STATE_DISABLED) {
-	    goto next;
-	}
-
-	if (! sched->name) {
-	    lmap_err("disabling unnamed schedule");
-	    sched->state = LMAP_SCHEDULE_STATE_DISABLED;
-	    goto next;
-	}
-
-	if (sched->start && !strcmp(sched->start, event->name)) {
-	    if (sched->state == LMAP_SCHEDULE_STATE_SUPPRESSED) {
-		sched->cnt_suppressions++;
-		goto next;
-	    }
-	    if (sched->state == LMAP_SCHEDULE_STATE_RUNNING) {
-		lmap_wrn("schedule '%s' still running - skipping", sched->name);
-		sched->cnt_overlaps++;
-		goto next;
-	    }
-
-	    sched->cycle_number = 0;
-	    if (event->flags & LMAP_EVENT_FLAG_CYCLE_INTERVAL_SET
-		&& event->cycle_interval) {
-		struct timeval t;
-		event_base_gettimeofday_cached(lmapd->base, &t);
-		sched->cycle_number = (t.tv_sec / event->cycle_interval) * event->cycle_interval;
-	    }
+/**
+ * @brief Callback writing the runtime state snapshot periodically
+ */
 
-	    lmapd_workspace_schedule_move(lmapd, sched);
-	    schedule_exec(lmapd, sched);
-	    if (event->type == LMAP_EVENT_TYPE_ONE_OFF
-		|| event->type == LMAP_EVENT_TYPE_IMMEDIATE
-		|| event->type == LMAP_EVENT_TYPE_STARTUP) {
-		sched->state = LMAP_SCHEDULE_STATE_DISABLED;
-	    }
-	    if (event->type == LMAP_EVENT_TYPE_STARTUP) {
-		lmapd->flags |= LMAPD_FLAG_STARTUPDONE;
-	    }
-	}
+static void
+snapshot_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct lmapd *lmapd = (struct lmapd *) context;
 
-    next:
+    UNUSED(fd);
+    UNUSED(events);
 
-	if (sched->end && !strcmp(sched->end, event->name)) {
-	    schedule_kill(lmapd, sched);
-	}
-    }
+    snapshot_update(lmapd);
 }
 
 /**
- * @brief Callback called from the event loop
- *
- * Function which is executed by the event loop when an event
- * fires. It loops through the existing suppressions and checks which
- * suppressions need to be actived or deactived.
+ * @brief Callback applying the reloads of finished schedules
  *
- * @param lmapd pointer to a struct lmapd
+ * Replaces schedules that were changed by a reload while they were
+ * running by their new definition, and removes the ones that were
+ * removed from the configuration, once they are no longer running.
  */
 
 static void
-suppress_cb(struct lmapd *lmapd, struct event *event)
+pending_cb(evutil_socket_t fd, short events, void *context)
 {
-    struct supp *supp;
+    struct lmapd *lmapd = (struct lmapd *) context;
+    struct pending **pp, *p;
+    struct schedule **sp;
+    int applied = 0;
 
-    assert(lmapd && event);
+    UNUSED(fd);
+    UNUSED(events);
 
     if (! lmapd->lmap) {
 	return;
     }
 
-    for (supp = lmapd->lmap->supps; supp; supp = supp->next) {
-
-	if (supp->state == LMAP_SUPP_STATE_DISABLED) {
+    for (pp = &lmapd->pending; (p = *pp); ) {
+	if (schedule_busy(p->schedule)) {
+	    pp = &p->next;
 	    continue;
 	}
-
-	if (! supp->name) {
-	    lmap_err("disabling unnamed suppression");
-	    supp->state = LMAP_SUPP_STATE_DISABLED;
- 	    continue;
-	}
-
- 	if (supp->start && !strcmp(supp->start, event->name)) {
-	    if (supp->state == LMAP_SUPP_STATE_ENABLED) {
-		suppression_start(lmapd, supp);
+	*pp = p->next;
+
+	for (sp = &lmapd->lmap->schedules; *sp && *sp != p->schedule; sp = &(*sp)->next) ;
+	if (*sp) {
+	    if (p->replacement) {
+		lmap_dbg("applying the new configuration of schedule '%s'",
+			 p->schedule->name);
+		schedule_carry(p->replacement, p->schedule);
+		p->replacement->next = p->schedule->next;
+		*sp = p->replacement;
+		p->replacement = NULL;
+		schedule_suppress_active(lmapd, lmapd->lmap->supps, *sp);
 	    } else {
-		lmap_wrn("suppression '%s' not enabled - skipping",
-			 supp->name);
+		lmap_dbg("removing schedule '%s'", p->schedule->name);
+		*sp = p->schedule->next;
 	    }
+	    p->schedule->next = NULL;
+	    lmap_schedule_free(p->schedule);
+	    applied++;
 	}
+	lmap_schedule_free(p->replacement);
+	free(p);
+    }
 
-	if (supp->end && !strcmp(supp->end, event->name)) {
-	    if (supp->state == LMAP_SUPP_STATE_ACTIVE) {
-		suppression_end(lmapd, supp);
-	    } else
-		lmap_wrn("suppression '%s' not active - skipping",
-			 supp->name);
+    if (applied) {
+	if (lmap_link(lmapd->lmap)) {
+	    lmap_err("failed to link configuration - restarting...");
+	    lmapd_restart(lmapd);
+	    return;
 	}
+	(void) lmapd_workspace_init(lmapd);
     }
 }
 
 /**
- * @brief Callback called from the event loop
+ * @brief Reloads the configuration
  *
- * This function is executed when the event passed in the context
- * fires.
+ * Reads the configuration again and compares it with the running
+ * one, by the names of schedules, suppressions and events. Objects
+ * that did not change are kept together with their state, and
+ * running actions of unchanged schedules keep running. Changed
+ * schedules get the counters of their previous definition. Changed
+ * or removed schedules that are running finish with their previous
+ * definition. Only new and changed events are armed, except
+ * immediate events, which fire on every reload.
  *
- * @param fd unused
- * @param events unused
- * @param context pointer to a struct event
+ * If the new configuration cannot be read or is invalid, the running
+ * configuration is kept.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return 0 on success, -1 on error
  */
 
-static void
-fire_cb(evutil_socket_t fd, short events, void *context)
+int
+lmapd_reload(struct lmapd *lmapd)
 {
-    struct event *event = (struct event *) context;
+    struct lmap *old, *lmap;
+    struct schedule **sp, *sched, *osched;
+    struct supp **pp, *supp, *osupp, **restart = NULL;
+    struct event **ep, *event, *oevent;
+    time_t now = time(NULL);
+    size_t n = 0;
 
-    (void) fd;
-    (void) events;
-
-    assert(event && event->lmapd);
-
-    suppress_cb(event->lmapd, event);
-    execute_cb(event->lmapd, event);
-
-    safe_event_free(event->fire_event);
-    event->fire_event = NULL;
-}
+    assert(lmapd);
 
-static void
-trigger_periodic_cb(evutil_socket_t fd, short events, void *context)
-{
-    struct event *event = (struct event *) context;
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
-    struct timeval t;
+    lmap = lmapd_read_config(lmapd);
+    if (! lmap) {
+	lmap_err("failed to read configuration - keeping the running one");
+	return -1;
+    }
+    if (! lmap_valid(lmap)) {
+	lmap_err("configuration is invalid - keeping the running one");
+	lmap_free(lmap);
+	return -1;
+    }
+    for (supp = lmap->supps; supp; supp = supp->next) {
+	n++;
+    }
+    restart = calloc(n + 1, sizeof(struct supp *));
+    if (! restart) {
+	lmap_err("failed to allocate memory");
+	lmap_free(lmap);
+	return -1;
+    }
 
-    (void) fd;
-    (void) events;
+    old = lmapd->lmap;
+    pending_flush(lmapd);
 
-    assert(event && event->lmapd);
+    /*
+     * Keep unchanged suppressions. Changed or removed ones that are
+     * active are ended, the changed ones start again below.
+     */
 
-    event_base_gettimeofday_cached(event->lmapd->base, &t);
-    if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-	if (t.tv_sec > event->end) {
-	    /* XXX disable related schedules / suppressions */
-	    lmap_wrn("event '%s' ending", event->name);
-	    safe_event_free(event->trigger_event);
-	    event->trigger_event = NULL;
-	    return;
+    n = 0;
+    for (pp = &lmap->supps; (supp = *pp); pp = &(*pp)->next) {
+	osupp = lmap_find_supp(old, supp->name);
+	if (osupp && lmap_supp_equal(osupp, supp)) {
+	    lmap_remove_supp(old, osupp);
+	    osupp->next = supp->next;
+	    *pp = osupp;
+	    supp->next = NULL;
+	    lmap_supp_free(supp);
+	} else if (osupp && osupp->state == LMAP_SUPP_STATE_ACTIVE) {
+	    restart[n++] = supp;
+	}
+    }
+    for (osupp = old ? old->supps : NULL; osupp; osupp = osupp->next) {
+	if (osupp->state == LMAP_SUPP_STATE_ACTIVE) {
+	    (void) suppression_end(lmapd, osupp);
 	}
     }
 
-    add_random_spread(event, &tv);
-    event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
-}
-
-static void
-trigger_calendar_cb(evutil_socket_t fd, short events, void *context)
-{
-    struct event *event = (struct event *) context;
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
-    struct timeval t;
-    int match;
+    /*
+     * Keep unchanged schedules, and changed ones that are running
+     * until they finish. The others start afresh with the counters
+     * of their previous definition, subject to the suppressions that
+     * were kept active.
+     */
 
-    (void) fd;
-    (void) events;
+    for (sp = &lmap->schedules; (sched = *sp); sp = &(*sp)->next) {
+	osched = lmap_find_schedule(old, sched->name);
+	if (osched && (lmap_schedule_equal(osched, sched) || schedule_busy(osched))) {
+	    lmap_remove_schedule(old, osched);
+	    osched->next = sched->next;
+	    *sp = osched;
+	    sched->next = NULL;
+	    if (lmap_schedule_equal(osched, sched)
+		|| pending_add(lmapd, osched, sched)) {
+		lmap_schedule_free(sched);
+	    } else {
+		lmap_dbg("schedule '%s' is running - reloading it when it finishes",
+			 osched->name);
+	    }
+	    continue;
+	}
+	if (osched) {
+	    schedule_carry(sched, osched);
+	}
+	schedule_suppress_active(lmapd, lmap->supps, sched);
+    }
+    while (old && (osched = old->schedules)) {
+	old->schedules = osched->next;
+	osched->next = NULL;
+	if (schedule_busy(osched) && pending_add(lmapd, osched, NULL) == 0) {
+	    lmap_dbg("schedule '%s' is running - removing it when it finishes",
+		     osched->name);
+	    *sp = osched;
+	    sp = &osched->next;
+	} else {
+	    lmap_schedule_free(osched);
+	}
+    }
 
-    assert(event && event->lmapd);
+    /*
+     * Keep unchanged events, so that their timers keep running.
+     */
 
-    event_base_gettimeofday_cached(event->lmapd->base, &t);
-    if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-	if (t.tv_sec > event->end) {
-	    /* XXX disable related schedules / suppressions */
-	    lmap_wrn("event '%s' ending", event->name);
-	    safe_event_free(event->trigger_event);
-	    event->trigger_event = NULL;
-	    return;
+    for (ep = &lmap->events; (event = *ep); ep = &(*ep)->next) {
+	oevent = lmap_find_event(old, event->name);
+	if (oevent && lmap_event_equal(oevent, event)) {
+	    lmap_remove_event(old, oevent);
+	    oevent->next = event->next;
+	    *ep = oevent;
+	    event->next = NULL;
+	    lmap_event_free(event);
 	}
     }
-
-    match = lmap_event_calendar_match(event, &t.tv_sec);
-    if (match < 0) {
-	lmap_err("shutting down '%s'", event->name);
-	safe_event_free(event->trigger_event);
-	event->trigger_event = NULL;
-	return;
+    for (oevent = old ? old->events : NULL; oevent; oevent = oevent->next) {
+	event_disarm(oevent);
     }
 
-    if (match == 0) {
-	tv.tv_sec = 1;
-	event_add(event->trigger_event, &tv);
-	return;
+    if (old && old->agent && lmap->agent) {
+	lmap->agent->last_started = old->agent->last_started;
+	lmap->agent->admission_queue_depth = old->agent->admission_queue_depth;
+	lmap->agent->cnt_admissions = old->agent->cnt_admissions;
+	lmap->agent->admission_wait = old->agent->admission_wait;
+	lmap->agent->admission_max_wait = old->agent->admission_max_wait;
+	lmap->agent->loop_lag = old->agent->loop_lag;
+	lmap->agent->loop_max_lag = old->agent->loop_max_lag;
+	lmap->agent->cnt_commits = old->agent->cnt_commits;
+	lmap->agent->commit_latency = old->agent->commit_latency;
+	lmap->agent->commit_max_latency = old->agent->commit_max_latency;
+	lmap->agent->commit_batch = old->agent->commit_batch;
+	lmap->agent->commit_max_batch = old->agent->commit_max_batch;
     }
 
-    add_random_spread(event, &tv);
-    event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
-
-    tv.tv_sec = match;
-    event_add(event->trigger_event, &tv);
-}
+    lmapd->lmap = lmap;
+    lmap_free(old);
 
-static void
-startup_cb(evutil_socket_t fd, short events, void *context)
-{
-    struct event *event = (struct event *) context;
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+    if (lmap_link(lmap)) {
+	lmap_err("failed to link configuration - restarting...");
+	free(restart);
+	lmapd_restart(lmapd);
+	return -1;
+    }
+    (void) lmapd_workspace_init(lmapd);
 
-    (void) fd;
-    (void) events;
+    /* events that were kept are armed already, unless unused before */
+    for (event = lmap->events; event; event = event->next) {
+	if (! event->lmapd || event->type == LMAP_EVENT_TYPE_IMMEDIATE) {
+	    event_arm(lmapd, event, now, 1);
+	}
+    }
 
-    switch (event->type) {
-    case LMAP_EVENT_TYPE_PERIODIC:
-	tv.tv_sec = event->interval;
-	event_gaga(event, &event->trigger_event, EV_PERSIST, trigger_periodic_cb, &tv);
-	trigger_periodic_cb(-1, 0, event);
-	break;
-    case LMAP_EVENT_TYPE_CALENDAR:
-	event_gaga(event, &event->trigger_event, EV_TIMEOUT, trigger_calendar_cb, &tv);
-	break;
-    default:
-	break;
+    /* suppressions that changed while active start again */
+    for (n = 0; restart[n]; n++) {
+	(void) suppression_start(lmapd, restart[n]);
     }
+    free(restart);
 
-    safe_event_free(event->start_event);
-    event->start_event = NULL;
+    /* new schedules may find files in their workspace */
+    storage_update(lmapd);
+
+    admission_run(lmapd);
+    snapshot_update(lmapd);
+    return 0;
 }
 
 /**
@@ -1013,11 +3202,55 @@ lmapd_run(struct lmapd *lmapd)
 	{ NULL,		0,		NULL,			NULL }
     };
 
+    if (lmapd->lmap && lmap_link(lmapd->lmap)) {
+	lmap_err("failed to link configuration - exiting...");
+	return -1;
+    }
+
+    lmapd->running = 0;
     lmapd->base = event_base_new();
     if (! lmapd->base) {
 	lmap_err("failed to initialize event base - exiting...");
 	return -1;
     }
+    lmapd->pending_timer = evtimer_new(lmapd->base, pending_cb, lmapd);
+    if (! lmapd->pending_timer) {
+	lmap_err("failed to create pending reload event");
+    }
+    lmapd->workers = lmapd_workers_new(lmapd->base, LMAPD_WORKERS);
+    if (! lmapd->workers) {
+	lmap_wrn("no worker threads - doing workspace operations inline");
+    }
+    lmapd->commit_timer = evtimer_new(lmapd->base, commit_cb, lmapd);
+    if (! lmapd->commit_timer) {
+	lmap_err("failed to create commit event");
+    }
+    lmapd->lag_due = 0;
+    lmapd->lag_timer = evtimer_new(lmapd->base, lag_cb, lmapd);
+    if (! lmapd->lag_timer) {
+	lmap_err("failed to create event loop lag event");
+    } else {
+	lag_cb(-1, 0, lmapd);
+    }
+    lmapd->storage_timer = event_new(lmapd->base, -1, EV_PERSIST,
+				     storage_cb, lmapd);
+    if (lmapd->storage_timer) {
+	struct timeval tv = { .tv_sec = LMAPD_STORAGE_INTERVAL, .tv_usec = 0 };
+	if (event_add(lmapd->storage_timer, &tv) < 0) {
+	    lmap_err("failed to add storage event");
+	}
+    } else {
+	lmap_err("failed to create storage event");
+    }
+    storage_update(lmapd);
+    if (lmapd->snapshot_interval) {
+	struct timeval tv = { .tv_sec = lmapd->snapshot_interval, .tv_usec = 0 };
+	lmapd->snapshot_timer = event_new(lmapd->base, -1, EV_PERSIST,
+					  snapshot_cb, lmapd);
+	if (! lmapd->snapshot_timer || event_add(lmapd->snapshot_timer, &tv) < 0) {
+	    lmap_err("failed to create/add snapshot event");
+	}
+    }
 
     /*
      * Register all event callbacks...
@@ -1043,95 +3276,7 @@ lmapd_run(struct lmapd *lmapd)
 	struct event *event;
 	time_t now = time(NULL);
 	for (event = lmapd->lmap->events; event; event = event->next) {
-	    struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
-	    if (! event->name) {
-		continue;
-	    }
-
-	    {
-		/* skip events that are not used by anyone */
-		struct schedule *sched;
-		struct supp *supp;
-		int used = 0;
-
-		for (sched = lmapd->lmap->schedules; !used && sched; sched = sched->next) {
-		    if (sched->start && ! strcmp(sched->start, event->name)) {
-			used = 1;
-		    }
-		    if (sched->end && ! strcmp(sched->end, event->name)) {
-			used = 1;
-		    }
-		}
-
-		for (supp = lmapd->lmap->supps; !used && supp; supp = supp->next) {
-		    if (supp->start && ! strcmp(supp->start, event->name)) {
-			used = 1;
-		    }
-		    if (supp->end && ! strcmp(supp->end, event->name)) {
-			used = 1;
-		    }
-		}
-		if (! used) {
-		    lmap_wrn("event '%s' is not used - skipping", event->name);
-		    continue;
-		}
-	    }
-
-	    event->lmapd = lmapd;	/* this avoids a new data structure */
-	    switch (event->type) {
-	    case LMAP_EVENT_TYPE_PERIODIC:
-		if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-		    if (now > event->end) {
-			lmap_wrn("event '%s' ended in the past", event->name);
-			break;
-		    }
-		}
-		if (event->flags & LMAP_EVENT_FLAG_START_SET) {
-		    if (now > event->start) {
-			int64_t delta = (now - event->start) / event->interval;
-			tv.tv_sec = (time_t)((event->start + (delta + 1) * event->interval) - now);
-		    } else {
-			tv.tv_sec = event->start - now;
-		    }
-		}
-		event_gaga(event, &event->start_event, EV_TIMEOUT, startup_cb, &tv);
-		break;
-
-	    case LMAP_EVENT_TYPE_CALENDAR:
-		if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-		    if (now > event->end) {
-			lmap_wrn("event '%s' ended in the past", event->name);
-			break;
-		    }
-		}
-		event_gaga(event, &event->start_event, EV_TIMEOUT, startup_cb, &tv);
-		break;
-
-	    case LMAP_EVENT_TYPE_ONE_OFF:
-		if (now < event->start) {
-		    lmap_wrn("event '%s' is in the past", event->name);
-		    break;
-		}
-		tv.tv_sec = event->start-now;
-		add_random_spread(event, &tv);
-		event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
-		break;
-
-	    case LMAP_EVENT_TYPE_STARTUP:
-		if (lmapd->flags & LMAPD_FLAG_SKIPSTARTUP) {
-		    lmap_dbg("skipping startup event '%s' on restart", event->name);
-		    break;
-		}
-		/* fallthrough */
-	    case LMAP_EVENT_TYPE_IMMEDIATE:
-		add_random_spread(event, &tv);
-		event_gaga(event, &event->fire_event, EV_TIMEOUT, fire_cb, &tv);
-		break;
-
-	    default:
-		lmap_wrn("ignoring event '%s' (not implemented)", event->name);
-		break;
-	    }
+	    event_arm(lmapd, event, now, 0);
 	}
     }
 
@@ -1142,6 +3287,24 @@ lmapd_run(struct lmapd *lmapd)
     }
     lmap_dbg("event loop finished");
 
+    /* let the workers complete what they started, without going on
+     * with the schedules */
+    lmapd_workers_free(lmapd->workers);
+    lmapd->workers = NULL;
+    commit_cancel(lmapd);
+    if (lmapd->commit_timer) {
+	event_free(lmapd->commit_timer);
+	lmapd->commit_timer = NULL;
+    }
+    if (lmapd->lag_timer) {
+	event_free(lmapd->lag_timer);
+	lmapd->lag_timer = NULL;
+    }
+    if (lmapd->storage_timer) {
+	event_free(lmapd->storage_timer);
+	lmapd->storage_timer = NULL;
+    }
+
     /*
      * Cleanup all events and the event loop base.
      */
@@ -1149,21 +3312,43 @@ lmapd_run(struct lmapd *lmapd)
     if (lmapd->lmap) {
 	struct event *event;
 	for (event = lmapd->lmap->events; event; event = event->next) {
-	    if (event->start_event) {
-		event_free(event->start_event);
-		event->start_event = NULL;
-	    }
-	    if (event->trigger_event) {
-		event_free(event->trigger_event);
-		event->trigger_event = NULL;
-	    }
-	    if (event->fire_event) {
-		event_free(event->fire_event);
-		event->fire_event = NULL;
+	    event_disarm(event);
+	}
+    }
+
+    /* the pid table owns the pidfd events of running actions */
+    lmapd_pidtab_flush(lmapd->pidtab);
+
+    if (lmapd->lmap) {
+	struct schedule *sched;
+	struct action *act;
+	for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	    deadline_disarm(&sched->deadline);
+	    for (act = sched->actions; act; act = act->next) {
+		deadline_disarm(&act->deadline);
+		output_watch_disarm(&act->output_watch);
+		/* results not moved yet must survive a restart */
+		(void) lmapd_workspace_action_spill(sched, act);
 	    }
 	}
     }
 
+    admission_cancel(lmapd, NULL);
+    if (lmapd->admission_timer) {
+	event_free(lmapd->admission_timer);
+	lmapd->admission_timer = NULL;
+    }
+
+    pending_flush(lmapd);
+    if (lmapd->pending_timer) {
+	event_free(lmapd->pending_timer);
+	lmapd->pending_timer = NULL;
+    }
+    if (lmapd->snapshot_timer) {
+	event_free(lmapd->snapshot_timer);
+	lmapd->snapshot_timer = NULL;
+    }
+
     for (i = 0; tab[i].name; i++) {
 	if (tab[i].event) {
 	    event_free(tab[i].event);
@@ -1173,9 +3358,11 @@ lmapd_run(struct lmapd *lmapd)
 
     /*
      * Cleanup the lmap data model but keep the lmapd daemon state (in
-     * case we do a restart).
+     * case we do a restart). The runtime state goes to the snapshot
+     * so that the next start can pick it up.
      */
 
+    (void) lmapd_snapshot_write(lmapd);
     if (lmapd->lmap) {
 	lmap_free(lmapd->lmap);
 	lmapd->lmap = NULL;
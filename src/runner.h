@@ -24,7 +24,10 @@
 extern int lmapd_run(struct lmapd *lmapd);
 extern void lmapd_stop(struct lmapd *lmapd);
 extern void lmapd_restart(struct lmapd *lmapd);
+extern int lmapd_reload(struct lmapd *lmapd);
+extern struct lmap *lmapd_read_config(struct lmapd *lmapd);
 
+extern void lmapd_schedule_exec(struct lmapd *lmapd, struct schedule *schedule);
 extern void lmapd_cleanup(struct lmapd *lmapd);
 
 #endif
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "lmap.h"
 #include "lmapd.h"
@@ -82,8 +83,8 @@ lmapd_sigterm_cb(evutil_socket_t sig, short events, void *context)
  * @brief Callback executed when SIGHUP is received
  *
  * Function which is executed when SIGHUP is received by the daemon.
- * We simply signal to quit the eventloop and then let the lmapd main
- * loop reload and restart the system.
+ * The configuration is reloaded in place, keeping the state and the
+ * running actions of everything that did not change.
  *
  * @param sig unused
  * @param events unused
@@ -99,7 +100,7 @@ lmapd_sighup_cb(evutil_socket_t sig, short events, void *context)
     (void) events;
 
     assert(lmapd);
-    lmapd_restart(lmapd);
+    (void) lmapd_reload(lmapd);
 }
 
 /**
@@ -130,8 +131,8 @@ lmapd_sigchld_cb(evutil_socket_t sig, short events, void *context)
  * @brief Callback executed when SIGUSR1 is received
  *
  * Function which is executed when SIGUSR1 is received by the
- * daemon. It obtains the lmap state information rendered in XML and
- * writes it into the lmap state file in the run directory.
+ * daemon. It writes the lmap state information rendered in XML or JSON
+ * into the lmap state file in the run directory.
  *
  * @param sig unused
  * @param events unused
@@ -142,10 +143,11 @@ void
 lmapd_sigusr1_cb(evutil_socket_t sig, short events, void *context)
 {
     FILE *f = NULL;
-    char *doc = NULL;
     char filename[PATH_MAX];
+    char tmpname[PATH_MAX + 8];
     const char *ext;
     struct lmapd *lmapd = (struct lmapd *) context;
+    int flags, ret;
 
     (void) sig;
     (void) events;
@@ -153,33 +155,35 @@ lmapd_sigusr1_cb(evutil_socket_t sig, short events, void *context)
     assert(lmapd);
     assert(lmapd->run_path);
 
-    lmapd_workspace_update(lmapd);
-    doc = lmap_io_render_state(lmapd->lmap);
-    if (! doc) {
-	lmap_err("failed to render lmap state");
-	return;
-    }
-
+    /*
+     * The state is written while it is rendered, so write it to a
+     * temporary file first: readers never see a partial state file.
+     */
     ext = lmap_io_engine_ext();
     snprintf(filename, sizeof(filename),
 	     "%s/%s%s", lmapd->run_path, LMAPD_STATUS_FILE, ext);
-    f = fopen(filename, "w");
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    f = fopen(tmpname, "w");
     if (! f) {
-	lmap_err("failed to open '%s': %s", filename, strerror(errno));
-	goto done;
+	lmap_err("failed to open '%s': %s", tmpname, strerror(errno));
+	return;
     }
 
-    if (fputs(doc, f) == EOF || fflush(f) == EOF) {
-	lmap_err("failed to write to '%s'", filename);
-	goto done;
+    /* the storage is kept up to date, see lmapd_workspace_job_account() */
+    flags = (lmapd->flags & LMAPD_FLAG_COMPACT) ? LMAP_IO_FLAG_COMPACT : 0;
+    ret = lmap_io_write_state(lmapd->lmap, f, flags);
+    if (fclose(f) == EOF) {
+	ret = -1;
     }
-
-done:
-    if (f) {
-	(void) fclose(f);
+    if (ret) {
+	lmap_err("failed to write lmap state to '%s'", tmpname);
+	(void) unlink(tmpname);
+	return;
     }
-    if (doc) {
-	free(doc);
+
+    if (rename(tmpname, filename) == -1) {
+	lmap_err("failed to rename '%s': %s", tmpname, strerror(errno));
+	(void) unlink(tmpname);
     }
 }
 
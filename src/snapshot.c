@@ -0,0 +1,556 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The snapshot is a compact binary image of the runtime state of the
+ * schedules and actions (counters, last invocations and resource
+ * usage), which lets lmapd carry that state over a restart without
+ * parsing a state document. It is meant to be read back by the same
+ * lmapd binary on the same host, hence the native byte order and
+ * layout; a snapshot written elsewhere is recognized and ignored.
+ *
+ * The file starts with a struct snap_header, followed by one struct
+ * snap_schedule per schedule. Each of them is followed by its name,
+ * then by one struct snap_action plus its name for each action of
+ * the schedule. Names are NUL terminated and padded with zeros to a
+ * multiple of 8 bytes, so that all records are aligned.
+ *
+ * Every record carries a hash of the configuration of its schedule
+ * or action. Records whose hash no longer matches the configuration
+ * are skipped when the snapshot is read.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "lmap.h"
+#include "lmapd.h"
+#include "utils.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC	"LMAPDSN2"
+#define SNAPSHOT_BOM	0x01020304U
+#define SNAPSHOT_ALIGN	8
+
+struct snap_header {
+    char magic[8];
+    uint32_t bom;		/* byte order mark */
+    uint32_t schedules;		/* number of schedule records */
+    uint64_t size;		/* size of the whole snapshot */
+};
+
+struct snap_schedule {
+    uint64_t hash;
+    int64_t last_invocation;
+    uint32_t cnt_invocations;
+    uint32_t cnt_failures;
+    uint32_t cnt_suppressions;
+    uint32_t cnt_overlaps;
+    uint32_t cnt_timeouts;
+    uint32_t actions;		/* number of action records */
+    uint32_t name_len;
+    uint32_t cnt_quota_hits;
+    uint64_t evicted_bytes;
+    struct usage last_usage;
+    struct usage usage;
+};
+
+struct snap_action {
+    uint64_t hash;
+    int64_t last_invocation;
+    int64_t last_completion;
+    int64_t last_failed_completion;
+    int32_t last_status;
+    int32_t last_failed_status;
+    uint32_t cnt_invocations;
+    uint32_t cnt_failures;
+    uint32_t cnt_suppressions;
+    uint32_t cnt_overlaps;
+    uint32_t cnt_timeouts;
+    uint32_t name_len;
+    struct usage last_usage;
+    struct usage usage;
+};
+
+static size_t
+name_size(const char *name)
+{
+    size_t len = name ? strlen(name) + 1 : 1;
+
+    return (len + SNAPSHOT_ALIGN - 1) & ~(size_t) (SNAPSHOT_ALIGN - 1);
+}
+
+static char *
+put_name(char *p, const char *name)
+{
+    size_t size = name_size(name);
+
+    memset(p, 0, size);
+    if (name) {
+	memcpy(p, name, strlen(name));
+    }
+    return p + size;
+}
+
+/*
+ * Returns the NUL terminated name of len bytes at p, or NULL if it
+ * does not fit into the remaining n bytes.
+ */
+
+static const char *
+get_name(const char *p, size_t n, uint32_t len, size_t *size)
+{
+    *size = ((size_t) len + 1 + SNAPSHOT_ALIGN - 1) & ~(size_t) (SNAPSHOT_ALIGN - 1);
+    if (*size > n || p[len] != '\0') {
+	return NULL;
+    }
+    return p;
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+	n = write(fd, buf, len);
+	if (n == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return -1;
+	}
+	buf += n;
+	len -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serializes the runtime state snapshot
+ *
+ * Serializes the runtime state of all schedules and actions into a
+ * newly allocated buffer, which the caller has to free. The buffer
+ * is set to NULL if there is nothing to write.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param bufp pointer to the buffer
+ * @param sizep pointer to the size of the buffer
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_snapshot_build(struct lmapd *lmapd, char **bufp, size_t *sizep)
+{
+    struct snap_header hdr;
+    struct schedule *sched;
+    struct action *act;
+    char *buf, *p;
+    size_t size;
+
+    assert(lmapd && bufp && sizep);
+
+    *bufp = NULL;
+    *sizep = 0;
+    if (! lmapd->lmap || ! lmapd->run_path) {
+	return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.bom = SNAPSHOT_BOM;
+    size = sizeof(hdr);
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	hdr.schedules++;
+	size += sizeof(struct snap_schedule) + name_size(sched->name);
+	for (act = sched->actions; act; act = act->next) {
+	    size += sizeof(struct snap_action) + name_size(act->name);
+	}
+    }
+    hdr.size = size;
+
+    buf = malloc(size);
+    if (! buf) {
+	lmap_err("failed to allocate memory");
+	return -1;
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    p = buf + sizeof(hdr);
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	struct snap_schedule s;
+
+	memset(&s, 0, sizeof(s));
+	s.hash = lmap_schedule_hash(sched);
+	s.last_invocation = sched->last_invocation;
+	s.cnt_invocations = sched->cnt_invocations;
+	s.cnt_failures = sched->cnt_failures;
+	s.cnt_suppressions = sched->cnt_suppressions;
+	s.cnt_overlaps = sched->cnt_overlaps;
+	s.cnt_timeouts = sched->cnt_timeouts;
+	s.cnt_quota_hits = sched->cnt_quota_hits;
+	s.evicted_bytes = sched->evicted_bytes;
+	for (act = sched->actions; act; act = act->next) {
+	    s.actions++;
+	}
+	s.name_len = sched->name ? (uint32_t) strlen(sched->name) : 0;
+	s.last_usage = sched->last_usage;
+	s.usage = sched->usage;
+	memcpy(p, &s, sizeof(s));
+	p = put_name(p + sizeof(s), sched->name);
+
+	for (act = sched->actions; act; act = act->next) {
+	    struct snap_action a;
+
+	    memset(&a, 0, sizeof(a));
+	    a.hash = lmap_action_hash(act);
+	    a.last_invocation = act->last_invocation;
+	    a.last_completion = act->last_completion;
+	    a.last_failed_completion = act->last_failed_completion;
+	    a.last_status = act->last_status;
+	    a.last_failed_status = act->last_failed_status;
+	    a.cnt_invocations = act->cnt_invocations;
+	    a.cnt_failures = act->cnt_failures;
+	    a.cnt_suppressions = act->cnt_suppressions;
+	    a.cnt_overlaps = act->cnt_overlaps;
+	    a.cnt_timeouts = act->cnt_timeouts;
+	    a.name_len = act->name ? (uint32_t) strlen(act->name) : 0;
+	    a.last_usage = act->last_usage;
+	    a.usage = act->usage;
+	    memcpy(p, &a, sizeof(a));
+	    p = put_name(p + sizeof(a), act->name);
+	}
+    }
+    assert((size_t) (p - buf) == size);
+
+    *bufp = buf;
+    *sizep = size;
+    return 0;
+}
+
+/**
+ * @brief Stores a serialized runtime state snapshot
+ *
+ * Writes a snapshot serialized by lmapd_snapshot_build() to the
+ * snapshot file in the run directory. The snapshot is written to a
+ * temporary file first, which is renamed once it is complete, so
+ * that a crash never leaves a partial snapshot behind. This does
+ * not touch the data model and may run on a worker thread.
+ *
+ * @param run_path path of the run directory
+ * @param buf pointer to the serialized snapshot
+ * @param size size of the serialized snapshot
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_snapshot_store(const char *run_path, const char *buf, size_t size)
+{
+    char filename[PATH_MAX], tmpname[PATH_MAX];
+    int fd;
+
+    assert(run_path && buf);
+
+    snprintf(filename, sizeof(filename),
+	     "%s/%s", run_path, LMAPD_SNAPSHOT_FILE);
+    snprintf(tmpname, sizeof(tmpname),
+	     "%s/%s.tmp", run_path, LMAPD_SNAPSHOT_FILE);
+
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+	lmap_err("failed to open '%s': %s", tmpname, strerror(errno));
+	return -1;
+    }
+    if (write_all(fd, buf, size) == -1 || fsync(fd) == -1) {
+	lmap_err("failed to write to '%s': %s", tmpname, strerror(errno));
+	(void) close(fd);
+	(void) unlink(tmpname);
+	return -1;
+    }
+    if (close(fd) == -1 || rename(tmpname, filename) == -1) {
+	lmap_err("failed to rename '%s': %s", tmpname, strerror(errno));
+	(void) unlink(tmpname);
+	return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the runtime state snapshot
+ *
+ * Writes the runtime state of all schedules and actions to the
+ * snapshot file in the run directory, see lmapd_snapshot_build()
+ * and lmapd_snapshot_store().
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_snapshot_write(struct lmapd *lmapd)
+{
+    char *buf;
+    size_t size;
+    int ret;
+
+    if (lmapd_snapshot_build(lmapd, &buf, &size)) {
+	return -1;
+    }
+    if (! buf) {
+	return 0;
+    }
+    ret = lmapd_snapshot_store(lmapd->run_path, buf, size);
+    free(buf);
+    return ret;
+}
+
+/*
+ * Restores the state of a schedule or action from a record, unless
+ * its configuration changed since the record was written.
+ */
+
+static void
+restore_schedule(struct schedule *sched, const struct snap_schedule *s)
+{
+    if (s->hash != lmap_schedule_hash(sched)) {
+	lmap_dbg("schedule '%s' changed - not restoring its state", sched->name);
+	return;
+    }
+    sched->last_invocation = (time_t) s->last_invocation;
+    sched->cnt_invocations = s->cnt_invocations;
+    sched->cnt_failures = s->cnt_failures;
+    sched->cnt_suppressions = s->cnt_suppressions;
+    sched->cnt_overlaps = s->cnt_overlaps;
+    sched->cnt_timeouts = s->cnt_timeouts;
+    sched->cnt_quota_hits = s->cnt_quota_hits;
+    sched->evicted_bytes = s->evicted_bytes;
+    sched->last_usage = s->last_usage;
+    sched->usage = s->usage;
+}
+
+static void
+restore_action(struct action *act, const struct snap_action *a)
+{
+    if (a->hash != lmap_action_hash(act)) {
+	lmap_dbg("action '%s' changed - not restoring its state", act->name);
+	return;
+    }
+    act->last_invocation = (time_t) a->last_invocation;
+    act->last_completion = (time_t) a->last_completion;
+    act->last_failed_completion = (time_t) a->last_failed_completion;
+    act->last_status = a->last_status;
+    act->last_failed_status = a->last_failed_status;
+    act->cnt_invocations = a->cnt_invocations;
+    act->cnt_failures = a->cnt_failures;
+    act->cnt_suppressions = a->cnt_suppressions;
+    act->cnt_overlaps = a->cnt_overlaps;
+    act->cnt_timeouts = a->cnt_timeouts;
+    act->last_usage = a->last_usage;
+    act->usage = a->usage;
+}
+
+static struct action *
+find_action(struct schedule *sched, struct action *hint, const char *name)
+{
+    struct action *act;
+
+    if (hint && hint->name && strcmp(hint->name, name) == 0) {
+	return hint;
+    }
+    for (act = sched->actions; act; act = act->next) {
+	if (act->name && strcmp(act->name, name) == 0) {
+	    return act;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Walks the records of the snapshot in buf and merges them into lmap,
+ * or only checks that they are all valid if lmap is NULL. Records are
+ * usually in the order of the configuration, so the next schedule
+ * and action are tried before searching for them by name.
+ */
+
+static int
+snapshot_walk(struct lmap *lmap, const char *buf, size_t len)
+{
+    struct snap_header hdr;
+    struct snap_schedule s;
+    struct snap_action a;
+    struct schedule *sched, *next = lmap ? lmap->schedules : NULL;
+    struct action *act, *hint;
+    const char *p = buf, *end = buf + len, *name;
+    size_t size;
+    uint32_t i, j;
+
+    if (len < sizeof(hdr)) {
+	return -1;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    if (memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0
+	|| hdr.bom != SNAPSHOT_BOM || hdr.size != len) {
+	return -1;
+    }
+
+    for (i = 0; i < hdr.schedules; i++) {
+	if ((size_t) (end - p) < sizeof(s)) {
+	    return -1;
+	}
+	memcpy(&s, p, sizeof(s));
+	p += sizeof(s);
+	name = get_name(p, (size_t) (end - p), s.name_len, &size);
+	if (! name) {
+	    return -1;
+	}
+	p += size;
+
+	if (! lmap) {
+	    sched = NULL;
+	} else if (next && next->name && strcmp(next->name, name) == 0) {
+	    sched = next;
+	} else {
+	    sched = lmap_find_schedule(lmap, name);
+	}
+	if (sched) {
+	    restore_schedule(sched, &s);
+	    next = sched->next;
+	}
+
+	hint = sched ? sched->actions : NULL;
+	for (j = 0; j < s.actions; j++) {
+	    if ((size_t) (end - p) < sizeof(a)) {
+		return -1;
+	    }
+	    memcpy(&a, p, sizeof(a));
+	    p += sizeof(a);
+	    name = get_name(p, (size_t) (end - p), a.name_len, &size);
+	    if (! name) {
+		return -1;
+	    }
+	    p += size;
+
+	    if (! sched) {
+		continue;
+	    }
+	    act = find_action(sched, hint, name);
+	    if (act) {
+		restore_action(act, &a);
+		hint = act->next;
+	    }
+	}
+    }
+
+    return p == end ? 0 : -1;
+}
+
+/*
+ * Merges the records of the snapshot in buf into lmap, but only if
+ * the whole snapshot is valid, so that a damaged snapshot is not
+ * partially applied.
+ */
+
+static int
+snapshot_merge(struct lmap *lmap, const char *buf, size_t len)
+{
+    if (snapshot_walk(NULL, buf, len) != 0) {
+	return -1;
+    }
+    return snapshot_walk(lmap, buf, len);
+}
+
+/**
+ * @brief Reads the runtime state snapshot
+ *
+ * Reads the snapshot file in the run directory, if there is one, and
+ * merges the state it holds into the schedules and actions of the
+ * configuration. Schedules and actions that no longer exist or whose
+ * configuration changed are skipped.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return 0 on success or if there is no snapshot, -1 on error
+ */
+
+int
+lmapd_snapshot_read(struct lmapd *lmapd)
+{
+    struct stat st;
+    char filename[PATH_MAX];
+    char *buf = NULL;
+    size_t len = 0;
+    ssize_t n;
+    int fd, ret = -1;
+
+    assert(lmapd);
+
+    if (! lmapd->lmap || ! lmapd->run_path) {
+	return 0;
+    }
+
+    snprintf(filename, sizeof(filename),
+	     "%s/%s", lmapd->run_path, LMAPD_SNAPSHOT_FILE);
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+	if (errno == ENOENT) {
+	    return 0;
+	}
+	lmap_err("failed to open '%s': %s", filename, strerror(errno));
+	return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+	lmap_err("failed to stat '%s': %s", filename, strerror(errno));
+	goto done;
+    }
+
+    buf = malloc(st.st_size > 0 ? (size_t) st.st_size : 1);
+    if (! buf) {
+	lmap_err("failed to allocate memory");
+	goto done;
+    }
+    while (len < (size_t) st.st_size) {
+	n = read(fd, buf + len, (size_t) st.st_size - len);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    lmap_err("failed to read '%s': %s", filename,
+		     n ? strerror(errno) : "unexpected end of file");
+	    goto done;
+	}
+	len += (size_t) n;
+    }
+
+    if (snapshot_merge(lmapd->lmap, buf, len) != 0) {
+	lmap_wrn("ignoring invalid snapshot '%s'", filename);
+	goto done;
+    }
+    ret = 0;
+
+done:
+    free(buf);
+    (void) close(fd);
+    return ret;
+}
@@ -0,0 +1,29 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_SNAPSHOT_H
+#define LMAP_SNAPSHOT_H
+
+#include "lmap.h"
+#include "lmapd.h"
+
+int   lmapd_snapshot_build(struct lmapd *lmapd, char **bufp, size_t *sizep);
+int   lmapd_snapshot_store(const char *run_path, const char *buf, size_t size);
+int   lmapd_snapshot_write(struct lmapd *lmapd);
+int   lmapd_snapshot_read(struct lmapd *lmapd);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef WITH_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "utils.h"
+#include "uring.h"
+
+struct uring {
+    int fd;
+    unsigned int entries;	/* of the submission queue */
+
+    void *sq_ring, *cq_ring;	/* the same mapping with IORING_FEAT_SINGLE_MMAP */
+    size_t sq_ring_len, cq_ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int sqe_tail;	/* next free sqe, not yet seen by the kernel */
+    unsigned int inflight;	/* submitted but not completed */
+};
+
+static int
+uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+	    unsigned int flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			 flags, NULL, 0);
+}
+
+static int
+uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * linkat and unlinkat are supported since Linux 5.11 and 5.15, older
+ * kernels fail them with -EINVAL. Ask the kernel up front, so that the
+ * caller can use plain system calls instead.
+ */
+
+static int
+uring_probe(int fd)
+{
+    static const int ops[] = { IORING_OP_LINKAT, IORING_OP_UNLINKAT };
+    struct io_uring_probe *probe;
+    size_t i;
+    int ret = 0;
+
+    probe = calloc(1, sizeof(*probe) + 256 * sizeof(probe->ops[0]));
+    if (! probe) {
+	return -1;
+    }
+    if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256)) {
+	free(probe);
+	return -1;
+    }
+    for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+	if (ops[i] > probe->last_op
+	    || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+	    errno = EOPNOTSUPP;
+	    ret = -1;
+	}
+    }
+    free(probe);
+    return ret;
+}
+
+/**
+ * @brief Creates a new io_uring
+ *
+ * Creates a ring with room for entries queued operations. Returns NULL
+ * if io_uring is not available (e.g., disabled by the administrator or
+ * by a seccomp filter, or the kernel is too old), in which case the
+ * caller uses plain system calls.
+ *
+ * @param entries size of the submission queue
+ * @return pointer to the ring or NULL
+ */
+
+struct uring *
+lmapd_uring_new(unsigned int entries)
+{
+    struct uring *ring;
+    struct io_uring_params p;
+    void *ptr;
+
+    ring = calloc(1, sizeof(*ring));
+    if (! ring) {
+	return NULL;
+    }
+    ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = uring_setup(entries, &p);
+    if (ring->fd == -1) {
+	lmap_dbg("io_uring not available: %s", strerror(errno));
+	free(ring);
+	return NULL;
+    }
+    if (uring_probe(ring->fd)) {
+	lmap_dbg("io_uring not usable: %s", strerror(errno));
+	goto fail;
+    }
+
+    ring->entries = p.sq_entries;
+    ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring->cq_ring_len > ring->sq_ring_len) {
+	    ring->sq_ring_len = ring->cq_ring_len;
+	}
+	ring->cq_ring_len = ring->sq_ring_len;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+	goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	ring->cq_ring = ring->sq_ring;
+    } else {
+	ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) {
+	    goto fail;
+	}
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+	goto fail;
+    }
+
+    ptr = ring->sq_ring;
+    ring->sq_head = (unsigned int *) ((char *) ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int *) ((char *) ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) ((char *) ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) ((char *) ptr + p.sq_off.array);
+    ptr = ring->cq_ring;
+    ring->cq_head = (unsigned int *) ((char *) ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int *) ((char *) ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) ((char *) ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ptr + p.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+
+    return ring;
+
+fail:
+    lmapd_uring_free(ring);
+    return NULL;
+}
+
+/**
+ * @brief Frees an io_uring
+ *
+ * Operations that were queued but not run are dropped.
+ *
+ * @param ring pointer to the ring
+ */
+
+void
+lmapd_uring_free(struct uring *ring)
+{
+    if (! ring) {
+	return;
+    }
+    if (ring->sqes != MAP_FAILED) {
+	(void) munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+	(void) munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    if (ring->sq_ring != MAP_FAILED) {
+	(void) munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+    (void) close(ring->fd);
+    free(ring);
+}
+
+/**
+ * @brief Number of operations that can still be queued
+ *
+ * @param ring pointer to the ring
+ * @return the number of free submission queue entries
+ */
+
+unsigned int
+lmapd_uring_space(struct uring *ring)
+{
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    return ring->entries - (ring->sqe_tail - head);
+}
+
+static struct io_uring_sqe *
+uring_sqe(struct uring *ring, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+
+    if (! lmapd_uring_space(ring)) {
+	errno = EBUSY;
+	return NULL;
+    }
+    idx = ring->sqe_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = data;
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Queues a linkat(2)
+ *
+ * @param ring pointer to the ring
+ * @param olddirfd, oldpath, newdirfd, newpath, flags as for linkat(2)
+ * @param data passed to the done function of lmapd_uring_run()
+ * @return 0 on success, -1 if the ring is full
+ */
+
+int
+lmapd_uring_linkat(struct uring *ring,
+		   int olddirfd, const char *oldpath,
+		   int newdirfd, const char *newpath,
+		   int flags, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(ring, data);
+    if (! sqe) {
+	return -1;
+    }
+    sqe->opcode = IORING_OP_LINKAT;
+    sqe->fd = olddirfd;
+    sqe->addr = (uint64_t) (uintptr_t) oldpath;
+    sqe->len = (uint32_t) newdirfd;
+    sqe->addr2 = (uint64_t) (uintptr_t) newpath;
+    sqe->hardlink_flags = (uint32_t) flags;
+    return 0;
+}
+
+/**
+ * @brief Queues an unlinkat(2)
+ *
+ * @param ring pointer to the ring
+ * @param dirfd, path, flags as for unlinkat(2)
+ * @param data passed to the done function of lmapd_uring_run()
+ * @return 0 on success, -1 if the ring is full
+ */
+
+int
+lmapd_uring_unlinkat(struct uring *ring, int dirfd, const char *path,
+		     int flags, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(ring, data);
+    if (! sqe) {
+	return -1;
+    }
+    sqe->opcode = IORING_OP_UNLINKAT;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t) (uintptr_t) path;
+    sqe->unlink_flags = (uint32_t) flags;
+    return 0;
+}
+
+static void
+uring_reap(struct uring *ring, uring_done_func *done, void *arg)
+{
+    unsigned int head, tail;
+    struct io_uring_cqe *cqe;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	done(arg, cqe->user_data, cqe->res);
+	head++;
+	ring->inflight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Runs the queued operations
+ *
+ * Submits all queued operations and waits until they have completed,
+ * calling done with the data of the operation and its result (zero or
+ * a negative errno value) for each of them, in completion order.
+ *
+ * The completion queue has twice the room of the submission queue, so
+ * it cannot overflow as long as the caller does not queue more than
+ * lmapd_uring_space() operations.
+ *
+ * @param ring pointer to the ring
+ * @param done function called for every completed operation
+ * @param arg passed to done
+ * @return 0 on success, -1 if the kernel failed to take the operations
+ */
+
+int
+lmapd_uring_run(struct uring *ring, uring_done_func *done, void *arg)
+{
+    unsigned int submit;
+    int n, ret = 0;
+
+    submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    while (submit || ring->inflight) {
+	n = uring_enter(ring->fd, submit, 1, IORING_ENTER_GETEVENTS);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    if ((errno != EAGAIN && errno != EBUSY) || !ring->inflight) {
+		lmap_err("io_uring_enter failed: %s", strerror(errno));
+		ret = -1;
+		if (! submit) {
+		    break;
+		}
+		/* drop what the kernel did not take, but wait for the
+		 * operations in flight: they refer to our buffers */
+		*ring->sq_tail -= submit;
+		ring->sqe_tail = *ring->sq_tail;
+		submit = 0;
+	    }
+	} else {
+	    submit -= (unsigned int) n;
+	    ring->inflight += (unsigned int) n;
+	}
+	uring_reap(ring, done, arg);
+    }
+
+    return ret;
+}
+
+#endif /* ifdef WITH_IO_URING */
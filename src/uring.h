@@ -0,0 +1,54 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_URING_H
+#define LMAP_URING_H
+
+#ifdef WITH_IO_URING
+
+#include <stdint.h>
+
+/*
+ * A minimal io_uring(7) ring, talking to the kernel with the raw system
+ * calls, used to submit batches of workspace file operations at once.
+ * A ring is not thread-safe, each worker thread needs its own.
+ *
+ * Operations are queued with lmapd_uring_linkat() and friends, and
+ * submitted with lmapd_uring_run(), which waits until all of them have
+ * completed. The paths passed must stay valid until then. The queued
+ * operations may run concurrently and in any order: operations that
+ * depend on each other go in separate runs.
+ */
+
+struct uring;
+
+typedef void (uring_done_func)(void *arg, uint64_t data, int res);
+
+struct uring *lmapd_uring_new(unsigned int entries);
+void  lmapd_uring_free(struct uring *ring);
+unsigned int lmapd_uring_space(struct uring *ring);
+int   lmapd_uring_linkat(struct uring *ring,
+			 int olddirfd, const char *oldpath,
+			 int newdirfd, const char *newpath,
+			 int flags, uint64_t data);
+int   lmapd_uring_unlinkat(struct uring *ring, int dirfd, const char *path,
+			   int flags, uint64_t data);
+int   lmapd_uring_run(struct uring *ring, uring_done_func *done, void *arg);
+
+#endif /* ifdef WITH_IO_URING */
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "utils.h"
+#include "workers.h"
+
+#define UNUSED(x) (void)(x)
+
+struct job {
+    const void *key;
+    worker_work_func *work;
+    worker_done_func *done;
+    void *arg;
+    struct job *next;
+};
+
+struct workers {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t *threads;
+    const void **keys;		/* key of the job run by each thread */
+    unsigned int nthreads;
+    int stop;
+
+    struct job *queue;		/* submitted jobs, oldest first */
+    struct job **queue_tail;
+    struct job *done;		/* completed jobs, oldest first */
+    struct job **done_tail;
+
+    int fds[2];			/* wakes up the event loop */
+    struct event *event;
+};
+
+struct worker {
+    struct workers *workers;
+    unsigned int index;
+};
+
+/*
+ * Unlinks the oldest job whose key is not used by a running job. All
+ * jobs of a key behind a running one are skipped, which keeps them in
+ * order. Called with the lock held.
+ */
+
+static struct job *
+job_take(struct workers *w)
+{
+    struct job **jp, *job;
+    unsigned int i;
+
+    for (jp = &w->queue; (job = *jp); jp = &job->next) {
+	for (i = 0; job->key && i < w->nthreads; i++) {
+	    if (w->keys[i] == job->key) {
+		break;
+	    }
+	}
+	if (! job->key || i == w->nthreads) {
+	    *jp = job->next;
+	    if (! *jp) {
+		w->queue_tail = jp;
+	    }
+	    job->next = NULL;
+	    return job;
+	}
+    }
+    return NULL;
+}
+
+static void *
+worker_main(void *context)
+{
+    struct worker *self = context;
+    struct workers *w = self->workers;
+    struct job *job;
+    char c = 0;
+
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+	job = job_take(w);
+	if (! job) {
+	    if (w->stop && ! w->queue) {
+		break;
+	    }
+	    pthread_cond_wait(&w->cond, &w->lock);
+	    continue;
+	}
+	w->keys[self->index] = job->key;
+	pthread_mutex_unlock(&w->lock);
+
+	job->work(job->arg);
+
+	pthread_mutex_lock(&w->lock);
+	w->keys[self->index] = NULL;
+	if (! w->done) {
+	    while (write(w->fds[1], &c, 1) == -1 && errno == EINTR) ;
+	}
+	*w->done_tail = job;
+	w->done_tail = &job->next;
+	/* the key is free again, a job waiting for it may run now */
+	pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    free(self);
+    return NULL;
+}
+
+/**
+ * @brief Callback running the completions of jobs
+ *
+ * Function which is executed by the event loop when workers have
+ * completed jobs. It calls the done functions of the jobs in the
+ * order they completed.
+ */
+
+static void
+workers_cb(evutil_socket_t fd, short events, void *context)
+{
+    struct workers *w = context;
+    struct job *job;
+    char buf[64];
+
+    UNUSED(events);
+
+    pthread_mutex_lock(&w->lock);
+    while (read(fd, buf, sizeof(buf)) > 0) ;
+    job = w->done;
+    w->done = NULL;
+    w->done_tail = &w->done;
+    pthread_mutex_unlock(&w->lock);
+
+    while (job) {
+	struct job *next = job->next;
+	job->done(job->arg, 0);
+	free(job);
+	job = next;
+    }
+}
+
+/**
+ * @brief Creates a pool of worker threads
+ *
+ * @param base event base receiving the completions
+ * @param nthreads number of worker threads
+ * @return pointer to the new pool, NULL on error
+ */
+
+struct workers *
+lmapd_workers_new(struct event_base *base, unsigned int nthreads)
+{
+    struct workers *w;
+    struct worker *self;
+    unsigned int i;
+    int flags;
+
+    assert(base && nthreads);
+
+    w = calloc(1, sizeof(*w));
+    if (! w) {
+	lmap_err("failed to allocate worker pool");
+	return NULL;
+    }
+    w->threads = calloc(nthreads, sizeof(*w->threads));
+    w->keys = calloc(nthreads, sizeof(*w->keys));
+    if (! w->threads || ! w->keys) {
+	lmap_err("failed to allocate worker pool");
+	free(w->threads);
+	free(w->keys);
+	free(w);
+	return NULL;
+    }
+    w->queue_tail = &w->queue;
+    w->done_tail = &w->done;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->fds[0] = w->fds[1] = -1;
+    if (pipe(w->fds) == -1) {
+	lmap_err("failed to create worker pipe: %s", strerror(errno));
+	goto error;
+    }
+    for (i = 0; i < 2; i++) {
+	flags = fcntl(w->fds[i], F_GETFD);
+	(void) fcntl(w->fds[i], F_SETFD, flags | FD_CLOEXEC);
+	flags = fcntl(w->fds[i], F_GETFL);
+	(void) fcntl(w->fds[i], F_SETFL, flags | O_NONBLOCK);
+    }
+    w->event = event_new(base, w->fds[0], EV_READ | EV_PERSIST, workers_cb, w);
+    if (! w->event || event_add(w->event, NULL) < 0) {
+	lmap_err("failed to create/add worker event");
+	goto error;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+	self = calloc(1, sizeof(*self));
+	if (! self) {
+	    break;
+	}
+	self->workers = w;
+	self->index = i;
+	if (pthread_create(&w->threads[i], NULL, worker_main, self)) {
+	    free(self);
+	    break;
+	}
+	w->nthreads++;
+    }
+    if (! w->nthreads) {
+	lmap_err("failed to start worker threads");
+	goto error;
+    }
+    return w;
+
+error:
+    lmapd_workers_free(w);
+    return NULL;
+}
+
+/**
+ * @brief Frees a pool of worker threads
+ *
+ * Waits until all submitted jobs did their work and stops the worker
+ * threads. The done functions of jobs that did not complete on the
+ * event loop are called with cancelled set.
+ *
+ * @param workers pointer to the pool
+ */
+
+void
+lmapd_workers_free(struct workers *w)
+{
+    struct job *job;
+    unsigned int i;
+
+    if (! w) {
+	return;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    for (i = 0; i < w->nthreads; i++) {
+	pthread_join(w->threads[i], NULL);
+    }
+
+    while ((job = w->done)) {
+	w->done = job->next;
+	job->done(job->arg, 1);
+	free(job);
+    }
+    if (w->event) {
+	event_free(w->event);
+    }
+    for (i = 0; i < 2; i++) {
+	if (w->fds[i] != -1) {
+	    (void) close(w->fds[i]);
+	}
+    }
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->threads);
+    free(w->keys);
+    free(w);
+}
+
+/**
+ * @brief Submits a job to a pool of worker threads
+ *
+ * Without a pool, or if the job cannot be queued, the work and done
+ * functions are called right away.
+ *
+ * @param workers pointer to the pool, may be NULL
+ * @param key jobs with the same key run in order, NULL for none
+ * @param work function doing the work on a worker thread
+ * @param done function called on the event loop thread afterwards
+ * @param arg argument passed to both functions
+ * @return 0 if the job was queued, 1 if it completed already
+ */
+
+int
+lmapd_workers_submit(struct workers *w, const void *key,
+		     worker_work_func *work, worker_done_func *done, void *arg)
+{
+    struct job *job = NULL;
+
+    assert(work && done);
+
+    if (w) {
+	job = calloc(1, sizeof(*job));
+    }
+    if (! job) {
+	work(arg);
+	done(arg, 0);
+	return 1;
+    }
+
+    job->key = key;
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+
+    pthread_mutex_lock(&w->lock);
+    *w->queue_tail = job;
+    w->queue_tail = &job->next;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
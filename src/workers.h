@@ -0,0 +1,45 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_WORKERS_H
+#define LMAP_WORKERS_H
+
+#include <event2/event.h>
+
+/*
+ * A small pool of threads running blocking work (mostly file system
+ * operations) away from the event loop. The work function of a job
+ * runs on a worker thread and must not touch the lmap data model.
+ * The done function runs on the event loop thread once the work is
+ * complete, or with cancelled set when the pool is freed first.
+ *
+ * Jobs with the same (non-NULL) key run one at a time, in the order
+ * they were submitted, and complete in that order.
+ */
+
+struct workers;
+
+typedef void (worker_work_func)(void *arg);
+typedef void (worker_done_func)(void *arg, int cancelled);
+
+struct workers *lmapd_workers_new(struct event_base *base, unsigned int nthreads);
+void  lmapd_workers_free(struct workers *workers);
+int   lmapd_workers_submit(struct workers *workers, const void *key,
+			   worker_work_func *work, worker_done_func *done,
+			   void *arg);
+
+#endif
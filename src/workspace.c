@@ -26,13 +26,16 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <ftw.h>
 #include <signal.h>
 #include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <sys/syscall.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include "lmap.h"
 #include "lmapd.h"
@@ -40,6 +43,10 @@
 #include "csv.h"
 #include "lmap-io.h"
 #include "workspace.h"
+#include "uring.h"
+#include "qindex.h"
+#include "zio.h"
+#include "rlog.h"
 
 /* incoming schedule queue name, must start with _ */
 #define LMAPD_QUEUE_INCOMING_NAME "_incoming"
@@ -48,6 +55,39 @@
 
 static const char delimiter = ';';
 
+/*
+ * The quota of the incoming queue of a schedule, and what happened
+ * when a result was delivered to it.
+ */
+
+struct queue_quota {
+    struct qindex *qindex;	/* NULL if there is no quota */
+    uint64_t max_bytes;
+    uint64_t max_files;
+    int refuse;			/* refuse results instead of evicting */
+    int hit;			/* the result did not fit */
+    uint64_t evicted;		/* disk usage of the evicted entries */
+};
+
+static int schedule_clean(int wsfd, const char *workspace, uint64_t *bytes);
+static int schedule_move(int wsfd, int incfd, const char *workspace,
+			 struct qindex *qindex);
+static int action_clean(int wsfd, const char *workspace, uint64_t *bytes);
+static int action_move(int wsfd, int destfd, const char *workspace,
+		       const char *destdir, uint64_t *bytes,
+		       struct queue_quota *quota, int compress,
+		       int datafd, const char *dataname, int hold);
+static int action_publish(int wsfd, int destfd, const char *workspace,
+			  const char *destdir, uint64_t *bytes);
+static int action_append(int wsfd, int destfd, const char *workspace,
+			 const char *destdir, uint64_t *bytes,
+			 int datafd, const char *dataname);
+static int spill(int datafd, int wsfd, const char *workspace,
+		 const char *dataname, int resume, uint64_t to,
+		 uint64_t *bytes);
+static void action_name(struct schedule *schedule, struct action *action,
+			const char *ext, char *buf, size_t size);
+
 /**
  * @brief Create a safe filesystem name
  *
@@ -59,9 +99,9 @@ static const char delimiter = ';';
  * Note: as a side-effect, does not allow filenames to start with a
  * few other characters, either, and will %-escape them instead.
  *
+ * @param buf work buffer
+ * @param buflen work buffer length
  * @param name file system name
- * @param buf work buffer, NULL for static buffer
- * @param buflen work buffer length (zero for static buffer)
  * @return pointer to a safe filesystem name
  */
 
@@ -71,12 +111,6 @@ mksafe(char *buf, size_t buflen, const char *name)
     size_t i, j;
     const char safe[] = "-.,_";
     const char hex[] = "0123456789ABCDEF";
-    static char save_name[NAME_MAX];
-
-    if (!buf || !buflen) {
-	buf = save_name;
-	buflen = sizeof(save_name);
-    }
 
     if (!name) {
 	buf[0] = '\0';
@@ -101,481 +135,2476 @@ mksafe(char *buf, size_t buflen, const char *name)
     return buf;
 }
 
-/**
- * @brief Callback for removing a file
- *
- * Callback called by nftw when traversing a directory tree.
- *
- * @param fpath path to the file which is to be removed
- * @param sb unused
- * @param typeflag unused
- * @param ftwbuf unused
- * @return 0 on success, -1 on error
+/*
+ * The disk usage of a file, as accounted in the storage state leaves
+ * (like du, hard links are counted once per link).
  */
 
-static int
-remove_cb(const char *fpath, const struct stat *sb,
-	  int typeflag, struct FTW *ftwbuf)
+static inline uint64_t
+st_bytes(const struct stat *st)
 {
-    (void) sb;
-    (void) typeflag;
-    (void) ftwbuf;
+    return S_ISREG(st->st_mode) ? (uint64_t) st->st_blocks * 512 : 0;
+}
 
-    if (remove(fpath)) {
-	lmap_err("cannot remove %s", fpath);
-	/* we continue to remove the rest */
-    }
-    return 0;
+static int
+is_dot(const char *name)
+{
+    return name[0] == '.'
+	&& (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
 }
 
-/**
- * @brief Recursively removes a directory/file
- *
- * Function to recursively remove a directory/file from the
- * filesystem. A directory can include other files or directories.
- *
- * @param path path to directory or file
- * @return 0 on success, -1 on error
+/*
+ * Each workspace directory has an O_PATH file descriptor cached in the
+ * data model, see lmapd_workspace_init(). Files are opened, linked and
+ * removed relative to it, so that the path of the workspace is not
+ * looked up again. Without a cached descriptor (e.g., when running out
+ * of file descriptors), the directory is opened by its path.
  */
 
 static int
-remove_all(char *path)
+dir_fd(int cached, const char *path)
 {
-    if (! path) {
-	return -1;
+    int fd = -1;
+
+    if (cached != -1) {
+	fd = fcntl(cached, F_DUPFD_CLOEXEC, 0);
+    }
+    if (fd == -1 && path) {
+	fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
     }
-    return nftw(path, remove_cb, 12, FTW_DEPTH | FTW_PHYS);
+    return fd;
 }
 
-/* static unsigned long du_cnt = 0;	unused */
-/* static unsigned long du_size = 0;	unused */
-static uint64_t du_blocks = 0;
-
-static int
-du_cb(const char *fpath, const struct stat *sb, int tflag, struct FTW *ftwbuf)
+static void
+dir_close(int fd)
 {
-    UNUSED(fpath);
-    UNUSED(ftwbuf);
-
-    if (tflag == FTW_F) {
-	/* du_size += sb->st_size; */
-	du_blocks += (uint64_t)sb->st_blocks;
-	/* du_cnt++; */
+    if (fd != -1) {
+	(void) close(fd);
     }
-    return 0;           /* To tell nftw() to continue */
 }
 
+/*
+ * A directory iterator reading the entries in large batches with
+ * getdents64(2). The file type comes from d_type, and only if the file
+ * system does not provide it from fstatat(). Hidden names and names
+ * starting with "_" can be skipped before any system call is made for
+ * them. The entries "." and ".." are always skipped.
+ */
+
+#define DIR_ITER_BUFSIZE	(64 * 1024)
+
+#define DIR_ITER_SKIP_HIDDEN	0x01	/* names starting with "." */
+#define DIR_ITER_SKIP_PRIVATE	0x02	/* names starting with "_" */
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct dir_iter {
+    int fd;			/* the directory, for *at() calls */
+    int flags;
+    char *buf;
+    size_t len, pos;
+    const char *name;		/* current entry */
+    unsigned char type;		/* DT_* of the current entry */
+    int have_st;		/* st is valid for the current entry */
+    struct stat st;
+};
+
 static int
-du(char *path, uint64_t *storage)
+dir_iter_open(struct dir_iter *it, int dirfd, const char *name, int flags)
 {
-    /* du_cnt = 0;  */
-    /* du_size = 0; */
-    du_blocks = 0;
-    if (nftw(path, du_cb, 6, 0) == -1) {
+    memset(it, 0, sizeof(*it));
+    it->flags = flags;
+    it->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (it->fd == -1) {
+	return -1;
+    }
+    it->buf = malloc(DIR_ITER_BUFSIZE);
+    if (! it->buf) {
+	(void) close(it->fd);
+	it->fd = -1;
+	errno = ENOMEM;
 	return -1;
     }
-    *storage = du_blocks * 512;
     return 0;
 }
 
+static void
+dir_iter_close(struct dir_iter *it)
+{
+    free(it->buf);
+    it->buf = NULL;
+    dir_close(it->fd);
+    it->fd = -1;
+}
 
-/**
- * @brief Clean the complete workspace (aka queue) directory
- *
- * Function to clean the queue directory by removing everything in the
- * queue directory.
- *
- * @param lmapd pointer to the struct lmapd
- * @return 0 on success, -1 on error
+/*
+ * Advance to the next entry. Returns 1 if there is one, 0 at the end
+ * of the directory and -1 on error.
  */
 
-int
-lmapd_workspace_clean(struct lmapd *lmapd)
+static int
+dir_iter_next(struct dir_iter *it)
 {
-    int ret = 0;
-    char filepath[PATH_MAX];
-    struct dirent *dp;
-    DIR *dfd;
-
-    assert(lmapd);
-
-    (void) remove_all(NULL);
-
-    if (!lmapd->queue_path) {
-	return 0;
-    }
-
-    dfd = opendir(lmapd->queue_path);
-    if (!dfd) {
-	lmap_err("failed to open queue directory '%s'", lmapd->queue_path);
-	return -1;
-    }
+    struct linux_dirent64 *d;
+    long n;
+
+    for (;;) {
+	if (it->pos >= it->len) {
+	    n = syscall(SYS_getdents64, it->fd, it->buf, DIR_ITER_BUFSIZE);
+	    if (n <= 0) {
+		return (n == 0) ? 0 : -1;
+	    }
+	    it->len = (size_t) n;
+	    it->pos = 0;
+	}
+	d = (struct linux_dirent64 *) (it->buf + it->pos);
+	it->pos += d->d_reclen;
 
-    while ((dp = readdir(dfd)) != NULL) {
-	if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
+	if (d->d_name[0] == '.'
+	    && ((it->flags & DIR_ITER_SKIP_HIDDEN) || is_dot(d->d_name))) {
 	    continue;
 	}
-	(void) snprintf(filepath, sizeof(filepath), "%s/%s",
-			lmapd->queue_path, dp->d_name);
-	if (remove_all(filepath) != 0) {
-	    lmap_err("failed to remove '%s'", filepath);
-	    ret = -1;
+	if (d->d_name[0] == '_' && (it->flags & DIR_ITER_SKIP_PRIVATE)) {
+	    continue;
 	}
+	it->name = d->d_name;
+	it->type = d->d_type;
+	it->have_st = 0;
+	if (it->type == DT_UNKNOWN) {
+	    if (fstatat(it->fd, it->name, &it->st, AT_SYMLINK_NOFOLLOW)) {
+		continue;	/* gone already */
+	    }
+	    it->have_st = 1;
+	    it->type = IFTODT(it->st.st_mode);
+	}
+	return 1;
     }
-    (void) closedir(dfd);
-
-    return ret;
 }
 
-int
-lmapd_workspace_update(struct lmapd *lmapd)
-{
-    int ret = 0;
-    struct schedule *sched;
-    struct action *act;
+/*
+ * The disk usage of the current entry. Only regular files are stat'ed.
+ */
 
-    if (!lmapd || !lmapd->lmap) {
+static uint64_t
+dir_iter_bytes(struct dir_iter *it)
+{
+    if (it->type != DT_REG) {
 	return 0;
     }
-
-    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
-	if (du(sched->workspace, &sched->storage) == -1) {
-	    ret = -1;
-	}
-	for (act = sched->actions; act; act = act->next) {
-	    if (du(act->workspace, &act->storage) == -1) {
-		ret = -1;
-	    }
+    if (! it->have_st) {
+	if (fstatat(it->fd, it->name, &it->st, AT_SYMLINK_NOFOLLOW)) {
+	    return 0;
 	}
+	it->have_st = 1;
     }
-
-    return ret;
+    return st_bytes(&it->st);
 }
 
 /**
- * @brief Clean the workspace of an schedule
+ * @brief Recursively removes a directory/file
  *
- * Function to clean the workspace of an schedule, by removing
- * the processing queue (all files in the base schedule directory),
- * it leaves directories and files starting with "_" untouched.
+ * Function to recursively remove the current entry of a directory
+ * iterator from the filesystem. A directory can include other files
+ * or directories. Removal continues after errors. This is safe to
+ * call from a worker thread.
  *
- * @param lmapd pointer to the struct lmapd
- * @param schedule pointer to the struct schedule
+ * @param parent pointer to the iterator of the parent directory
+ * @param bytes incremented by the disk usage of the removed files
  * @return 0 on success, -1 on error
  */
-int
-lmapd_workspace_schedule_clean(struct lmapd *lmapd, struct schedule *schedule)
-{
-    int ret = 0;
-    struct dirent *dp;
-    struct stat st;
-    DIR *dfd;
-
-    assert(lmapd);
-    (void) lmapd;
 
-    if (!schedule || !schedule->workspace) {
+static int
+remove_entry(struct dir_iter *parent, uint64_t *bytes)
+{
+    int n, ret = 0;
+    uint64_t size;
+    struct dir_iter it;
+
+    if (parent->type != DT_DIR) {
+	size = dir_iter_bytes(parent);
+	if (unlinkat(parent->fd, parent->name, 0)) {
+	    lmap_err("cannot remove %s: %s", parent->name, strerror(errno));
+	    return -1;
+	}
+	*bytes += size;
 	return 0;
     }
 
-    dfd = opendir(schedule->workspace);
-    if (!dfd) {
-	lmap_err("failed to open directory '%s'", schedule->workspace);
+    if (dir_iter_open(&it, parent->fd, parent->name, 0)) {
+	lmap_err("cannot open %s: %s", parent->name, strerror(errno));
 	return -1;
     }
-
-    while ((dp = readdir(dfd)) != NULL) {
-	if (dp->d_name[0] == '_') {
-	    continue;
-	}
-	if (fstatat(dirfd(dfd), dp->d_name, &st, AT_SYMLINK_NOFOLLOW)
-		|| S_ISDIR(st.st_mode)) {
-	    continue;
-	}
-	if (unlinkat(dirfd(dfd), dp->d_name, 0)) {
-	    lmap_err("failed to remove '%s/%s'", schedule->workspace, dp->d_name);
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (remove_entry(&it, bytes)) {
+	    /* we continue to remove the rest */
 	    ret = -1;
 	}
     }
-    (void) closedir(dfd);
+    if (n < 0) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
 
+    if (unlinkat(parent->fd, parent->name, AT_REMOVEDIR)) {
+	lmap_err("cannot remove %s: %s", parent->name, strerror(errno));
+	return -1;
+    }
     return ret;
 }
 
 /**
- * @brief Move the workspace incoming queue of an schedule
- *
- * Function to move the contents of the incoming special
- * queue of an schedule to the active input queue.
+ * @brief Disk usage of a directory tree
  *
- * Only complete queue entries (i.e. those with both .data
- * and .meta files) are moved.
+ * Adds up the disk usage of the regular files in a directory tree.
+ * Unlike nftw(), this keeps no global state, so it is safe to call
+ * from a worker thread.
  *
- * @param lmapd pointer to the struct lmapd
- * @param schedule pointer to the struct schedule
+ * @param dirfd directory file descriptor name is relative to
+ * @param name name of the directory
+ * @param bytes incremented by the disk usage of the files
  * @return 0 on success, -1 on error
  */
 
-int
-lmapd_workspace_schedule_move(struct lmapd *lmapd, struct schedule *schedule)
+static int
+usage_at(int dirfd, const char *name, uint64_t *bytes)
 {
-    int ret = -1;
-    char oldfilepath[PATH_MAX];
-    struct dirent *dp;
-    DIR *dfd;
-    struct stat st;
+    int n, ret = 0;
+    struct dir_iter it;
 
-    int dirfd_dest = -1;
-    char *sdata = NULL, *s;
+    if (dir_iter_open(&it, dirfd, name, 0)) {
+	return -1;
+    }
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (it.type == DT_DIR) {
+	    if (usage_at(it.fd, it.name, bytes)) {
+		ret = -1;
+	    }
+	} else {
+	    *bytes += dir_iter_bytes(&it);
+	}
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
 
-    assert(lmapd);
-    (void) lmapd;
+    return ret;
+}
 
-    if (!schedule || !schedule->workspace) {
-	return 0;
-    }
+/*
+ * The files of a directory are removed, linked and moved in batches of
+ * up to BATCH_MAX entries. When built with io_uring support, a full
+ * batch is handed to the kernel at once, and it runs the operations
+ * concurrently. The ring is only set up once a batch is full, so that
+ * small directories do not pay for it. Without io_uring, or when the
+ * kernel does not provide it, the operations of a batch are plain
+ * system calls, made one after the other.
+ *
+ * Moving a queue entry takes four operations: link the .data file,
+ * link the .meta file, then unlink both from the source directory. With
+ * io_uring, each step is run for the whole batch before the next one.
+ * A failure to link the .data file skips the rest of the steps. A
+ * failure to link the .meta file rolls back the link of the .data
+ * file, and no further batches are moved.
+ */
 
-    const char * const newfilepath = schedule->workspace;
+#define BATCH_MAX	64
+
+enum batch_type {
+    BATCH_UNLINK,		/* unlink name from dirfd */
+    BATCH_LINK,			/* link name from dirfd to destfd */
+    BATCH_MOVE,			/* move the queue entry name (.meta) and data */
+};
+
+enum {
+    MOVE_LINK_DATA,
+    MOVE_LINK_META,
+    MOVE_UNLINK_META,
+    MOVE_UNLINK_DATA,
+    MOVE_OPS
+};
+
+struct batch_entry {
+    char name[NAME_MAX + 1];
+    char data[NAME_MAX + 1];	/* BATCH_MOVE only */
+    uint64_t size;
+    int res[MOVE_OPS];		/* 0 or -errno, -ECANCELED if not run */
+};
+
+struct batch {
+    enum batch_type type;
+    int dirfd, destfd;
+    const char *workspace;	/* for messages */
+    const char *destdir;
+    uint64_t *bytes;		/* incremented by unlinked/linked files */
+    int ret;
+    int stop;			/* a move was rolled back */
+    struct qindex *qindex;	/* BATCH_MOVE: remove the moved entries */
+#ifdef WITH_IO_URING
+    struct uring *ring;
+    int no_ring;
+#endif
+    unsigned int n;
+    struct batch_entry e[BATCH_MAX];
+};
+
+static struct batch *
+batch_new(enum batch_type type, int dirfd, int destfd,
+	  const char *workspace, const char *destdir, uint64_t *bytes)
+{
+    struct batch *b;
 
-    errno = 0;
-    do {
-	dirfd_dest = open(newfilepath, O_DIRECTORY | O_RDONLY);
-    } while (dirfd_dest == -1 && (errno == EAGAIN || errno == EINTR));
-    if (dirfd_dest == -1) {
-	lmap_err("failed to open directory '%s': %s",
-		 newfilepath, strerror(errno));
-	return -1;
+    b = calloc(1, sizeof(*b));
+    if (! b) {
+	lmap_err("failed to allocate memory");
+	return NULL;
     }
+    b->type = type;
+    b->dirfd = dirfd;
+    b->destfd = destfd;
+    b->workspace = workspace;
+    b->destdir = destdir;
+    b->bytes = bytes;
+    return b;
+}
 
-    snprintf(oldfilepath, sizeof(oldfilepath), "%s/" LMAPD_QUEUE_INCOMING_NAME,
-	     schedule->workspace);
-    dfd = opendir(oldfilepath);
-    if (!dfd) {
-	lmap_err("failed to open directory '%s': %s",
-		 oldfilepath, strerror(errno));
-	goto err_exit;
+static void
+batch_run_sync(struct batch *b)
+{
+    unsigned int i;
+    struct batch_entry *e;
+
+    for (i = 0; i < b->n; i++) {
+	e = &b->e[i];
+	switch (b->type) {
+	case BATCH_UNLINK:
+	    e->res[0] = unlinkat(b->dirfd, e->name, 0) ? -errno : 0;
+	    break;
+	case BATCH_LINK:
+	    e->res[0] = linkat(b->dirfd, e->name, b->destfd, e->name, 0)
+		? -errno : 0;
+	    break;
+	case BATCH_MOVE:
+	    e->res[MOVE_LINK_DATA] =
+		linkat(b->dirfd, e->data, b->destfd, e->data, 0) ? -errno : 0;
+	    if (e->res[MOVE_LINK_DATA]) {
+		break;
+	    }
+	    e->res[MOVE_LINK_META] =
+		linkat(b->dirfd, e->name, b->destfd, e->name, 0) ? -errno : 0;
+	    if (e->res[MOVE_LINK_META]) {
+		/* leave the remaining entries alone, see batch_report() */
+		b->n = i + 1;
+		return;
+	    }
+	    e->res[MOVE_UNLINK_META] =
+		unlinkat(b->dirfd, e->name, 0) ? -errno : 0;
+	    e->res[MOVE_UNLINK_DATA] =
+		unlinkat(b->dirfd, e->data, 0) ? -errno : 0;
+	    break;
+	}
     }
+}
 
-    sdata = NULL;
-    while ((dp = readdir(dfd)) != NULL) {
-	/* skip ., .., hidden files/directories */
-	if (dp->d_name[0] == '.') {
-	    continue;
+#ifdef WITH_IO_URING
+
+static void
+batch_done(void *arg, uint64_t data, int res)
+{
+    struct batch *b = arg;
+
+    b->e[data / MOVE_OPS].res[data % MOVE_OPS] = res;
+}
+
+static void
+batch_queue(struct batch *b, unsigned int i, int op)
+{
+    struct batch_entry *e = &b->e[i];
+    uint64_t d = (uint64_t) i * MOVE_OPS + op;
+
+    switch (b->type) {
+    case BATCH_UNLINK:
+	(void) lmapd_uring_unlinkat(b->ring, b->dirfd, e->name, 0, d);
+	break;
+    case BATCH_LINK:
+	(void) lmapd_uring_linkat(b->ring, b->dirfd, e->name,
+				  b->destfd, e->name, 0, d);
+	break;
+    case BATCH_MOVE:
+	switch (op) {
+	case MOVE_LINK_DATA:
+	    (void) lmapd_uring_linkat(b->ring, b->dirfd, e->data,
+				      b->destfd, e->data, 0, d);
+	    break;
+	case MOVE_LINK_META:
+	    (void) lmapd_uring_linkat(b->ring, b->dirfd, e->name,
+				      b->destfd, e->name, 0, d);
+	    break;
+	case MOVE_UNLINK_META:
+	    (void) lmapd_uring_unlinkat(b->ring, b->dirfd, e->name, 0, d);
+	    break;
+	case MOVE_UNLINK_DATA:
+	    (void) lmapd_uring_unlinkat(b->ring, b->dirfd, e->data, 0, d);
+	    break;
 	}
-	/* is it the .meta file ? */
-	s = strrchr(dp->d_name, '.');
-	if (s && !strcmp(".meta", s)) {
-	    free(sdata);
-	    sdata = strdup(dp->d_name);
-	    if (!sdata)
-		break; /* abort scan */
-	    s = strrchr(sdata, '.');
-	    if (!s)
-		break; /* should *NEVER* happen */
-	    s++;
-	    strcpy(s, "data"); /* strlen("data") == strlen("meta") */
-
-	    if (fstatat(dirfd(dfd), dp->d_name, &st, AT_SYMLINK_NOFOLLOW)
-		    || !S_ISREG(st.st_mode)) {
-		continue; /* "meta" is not a regular file? skip this pair */
-	    }
-	    /* "meta" *is* there, "data" might not be */
-	    if (fstatat(dirfd(dfd), sdata, &st, AT_SYMLINK_NOFOLLOW)
-		    || !S_ISREG(st.st_mode)) {
-		continue; /* "data" is not a regular file, or not there yet, skip this pair */
-	    }
-	    if (linkat(dirfd(dfd), sdata, dirfd_dest, sdata, 0)) {
-		lmap_err("failed to move %s from %s to %s: %s",
-			sdata, oldfilepath, newfilepath, strerror(errno));
+	break;
+    }
+}
+
+static int
+batch_run_uring(struct batch *b)
+{
+    unsigned int i;
+    int op;
+
+    if (b->type != BATCH_MOVE) {
+	for (i = 0; i < b->n; i++) {
+	    batch_queue(b, i, 0);
+	}
+	return lmapd_uring_run(b->ring, batch_done, b);
+    }
+
+    /* the .meta files are only linked once their .data file was, and
+     * both are only unlinked from the source once both were linked */
+    for (op = MOVE_LINK_DATA; op <= MOVE_UNLINK_META; op++) {
+	for (i = 0; i < b->n; i++) {
+	    if (op != MOVE_LINK_DATA && b->e[i].res[op - 1]) {
 		continue;
 	    }
-	    if (linkat(dirfd(dfd), dp->d_name, dirfd_dest, dp->d_name, 0)) {
+	    batch_queue(b, i, op);
+	    if (op == MOVE_UNLINK_META) {
+		batch_queue(b, i, MOVE_UNLINK_DATA);
+	    }
+	}
+	if (lmapd_uring_run(b->ring, batch_done, b)) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+#endif
+
+/*
+ * Logs the failed operations of a batch and accounts the successful ones.
+ */
+
+static void
+batch_report(struct batch *b)
+{
+    unsigned int i;
+    struct batch_entry *e;
+
+    for (i = 0; i < b->n; i++) {
+	e = &b->e[i];
+	switch (b->type) {
+	case BATCH_UNLINK:
+	    if (e->res[0]) {
+		lmap_err("failed to remove '%s/%s': %s",
+			 b->workspace, e->name, strerror(-e->res[0]));
+		b->ret = -1;
+	    } else {
+		*b->bytes += e->size;
+	    }
+	    break;
+	case BATCH_LINK:
+	    if (e->res[0]) {
+		lmap_err("failed to move '%s/%s' to '%s': %s",
+			 b->workspace, e->name, b->destdir, strerror(-e->res[0]));
+		b->ret = -1;
+	    } else {
+		*b->bytes += e->size;
+	    }
+	    break;
+	case BATCH_MOVE:
+	    /* "meta" *is* there, "data" might not be: linkat() tells */
+	    if (e->res[MOVE_LINK_DATA]) {
+		if (e->res[MOVE_LINK_DATA] != -ENOENT
+		    && e->res[MOVE_LINK_DATA] != -ECANCELED) {
+		    lmap_err("failed to move %s from %s to %s: %s",
+			     e->data, b->workspace, b->destdir,
+			     strerror(-e->res[MOVE_LINK_DATA]));
+		}
+		break;
+	    }
+	    if (e->res[MOVE_LINK_META]) {
 		lmap_err("failed to move %s from %s to %s: %s",
-			dp->d_name, oldfilepath, newfilepath, strerror(errno));
+			 e->name, b->workspace, b->destdir,
+			 strerror(-e->res[MOVE_LINK_META]));
 		/* rollback first linkat() */
-		if (unlinkat(dirfd_dest, sdata, 0))
+		if (unlinkat(b->destfd, e->data, 0))
 		    lmap_err("Could not rollback move of '%s/%s': %s",
-			    oldfilepath, sdata, strerror(errno));
+			     b->workspace, e->data, strerror(errno));
+		b->stop = 1;
 		break;
 	    }
-	    /* unlink from source dir to complete the move operation, do not
-	     * short-circuit -- if we unlink either one, we already avoid
-	     * double processing them */
-	    if (unlinkat(dirfd(dfd), dp->d_name, 0)) {
-		    lmap_wrn("failed to unlink %s from incoming queue: %s",
-			    dp->d_name, strerror(errno));
+	    if (b->qindex) {
+		lmapd_qindex_remove(b->qindex, e->name);
 	    }
-	    if (unlinkat(dirfd(dfd), sdata, 0)) {
-		    lmap_wrn("failed to unlink %s from incoming queue: %s",
-			    sdata, strerror(errno));
+	    /* if we unlinked either one, we already avoid double
+	     * processing them */
+	    if (e->res[MOVE_UNLINK_META]) {
+		lmap_wrn("failed to unlink %s from incoming queue: %s",
+			 e->name, strerror(-e->res[MOVE_UNLINK_META]));
 	    }
+	    if (e->res[MOVE_UNLINK_DATA]) {
+		lmap_wrn("failed to unlink %s from incoming queue: %s",
+			 e->data, strerror(-e->res[MOVE_UNLINK_DATA]));
+	    }
+	    break;
+	}
+    }
+}
+
+static void
+batch_flush(struct batch *b)
+{
+    unsigned int i;
+    int j;
+
+    if (! b->n) {
+	return;
+    }
+    for (i = 0; i < b->n; i++) {
+	for (j = 0; j < MOVE_OPS; j++) {
+	    b->e[i].res[j] = -ECANCELED;
 	}
     }
-    ret = 0;
 
-err_exit:
-    free(sdata);
-    if (dfd) {
-	(void) closedir(dfd);
+#ifdef WITH_IO_URING
+    if (! b->ring && ! b->no_ring && b->n == BATCH_MAX) {
+	b->ring = lmapd_uring_new(BATCH_MAX * 2);
+	b->no_ring = ! b->ring;
     }
-    if (dirfd_dest != -1) {
-	(void) close(dirfd_dest);
+    if (b->ring) {
+	if (batch_run_uring(b)) {
+	    /* what did not run stays -ECANCELED, go on without the ring */
+	    lmapd_uring_free(b->ring);
+	    b->ring = NULL;
+	    b->no_ring = 1;
+	}
+    } else {
+	batch_run_sync(b);
     }
+#else
+    batch_run_sync(b);
+#endif
 
-    return ret;
+    batch_report(b);
+    b->n = 0;
 }
 
-/**
- * @brief Clean the workspace of an action
- *
- * Function to clean the workspace of an action by removing everything
- * in the workspace directory.
- *
- * We preserve files and direct subdirectories (but not files or
- * directories inside subdirectories) starting with "_", so that actions
- * can have a private namespace for work that, while not guaranteed to
- * last across lmapd config updates and restarts, keeps state from one
- * schedule execution to the next.
- *
- * @param lmapd pointer to the struct lmapd
- * @param action pointer to the struct action
- * @return 0 on success, -1 on error
+/*
+ * Adds an entry to the batch, running the batch when it is full.
+ * Returns -1 once no more entries should be added.
  */
 
-int
-lmapd_workspace_action_clean(struct lmapd *lmapd, struct action *action)
+static int
+batch_add(struct batch *b, const char *name, const char *data, uint64_t size)
 {
-    int ret = 0;
-    char filepath[PATH_MAX];
-    struct dirent *dp;
-    DIR *dfd;
-
-    assert(lmapd);
-    (void) lmapd;
+    struct batch_entry *e = &b->e[b->n++];
 
-    if (!action || !action->workspace) {
-	return 0;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    if (data) {
+	snprintf(e->data, sizeof(e->data), "%s", data);
+    }
+    e->size = size;
+    if (b->n == BATCH_MAX) {
+	batch_flush(b);
     }
+    return b->stop ? -1 : 0;
+}
+
+/*
+ * Runs the entries left in the batch and frees it. Returns 0 if all
+ * operations succeeded, -1 otherwise.
+ */
+
+static int
+batch_free(struct batch *b)
+{
+    int ret;
+
+    batch_flush(b);
+    ret = b->ret;
+#ifdef WITH_IO_URING
+    lmapd_uring_free(b->ring);
+#endif
+    free(b);
+    return ret;
+}
+
+/*
+ * The incoming queue of a schedule may have a quota on the disk usage
+ * and the number of files of its complete entries. The entries are
+ * tracked in a struct qindex, oldest first: results delivered by
+ * action_move() are added, entries moved by schedule_move() are
+ * removed. The index is rebuilt from the directory only when the
+ * workspace is initialized and when the storage is measured.
+ */
+
+/*
+ * Whether the current entry is the .meta file of a complete queue
+ * entry. Sets data to the name of its .data file, and bytes to the
+ * disk usage of both files.
+ */
+
+static int
+entry_pair(struct dir_iter *it, char *data, size_t size, uint64_t *bytes)
+{
+    size_t len = strlen(it->name);
+    struct stat st;
+
+    if (len < 5 || len >= size || it->type != DT_REG
+	|| strcmp(it->name + len - 5, ".meta")) {
+	return 0;
+    }
+    memcpy(data, it->name, len - 4);
+    strcpy(data + len - 4, "data");
+    if (fstatat(it->fd, data, &st, AT_SYMLINK_NOFOLLOW) || !S_ISREG(st.st_mode)) {
+	return 0;
+    }
+    *bytes = dir_iter_bytes(it) + st_bytes(&st);
+    return 1;
+}
+
+struct scan_entry {
+    unsigned long long t;	/* invocation time, see action_open() */
+    char *name;
+    uint64_t bytes;
+};
+
+static int
+scan_cmp(const void *a, const void *b)
+{
+    const struct scan_entry *x = a, *y = b;
+
+    if (x->t != y->t) {
+	return x->t < y->t ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+/*
+ * Collects the complete entries of a directory into a new, unshared
+ * index, oldest first.
+ */
+
+static struct qindex *
+queue_scan(int dirfd)
+{
+    int n;
+    char data[NAME_MAX + 1];
+    struct dir_iter it;
+    struct scan_entry *v = NULL, *tmp;
+    size_t i, len = 0, cap = 0;
+    uint64_t bytes;
+    struct qindex *qindex;
+
+    if (dir_iter_open(&it, dirfd, ".", DIR_ITER_SKIP_HIDDEN)) {
+	return NULL;
+    }
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (! entry_pair(&it, data, sizeof(data), &bytes)) {
+	    continue;
+	}
+	if (len == cap) {
+	    cap = cap ? cap * 2 : 64;
+	    tmp = realloc(v, cap * sizeof(*v));
+	    if (! tmp) {
+		n = -1;
+		break;
+	    }
+	    v = tmp;
+	}
+	v[len].t = strtoull(it.name, NULL, 10);
+	v[len].name = strdup(it.name);
+	v[len].bytes = bytes;
+	if (! v[len].name) {
+	    n = -1;
+	    break;
+	}
+	len++;
+    }
+    dir_iter_close(&it);
+
+    qindex = (n == 0) ? lmapd_qindex_new() : NULL;
+    if (qindex) {
+	if (len) {
+	    qsort(v, len, sizeof(*v), scan_cmp);
+	}
+	for (i = 0; i < len; i++) {
+	    if (lmapd_qindex_add(qindex, v[i].name, v[i].bytes)) {
+		lmapd_qindex_unref(qindex);
+		qindex = NULL;
+		break;
+	    }
+	}
+    }
+    for (i = 0; i < len; i++) {
+	free(v[i].name);
+    }
+    free(v);
+    return qindex;
+}
+
+/*
+ * Replaces the entries of an index with the complete entries of the
+ * incoming directory.
+ */
+
+static int
+queue_rebuild(int incfd, struct qindex *qindex)
+{
+    struct qindex *scan;
+
+    scan = queue_scan(incfd);
+    if (! scan) {
+	return -1;
+    }
+    lmapd_qindex_assign(qindex, scan);
+    lmapd_qindex_unref(scan);
+    return 0;
+}
+
+/*
+ * Removes an evicted entry, the .meta file first so that it is not
+ * moved anymore. Returns -1 if the entry is gone already.
+ */
+
+static int
+queue_evict(int destfd, const char *destdir, const char *name)
+{
+    char data[NAME_MAX + 1];
+    size_t len = strlen(name);
+
+    if (unlinkat(destfd, name, 0)) {
+	if (errno != ENOENT) {
+	    lmap_err("failed to remove '%s/%s': %s",
+		     destdir, name, strerror(errno));
+	}
+	return -1;
+    }
+    if (len >= 5 && len < sizeof(data)) {
+	memcpy(data, name, len - 4);
+	strcpy(data + len - 4, "data");
+	if (unlinkat(destfd, data, 0) && errno != ENOENT) {
+	    lmap_wrn("failed to remove '%s/%s': %s",
+		     destdir, data, strerror(errno));
+	}
+    }
+    return 0;
+}
+
+/*
+ * Makes room in the incoming queue for the complete entries in the
+ * workspace of an action, and for its output held in datafd, evicting
+ * the oldest entries of the queue unless the quota refuses new results.
+ * Returns the entries to add to the queue index once they were
+ * delivered, NULL if the result was refused (or on error).
+ */
+
+static struct qindex *
+queue_admit(int wsfd, int destfd, const char *destdir,
+	    struct queue_quota *quota, int datafd, const char *meta)
+{
+    struct qindex *result;
+    struct qindex_entry *evicted, *entry;
+    uint64_t bytes, files, evicted_bytes = 0;
+    struct stat st, mst;
+
+    result = queue_scan(wsfd);
+    if (! result) {
+	return NULL;
+    }
+    /* the .data of an output held in memory is not in the workspace */
+    if (datafd != -1 && fstat(datafd, &st) == 0
+	&& fstatat(wsfd, meta, &mst, AT_SYMLINK_NOFOLLOW) == 0
+	&& lmapd_qindex_add(result, meta, st_bytes(&st) + st_bytes(&mst))) {
+	lmapd_qindex_unref(result);
+	return NULL;
+    }
+    lmapd_qindex_usage(result, &bytes, &files);
+    if (lmapd_qindex_reserve(quota->qindex, bytes, files,
+			     quota->max_bytes, quota->max_files,
+			     ! quota->refuse, &evicted)) {
+	lmap_wrn("queue '%s' is full, refusing a result of %llu bytes",
+		 destdir, (unsigned long long) bytes);
+	quota->hit = 1;
+	lmapd_qindex_unref(result);
+	return NULL;
+    }
+    if (evicted) {
+	quota->hit = 1;
+	for (entry = evicted; entry; entry = entry->next) {
+	    if (queue_evict(destfd, destdir, entry->name) == 0) {
+		evicted_bytes += entry->bytes;
+	    }
+	}
+	lmap_wrn("queue '%s' is full, evicted %llu bytes of old results",
+		 destdir, (unsigned long long) evicted_bytes);
+	quota->evicted += evicted_bytes;
+	lmapd_qindex_entries_free(evicted);
+    }
+    return result;
+}
+
+/*
+ * Sets up the quota of the incoming queue of a schedule for a delivery.
+ */
+
+static void
+queue_quota(struct queue_quota *quota, struct schedule *schedule)
+{
+    memset(quota, 0, sizeof(*quota));
+    quota->qindex = lmapd_qindex_ref(schedule->qindex);
+    quota->max_bytes = schedule->incoming_max_bytes;
+    quota->max_files = schedule->incoming_max_files;
+    quota->refuse = (schedule->incoming_overflow == LMAP_SCHEDULE_OVERFLOW_REFUSE);
+}
+
+/*
+ * Counts what happened to the quota of a schedule.
+ */
+
+static void
+queue_account(struct schedule *schedule, struct queue_quota *quota)
+{
+    if (quota->hit) {
+	schedule->cnt_quota_hits++;
+    }
+    schedule->evicted_bytes += quota->evicted;
+}
+
+/**
+ * @brief Clean the complete workspace (aka queue) directory
+ *
+ * Function to clean the queue directory by removing everything in the
+ * queue directory. The storage of all schedules and actions is zero
+ * afterwards.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_clean(struct lmapd *lmapd)
+{
+    int n, ret = 0;
+    uint64_t bytes = 0;
+    struct dir_iter it;
+
+    assert(lmapd);
+
+    if (!lmapd->queue_path) {
+	return 0;
+    }
+
+    if (dir_iter_open(&it, AT_FDCWD, lmapd->queue_path, 0)) {
+	lmap_err("failed to open queue directory '%s'", lmapd->queue_path);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (remove_entry(&it, &bytes) != 0) {
+	    lmap_err("failed to remove '%s/%s'", lmapd->queue_path, it.name);
+	    ret = -1;
+	}
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+
+    if (lmapd->lmap) {
+	struct schedule *sched;
+	struct action *act;
+
+	for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	    sched->storage = 0;
+	    for (act = sched->actions; act; act = act->next) {
+		act->storage = 0;
+	    }
+	}
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Measure the storage of all schedules and actions
+ *
+ * Walks the workspaces of all schedules and actions and sets their
+ * storage to the disk usage of the files in there. lmapd keeps the
+ * storage up to date as it moves and removes files, this only
+ * corrects for changes it did not make itself. See
+ * lmapd_workspace_job_update() to do this on a worker thread.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_update(struct lmapd *lmapd)
+{
+    int ret;
+    struct workspace_job *job;
+
+    if (!lmapd || !lmapd->lmap) {
+	return 0;
+    }
+
+    job = lmapd_workspace_job_new();
+    if (! job) {
+	return -1;
+    }
+    ret = lmapd_workspace_job_update(job, lmapd->lmap);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+
+    return ret;
+}
+
+/**
+ * @brief Clean the workspace of an schedule
+ *
+ * Function to clean the workspace of an schedule, by removing
+ * the processing queue (all files in the base schedule directory),
+ * it leaves directories and files starting with "_" untouched.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @return 0 on success, -1 on error
+ */
+int
+lmapd_workspace_schedule_clean(struct lmapd *lmapd, struct schedule *schedule)
+{
+    assert(lmapd);
+    (void) lmapd;
+
+    int ret, fd;
+    uint64_t bytes = 0;
+
+    if (!schedule || !schedule->workspace) {
+	return 0;
+    }
+
+    fd = dir_fd(schedule->workspace_fd, schedule->workspace);
+    ret = schedule_clean(fd, schedule->workspace, &bytes);
+    dir_close(fd);
+    return ret;
+}
+
+static int
+schedule_clean(int wsfd, const char *workspace, uint64_t *bytes)
+{
+    int n, ret = 0;
+    struct dir_iter it;
+    struct batch *b;
+
+    if (dir_iter_open(&it, wsfd, ".", DIR_ITER_SKIP_PRIVATE)) {
+	lmap_err("failed to open directory '%s'", workspace);
+	return -1;
+    }
+    b = batch_new(BATCH_UNLINK, it.fd, -1, workspace, NULL, bytes);
+    if (! b) {
+	dir_iter_close(&it);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (it.type == DT_DIR) {
+	    continue;
+	}
+	(void) batch_add(b, it.name, NULL, dir_iter_bytes(&it));
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    if (batch_free(b)) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+
+    return ret;
+}
+
+/**
+ * @brief Move the workspace incoming queue of an schedule
+ *
+ * Function to move the contents of the incoming special
+ * queue of an schedule to the active input queue.
+ *
+ * Only complete queue entries (i.e. those with both .data
+ * and .meta files) are moved. The active segment of a result log
+ * is sealed into the active queue, see lmapd_rlog_seal().
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_schedule_move(struct lmapd *lmapd, struct schedule *schedule)
+{
+    assert(lmapd);
+    (void) lmapd;
+
+    int ret, fd, incfd;
+    char filepath[PATH_MAX];
+
+    if (!schedule || !schedule->workspace) {
+	return 0;
+    }
+
+    snprintf(filepath, sizeof(filepath), "%s/" LMAPD_QUEUE_INCOMING_NAME,
+	     schedule->workspace);
+    fd = dir_fd(schedule->workspace_fd, schedule->workspace);
+    incfd = dir_fd(schedule->incoming_fd, filepath);
+    ret = schedule_move(fd, incfd, schedule->workspace, schedule->qindex);
+    dir_close(fd);
+    dir_close(incfd);
+    return ret;
+}
+
+static int
+schedule_move(int wsfd, int incfd, const char *workspace,
+	      struct qindex *qindex)
+{
+    int n;
+    char oldfilepath[PATH_MAX];
+    char sdata[NAME_MAX + 1];
+    struct dir_iter it;
+    struct batch *b;
+    size_t len;
+
+    const char * const newfilepath = workspace;
+
+    if (wsfd == -1) {
+	lmap_err("failed to open directory '%s'", newfilepath);
+	return -1;
+    }
+    snprintf(oldfilepath, sizeof(oldfilepath), "%s/" LMAPD_QUEUE_INCOMING_NAME,
+	     workspace);
+    /* the result log is moved by sealing its active segment */
+    if (incfd != -1) {
+	(void) lmapd_rlog_seal(incfd, wsfd, oldfilepath, newfilepath);
+    }
+    if (dir_iter_open(&it, incfd, ".", DIR_ITER_SKIP_HIDDEN)) {
+	lmap_err("failed to open directory '%s': %s",
+		 oldfilepath, strerror(errno));
+	return -1;
+    }
+    b = batch_new(BATCH_MOVE, it.fd, wsfd, oldfilepath, newfilepath, NULL);
+    if (! b) {
+	dir_iter_close(&it);
+	return -1;
+    }
+    b->qindex = qindex;
+
+    /* skips ., .., hidden files/directories */
+    while ((n = dir_iter_next(&it)) > 0) {
+	/* is it the .meta file ? "meta" must be a regular file */
+	len = strlen(it.name);
+	if (len < 5 || len >= sizeof(sdata) || it.type != DT_REG
+	    || strcmp(it.name + len - 5, ".meta")) {
+	    continue;
+	}
+	memcpy(sdata, it.name, len - 4);
+	strcpy(sdata + len - 4, "data"); /* strlen("data") == strlen("meta") */
+
+	if (batch_add(b, it.name, sdata, 0)) {
+	    break;
+	}
+    }
+    (void) batch_free(b);
+    dir_iter_close(&it);
+
+    return 0;
+}
+
+/**
+ * @brief Clean the workspace of an action
+ *
+ * Function to clean the workspace of an action by removing everything
+ * in the workspace directory.
+ *
+ * We preserve files and direct subdirectories (but not files or
+ * directories inside subdirectories) starting with "_", so that actions
+ * can have a private namespace for work that, while not guaranteed to
+ * last across lmapd config updates and restarts, keeps state from one
+ * schedule execution to the next. An output held in memory is
+ * discarded as well.
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param action pointer to the struct action
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_action_clean(struct lmapd *lmapd, struct action *action)
+{
+    assert(lmapd);
+    (void) lmapd;
+
+    int ret, fd;
+    uint64_t bytes = 0;
+
+    if (!action || !action->workspace) {
+	return 0;
+    }
+
+    if (action->output_fd != -1) {
+	(void) close(action->output_fd);
+	action->output_fd = -1;
+    }
+    fd = dir_fd(action->workspace_fd, action->workspace);
+    ret = action_clean(fd, action->workspace, &bytes);
+    dir_close(fd);
+    return ret;
+}
+
+static int
+action_clean(int wsfd, const char *workspace, uint64_t *bytes)
+{
+    int n, ret = 0;
+    struct dir_iter it;
+    struct batch *b;
+
+    if (dir_iter_open(&it, wsfd, ".", DIR_ITER_SKIP_PRIVATE)) {
+	lmap_err("failed to open '%s'", workspace);
+	return -1;
+    }
+
+    b = batch_new(BATCH_UNLINK, it.fd, -1, workspace, NULL, bytes);
+    if (! b) {
+	dir_iter_close(&it);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (it.type != DT_DIR) {
+	    (void) batch_add(b, it.name, NULL, dir_iter_bytes(&it));
+	    continue;
+	}
+	if (remove_entry(&it, bytes) != 0) {
+	    lmap_err("failed to remove '%s/%s'", workspace, it.name);
+	    ret = -1;
+	}
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    if (batch_free(b)) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+
+    return ret;
+}
+
+/**
+ * @brief Move the workspace of an action
+ *
+ * Function to move the workspace of an action to a destination
+ * schedule.  The action output files are moved to the destination
+ * schedule's incoming special folder.
+ *
+ * Note: all files in the action workspace are moved, except for
+ * hidden files, or those starting with "_".
+ *
+ * Should the destination schedule be the action's own schedule,
+ * move its output files to its own schedule's *active* (processing)
+ * incoming queue instead, where it will be immediately available
+ * for consumption (e.g. by the next action in a sequential execution
+ * mode).
+ *
+ * The "defer" parameter can be used to move the results of all
+ * actions of a schedule only after the schedule finishes running,
+ * while still immediately moving the output of actions directed
+ * to their own schedule (see above).
+ *
+ * If the incoming queue of the destination schedule has a quota, its
+ * oldest entries are evicted to make room for the output, or the output
+ * is refused, see lmapd_workspace_init().
+ *
+ * @param lmapd pointer to the struct lmapd
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @param destination pointer to the struct schedule
+ * @param defer defer moves destined to a different schedule
+ * @return 0 on success, -1 on error, 1 if the move was deferred
+ */
+
+int
+lmapd_workspace_action_move(struct lmapd *lmapd, struct schedule *schedule,
+		            struct action *action, struct schedule *destination,
+			    int defer)
+{
+    int ret, fd, destfd;
+    char destdir[PATH_MAX];
+    char dataname[NAME_MAX + 1] = "";
+    uint64_t bytes = 0;
+    struct queue_quota quota = { 0 };
+
+    assert(lmapd);
+    (void) lmapd;
+
+    if (!schedule || !schedule->name
+	|| !action || !action->workspace || !action->name
+	|| !destination || !destination->workspace) {
+	return 0;
+    }
+
+    /* we want to process moves to the action's own schedule
+     * immediately, but we might want to defer moves to any other
+     * schedule to happen when the schedule finishes (i.e. all
+     * actions have finished). */
+    if (defer && destination != schedule)
+	return 1;
+
+    if (destination != schedule) {
+	snprintf(destdir, sizeof(destdir),
+		 "%s/" LMAPD_QUEUE_INCOMING_NAME, destination->workspace);
+	destfd = dir_fd(destination->incoming_fd, destdir);
+	if (destination->qindex) {
+	    queue_quota(&quota, destination);
+	}
+    } else {
+	/* Special case: action moving its result to its own schedule */
+	snprintf(destdir, sizeof(destdir), "%s", destination->workspace);
+	destfd = dir_fd(destination->workspace_fd, destdir);
+    }
+    if (action->output_fd != -1) {
+	action_name(schedule, action, "data", dataname, sizeof(dataname));
+    }
+    fd = dir_fd(action->workspace_fd, action->workspace);
+    if (destination != schedule
+	&& destination->incoming_format == LMAP_SCHEDULE_FORMAT_LOG) {
+	ret = action_append(fd, destfd, action->workspace, destdir, &bytes,
+			    action->output_fd, dataname);
+    } else {
+	ret = action_move(fd, destfd, action->workspace, destdir, &bytes, &quota,
+			  destination != schedule && destination->incoming_compression,
+			  action->output_fd, dataname, 0);
+    }
+    dir_close(fd);
+    dir_close(destfd);
+    queue_account(destination, &quota);
+    lmapd_qindex_unref(quota.qindex);
+    return ret;
+}
+
+/*
+ * Copies a file from offset off up to end (to the end of the file if
+ * end is 0), without changing its offset (the memfd holding the
+ * output of an action is shared by the operations delivering it).
+ */
+
+static int
+copy_range(int in, int out, off_t off, off_t end)
+{
+    char buf[16384];
+    ssize_t n, w;
+    size_t done, len;
+
+    for (;;) {
+	len = sizeof(buf);
+	if (end && (off_t) len > end - off) {
+	    len = (end > off) ? (size_t) (end - off) : 0;
+	}
+	if (len == 0) {
+	    return 0;
+	}
+	n = pread(in, buf, len, off);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    return (n == 0) ? 0 : -1;
+	}
+	for (done = 0; done < (size_t) n; done += (size_t) w) {
+	    w = write(out, buf + done, (size_t) n - done);
+	    if (w == -1 && errno == EINTR) {
+		w = 0;
+	    } else if (w <= 0) {
+		return -1;
+	    }
+	}
+	off += n;
+    }
+}
+
+/*
+ * Copies a file from the start.
+ */
+
+static int
+copy_fd(int in, int out)
+{
+    return copy_range(in, out, 0, 0);
+}
+
+/*
+ * Writes a copy of a file, gzip compressed if compress is set, as name
+ * in a destination directory. The copy is written to a hidden file
+ * first, which is linked to its name once complete, so that a partial
+ * copy is never moved.
+ */
+
+static int
+write_entry(int in, int destfd, const char *destdir, const char *name,
+	    int compress, uint64_t *bytes)
+{
+    int out, ret = -1;
+    char tmp[NAME_MAX + 1];
+    struct stat st;
+
+    if ((size_t) snprintf(tmp, sizeof(tmp), ".%s", name) >= sizeof(tmp)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    out = openat(destfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (out != -1) {
+	ret = compress ? lmapd_zio_gzip(in, out) : copy_fd(in, out);
+	if (ret == 0) {
+	    ret = fstat(out, &st);
+	}
+	if (close(out)) {
+	    ret = -1;
+	}
+	if (ret == 0) {
+	    ret = linkat(destfd, tmp, destfd, name, 0);
+	}
+    }
+    if (ret && errno != EEXIST) {
+	lmap_wrn("failed to write '%s/%s': %s", destdir, name, strerror(errno));
+    }
+    if (out != -1) {
+	(void) unlinkat(destfd, tmp, 0);
+    }
+    if (ret == 0) {
+	*bytes += st_bytes(&st);
+    }
+    return ret;
+}
+
+/*
+ * Delivers the current entry, a .data file, as a gzip compressed copy.
+ * Returns -1 if the entry is to be linked as it is instead (e.g., it
+ * is compressed already).
+ */
+
+static int
+compress_entry(struct dir_iter *it, int destfd, const char *destdir,
+	       uint64_t *bytes)
+{
+    int in, ret = -1;
+
+    in = openat(it->fd, it->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in == -1) {
+	return -1;
+    }
+    if (! lmapd_zio_is_gzip(in)) {
+	ret = write_entry(in, destfd, destdir, it->name, 1, bytes);
+    }
+    (void) close(in);
+    return ret;
+}
+
+/*
+ * The name of the .meta file of a .data file.
+ */
+
+static int
+meta_name(char *buf, size_t size, const char *data)
+{
+    size_t len = strlen(data);
+
+    if (len < 5 || len >= size || strcmp(data + len - 5, ".data")) {
+	return -1;
+    }
+    memcpy(buf, data, len - 4);
+    strcpy(buf + len - 4, "meta");
+    return 0;
+}
+
+/*
+ * The output of the action may be held in a memfd (datafd) instead of
+ * its workspace, see lmapd_workspace_action_open_output(). It is then
+ * written to the destination as dataname before the files of the
+ * workspace, including its .meta file, are linked there. With hold
+ * set, the .meta files are left for action_publish().
+ */
+
+static int
+action_move(int wsfd, int destfd, const char *workspace, const char *destdir,
+	    uint64_t *bytes, struct queue_quota *quota, int compress,
+	    int datafd, const char *dataname, int hold)
+{
+    int n, ret = 0;
+    struct dir_iter it;
+    struct batch *b;
+    struct qindex *result = NULL;
+    char meta[NAME_MAX + 1];
+    size_t len;
+
+    if (destfd == -1) {
+	lmap_err("failed to open directory '%s'", destdir);
+	return -1;
+    }
+    if (datafd != -1 && meta_name(meta, sizeof(meta), dataname)) {
+	datafd = -1;
+    }
+    if (quota && quota->qindex) {
+	result = queue_admit(wsfd, destfd, destdir, quota, datafd, meta);
+	if (! result) {
+	    return -1;
+	}
+    }
+    if (datafd != -1
+	&& write_entry(datafd, destfd, destdir, dataname,
+		       compress && ! lmapd_zio_is_gzip(datafd), bytes)) {
+	/* without its .data, the .meta is useless */
+	ret = -1;
+    } else {
+	datafd = -1;
+    }
+    if (dir_iter_open(&it, wsfd, ".",
+		      DIR_ITER_SKIP_HIDDEN | DIR_ITER_SKIP_PRIVATE)) {
+	lmap_err("failed to open '%s'", workspace);
+	lmapd_qindex_unref(result);
+	return -1;
+    }
+    b = batch_new(BATCH_LINK, it.fd, destfd, workspace, destdir, bytes);
+    if (! b) {
+	dir_iter_close(&it);
+	lmapd_qindex_unref(result);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	/* we only "move" files, never directories or other inode types */
+	if (it.type != DT_REG) {
+	    continue;
+	}
+	if (datafd != -1 && strcmp(it.name, meta) == 0) {
+	    continue;
+	}
+	len = strlen(it.name);
+	if (hold && len > 5 && strcmp(it.name + len - 5, ".meta") == 0) {
+	    continue;
+	}
+	if (compress && len > 5 && strcmp(it.name + len - 5, ".data") == 0
+	    && compress_entry(&it, destfd, destdir, bytes) == 0) {
+	    continue;
+	}
+	(void) batch_add(b, it.name, NULL, dir_iter_bytes(&it));
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    if (batch_free(b)) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+
+    if (result) {
+	if (ret == 0) {
+	    lmapd_qindex_append(quota->qindex, result);
+	}
+	lmapd_qindex_unref(result);
+    }
+    return ret;
+}
+
+/*
+ * Links the .meta files held back by action_move() to the destination,
+ * once the files moved before are durable, and flushes the directory.
+ * A .meta file whose .data file did not make it is not published, so
+ * that a crash never leaves a .meta file without its data.
+ */
+
+static int
+action_publish(int wsfd, int destfd, const char *workspace, const char *destdir,
+	       uint64_t *bytes)
+{
+    int n, fd, ret = 0;
+    struct dir_iter it;
+    struct batch *b;
+    struct stat st;
+    char data[NAME_MAX + 1];
+    size_t len;
+
+    if (destfd == -1) {
+	lmap_err("failed to open directory '%s'", destdir);
+	return -1;
+    }
+    if (dir_iter_open(&it, wsfd, ".",
+		      DIR_ITER_SKIP_HIDDEN | DIR_ITER_SKIP_PRIVATE)) {
+	lmap_err("failed to open '%s'", workspace);
+	return -1;
+    }
+    b = batch_new(BATCH_LINK, it.fd, destfd, workspace, destdir, bytes);
+    if (! b) {
+	dir_iter_close(&it);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	len = strlen(it.name);
+	if (it.type != DT_REG || len <= 5 || len >= sizeof(data)
+	    || strcmp(it.name + len - 5, ".meta")) {
+	    continue;
+	}
+	memcpy(data, it.name, len - 4);
+	strcpy(data + len - 4, "data");
+	if (fstatat(destfd, data, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+	    /* refused by a quota, or failed to move */
+	    lmap_dbg("not publishing '%s/%s' without its data",
+		     workspace, it.name);
+	    continue;
+	}
+	(void) batch_add(b, it.name, NULL, dir_iter_bytes(&it));
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    if (batch_free(b)) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+
+    fd = openat(destfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fsync(fd)) {
+	lmap_wrn("failed to sync '%s': %s", destdir, strerror(errno));
+	ret = -1;
+    }
+    if (fd != -1) {
+	(void) close(fd);
+    }
+    return ret;
+}
+
+/*
+ * Appends the results in the workspace of an action, and its output
+ * held in datafd, to the result log of an incoming queue, see
+ * lmapd_rlog_append(). Other files are linked as they are.
+ */
+
+static int
+action_append(int wsfd, int destfd, const char *workspace, const char *destdir,
+	      uint64_t *bytes, int datafd, const char *dataname)
+{
+    int n, ret = 0, metafd, fd;
+    struct dir_iter it;
+    struct batch *b;
+    struct stat st;
+    char data[NAME_MAX + 1];
+    char meta[NAME_MAX + 1];
+    char other[NAME_MAX + 1];
+    uint64_t size;
+
+    if (destfd == -1) {
+	lmap_err("failed to open directory '%s'", destdir);
+	return -1;
+    }
+    if (datafd != -1 && meta_name(meta, sizeof(meta), dataname)) {
+	datafd = -1;
+    }
+    if (dir_iter_open(&it, wsfd, ".",
+		      DIR_ITER_SKIP_HIDDEN | DIR_ITER_SKIP_PRIVATE)) {
+	lmap_err("failed to open '%s'", workspace);
+	return -1;
+    }
+    b = batch_new(BATCH_LINK, it.fd, destfd, workspace, destdir, bytes);
+    if (! b) {
+	dir_iter_close(&it);
+	return -1;
+    }
+
+    while ((n = dir_iter_next(&it)) > 0) {
+	if (it.type != DT_REG) {
+	    continue;
+	}
+	if (datafd != -1 && strcmp(it.name, meta) == 0) {
+	    fd = datafd;
+	} else if (entry_pair(&it, data, sizeof(data), &size)) {
+	    fd = openat(it.fd, data, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	} else {
+	    /* the .data file of a result goes with its .meta file */
+	    if (meta_name(other, sizeof(other), it.name) == 0
+		&& fstatat(it.fd, other, &st, AT_SYMLINK_NOFOLLOW) == 0
+		&& S_ISREG(st.st_mode)) {
+		continue;
+	    }
+	    (void) batch_add(b, it.name, NULL, dir_iter_bytes(&it));
+	    continue;
+	}
+	metafd = openat(it.fd, it.name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (metafd == -1 || fd == -1) {
+	    lmap_err("failed to open result '%s/%s': %s",
+		     workspace, it.name, strerror(errno));
+	    ret = -1;
+	} else {
+	    /* the name of the result, without .meta */
+	    snprintf(other, sizeof(other), "%.*s",
+		     (int) (strlen(it.name) - 5), it.name);
+	    if (lmapd_rlog_append(destfd, destdir, other, metafd, fd, bytes)) {
+		ret = -1;
+	    }
+	}
+	if (metafd != -1) {
+	    (void) close(metafd);
+	}
+	if (fd != -1 && fd != datafd) {
+	    (void) close(fd);
+	}
+    }
+    if (n < 0) {
+	ret = -1;
+    }
+    if (batch_free(b)) {
+	ret = -1;
+    }
+    dir_iter_close(&it);
+    return ret;
+}
+
+/*
+ * Writes the output of an action held in a memfd to its workspace. If
+ * resume is set, parts of the output were flushed before, and the
+ * .data file is continued where it ends: it is written sequentially,
+ * so it always holds the start of the output, also after a failed
+ * flush. If to is not 0, the action is still running: only the output
+ * up to offset to is written, and the memory it used is released once
+ * all of it is in the .data file, see lmapd_workspace_job_action_flush().
+ */
+
+static int
+spill(int datafd, int wsfd, const char *workspace, const char *dataname,
+      int resume, uint64_t to, uint64_t *bytes)
+{
+    int fd, ret;
+    struct stat st;
+    uint64_t before = 0;
+    off_t from = 0;
+
+    fd = openat(wsfd, dataname, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC
+		| (resume ? O_APPEND : O_TRUNC), 0600);
+    if (fd == -1) {
+	lmap_err("failed to open '%s/%s': %s", workspace, dataname, strerror(errno));
+	return -1;
+    }
+    if (resume) {
+	if (fstat(fd, &st) == -1) {
+	    lmap_err("failed to stat '%s/%s': %s", workspace, dataname, strerror(errno));
+	    (void) close(fd);
+	    return -1;
+	}
+	before = st_bytes(&st);
+	from = st.st_size;
+    }
+    ret = (to && (uint64_t) from >= to) ? 0
+	: copy_range(datafd, fd, from, (off_t) to);
+    if (ret == 0 && fstat(fd, &st) == 0 && st_bytes(&st) > before) {
+	*bytes += st_bytes(&st) - before;
+    }
+    if (close(fd)) {
+	ret = -1;
+    }
+    if (ret) {
+	lmap_err("failed to write '%s/%s': %s", workspace, dataname, strerror(errno));
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    /* the action only writes beyond to */
+    if (ret == 0 && to
+	&& fallocate(datafd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		     0, (off_t) to) == -1) {
+	lmap_wrn("failed to release the memory of '%s/%s': %s",
+		 workspace, dataname, strerror(errno));
+    }
+#endif
+    return ret;
+}
+
+/*
+ * A struct workspace_job is a list of workspace operations that is
+ * built on the event loop thread and run on a worker thread. It holds
+ * copies of all paths and cached directory descriptors, so it never
+ * touches the data model, which may change or go away (e.g., on a
+ * reload) while the job runs. The
+ * operations record how much storage they freed, added or measured,
+ * which lmapd_workspace_job_account() applies to the schedules and
+ * actions, looked up by name, back on the event loop thread.
+ */
+
+enum workspace_op_type {
+    WORKSPACE_OP_SCHEDULE_MOVE,
+    WORKSPACE_OP_SCHEDULE_CLEAN,
+    WORKSPACE_OP_SCHEDULE_MEASURE,
+    WORKSPACE_OP_ACTION_MOVE,
+    WORKSPACE_OP_ACTION_STAGE,
+    WORKSPACE_OP_ACTION_PUBLISH,
+    WORKSPACE_OP_ACTION_CLEAN,
+    WORKSPACE_OP_ACTION_MEASURE,
+    WORKSPACE_OP_ACTION_SPILL,
+};
+
+struct workspace_op {
+    enum workspace_op_type type;
+    char *workspace;
+    char *destdir;		/* incoming for WORKSPACE_OP_SCHEDULE_MOVE */
+    int wsfd;			/* O_PATH of workspace, or -1 */
+    int destfd;			/* O_PATH of destdir, or -1 */
+    char *schedule;		/* owner of the workspace */
+    char *action;		/* WORKSPACE_OP_ACTION_* only */
+    char *destination;		/* WORKSPACE_OP_ACTION_{MOVE,STAGE,PUBLISH} */
+    uint64_t bytes;		/* freed, added or measured */
+    int done;			/* bytes is valid */
+    struct queue_quota quota;	/* of the incoming queue, if any */
+    int compress;		/* WORKSPACE_OP_ACTION_MOVE: gzip .data files */
+    int log;			/* WORKSPACE_OP_ACTION_MOVE: append to the result log */
+    int datafd;			/* output held in memory, or -1 */
+    char *dataname;		/* name of the .data file of the output */
+    int resume;			/* WORKSPACE_OP_ACTION_SPILL: continue .data */
+    uint64_t dataend;		/* WORKSPACE_OP_ACTION_SPILL: flush up to */
+    struct workspace_op *next;
+};
+
+struct workspace_job {
+    struct workspace_op *ops;
+    struct workspace_op **tail;
+    int incomplete;		/* an operation could not be added */
+};
+
+struct workspace_job *
+lmapd_workspace_job_new(void)
+{
+    struct workspace_job *job;
+
+    job = calloc(1, sizeof(*job));
+    if (! job) {
+	lmap_err("failed to allocate workspace job");
+	return NULL;
+    }
+    job->tail = &job->ops;
+    return job;
+}
+
+static void
+op_free(struct workspace_op *op)
+{
+    dir_close(op->wsfd);
+    dir_close(op->destfd);
+    if (op->datafd != -1) {
+	(void) close(op->datafd);
+    }
+    free(op->workspace);
+    free(op->destdir);
+    free(op->schedule);
+    free(op->action);
+    free(op->destination);
+    free(op->dataname);
+    lmapd_qindex_unref(op->quota.qindex);
+    free(op);
+}
+
+void
+lmapd_workspace_job_free(struct workspace_job *job)
+{
+    struct workspace_op *op;
+
+    if (! job) {
+	return;
+    }
+    while ((op = job->ops)) {
+	job->ops = op->next;
+	op_free(op);
+    }
+    free(job);
+}
+
+static int
+xstrdup(char **dst, const char *src)
+{
+    *dst = src ? strdup(src) : NULL;
+    return src && ! *dst;
+}
+
+/*
+ * Whether parts of the output of an action held in memory were (or
+ * are being) flushed to its .data file.
+ */
+
+static int
+output_flushed(struct action *action)
+{
+    return action->output_spilled
+	|| (action->flags & LMAP_ACTION_FLAG_FLUSHING);
+}
+
+/*
+ * Closes the output of an action held in memory. Operations that
+ * still need it hold their own descriptor.
+ */
+
+static void
+output_close(struct action *action)
+{
+    (void) close(action->output_fd);
+    action->output_fd = -1;
+    action->output_spilled = 0;
+    action->flags &= ~LMAP_ACTION_FLAG_FLUSHING;
+}
+
+/*
+ * Adds an operation to a job. The operation works on the incoming
+ * queue of the schedule queue with its quota, if it has one. Moves
+ * and spills get their own descriptor of the output of the action if
+ * it is held in memory.
+ */
+
+static int
+job_add(struct workspace_job *job, enum workspace_op_type type,
+	const char *workspace, int wsfd, const char *destdir, int destfd,
+	struct schedule *schedule, struct action *action,
+	struct schedule *destination, struct schedule *queue)
+{
+    struct workspace_op *op;
+    char dataname[NAME_MAX + 1];
+    int output = (type == WORKSPACE_OP_ACTION_MOVE
+		  || type == WORKSPACE_OP_ACTION_STAGE
+		  || type == WORKSPACE_OP_ACTION_SPILL)
+	&& action && action->output_fd != -1;
+
+    if (! workspace) {
+	return 0;
+    }
+
+    op = calloc(1, sizeof(*op));
+    if (op) {
+	/* opened by path on the worker if this fails */
+	op->wsfd = dir_fd(wsfd, NULL);
+	op->destfd = dir_fd(destfd, NULL);
+	op->datafd = -1;
+    }
+    if (op && output) {
+	action_name(schedule, action, "data", dataname, sizeof(dataname));
+	op->datafd = fcntl(action->output_fd, F_DUPFD_CLOEXEC, 0);
+	op->resume = output_flushed(action);
+	if (op->datafd == -1 || xstrdup(&op->dataname, dataname)) {
+	    op_free(op);
+	    op = NULL;
+	}
+    }
+    if (! op
+	|| xstrdup(&op->workspace, workspace)
+	|| xstrdup(&op->destdir, destdir)
+	|| xstrdup(&op->schedule, schedule ? schedule->name : NULL)
+	|| xstrdup(&op->action, action ? action->name : NULL)
+	|| xstrdup(&op->destination, destination ? destination->name : NULL)) {
+	lmap_err("failed to allocate workspace operation");
+	if (op) {
+	    op_free(op);
+	}
+	job->incomplete = 1;
+	return -1;
+    }
+    op->type = type;
+    if (queue && queue->qindex) {
+	queue_quota(&op->quota, queue);
+    }
+    if (queue) {
+	op->compress = queue->incoming_compression;
+	op->log = (queue->incoming_format == LMAP_SCHEDULE_FORMAT_LOG);
+    }
+
+    *job->tail = op;
+    job->tail = &op->next;
+    return 0;
+}
+
+/**
+ * @brief Add lmapd_workspace_schedule_move() to a workspace job
+ */
+
+int
+lmapd_workspace_job_schedule_move(struct workspace_job *job,
+				  struct schedule *schedule)
+{
+    assert(job && schedule);
+
+    char incoming[PATH_MAX];
+
+    if (! schedule->workspace) {
+	return 0;
+    }
+
+    snprintf(incoming, sizeof(incoming), "%s/" LMAPD_QUEUE_INCOMING_NAME,
+	     schedule->workspace);
+    return job_add(job, WORKSPACE_OP_SCHEDULE_MOVE,
+		   schedule->workspace, schedule->workspace_fd,
+		   incoming, schedule->incoming_fd, schedule, NULL, NULL,
+		   schedule);
+}
+
+/**
+ * @brief Add lmapd_workspace_schedule_clean() to a workspace job
+ */
+
+int
+lmapd_workspace_job_schedule_clean(struct workspace_job *job,
+				   struct schedule *schedule)
+{
+    assert(job && schedule);
+
+    return job_add(job, WORKSPACE_OP_SCHEDULE_CLEAN,
+		   schedule->workspace, schedule->workspace_fd,
+		   NULL, -1, schedule, NULL, NULL, NULL);
+}
+
+static int
+job_deliver(struct workspace_job *job, enum workspace_op_type type,
+	    struct schedule *schedule, struct action *action,
+	    struct schedule *destination)
+{
+    char destdir[PATH_MAX];
+    int destfd;
+
+    if (!action->name || !destination->workspace) {
+	return 0;
+    }
+
+    if (destination != schedule) {
+	snprintf(destdir, sizeof(destdir),
+		 "%s/" LMAPD_QUEUE_INCOMING_NAME, destination->workspace);
+	destfd = destination->incoming_fd;
+    } else {
+	snprintf(destdir, sizeof(destdir), "%s", destination->workspace);
+	destfd = destination->workspace_fd;
+    }
+    return job_add(job, type,
+		   action->workspace, action->workspace_fd, destdir, destfd,
+		   schedule, action, destination,
+		   destination != schedule ? destination : NULL);
+}
+
+/**
+ * @brief Add lmapd_workspace_action_move() to a workspace job
+ *
+ * The move is never deferred.
+ */
+
+int
+lmapd_workspace_job_action_move(struct workspace_job *job,
+				struct schedule *schedule,
+				struct action *action,
+				struct schedule *destination)
+{
+    assert(job && schedule && action && destination);
+
+    return job_deliver(job, WORKSPACE_OP_ACTION_MOVE,
+		       schedule, action, destination);
+}
+
+/**
+ * @brief Add the first half of a durable move to a workspace job
+ *
+ * Like lmapd_workspace_job_action_move(), but the .meta files of the
+ * results are not linked to the destination, so that the results are
+ * not visible there yet. Once the files are durable, see
+ * lmapd_workspace_sync(), lmapd_workspace_job_action_publish() links
+ * the .meta files. Appending to a result log is not split, its
+ * records carry a checksum.
+ */
+
+int
+lmapd_workspace_job_action_stage(struct workspace_job *job,
+				 struct schedule *schedule,
+				 struct action *action,
+				 struct schedule *destination)
+{
+    assert(job && schedule && action && destination);
+
+    return job_deliver(job, WORKSPACE_OP_ACTION_STAGE,
+		       schedule, action, destination);
+}
+
+/**
+ * @brief Add the second half of a durable move to a workspace job
+ *
+ * Links the .meta files left by lmapd_workspace_job_action_stage()
+ * to the destination and flushes the destination directory. This
+ * must come before the workspace of the action is cleaned.
+ */
+
+int
+lmapd_workspace_job_action_publish(struct workspace_job *job,
+				   struct schedule *schedule,
+				   struct action *action,
+				   struct schedule *destination)
+{
+    assert(job && schedule && action && destination);
+
+    return job_deliver(job, WORKSPACE_OP_ACTION_PUBLISH,
+		       schedule, action, destination);
+}
+
+/**
+ * @brief Add lmapd_workspace_action_clean() to a workspace job
+ */
+
+int
+lmapd_workspace_job_action_clean(struct workspace_job *job,
+				 struct schedule *schedule,
+				 struct action *action)
+{
+    int ret;
+
+    assert(job && schedule && action);
+
+    ret = job_add(job, WORKSPACE_OP_ACTION_CLEAN,
+		  action->workspace, action->workspace_fd,
+		  NULL, -1, schedule, action, NULL, NULL);
+    if (ret == 0 && ! job->incomplete && action->output_fd != -1) {
+	/* moves added before hold their own descriptor */
+	output_close(action);
+    }
+    return ret;
+}
+
+/**
+ * @brief Add lmapd_workspace_action_spill() to a workspace job
+ *
+ * The memory of the output is released once the job ran.
+ */
+
+int
+lmapd_workspace_job_action_spill(struct workspace_job *job,
+				 struct schedule *schedule,
+				 struct action *action)
+{
+    int ret;
+
+    assert(job && schedule && action);
+
+    if (action->output_fd == -1) {
+	return 0;
+    }
+    ret = job_add(job, WORKSPACE_OP_ACTION_SPILL,
+		  action->workspace, action->workspace_fd,
+		  NULL, -1, schedule, action, NULL, NULL);
+    if (ret == 0) {
+	output_close(action);
+    }
+    return ret;
+}
+
+/**
+ * @brief Add writing the output of a running action to a workspace job
+ *
+ * Appends the output the action wrote to its memory file so far, up
+ * to size bytes, to its .data file and releases the memory it used,
+ * while the action keeps writing to the memory file. The spill of the
+ * output once the action completed then only writes the rest. Only one
+ * flush is in flight at a time, and action->output_spilled advances
+ * once it succeeded, see lmapd_workspace_job_account(). A failed flush
+ * is retried by the next one, or by the spill.
+ *
+ * @param job pointer to the workspace job
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @param size size of the output written so far
+ * @return 0 on success or if there is nothing to write, -1 on error
+ */
+
+int
+lmapd_workspace_job_action_flush(struct workspace_job *job,
+				 struct schedule *schedule,
+				 struct action *action, uint64_t size)
+{
+    struct workspace_op *op;
+    int ret;
+
+    assert(job && schedule && action);
+
+    if (action->output_fd == -1 || size <= action->output_spilled
+	|| (action->flags & LMAP_ACTION_FLAG_FLUSHING)) {
+	return 0;
+    }
+    ret = job_add(job, WORKSPACE_OP_ACTION_SPILL,
+		  action->workspace, action->workspace_fd,
+		  NULL, -1, schedule, action, NULL, NULL);
+    if (ret == 0 && job->ops) {
+	for (op = job->ops; op->next; op = op->next) ;
+	op->dataend = size;
+	action->flags |= LMAP_ACTION_FLAG_FLUSHING;
+    }
+    return ret;
+}
+
+/**
+ * @brief Add measuring the storage of an action to a workspace job
+ *
+ * The storage of the action is set to the disk usage of its
+ * workspace, and that of the schedule changes by the same amount.
+ * This accounts for the files written by the action itself.
+ */
+
+int
+lmapd_workspace_job_action_measure(struct workspace_job *job,
+				   struct schedule *schedule,
+				   struct action *action)
+{
+    assert(job && schedule && action);
+
+    return job_add(job, WORKSPACE_OP_ACTION_MEASURE,
+		   action->workspace, action->workspace_fd,
+		   NULL, -1, schedule, action, NULL, NULL);
+}
+
+/**
+ * @brief Add measuring the storage of everything to a workspace job
+ *
+ * Adds measuring the storage of all actions, and then of their
+ * schedule, for all schedules of the lmap, see lmapd_workspace_update().
+ *
+ * @param job pointer to the struct workspace_job
+ * @param lmap pointer to the struct lmap
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_job_update(struct workspace_job *job, struct lmap *lmap)
+{
+    int ret = 0;
+    struct schedule *sched;
+    struct action *act;
+    char incoming[PATH_MAX];
+
+    assert(job && lmap);
+
+    for (sched = lmap->schedules; sched; sched = sched->next) {
+	for (act = sched->actions; act; act = act->next) {
+	    if (lmapd_workspace_job_action_measure(job, sched, act)) {
+		ret = -1;
+	    }
+	}
+	/* the index of a queue with a quota is rebuilt as well */
+	if (sched->qindex && sched->workspace) {
+	    snprintf(incoming, sizeof(incoming),
+		     "%s/" LMAPD_QUEUE_INCOMING_NAME, sched->workspace);
+	}
+	if (job_add(job, WORKSPACE_OP_SCHEDULE_MEASURE,
+		    sched->workspace, sched->workspace_fd,
+		    sched->qindex ? incoming : NULL,
+		    sched->qindex ? sched->incoming_fd : -1,
+		    sched, NULL, NULL, sched)) {
+	    ret = -1;
+	}
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Let a workspace job run after another one
+ *
+ * If an operation could not be added to the job, the after job does
+ * not remove any files either, see lmapd_workspace_job_run().
+ *
+ * @param job pointer to the struct workspace_job running first
+ * @param after pointer to the struct workspace_job running after it
+ */
+
+void
+lmapd_workspace_job_after(struct workspace_job *job, struct workspace_job *after)
+{
+    if (job && after && job->incomplete) {
+	after->incomplete = 1;
+    }
+}
+
+/**
+ * @brief Make everything written to the queue durable
+ *
+ * Flushes the file system holding the queue directory with syncfs(),
+ * or all file systems where that is not available. This is safe to
+ * call from a worker thread.
+ *
+ * @param path path of the queue directory
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmapd_workspace_sync(const char *path)
+{
+    int fd, ret = 0;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+	lmap_err("failed to open '%s': %s", path, strerror(errno));
+	return -1;
+    }
+#ifdef HAVE_SYNCFS
+    if (syncfs(fd)) {
+	lmap_err("failed to sync '%s': %s", path, strerror(errno));
+	ret = -1;
+    }
+#else
+    sync();
+#endif
+    (void) close(fd);
+    return ret;
+}
+
+/**
+ * @brief Run the operations of a workspace job
+ *
+ * Runs the operations in the order they were added. This is safe to
+ * call from a worker thread. If an operation could not be added to
+ * the job, no files are removed, so that results which were not moved
+ * are not lost.
+ *
+ * @param job pointer to the struct workspace_job
+ */
+
+void
+lmapd_workspace_job_run(struct workspace_job *job)
+{
+    struct workspace_op *op;
+
+    for (op = job->ops; op; op = op->next) {
+	if (op->wsfd == -1) {
+	    op->wsfd = dir_fd(-1, op->workspace);
+	}
+	if (op->destfd == -1 && op->destdir) {
+	    op->destfd = dir_fd(-1, op->destdir);
+	}
+	op->bytes = 0;
+	op->done = 1;
+	switch (op->type) {
+	case WORKSPACE_OP_SCHEDULE_MOVE:
+	    (void) schedule_move(op->wsfd, op->destfd, op->workspace,
+				 op->quota.qindex);
+	    break;
+	case WORKSPACE_OP_SCHEDULE_CLEAN:
+	    if (! job->incomplete) {
+		(void) schedule_clean(op->wsfd, op->workspace, &op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_MOVE:
+	case WORKSPACE_OP_ACTION_STAGE:
+	    if (op->log) {
+		(void) action_append(op->wsfd, op->destfd, op->workspace,
+				     op->destdir, &op->bytes,
+				     op->datafd, op->dataname);
+		break;
+	    }
+	    (void) action_move(op->wsfd, op->destfd, op->workspace,
+			       op->destdir, &op->bytes, &op->quota, op->compress,
+			       op->datafd, op->dataname,
+			       op->type == WORKSPACE_OP_ACTION_STAGE);
+	    break;
+	case WORKSPACE_OP_ACTION_PUBLISH:
+	    if (! op->log) {
+		(void) action_publish(op->wsfd, op->destfd, op->workspace,
+				      op->destdir, &op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_SPILL:
+	    op->done = (op->wsfd != -1
+			&& spill(op->datafd, op->wsfd, op->workspace,
+				 op->dataname, op->resume, op->dataend,
+				 &op->bytes) == 0);
+	    break;
+	case WORKSPACE_OP_ACTION_CLEAN:
+	    if (! job->incomplete) {
+		(void) action_clean(op->wsfd, op->workspace, &op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_SCHEDULE_MEASURE:
+	    if (op->quota.qindex && op->destfd != -1) {
+		(void) queue_rebuild(op->destfd, op->quota.qindex);
+	    }
+	    /* fallthrough */
+	case WORKSPACE_OP_ACTION_MEASURE:
+	    op->done = (op->wsfd != -1
+			&& usage_at(op->wsfd, ".", &op->bytes) == 0);
+	    break;
+	}
+    }
+}
+
+static void
+storage_add(uint64_t *storage, uint64_t bytes)
+{
+    *storage += bytes;
+}
+
+static void
+storage_sub(uint64_t *storage, uint64_t bytes)
+{
+    *storage = (*storage > bytes) ? *storage - bytes : 0;
+}
 
-    dfd = opendir(action->workspace);
-    if (!dfd) {
-	lmap_err("failed to open '%s'", action->workspace);
-	return -1;
-    }
+static struct action *
+find_action(struct schedule *schedule, const char *name)
+{
+    struct action *act;
 
-    while ((dp = readdir(dfd)) != NULL) {
-	if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, "..")) {
-	    continue;
-	}
-	if (dp->d_name[0] == '_') {
-	    continue;
-	}
-	snprintf(filepath, sizeof(filepath), "%s/%s",
-		 action->workspace, dp->d_name);
-	if (remove_all(filepath) != 0) {
-	    lmap_err("failed to remove '%s'", filepath);
-	    ret = -1;
+    for (act = schedule ? schedule->actions : NULL; act; act = act->next) {
+	if (act->name && name && strcmp(act->name, name) == 0) {
+	    return act;
 	}
     }
-    (void) closedir(dfd);
+    return NULL;
+}
 
-    return ret;
+/*
+ * Completes a flush of the output of a running action, see
+ * lmapd_workspace_job_action_flush(). The output is only known to be
+ * in the .data file up to the end of the flush if it succeeded. A
+ * flush of an earlier invocation, whose output is gone, is ignored.
+ */
+
+static void
+flush_account(struct lmap *lmap, struct workspace_op *op)
+{
+    struct schedule *sched;
+    struct action *act;
+    char dataname[NAME_MAX + 1];
+
+    sched = lmap_find_schedule(lmap, op->schedule);
+    act = find_action(sched, op->action);
+    if (! act || act->output_fd == -1
+	|| !(act->flags & LMAP_ACTION_FLAG_FLUSHING)) {
+	return;
+    }
+    action_name(sched, act, "data", dataname, sizeof(dataname));
+    if (! op->dataname || strcmp(op->dataname, dataname) != 0) {
+	return;
+    }
+    act->flags &= ~LMAP_ACTION_FLAG_FLUSHING;
+    if (op->done) {
+	act->output_spilled = op->dataend;
+    }
 }
 
 /**
- * @brief Move the workspace of an action
- *
- * Function to move the workspace of an action to a destination
- * schedule.  The action output files are moved to the destination
- * schedule's incoming special folder.
- *
- * Note: all files in the action workspace are moved, except for
- * hidden files, or those starting with "_".
- *
- * Should the destination schedule be the action's own schedule,
- * move its output files to its own schedule's *active* (processing)
- * incoming queue instead, where it will be immediately available
- * for consumption (e.g. by the next action in a sequential execution
- * mode).
+ * @brief Account for the storage changes of a workspace job
  *
- * The "defer" parameter can be used to move the results of all
- * actions of a schedule only after the schedule finishes running,
- * while still immediately moving the output of actions directed
- * to their own schedule (see above).
+ * Applies the storage freed, added or measured by the operations of
+ * a job that ran to the schedules and actions of the lmap. They are
+ * looked up by name, so schedules that went away in the meantime are
+ * skipped. Must be called on the event loop thread.
  *
- * @param lmapd pointer to the struct lmapd
- * @param schedule pointer to the struct schedule
- * @param action pointer to the struct action
- * @param destination pointer to the struct schedule
- * @param defer defer moves destined to a different schedule
- * @return 0 on success, -1 on error, 1 if the move was deferred
+ * @param job pointer to the struct workspace_job
+ * @param lmap pointer to the struct lmap
  */
 
-int
-lmapd_workspace_action_move(struct lmapd *lmapd, struct schedule *schedule,
-		            struct action *action, struct schedule *destination,
-			    int defer)
+void
+lmapd_workspace_job_account(struct workspace_job *job, struct lmap *lmap)
 {
-    int ret = 0;
-    char oldfilepath[PATH_MAX];
-    char newfilepath[PATH_MAX];
-    struct dirent *dp;
-    DIR *dfd;
-    struct stat st;
-
-    assert(lmapd);
-    (void) lmapd;
-
-    if (!schedule || !schedule->name
-	|| !action || !action->workspace || !action->name
-	|| !destination || !destination->workspace) {
-	return 0;
-    }
-
-    /* we want to process moves to the action's own schedule
-     * immediately, but we might want to defer moves to any other
-     * schedule to happen when the schedule finishes (i.e. all
-     * actions have finished). */
-    if (defer && destination != schedule)
-	return 1;
+    struct workspace_op *op;
+    struct schedule *sched;
+    struct action *act;
 
-    dfd = opendir(action->workspace);
-    if (!dfd) {
-	lmap_err("failed to open '%s'", action->workspace);
-	return -1;
+    if (! job || ! lmap) {
+	return;
     }
 
-    while ((dp = readdir(dfd)) != NULL) {
-	/* we only "move" files, never directories or other inode types */
-	if (fstatat(dirfd(dfd), dp->d_name, &st, AT_SYMLINK_NOFOLLOW)
-		|| !S_ISREG(st.st_mode)) {
-	    continue;
+    for (op = job->ops; op; op = op->next) {
+	if (op->type == WORKSPACE_OP_ACTION_SPILL && op->dataend) {
+	    flush_account(lmap, op);
 	}
-	if (dp->d_name[0] == '_' || dp->d_name[0] == '.') {
+	if (! op->done) {
 	    continue;
 	}
-	/* we don't need to special case . and .. directories due
-	 * to the above */
-	snprintf(oldfilepath, sizeof(oldfilepath), "%s/%s",
-		 action->workspace, dp->d_name);
-
-	if (destination != schedule) {
-	    snprintf(newfilepath, sizeof(newfilepath),
-			 "%s/" LMAPD_QUEUE_INCOMING_NAME "/%s",
-			 destination->workspace, dp->d_name);
-	} else {
-	    /* Special case: action moving its result to its own schedule */
-	    snprintf(newfilepath, sizeof(newfilepath), "%s/%s",
-			 destination->workspace, dp->d_name);
-	}
-	if (link(oldfilepath, newfilepath) < 0) {
-	    lmap_err("failed to move '%s' to '%s'", oldfilepath, newfilepath);
-	    ret = -1;
+	sched = lmap_find_schedule(lmap, op->schedule);
+	act = find_action(sched, op->action);
+	switch (op->type) {
+	case WORKSPACE_OP_SCHEDULE_MOVE:
+	    /* stays inside the schedule workspace */
+	    break;
+	case WORKSPACE_OP_SCHEDULE_CLEAN:
+	    if (sched) {
+		storage_sub(&sched->storage, op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_SCHEDULE_MEASURE:
+	    if (sched) {
+		sched->storage = op->bytes;
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_MOVE:
+	case WORKSPACE_OP_ACTION_STAGE:
+	    /* the files are linked, the action keeps its copy */
+	    sched = lmap_find_schedule(lmap, op->destination);
+	    if (sched) {
+		storage_add(&sched->storage, op->bytes);
+		storage_sub(&sched->storage, op->quota.evicted);
+		queue_account(sched, &op->quota);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_PUBLISH:
+	    sched = lmap_find_schedule(lmap, op->destination);
+	    if (sched) {
+		storage_add(&sched->storage, op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_CLEAN:
+	    if (act) {
+		storage_sub(&act->storage, op->bytes);
+		storage_sub(&sched->storage, op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_SPILL:
+	    if (act) {
+		storage_add(&act->storage, op->bytes);
+		storage_add(&sched->storage, op->bytes);
+	    }
+	    break;
+	case WORKSPACE_OP_ACTION_MEASURE:
+	    if (act) {
+		storage_sub(&sched->storage, act->storage);
+		storage_add(&sched->storage, op->bytes);
+		act->storage = op->bytes;
+	    }
+	    break;
 	}
     }
-    (void) closedir(dfd);
+}
 
-    return ret;
+/*
+ * Cache the safe name and an O_PATH descriptor of a workspace
+ * directory, replacing the previous ones (the directory might have
+ * been removed and created again).
+ */
+
+static void
+cache_dir(int *cached, const char *path)
+{
+    dir_close(*cached);
+    *cached = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (*cached == -1) {
+	lmap_wrn("failed to open '%s': %s", path, strerror(errno));
+    }
+}
+
+static void
+cache_name(char **cached, const char *name)
+{
+    free(*cached);
+    *cached = strdup(name);
 }
 
 /**
@@ -585,6 +2614,10 @@ lmapd_workspace_action_move(struct lmapd *lmapd, struct schedule *schedule,
  * actions. Actions store results before in their workspace sending
  * them to the destination schedule's incoming special folder.
  *
+ * The folders are opened once here, and later workspace operations
+ * work relative to these file descriptors. The incoming queues of
+ * schedules with a quota are indexed.
+ *
  * @param lmapd pointer to struct lmapd
  * @return 0 on success, -1 on error
  */
@@ -592,10 +2625,11 @@ lmapd_workspace_action_move(struct lmapd *lmapd, struct schedule *schedule,
 int
 lmapd_workspace_init(struct lmapd *lmapd)
 {
-    int ret = 0;
+    int ret = 0, fd;
     struct schedule *sched;
     struct action *act;
     char filepath[PATH_MAX];
+    char name[NAME_MAX];
 
     assert(lmapd);
 
@@ -607,26 +2641,32 @@ lmapd_workspace_init(struct lmapd *lmapd)
 	if (! sched->name) {
 	    continue;
 	}
+	mksafe(name, sizeof(name), sched->name);
+	cache_name(&sched->safe_name, name);
 	snprintf(filepath, sizeof(filepath), "%s/%s",
-		 lmapd->queue_path, mksafe(NULL, 0, sched->name));
+		 lmapd->queue_path, name);
 	if (mkdir(filepath, 0700) < 0 && errno != EEXIST) {
 	    lmap_err("failed to mkdir '%s'", filepath);
 	    ret = -1;
 	}
 	lmap_schedule_set_workspace(sched, filepath);
+	cache_dir(&sched->workspace_fd, filepath);
 
 	for (act = sched->actions; act; act = act->next) {
 	    if (! act->name) {
 		continue;
 	    }
+	    mksafe(name, sizeof(name), act->name);
+	    cache_name(&act->safe_name, name);
 	    snprintf(filepath, sizeof(filepath), "%s/%s",
-		     sched->workspace, mksafe(NULL, 0, act->name));
+		     sched->workspace, name);
 	    if (mkdir(filepath, 0700) < 0 && errno != EEXIST) {
 		lmap_err("failed to mkdir '%s'", filepath);
 		ret = -1;
 		continue;
 	    }
 	    lmap_action_set_workspace(act, filepath);
+	    cache_dir(&act->workspace_fd, filepath);
 	}
 
 	/* create incoming directory */
@@ -636,6 +2676,30 @@ lmapd_workspace_init(struct lmapd *lmapd)
 	    lmap_err("failed to mkdir '%s'", filepath);
 	    ret = -1;
 	}
+	cache_dir(&sched->incoming_fd, filepath);
+
+	/* index the incoming queue if it has a quota */
+	if ((sched->incoming_max_bytes || sched->incoming_max_files)
+	    && sched->incoming_format == LMAP_SCHEDULE_FORMAT_LOG) {
+	    lmap_wrn("schedule '%s': quotas do not apply to a result log",
+		     sched->name);
+	}
+	if ((! sched->incoming_max_bytes && ! sched->incoming_max_files)
+	    || sched->incoming_format == LMAP_SCHEDULE_FORMAT_LOG) {
+	    lmapd_qindex_unref(sched->qindex);
+	    sched->qindex = NULL;
+	    continue;
+	}
+	if (! sched->qindex) {
+	    sched->qindex = lmapd_qindex_new();
+	}
+	if (sched->qindex) {
+	    fd = dir_fd(sched->incoming_fd, filepath);
+	    if (queue_rebuild(fd, sched->qindex)) {
+		lmap_wrn("failed to index '%s'", filepath);
+	    }
+	    dir_close(fd);
+	}
     }
 
     return ret;
@@ -735,84 +2799,267 @@ lmapd_workspace_action_meta_add_end(struct schedule *schedule, struct action *ac
     return 0;
 }
 
-int
-lmapd_workspace_action_open_data(struct schedule *schedule,
-				 struct action *action, int flags)
+/*
+ * The name of the data or meta file of an action invocation.
+ */
+
+static void
+action_name(struct schedule *schedule, struct action *action,
+	    const char *ext, char *buf, size_t size)
+{
+    char b1[NAME_MAX], b2[NAME_MAX];
+    const char *sname, *aname;
+
+    sname = schedule->safe_name ? schedule->safe_name
+	: mksafe(b1, sizeof(b1), schedule->name);
+    aname = action->safe_name ? action->safe_name
+	: mksafe(b2, sizeof(b2), action->name);
+
+    snprintf(buf, size, "%llu-%s-%s.%s",
+	     (unsigned long long)action->last_invocation, sname, aname, ext);
+}
+
+/*
+ * Open the data or meta file of an action invocation, relative to the
+ * cached workspace descriptor if there is one.
+ */
+
+static int
+action_open(struct schedule *schedule, struct action *action,
+	    const char *ext, int flags)
 {
     int fd;
     char filepath[PATH_MAX];
-    char b1[NAME_MAX];
-
-    snprintf(filepath, sizeof(filepath), "%s/%llu-%s-%s.data",
-	     action->workspace,
-	     (unsigned long long)action->last_invocation,
-	     mksafe(NULL, 0, schedule->name),
-	     mksafe(b1, sizeof(b1), action->name));
-    fd = open(filepath, flags, 0600);
-    if (fd == -1) {
-	lmap_err("failed to open '%s'", filepath);
+    char name[NAME_MAX + 1];
+
+    action_name(schedule, action, ext, name, sizeof(name));
+    if (action->workspace_fd != -1) {
+	fd = openat(action->workspace_fd, name, flags, 0600);
+	if (fd == -1) {
+	    lmap_err("failed to open '%s/%s'", action->workspace, name);
+	}
+    } else {
+	snprintf(filepath, sizeof(filepath), "%s/%s", action->workspace, name);
+	fd = open(filepath, flags, 0600);
+	if (fd == -1) {
+	    lmap_err("failed to open '%s'", filepath);
+	}
     }
     return fd;
 }
 
+int
+lmapd_workspace_action_open_data(struct schedule *schedule,
+				 struct action *action, int flags)
+{
+    return action_open(schedule, action, "data", flags);
+}
+
 int
 lmapd_workspace_action_open_meta(struct schedule *schedule,
 				 struct action *action, int flags)
 {
+    return action_open(schedule, action, "meta", flags);
+}
+
+/**
+ * @brief Open the file the output of an action invocation goes to
+ *
+ * If the action has an output memory limit, its output is kept in
+ * an anonymous memory file (memfd) instead of a .data file in its
+ * workspace, which is kept in action->output_fd. Results small enough
+ * are then delivered to their destinations from memory, see
+ * lmapd_workspace_action_move(), without ever writing them to the
+ * workspace. Larger outputs, and outputs that need to survive a
+ * restart of lmapd, are written to the workspace with
+ * lmapd_workspace_action_spill().
+ *
+ * Without an output memory limit, or if memory files are not
+ * available, this opens the .data file of the invocation.
+ *
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @return file descriptor for the output on success, -1 on error
+ */
+
+int
+lmapd_workspace_action_open_output(struct schedule *schedule,
+				   struct action *action)
+{
+#ifdef HAVE_MEMFD_CREATE
     int fd;
-    char filepath[PATH_MAX];
-    char b1[NAME_MAX];
-
-    snprintf(filepath, sizeof(filepath), "%s/%llu-%s-%s.meta",
-	     action->workspace,
-	     (unsigned long long)action->last_invocation,
-	     mksafe(NULL, 0, schedule->name),
-	     mksafe(b1, sizeof(b1), action->name));
-    fd = open(filepath, flags, 0600);
+
+    if (action->output_memory_limit) {
+	if (action->output_fd != -1) {
+	    output_close(action);
+	}
+	fd = memfd_create(action->name, MFD_CLOEXEC);
+	if (fd != -1) {
+	    action->output_fd = fd;
+	    fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	    if (fd != -1) {
+		return fd;
+	    }
+	    (void) close(action->output_fd);
+	    action->output_fd = -1;
+	}
+	lmap_wrn("failed to create memory file for action '%s': %s",
+		 action->name, strerror(errno));
+    }
+#endif
+    return action_open(schedule, action, "data",
+		       O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+}
+
+/**
+ * @brief Write the output of an action held in memory to its workspace
+ *
+ * Writes the output of the last invocation of an action, if it is held
+ * in memory, to its .data file in the workspace of the action and
+ * releases the memory, see lmapd_workspace_action_open_output().
+ *
+ * @param schedule pointer to the struct schedule
+ * @param action pointer to the struct action
+ * @return 0 on success or if there is nothing to write, -1 on error
+ */
+
+int
+lmapd_workspace_action_spill(struct schedule *schedule, struct action *action)
+{
+    int fd, ret;
+    char name[NAME_MAX + 1];
+    uint64_t bytes = 0;
+
+    if (!schedule || !action || action->output_fd == -1) {
+	return 0;
+    }
+    action_name(schedule, action, "data", name, sizeof(name));
+    fd = dir_fd(action->workspace_fd, action->workspace);
     if (fd == -1) {
-	lmap_err("failed to open '%s'", filepath);
+	lmap_err("failed to open '%s'", action->workspace);
+	ret = -1;
+    } else {
+	ret = spill(action->output_fd, fd, action->workspace, name,
+		    output_flushed(action), 0, &bytes);
+	dir_close(fd);
+    }
+    output_close(action);
+    return ret;
+}
+
+/*
+ * The contents of a result file, mapped into memory if it is a plain
+ * regular file, read (and decompressed if needed) otherwise.
+ */
+
+struct content {
+    char *data;
+    size_t len;
+    int mapped;
+};
+
+static int
+content_load(struct content *c, int fd)
+{
+    struct stat st;
+    struct zio *zio;
+    ssize_t n;
+    size_t size = 0;
+    void *map;
+    char *p;
+
+    memset(c, 0, sizeof(*c));
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	&& (uint64_t) st.st_size <= SIZE_MAX && !lmapd_zio_is_gzip(fd)) {
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED) {
+	    (void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+	    c->data = map;
+	    c->len = (size_t) st.st_size;
+	    c->mapped = 1;
+	    return 0;
+	}
+    }
+
+    zio = lmapd_zio_open(fd);
+    if (! zio) {
+	return -1;
+    }
+    while (1) {
+	if (c->len == size) {
+	    size = size ? 2 * size : 65536;
+	    p = realloc(c->data, size);
+	    if (! p) {
+		lmap_err("failed to allocate memory");
+		goto error;
+	    }
+	    c->data = p;
+	}
+	n = lmapd_zio_read(zio, c->data + c->len, size - c->len);
+	if (n < 0) {
+	    lmap_err("failed to read file: %s", strerror(errno));
+	    goto error;
+	}
+	if (n == 0) {
+	    break;
+	}
+	c->len += (size_t) n;
+    }
+    lmapd_zio_close(zio);
+    return 0;
+
+error:
+    lmapd_zio_close(zio);
+    free(c->data);
+    c->data = NULL;
+    return -1;
+}
+
+static void
+content_free(struct content *c)
+{
+    if (c->mapped) {
+	(void) munmap(c->data, c->len);
+    } else {
+	free(c->data);
     }
-    return fd;
 }
 
+/*
+ * Reads a table, or the meta data of a result below, from a buffer.
+ * The fields are copied straight from the buffer into the values.
+ */
+
 static struct table *
-read_table(int fd)
+read_table(const char *data, size_t len)
 {
-    int inrow = 0;
-    FILE *file;
+    int n, inrow = 0;
+    struct csv_scanner scan;
     struct table *tab;
     struct row *row = NULL;
     struct value *val;
-
-    file = fdopen(fd, "r");
-    if (! file) {
-	lmap_err("failed to create file stream: %s", strerror(errno));
-	return NULL;
-    }
+    const char *field;
+    size_t flen;
 
     tab = lmap_table_new();
     if (! tab) {
-	(void) fclose(file);
 	return NULL;
     }
 
-    while (!feof(file)) {
-	char *s = csv_next(file, delimiter);
-	if (! s) {
-	    if (errno) {
-		lmap_err("failed to parse csv file: %s", strerror(errno));
-		goto error_exit;
-	    }
-	    if (feof(file)) {
-		break;
-	    }
+    csv_scan_init(&scan, data, len);
+    while (! csv_scan_eof(&scan)) {
+	n = csv_scan_next(&scan, delimiter, &field, &flen);
+	if (n < 0) {
+	    lmap_err("failed to parse csv data: %s", strerror(errno));
+	    goto error_exit;
+	}
+	if (n == 0) {
 	    inrow = 0;
 	    continue;
 	}
 	if (!inrow) {
 	    row = lmap_row_new();
 	    if (! row) {
-		free(s);
 		goto error_exit;
 	    }
 	    lmap_table_add_row(tab, row);
@@ -820,53 +3067,44 @@ read_table(int fd)
 	}
 	val = lmap_value_new();
 	if (! val) {
-	    free(s);
 	    goto error_exit;
 	}
-	lmap_value_set_value(val, s);
+	if (lmap_value_set_value_len(val, field, flen)) {
+	    lmap_value_free(val);
+	    goto error_exit;
+	}
 	lmap_row_add_value(row, val);
-	free(s);
     }
 
-    (void) fclose(file);
+    csv_scan_done(&scan);
     return tab;
 
 error_exit:
+    csv_scan_done(&scan);
     lmap_table_free(tab);
-    (void) fclose(file);
     return NULL;
 }
 
 static struct result *
-read_result(int fd)
+read_result(const char *data, size_t len)
 {
-    FILE *file;
+    struct csv_scanner scan;
     struct result *res;
     char *key, *value;
     struct option *opt = NULL;
 
-    file = fdopen(fd, "r");
-    if (! file) {
-	lmap_err("failed to create file stream: %s", strerror(errno));
-	return NULL;
-    }
-
     res = lmap_result_new();
     if (! res) {
-	(void) fclose(file);
 	return NULL;
     }
 
-    while (!feof(file)) {
-	key = NULL;
-	value = NULL;
-	csv_next_key_value(file, delimiter, &key, &value);
-	if (errno) {
-		lmap_err("failed to read csv file stream: %s", strerror(errno));
+    csv_scan_init(&scan, data, len);
+    while (! csv_scan_eof(&scan)) {
+	if (csv_scan_next_key_value(&scan, delimiter, &key, &value)) {
+		lmap_err("failed to read csv data: %s", strerror(errno));
+		lmap_option_free(opt);
 		lmap_result_free(res);
-		(void) fclose(file);
-		free(key);
-		free(value);
+		csv_scan_done(&scan);
 		return NULL;
 	}
 	if (key && value) {
@@ -918,10 +3156,68 @@ read_result(int fd)
 	lmap_result_add_option(res, opt);
     }
 
-    (void) fclose(file);
+    csv_scan_done(&scan);
     return res;
 }
 
+/*
+ * Reads the results in a sealed segment of a result log.
+ */
+
+static int
+read_segment(struct lmapd *lmapd, const char *name, const int filetype,
+	     int *valid_report)
+{
+    int n, err, ret = 0;
+    struct rlog log;
+    struct rlog_record rec;
+    struct result *res;
+    struct table *tab;
+
+    if (lmapd_rlog_open(&log, AT_FDCWD, name)) {
+	lmap_err("failed to open result log '%s': %s", name, strerror(errno));
+	return -1;
+    }
+    while ((n = lmapd_rlog_next(&log, &rec)) != 0) {
+	if (n < 0) {
+	    lmap_err("damaged record in result log '%s'", name);
+	    ret = -1;
+	    continue;
+	}
+	res = read_result(rec.meta, rec.meta_len);
+	if (! res) {
+	    ret = -1;
+	    continue;
+	}
+	err = 1;
+
+	if (filetype == LMAP_FT_CSV) {
+	    tab = read_table(rec.data, rec.data_len);
+	    if (tab) {
+		lmap_result_add_table(res, tab);
+		err = 0;
+	    }
+	} else {
+	    if (!lmap_io_parse_task_results_mem(rec.data, rec.data_len,
+						filetype, res)) {
+		err = 0;
+	    }
+	}
+
+	if (!err && lmap_result_valid(lmapd->lmap, res)) {
+	    lmap_add_result(lmapd->lmap, res);
+	    *valid_report = 1;
+	} else {
+	    lmap_err("failed to read result '%.*s' in result log '%s'",
+		     (int) rec.name_len, rec.name, name);
+	    ret = -1;
+	    lmap_result_free(res);
+	}
+    }
+    lmapd_rlog_close(&log);
+    return ret;
+}
+
 int
 lmapd_workspace_read_results(struct lmapd *lmapd, const int filetype)
 {
@@ -930,6 +3226,7 @@ lmapd_workspace_read_results(struct lmapd *lmapd, const int filetype)
     DIR *dfd;
     struct table *tab;
     struct result *res;
+    struct content content;
 
     int had_errors = 0;
     int valid_report = 0;
@@ -950,6 +3247,13 @@ lmapd_workspace_read_results(struct lmapd *lmapd, const int filetype)
 	    continue;
 	}
 
+	if (!strcmp(p, LMAPD_RLOG_SUFFIX)) {
+	    if (read_segment(lmapd, dp->d_name, filetype, &valid_report)) {
+		had_errors = 1;
+	    }
+	    continue;
+	}
+
 	/* note: security issue if len("meta") != len("data") */
 	if (!strcmp(p, ".meta")) {
 	    int mfd, datafd;
@@ -969,15 +3273,22 @@ lmapd_workspace_read_results(struct lmapd *lmapd, const int filetype)
 		had_errors = 1;
 		continue;
 	    }
-	    res = read_result(mfd);
+	    res = NULL;
+	    if (! content_load(&content, mfd)) {
+		res = read_result(content.data, content.len);
+		content_free(&content);
+	    }
 	    if (res) {
 		err = 1;
 
 		if (filetype == LMAP_FT_CSV) {
-		    tab = read_table(datafd);
-		    if (tab) {
-			lmap_result_add_table(res, tab);
-			err = 0;
+		    if (! content_load(&content, datafd)) {
+			tab = read_table(content.data, content.len);
+			content_free(&content);
+			if (tab) {
+			    lmap_result_add_table(res, tab);
+			    err = 0;
+			}
 		    }
 		} else {
 		    if (!lmap_io_parse_task_results_fd(datafd, filetype, res)) {
@@ -30,10 +30,32 @@ extern int lmapd_workspace_action_move(struct lmapd *lmapd, struct schedule *sch
 extern int lmapd_workspace_schedule_move(struct lmapd *lmapd, struct schedule *schedule);
 extern int lmapd_workspace_schedule_clean(struct lmapd *lmapd, struct schedule *schedule);
 
+struct workspace_job;
+
+extern struct workspace_job *lmapd_workspace_job_new(void);
+extern void lmapd_workspace_job_free(struct workspace_job *job);
+extern int lmapd_workspace_job_schedule_move(struct workspace_job *job, struct schedule *schedule);
+extern int lmapd_workspace_job_schedule_clean(struct workspace_job *job, struct schedule *schedule);
+extern int lmapd_workspace_job_action_move(struct workspace_job *job, struct schedule *schedule, struct action *action, struct schedule *destination);
+extern int lmapd_workspace_job_action_stage(struct workspace_job *job, struct schedule *schedule, struct action *action, struct schedule *destination);
+extern int lmapd_workspace_job_action_publish(struct workspace_job *job, struct schedule *schedule, struct action *action, struct schedule *destination);
+extern int lmapd_workspace_job_action_clean(struct workspace_job *job, struct schedule *schedule, struct action *action);
+extern int lmapd_workspace_job_action_spill(struct workspace_job *job, struct schedule *schedule, struct action *action);
+extern int lmapd_workspace_job_action_flush(struct workspace_job *job, struct schedule *schedule, struct action *action, uint64_t size);
+extern int lmapd_workspace_job_action_measure(struct workspace_job *job, struct schedule *schedule, struct action *action);
+extern int lmapd_workspace_job_update(struct workspace_job *job, struct lmap *lmap);
+extern void lmapd_workspace_job_run(struct workspace_job *job);
+extern void lmapd_workspace_job_account(struct workspace_job *job, struct lmap *lmap);
+extern void lmapd_workspace_job_after(struct workspace_job *job, struct workspace_job *after);
+extern int lmapd_workspace_sync(const char *path);
+
 extern int lmapd_workspace_action_open_data(struct schedule *schedule, struct action *action, int flags);
 
 extern int lmapd_workspace_action_open_meta(struct schedule *schedule, struct action *action, int flags);
 
+extern int lmapd_workspace_action_open_output(struct schedule *schedule, struct action *action);
+extern int lmapd_workspace_action_spill(struct schedule *schedule, struct action *action);
+
 extern int lmapd_workspace_action_meta_add_start(struct schedule *schedule, struct action *action, struct task *task);
 extern int lmapd_workspace_action_meta_add_end(struct schedule *schedule, struct action *action);
 
@@ -34,10 +34,12 @@
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
+#include <libxml/xmlwriter.h>
 
 #include "lmap.h"
 #include "utils.h"
 #include "xml-io.h"
+#include "lmap-io.h"
 
 #define RENDER_CONFIG_TRUE	0x01
 #define RENDER_CONFIG_FALSE	0x02
@@ -91,9 +93,51 @@ parse_agent(struct lmap *lmap, xmlXPathContextPtr ctx, int what)
 	{ .name = "controller-timeout",
 	  .flags = YANG_CONFIG_TRUE,
 	  .func = lmap_agent_set_controller_timeout },
+	{ .name = "max-concurrent-actions",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_agent_set_max_concurrent_actions },
+	{ .name = "durability",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_agent_set_durability },
+	{ .name = "commit-window",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_agent_set_commit_window },
 	{ .name = "last-started",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_agent_set_last_started },
+	{ .name = "admission-queue-depth",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_admission_queue_depth },
+	{ .name = "admissions",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_admissions },
+	{ .name = "admission-wait",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_admission_wait },
+	{ .name = "admission-max-wait",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_admission_max_wait },
+	{ .name = "event-loop-lag",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_loop_lag },
+	{ .name = "event-loop-max-lag",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_loop_max_lag },
+	{ .name = "commits",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_commits },
+	{ .name = "commit-latency",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_commit_latency },
+	{ .name = "commit-max-latency",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_commit_max_latency },
+	{ .name = "commit-batch",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_commit_batch },
+	{ .name = "commit-max-batch",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_agent_set_commit_max_batch },
 	{ .name = NULL, .flags = 0, .func = NULL }
     };
 
@@ -920,6 +964,54 @@ parse_events(struct lmap *lmap, xmlXPathContextPtr ctx, int what)
     return 0;
 }
 
+static void
+parse_usage(xmlNodePtr usage_node, struct usage *usage)
+{
+    int j;
+    xmlNodePtr node;
+
+    const struct {
+	const char * const name;
+	int (* const func)(struct usage *s, const char *c);
+    } tab[] = {
+	{ .name = "user-time",
+	  .func = lmap_usage_set_user_time },
+	{ .name = "system-time",
+	  .func = lmap_usage_set_system_time },
+	{ .name = "max-rss",
+	  .func = lmap_usage_set_max_rss },
+	{ .name = "block-input",
+	  .func = lmap_usage_set_block_input },
+	{ .name = "block-output",
+	  .func = lmap_usage_set_block_output },
+	{ .name = "voluntary-context-switches",
+	  .func = lmap_usage_set_voluntary_switches },
+	{ .name = "involuntary-context-switches",
+	  .func = lmap_usage_set_involuntary_switches },
+	{ .name = NULL, .func = NULL }
+    };
+
+    for (node = xmlFirstElementChild(usage_node);
+	 node; node = xmlNextElementSibling(node)) {
+
+	if (node->ns != usage_node->ns) continue;
+
+	for (j = 0; tab[j].name; j++) {
+	    if (!xmlStrcmp(node->name, BAD_CAST tab[j].name)) {
+		xmlChar *content = xmlNodeGetContent(node);
+		tab[j].func(usage, (char *) content);
+		if (content) {
+		    xmlFree(content);
+		}
+		break;
+	    }
+	}
+	if (! tab[j].name) {
+	    lmap_wrn("unexpected element '%s'", node->name);
+	}
+    }
+}
+
 static struct action *
 parse_action(xmlNodePtr action_node, int what)
 {
@@ -947,6 +1039,12 @@ parse_action(xmlNodePtr action_node, int what)
 	{ .name = "suppression-tag",
 	  .flags = YANG_CONFIG_TRUE,
 	  .func = lmap_action_add_suppression_tag },
+	{ .name = "timeout",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_action_set_timeout },
+	{ .name = "output-memory-limit",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_action_set_output_memory_limit },
 	{ .name = "state",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_action_set_state },
@@ -962,6 +1060,9 @@ parse_action(xmlNodePtr action_node, int what)
 	{ .name = "overlaps",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_action_set_overlaps },
+	{ .name = "timeouts",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_action_set_timeouts },
 	{ .name = "failures",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_action_set_failures },
@@ -1005,6 +1106,17 @@ parse_action(xmlNodePtr action_node, int what)
 	    continue;
 	}
 
+	if (what & PARSE_CONFIG_FALSE) {
+	    if (!xmlStrcmp(node->name, BAD_CAST "last-resource-usage")) {
+		parse_usage(node, &action->last_usage);
+		continue;
+	    }
+	    if (!xmlStrcmp(node->name, BAD_CAST "resource-usage")) {
+		parse_usage(node, &action->usage);
+		continue;
+	    }
+	}
+
 	for (j = 0; tab[j].name; j++) {
 	    if ((tab[j].flags & YANG_KEY)
 		|| (what & PARSE_CONFIG_TRUE && tab[j].flags & YANG_CONFIG_TRUE)
@@ -1054,6 +1166,27 @@ parse_schedule(xmlNodePtr schedule_node, int what)
 	{ .name = "execution-mode",
 	  .flags = YANG_CONFIG_TRUE,
 	  .func = lmap_schedule_set_exec_mode },
+	{ .name = "priority",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_priority },
+	{ .name = "stagger-interval",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_stagger },
+	{ .name = "incoming-max-bytes",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_incoming_max_bytes },
+	{ .name = "incoming-max-files",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_incoming_max_files },
+	{ .name = "incoming-overflow",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_incoming_overflow },
+	{ .name = "incoming-compression",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_incoming_compression },
+	{ .name = "incoming-format",
+	  .flags = YANG_CONFIG_TRUE,
+	  .func = lmap_schedule_set_incoming_format },
 	{ .name = "tag",
 	  .flags = YANG_CONFIG_TRUE,
 	  .func = lmap_schedule_add_tag },
@@ -1075,6 +1208,15 @@ parse_schedule(xmlNodePtr schedule_node, int what)
 	{ .name = "overlaps",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_schedule_set_overlaps },
+	{ .name = "timeouts",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_schedule_set_timeouts },
+	{ .name = "incoming-quota-hits",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_schedule_set_quota_hits },
+	{ .name = "incoming-evicted-bytes",
+	  .flags = YANG_CONFIG_FALSE,
+	  .func = lmap_schedule_set_evicted_bytes },
 	{ .name = "failures",
 	  .flags = YANG_CONFIG_FALSE,
 	  .func = lmap_schedule_set_failures },
@@ -1100,6 +1242,17 @@ parse_schedule(xmlNodePtr schedule_node, int what)
 	    continue;
 	}
 
+	if (what & PARSE_CONFIG_FALSE) {
+	    if (!xmlStrcmp(node->name, BAD_CAST "last-resource-usage")) {
+		parse_usage(node, &schedule->last_usage);
+		continue;
+	    }
+	    if (!xmlStrcmp(node->name, BAD_CAST "resource-usage")) {
+		parse_usage(node, &schedule->usage);
+		continue;
+	    }
+	}
+
 	for (j = 0; tab[j].name; j++) {
 	    if ((tab[j].flags & YANG_KEY)
 		|| (what & PARSE_CONFIG_TRUE && tab[j].flags & YANG_CONFIG_TRUE)
@@ -1785,45 +1938,144 @@ exit:
     return ret;
 }
 
+/*
+ * Opens a text writer on file and starts the document. The documents
+ * are streamed into the file as the lmap lists are walked; the output is
+ * the one of xmlDocDumpFormatMemoryEnc() on the equivalent tree.
+ */
+
+static xmlTextWriterPtr
+writer_open(FILE *file, int flags)
+{
+    xmlOutputBufferPtr out;
+    xmlTextWriterPtr writer;
+
+    out = xmlOutputBufferCreateFile(file, NULL);
+    if (! out) {
+	return NULL;
+    }
+    writer = xmlNewTextWriter(out);
+    if (! writer) {
+	(void) xmlOutputBufferClose(out);
+	return NULL;
+    }
+    if (! (flags & LMAP_IO_FLAG_COMPACT)) {
+	(void) xmlTextWriterSetIndent(writer, 1);
+	(void) xmlTextWriterSetIndentString(writer, BAD_CAST "  ");
+    }
+    if (xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL) < 0) {
+	xmlFreeTextWriter(writer);
+	return NULL;
+    }
+    return writer;
+}
+
+static int
+writer_close(xmlTextWriterPtr writer, FILE *file)
+{
+    int ret = 0;
+
+    if (xmlTextWriterEndDocument(writer) < 0 || xmlTextWriterFlush(writer) < 0) {
+	ret = -1;
+    }
+    xmlFreeTextWriter(writer);
+    return (ret || ferror(file)) ? -1 : 0;
+}
+
 static void
-render_leaf(xmlNodePtr root, xmlNsPtr ns, const char *name, const char *content)
+start_root(xmlTextWriterPtr writer, const char *name,
+	   const char *prefix, const char *namespace)
 {
-    assert(root && ns);
+    char attr[64];
+
+    snprintf(attr, sizeof(attr), "xmlns:%s", prefix);
+    (void) xmlTextWriterStartElement(writer, BAD_CAST name);
+    (void) xmlTextWriterWriteAttribute(writer, BAD_CAST attr, BAD_CAST namespace);
+}
+
+static void
+start_element(xmlTextWriterPtr writer, const char *ns, const char *name)
+{
+    (void) xmlTextWriterStartElementNS(writer, BAD_CAST ns, BAD_CAST name, NULL);
+}
+
+static void
+end_element(xmlTextWriterPtr writer)
+{
+    (void) xmlTextWriterEndElement(writer);
+}
+
+/*
+ * Writes character data escaped the way the libxml2 tree serializer
+ * escapes text nodes, so that the output is the same as the one of the
+ * former DOM based renderer.
+ */
+
+static void
+render_text(xmlTextWriterPtr writer, const char *content)
+{
+    const char *run = content, *esc;
+
+    for (; *content; content++) {
+	switch (*content) {
+	case '<': esc = "&lt;"; break;
+	case '>': esc = "&gt;"; break;
+	case '&': esc = "&amp;"; break;
+	case '\r': esc = "&#13;"; break;
+	default: continue;
+	}
+	if (content > run) {
+	    (void) xmlTextWriterWriteRawLen(writer, BAD_CAST run, (int) (content - run));
+	}
+	(void) xmlTextWriterWriteRaw(writer, BAD_CAST esc);
+	run = content + 1;
+    }
+    if (content > run) {
+	(void) xmlTextWriterWriteRawLen(writer, BAD_CAST run, (int) (content - run));
+    }
+}
+
+static void
+render_leaf(xmlTextWriterPtr writer, const char *ns, const char *name, const char *content)
+{
+    assert(writer && ns);
 
     if (name && content) {
-	xmlNewChild(root, ns, BAD_CAST name, BAD_CAST content);
+	start_element(writer, ns, name);
+	render_text(writer, content);
+	end_element(writer);
     }
 }
 
 static void
-render_leaf_int32(xmlNodePtr root, xmlNsPtr ns, const char *name, int32_t value)
+render_leaf_int32(xmlTextWriterPtr writer, const char *ns, const char *name, int32_t value)
 {
     char buf[32];
 
     snprintf(buf, sizeof(buf), "%" PRIi32, value);
-    render_leaf(root, ns, name, buf);
+    render_leaf(writer, ns, name, buf);
 }
 
 static void
-render_leaf_uint32(xmlNodePtr root, xmlNsPtr ns, const char *name, uint32_t value)
+render_leaf_uint32(xmlTextWriterPtr writer, const char *ns, const char *name, uint32_t value)
 {
     char buf[32];
 
     snprintf(buf, sizeof(buf), "%" PRIu32, value);
-    render_leaf(root, ns, name, buf);
+    render_leaf(writer, ns, name, buf);
 }
 
 static void
-render_leaf_uint64(xmlNodePtr root, xmlNsPtr ns, const char *name, uint64_t value)
+render_leaf_uint64(xmlTextWriterPtr writer, const char *ns, const char *name, uint64_t value)
 {
     char buf[64];
 
     snprintf(buf, sizeof(buf), "%" PRIu64, value);
-    render_leaf(root, ns, name, buf);
+    render_leaf(writer, ns, name, buf);
 }
 
 static void
-render_leaf_datetime(xmlNodePtr root, xmlNsPtr ns, const char *name, time_t *tp)
+render_leaf_datetime(xmlTextWriterPtr writer, const char *ns, const char *name, time_t *tp)
 {
     char buf[32];
     struct tm *tmp;
@@ -1843,11 +2095,11 @@ render_leaf_datetime(xmlNodePtr root, xmlNsPtr ns, const char *name, time_t *tp)
 	buf[22] = ':';
     }
 
-    render_leaf(root, ns, name, buf);
+    render_leaf(writer, ns, name, buf);
 }
 
 static void
-render_leaf_months(xmlNodePtr root, xmlNsPtr ns, const char *name, uint16_t months)
+render_leaf_months(xmlTextWriterPtr writer, const char *ns, const char *name, uint16_t months)
 {
     int i;
     const struct {
@@ -1870,36 +2122,36 @@ render_leaf_months(xmlNodePtr root, xmlNsPtr ns, const char *name, uint16_t mont
     };
 
     if (months == UINT16_MAX) {
-	render_leaf(root, ns, name, "*");
+	render_leaf(writer, ns, name, "*");
 	return;
     }
 
     for (i = 0; tab[i].name; i++) {
 	if (months & tab[i].value) {
-	    render_leaf(root, ns, name, tab[i].name);
+	    render_leaf(writer, ns, name, tab[i].name);
 	}
     }
 }
 
 static void
-render_leaf_days_of_month(xmlNodePtr root, xmlNsPtr ns, const char *name, uint32_t days_of_month)
+render_leaf_days_of_month(xmlTextWriterPtr writer, const char *ns, const char *name, uint32_t days_of_month)
 {
     int i;
 
     if (days_of_month == UINT32_MAX) {
-	render_leaf(root, ns, name, "*");
+	render_leaf(writer, ns, name, "*");
 	return;
     }
 
     for (i = 1; i < 32; i++) {
 	if (days_of_month & (1 << i)) {
-	    render_leaf_int32(root, ns, name, i);
+	    render_leaf_int32(writer, ns, name, i);
 	}
     }
 }
 
 static void
-render_leaf_days_of_week(xmlNodePtr root, xmlNsPtr ns, const char *name, uint8_t days_of_week)
+render_leaf_days_of_week(xmlTextWriterPtr writer, const char *ns, const char *name, uint8_t days_of_week)
 {
     int i;
     const struct {
@@ -1917,183 +2169,228 @@ render_leaf_days_of_week(xmlNodePtr root, xmlNsPtr ns, const char *name, uint8_t
     };
 
     if (days_of_week == UINT8_MAX) {
-	render_leaf(root, ns, name, "*");
+	render_leaf(writer, ns, name, "*");
 	return;
     }
 
     for (i = 0; tab[i].name; i++) {
 	if (days_of_week & tab[i].value) {
-	    render_leaf(root, ns, name, tab[i].name);
+	    render_leaf(writer, ns, name, tab[i].name);
 	}
     }
 }
 
 static void
-render_leaf_hours(xmlNodePtr root, xmlNsPtr ns, const char *name, uint32_t hours)
+render_leaf_hours(xmlTextWriterPtr writer, const char *ns, const char *name, uint32_t hours)
 {
     int i;
 
     if (hours == UINT32_MAX) {
-	render_leaf(root, ns, name, "*");
+	render_leaf(writer, ns, name, "*");
 	return;
     }
 
     for (i = 0; i < 24; i++) {
 	if (hours & (1 << i)) {
-	    render_leaf_int32(root, ns, name, i);
+	    render_leaf_int32(writer, ns, name, i);
 	}
     }
 }
 
 static void
-render_leaf_minsecs(xmlNodePtr root, xmlNsPtr ns, const char *name, uint64_t minsecs)
+render_leaf_minsecs(xmlTextWriterPtr writer, const char *ns, const char *name, uint64_t minsecs)
 {
     int i;
 
     if (minsecs == UINT64_MAX) {
-	render_leaf(root, ns, name, "*");
+	render_leaf(writer, ns, name, "*");
 	return;
     }
 
     for (i = 0; i < 60; i++) {
 	if (minsecs & (1ull << i)) {
-	    render_leaf_int32(root, ns, name, i);
+	    render_leaf_int32(writer, ns, name, i);
 	}
     }
 }
 
 static void
-render_registry(struct registry *registry, xmlNodePtr root, xmlNsPtr ns)
+render_registry(struct registry *registry, xmlTextWriterPtr writer, const char *ns)
 {
     struct tag *tag;
-    xmlNodePtr node;
 
     if (! registry) {
 	return;
     }
 
-    node = xmlNewChild(root, ns, BAD_CAST "function", NULL);
-    if (! node) {
-	return;
-    }
+    start_element(writer, ns, "function");
 
-    render_leaf(node, ns, "uri", registry->uri);
+    render_leaf(writer, ns, "uri", registry->uri);
     for (tag = registry->roles; tag; tag = tag->next) {
-	render_leaf(node, ns, "role", tag->tag);
+	render_leaf(writer, ns, "role", tag->tag);
     }
+    end_element(writer);
 }
 
 static void
-render_option(struct option *option, xmlNodePtr root, xmlNsPtr ns)
+render_option(struct option *option, xmlTextWriterPtr writer, const char *ns)
 {
-    xmlNodePtr node;
-
     if (! option) {
 	return;
     }
 
-    node = xmlNewChild(root, ns, BAD_CAST "option", NULL);
-
-    if (! node) {
-	return;
-    }
+    start_element(writer, ns, "option");
 
-    render_leaf(node, ns, "id", option->id);
-    render_leaf(node, ns, "name", option->name);
-    render_leaf(node, ns, "value", option->value);
+    render_leaf(writer, ns, "id", option->id);
+    render_leaf(writer, ns, "name", option->name);
+    render_leaf(writer, ns, "value", option->value);
+    end_element(writer);
 }
 
 static void
-render_agent(struct agent *agent, xmlNodePtr root, xmlNsPtr ns, int what)
+render_agent(struct agent *agent, xmlTextWriterPtr writer, const char *ns, int what)
 {
-    xmlNodePtr node;
-
     if (! agent) {
 	return;
     }
 
-    node = xmlNewChild(root, ns, BAD_CAST "agent", NULL);
-    if (! node) {
-	return;
-    }
+    start_element(writer, ns, "agent");
 
     if (what & RENDER_CONFIG_TRUE) {
-	render_leaf(node, ns, "agent-id", agent->agent_id);
-	render_leaf(node, ns, "group-id", agent->group_id);
-	render_leaf(node, ns, "measurement-point", agent->measurement_point);
+	render_leaf(writer, ns, "agent-id", agent->agent_id);
+	render_leaf(writer, ns, "group-id", agent->group_id);
+	render_leaf(writer, ns, "measurement-point", agent->measurement_point);
 	if (agent->flags & LMAP_AGENT_FLAG_REPORT_AGENT_ID_SET) {
-	    render_leaf(node, ns, "report-agent-id",
+	    render_leaf(writer, ns, "report-agent-id",
 			agent->report_agent_id ? "true" : "false");
 	}
 	if (agent->flags & LMAP_AGENT_FLAG_REPORT_GROUP_ID_SET) {
-	    render_leaf(node, ns, "report-group-id",
+	    render_leaf(writer, ns, "report-group-id",
 			agent->report_group_id ? "true" : "false");
 	}
 	if (agent->flags & LMAP_AGENT_FLAG_REPORT_MEASUREMENT_POINT_SET) {
-	    render_leaf(node, ns, "report-measurement-point",
+	    render_leaf(writer, ns, "report-measurement-point",
 			agent->report_measurement_point ? "true" : "false");
 	}
 	if (agent->flags & LMAP_AGENT_FLAG_CONTROLLER_TIMEOUT_SET) {
-	    render_leaf_uint32(node, ns, "controller-timeout",
+	    render_leaf_uint32(writer, ns, "controller-timeout",
 			       agent->controller_timeout);
 	}
+	if (agent->flags & LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET) {
+	    render_leaf_uint32(writer, ns, "max-concurrent-actions",
+			       agent->max_concurrent_actions);
+	}
+	if (agent->flags & LMAP_AGENT_FLAG_DURABILITY_SET) {
+	    render_leaf(writer, ns, "durability",
+			agent->durability == LMAP_AGENT_DURABILITY_GROUP
+			? "group" : "none");
+	}
+	if (agent->flags & LMAP_AGENT_FLAG_COMMIT_WINDOW_SET) {
+	    render_leaf_uint32(writer, ns, "commit-window", agent->commit_window);
+	}
     }
     if (what & RENDER_CONFIG_FALSE) {
 	if (agent->last_started) {
-	    render_leaf_datetime(node, ns, "last-started", &agent->last_started);
+	    render_leaf_datetime(writer, ns, "last-started", &agent->last_started);
+	}
+	if (agent->cnt_admissions || agent->admission_queue_depth) {
+	    render_leaf_uint32(writer, ns, "admission-queue-depth",
+			       agent->admission_queue_depth);
+	    render_leaf_uint32(writer, ns, "admissions", agent->cnt_admissions);
+	    render_leaf_uint64(writer, ns, "admission-wait", agent->admission_wait);
+	    render_leaf_uint64(writer, ns, "admission-max-wait",
+			       agent->admission_max_wait);
+	}
+	if (agent->loop_lag || agent->loop_max_lag) {
+	    render_leaf_uint64(writer, ns, "event-loop-lag", agent->loop_lag);
+	    render_leaf_uint64(writer, ns, "event-loop-max-lag",
+			       agent->loop_max_lag);
+	}
+	if (agent->cnt_commits) {
+	    render_leaf_uint32(writer, ns, "commits", agent->cnt_commits);
+	    render_leaf_uint64(writer, ns, "commit-latency", agent->commit_latency);
+	    render_leaf_uint64(writer, ns, "commit-max-latency",
+			       agent->commit_max_latency);
+	    render_leaf_uint32(writer, ns, "commit-batch", agent->commit_batch);
+	    render_leaf_uint32(writer, ns, "commit-max-batch",
+			       agent->commit_max_batch);
 	}
     }
+    end_element(writer);
 }
 
 static void
-render_agent_report(struct agent *agent, xmlNodePtr root, xmlNsPtr ns)
+render_agent_report(struct agent *agent, xmlTextWriterPtr writer, const char *ns)
 {
     if (! agent) {
 	return;
     }
 
-    render_leaf_datetime(root, ns, "date", &agent->report_date);
+    render_leaf_datetime(writer, ns, "date", &agent->report_date);
     if (agent->agent_id && agent->report_agent_id) {
-	render_leaf(root, ns, "agent-id", agent->agent_id);
+	render_leaf(writer, ns, "agent-id", agent->agent_id);
     }
     if (agent->group_id && agent->report_group_id) {
-	render_leaf(root, ns, "group-id", agent->group_id);
+	render_leaf(writer, ns, "group-id", agent->group_id);
     }
     if (agent->measurement_point && agent->report_measurement_point) {
-	render_leaf(root, ns, "measurement-point", agent->measurement_point);
+	render_leaf(writer, ns, "measurement-point", agent->measurement_point);
     }
 }
 
 static void
-render_action(struct action *action, xmlNodePtr root, xmlNsPtr ns, int what)
+render_usage(struct usage *usage, xmlTextWriterPtr writer, const char *ns, const char *name)
+{
+    if (! lmap_usage_isset(usage)) {
+	return;
+    }
+
+    start_element(writer, ns, name);
+    render_leaf_uint64(writer, ns, "user-time", usage->user_time);
+    render_leaf_uint64(writer, ns, "system-time", usage->system_time);
+    render_leaf_uint64(writer, ns, "max-rss", usage->max_rss);
+    render_leaf_uint64(writer, ns, "block-input", usage->block_input);
+    render_leaf_uint64(writer, ns, "block-output", usage->block_output);
+    render_leaf_uint64(writer, ns, "voluntary-context-switches",
+		       usage->voluntary_switches);
+    render_leaf_uint64(writer, ns, "involuntary-context-switches",
+		       usage->involuntary_switches);
+    end_element(writer);
+}
+
+static void
+render_action(struct action *action, xmlTextWriterPtr writer, const char *ns, int what)
 {
     struct option *option;
     struct tag *tag;
-    xmlNodePtr node;
 
     if (! action) {
 	return;
     }
 
-    node = xmlNewChild(root, ns, BAD_CAST "action", NULL);
-    if (! node) {
-	return;
-    }
+    start_element(writer, ns, "action");
 
-    render_leaf(node, ns, "name", action->name);
+    render_leaf(writer, ns, "name", action->name);
     if (what & RENDER_CONFIG_TRUE) {
-	render_leaf(node, ns, "task", action->task);
+	render_leaf(writer, ns, "task", action->task);
 	for (tag = action->destinations; tag; tag = tag->next) {
-	    render_leaf(node, ns, "destination", tag->tag);
+	    render_leaf(writer, ns, "destination", tag->tag);
 	}
 	for (option = action->options; option; option = option->next) {
-	    render_option(option, node, ns);
+	    render_option(option, writer, ns);
 	}
 	for (tag = action->tags; tag; tag = tag->next) {
-	    render_leaf(node, ns, "tag", tag->tag);
+	    render_leaf(writer, ns, "tag", tag->tag);
 	}
 	for (tag = action->suppression_tags; tag; tag = tag->next) {
-	    render_leaf(node, ns, "suppression-tag", tag->tag);
+	    render_leaf(writer, ns, "suppression-tag", tag->tag);
+	}
+	if (action->flags & LMAP_ACTION_FLAG_TIMEOUT_SET) {
+	    render_leaf_uint32(writer, ns, "timeout", action->timeout);
+	}
+	if (action->output_memory_limit) {
+	    render_leaf_uint64(writer, ns, "output-memory-limit",
+			       action->output_memory_limit);
 	}
     }
     if (what & RENDER_CONFIG_FALSE) {
@@ -2113,71 +2410,70 @@ render_action(struct action *action, xmlNodePtr root, xmlNsPtr ns, int what)
 	    break;
 	}
 	if (state) {
-	    render_leaf(node, ns, "state", state);
+	    render_leaf(writer, ns, "state", state);
 	}
 
-	render_leaf_uint64(node, ns, "storage", action->storage);
-	render_leaf_uint32(node, ns, "invocations", action->cnt_invocations);
-	render_leaf_uint32(node, ns, "suppressions", action->cnt_suppressions);
-	render_leaf_uint32(node, ns, "overlaps", action->cnt_overlaps);
-	render_leaf_uint32(node, ns, "failures", action->cnt_failures);
+	render_leaf_uint64(writer, ns, "storage", action->storage);
+	render_leaf_uint32(writer, ns, "invocations", action->cnt_invocations);
+	render_leaf_uint32(writer, ns, "suppressions", action->cnt_suppressions);
+	render_leaf_uint32(writer, ns, "overlaps", action->cnt_overlaps);
+	render_leaf_uint32(writer, ns, "failures", action->cnt_failures);
+	if (action->cnt_timeouts) {
+	    render_leaf_uint32(writer, ns, "timeouts", action->cnt_timeouts);
+	}
 
 	if (action->last_invocation) {
-	    render_leaf_datetime(node, ns, "last-invocation",
+	    render_leaf_datetime(writer, ns, "last-invocation",
 				 &action->last_invocation);
 	}
 	if (action->last_completion) {
-	    render_leaf_datetime(node, ns, "last-completion",
+	    render_leaf_datetime(writer, ns, "last-completion",
 				 &action->last_completion);
-	    render_leaf_int32(node, ns, "last-status",
+	    render_leaf_int32(writer, ns, "last-status",
 			      action->last_status);
 	    if (action->last_message) {
-		render_leaf(node, ns, "last-message",
+		render_leaf(writer, ns, "last-message",
 			    action->last_message);
 	    }
 	}
 	if (action->last_failed_completion) {
-	    render_leaf_datetime(node, ns, "last-failed-completion",
+	    render_leaf_datetime(writer, ns, "last-failed-completion",
 				 &action->last_failed_completion);
-	    render_leaf_int32(node, ns, "last-failed-status",
+	    render_leaf_int32(writer, ns, "last-failed-status",
 			      action->last_failed_status);
 	    if (action->last_failed_message) {
-		render_leaf(node, ns, "last-failed-message",
+		render_leaf(writer, ns, "last-failed-message",
 			    action->last_failed_message);
 	    }
 	}
+	render_usage(&action->last_usage, writer, ns, "last-resource-usage");
+	render_usage(&action->usage, writer, ns, "resource-usage");
     }
+    end_element(writer);
 }
 
 static void
-render_schedules(struct schedule *schedule, xmlNodePtr root, xmlNsPtr ns, int what)
+render_schedules(struct schedule *schedule, xmlTextWriterPtr writer, const char *ns, int what)
 {
     struct tag *tag;
     struct action *action;
-    xmlNodePtr node;
 
     if (! schedule) {
 	return;
     }
 
-    root = xmlNewChild(root, ns, BAD_CAST "schedules", NULL);
-    if (!root) {
-	return;
-    }
+    start_element(writer, ns, "schedules");
 
     for (; schedule; schedule = schedule->next) {
-	node = xmlNewChild(root, ns, BAD_CAST "schedule", NULL);
-	if (! node) {
-	    continue;
-	}
-	render_leaf(node, ns, "name", schedule->name);
+	start_element(writer, ns, "schedule");
+	render_leaf(writer, ns, "name", schedule->name);
 	if (what & RENDER_CONFIG_TRUE) {
-	    render_leaf(node, ns, "start", schedule->start);
+	    render_leaf(writer, ns, "start", schedule->start);
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_END_SET) {
-		render_leaf(node, ns, "end", schedule->end);
+		render_leaf(writer, ns, "end", schedule->end);
 	    }
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_DURATION_SET) {
-		render_leaf_uint64(node, ns, "duration", schedule->duration);
+		render_leaf_uint64(writer, ns, "duration", schedule->duration);
 	    }
 	    if (schedule->flags & LMAP_SCHEDULE_FLAG_EXEC_MODE_SET) {
 		const char *mode = NULL;
@@ -2193,14 +2489,43 @@ render_schedules(struct schedule *schedule, xmlNodePtr root, xmlNsPtr ns, int wh
 		    break;
 		}
 		if (mode) {
-		    render_leaf(node, ns, "execution-mode", mode);
+		    render_leaf(writer, ns, "execution-mode", mode);
 		}
 	    }
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_PRIORITY_SET) {
+		render_leaf_int32(writer, ns, "priority", schedule->priority);
+	    }
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_STAGGER_SET) {
+		render_leaf_uint32(writer, ns, "stagger-interval", schedule->stagger);
+	    }
+	    if (schedule->incoming_max_bytes) {
+		render_leaf_uint64(writer, ns, "incoming-max-bytes",
+				   schedule->incoming_max_bytes);
+	    }
+	    if (schedule->incoming_max_files) {
+		render_leaf_uint32(writer, ns, "incoming-max-files",
+				   schedule->incoming_max_files);
+	    }
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_OVERFLOW_SET) {
+		render_leaf(writer, ns, "incoming-overflow",
+			    schedule->incoming_overflow == LMAP_SCHEDULE_OVERFLOW_REFUSE
+			    ? "refuse" : "drop-oldest");
+	    }
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_COMPRESSION_SET) {
+		render_leaf(writer, ns, "incoming-compression",
+			    schedule->incoming_compression == LMAP_SCHEDULE_COMPRESSION_GZIP
+			    ? "gzip" : "none");
+	    }
+	    if (schedule->flags & LMAP_SCHEDULE_FLAG_FORMAT_SET) {
+		render_leaf(writer, ns, "incoming-format",
+			    schedule->incoming_format == LMAP_SCHEDULE_FORMAT_LOG
+			    ? "log" : "files");
+	    }
 	    for (tag = schedule->tags; tag; tag = tag->next) {
-		render_leaf(node, ns, "tag", tag->tag);
+		render_leaf(writer, ns, "tag", tag->tag);
 	    }
 	    for (tag = schedule->suppression_tags; tag; tag = tag->next) {
-		render_leaf(node, ns, "suppression-tag", tag->tag);
+		render_leaf(writer, ns, "suppression-tag", tag->tag);
 	    }
 	}
 	if (what & RENDER_CONFIG_FALSE) {
@@ -2220,56 +2545,64 @@ render_schedules(struct schedule *schedule, xmlNodePtr root, xmlNsPtr ns, int wh
 		break;
 	    }
 	    if (state) {
-		render_leaf(node, ns, "state", state);
+		render_leaf(writer, ns, "state", state);
 	    }
 
-	    render_leaf_uint64(node, ns, "storage", schedule->storage);
-	    render_leaf_uint32(node, ns, "invocations", schedule->cnt_invocations);
-	    render_leaf_uint32(node, ns, "suppressions", schedule->cnt_suppressions);
-	    render_leaf_uint32(node, ns, "overlaps", schedule->cnt_overlaps);
-	    render_leaf_uint32(node, ns, "failures", schedule->cnt_failures);
+	    render_leaf_uint64(writer, ns, "storage", schedule->storage);
+	    render_leaf_uint32(writer, ns, "invocations", schedule->cnt_invocations);
+	    render_leaf_uint32(writer, ns, "suppressions", schedule->cnt_suppressions);
+	    render_leaf_uint32(writer, ns, "overlaps", schedule->cnt_overlaps);
+	    render_leaf_uint32(writer, ns, "failures", schedule->cnt_failures);
+	    if (schedule->cnt_timeouts) {
+		render_leaf_uint32(writer, ns, "timeouts", schedule->cnt_timeouts);
+	    }
+	    if (schedule->cnt_quota_hits) {
+		render_leaf_uint32(writer, ns, "incoming-quota-hits",
+				   schedule->cnt_quota_hits);
+	    }
+	    if (schedule->evicted_bytes) {
+		render_leaf_uint64(writer, ns, "incoming-evicted-bytes",
+				   schedule->evicted_bytes);
+	    }
 
 	    if (schedule->last_invocation) {
-		render_leaf_datetime(node, ns, "last-invocation",
+		render_leaf_datetime(writer, ns, "last-invocation",
 				     &schedule->last_invocation);
 	    }
+	    render_usage(&schedule->last_usage, writer, ns, "last-resource-usage");
+	    render_usage(&schedule->usage, writer, ns, "resource-usage");
 	}
 
 	for (action = schedule->actions; action; action = action->next) {
-	    render_action(action, node, ns, what);
+	    render_action(action, writer, ns, what);
 	}
+	end_element(writer);
     }
+    end_element(writer);
 }
 
 static void
-render_suppressions(struct supp *supp, xmlNodePtr root, xmlNsPtr ns, int what)
+render_suppressions(struct supp *supp, xmlTextWriterPtr writer, const char *ns, int what)
 {
     struct tag *tag;
-    xmlNodePtr node;
 
     if (! supp) {
 	return;
     }
 
-    root = xmlNewChild(root, ns, BAD_CAST "suppressions", NULL);
-    if (!root) {
-	return;
-    }
+    start_element(writer, ns, "suppressions");
 
     for (; supp; supp = supp->next) {
-	node = xmlNewChild(root, ns, BAD_CAST "suppression", NULL);
-	if (! node) {
-	    continue;
-	}
-	render_leaf(node, ns, "name", supp->name);
+	start_element(writer, ns, "suppression");
+	render_leaf(writer, ns, "name", supp->name);
 	if (what & RENDER_CONFIG_TRUE) {
-	    render_leaf(node, ns, "start", supp->start);
-	    render_leaf(node, ns, "end", supp->end);
+	    render_leaf(writer, ns, "start", supp->start);
+	    render_leaf(writer, ns, "end", supp->end);
 	    for (tag = supp->match; tag; tag = tag->next) {
-		render_leaf(node, ns, "match", tag->tag);
+		render_leaf(writer, ns, "match", tag->tag);
 	    }
 	    if (supp->flags & LMAP_SUPP_FLAG_STOP_RUNNING_SET) {
-		render_leaf(node, ns, "stop-running",
+		render_leaf(writer, ns, "stop-running",
 			    supp->stop_running ? "true" : "false");
 	    }
 	}
@@ -2287,58 +2620,54 @@ render_suppressions(struct supp *supp, xmlNodePtr root, xmlNsPtr ns, int what)
 		break;
 	    }
 	    if (state) {
-		render_leaf(node, ns, "state", state);
+		render_leaf(writer, ns, "state", state);
 	    }
 	}
+	end_element(writer);
     }
+    end_element(writer);
 }
 
 static void
-render_tasks(struct task *task, xmlNodePtr root, xmlNsPtr ns, int what)
+render_tasks(struct task *task, xmlTextWriterPtr writer, const char *ns, int what)
 {
     struct registry *registry;
     struct option *option;
     struct tag *tag;
-    xmlNodePtr node;
 
     if (! task) {
 	return;
     }
 
-    root = xmlNewChild(root, ns, BAD_CAST "tasks", NULL);
-    if (!root) {
-	return;
-    }
+    start_element(writer, ns, "tasks");
 
     for (; task; task = task->next) {
-	node = xmlNewChild(root, ns, BAD_CAST "task", NULL);
-	if (! node) {
-	    continue;
-	}
-	render_leaf(node, ns, "name", task->name);
+	start_element(writer, ns, "task");
+	render_leaf(writer, ns, "name", task->name);
 	for (registry = task->registries; registry; registry = registry->next) {
-	    render_registry(registry, node, ns);
+	    render_registry(registry, writer, ns);
 	}
 	if (what & RENDER_CONFIG_FALSE) {
-	    render_leaf(node, ns, "version", task->version);
+	    render_leaf(writer, ns, "version", task->version);
 	}
-	render_leaf(node, ns, "program", task->program);
+	render_leaf(writer, ns, "program", task->program);
 	if (what & RENDER_CONFIG_TRUE) {
 	    for (option = task->options; option; option = option->next) {
-		render_option(option, node, ns);
+		render_option(option, writer, ns);
 	    }
 	    for (tag = task->tags; tag; tag = tag->next) {
-		render_leaf(node, ns, "tag", tag->tag);
+		render_leaf(writer, ns, "tag", tag->tag);
 	    }
 	}
+	end_element(writer);
     }
+    end_element(writer);
 }
 
 static void
-render_capabilities(struct capability *capability, xmlNodePtr root, xmlNsPtr ns, int what)
+render_capabilities(struct capability *capability, xmlTextWriterPtr writer, const char *ns, int what)
 {
     struct tag *tag;
-    xmlNodePtr node;
 
     if (! capability) {
 	return;
@@ -2352,85 +2681,70 @@ render_capabilities(struct capability *capability, xmlNodePtr root, xmlNsPtr ns,
 	return;
     }
 
-    node = xmlNewChild(root, ns, BAD_CAST "capabilities", NULL);
-    if (! node) {
-	return;
-    }
+    start_element(writer, ns, "capabilities");
 
     if (capability->version) {
-	render_leaf(node, ns, "version", capability->version);
+	render_leaf(writer, ns, "version", capability->version);
     }
     for (tag = capability->tags; tag; tag = tag->next) {
-	render_leaf(node, ns, "tag", tag->tag);
+	render_leaf(writer, ns, "tag", tag->tag);
     }
-    render_tasks(capability->tasks, node, ns, what);
+    render_tasks(capability->tasks, writer, ns, what);
+    end_element(writer);
 }
 
 static void
-render_events(struct event *event, xmlNodePtr root, xmlNsPtr ns, int what)
+render_events(struct event *event, xmlTextWriterPtr writer, const char *ns, int what)
 {
-    xmlNodePtr node, subnode;
-
     if (! event) {
 	return;
     }
 
-    root = xmlNewChild(root, ns, BAD_CAST "events", NULL);
-    if (!root) {
-	return;
-    }
+    start_element(writer, ns, "events");
 
     for (; event; event = event->next) {
-	node = xmlNewChild(root, ns, BAD_CAST "event", NULL);
-	if (! node) {
-	    continue;
-	}
-	render_leaf(node, ns, "name", event->name);
+	start_element(writer, ns, "event");
+	render_leaf(writer, ns, "name", event->name);
 	if (what & RENDER_CONFIG_TRUE) {
 	    if (event->flags & LMAP_EVENT_FLAG_RANDOM_SPREAD_SET) {
-		render_leaf_uint32(node, ns, "random-spread", event->random_spread);
+		render_leaf_uint32(writer, ns, "random-spread", event->random_spread);
 	    }
 	    if (event->flags & LMAP_EVENT_FLAG_CYCLE_INTERVAL_SET) {
-		render_leaf_uint32(node, ns, "cycle-interval", event->cycle_interval);
+		render_leaf_uint32(writer, ns, "cycle-interval", event->cycle_interval);
 	    }
 	    switch (event->type) {
 	    case LMAP_EVENT_TYPE_PERIODIC:
-		subnode = xmlNewChild(node, ns, BAD_CAST "periodic", NULL);
-		if (! subnode) {
-		    continue;
-		}
+		start_element(writer, ns, "periodic");
 		if (event->flags & LMAP_EVENT_FLAG_INTERVAL_SET) {
-		    render_leaf_uint32(subnode, ns, "interval", event->interval);
+		    render_leaf_uint32(writer, ns, "interval", event->interval);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_START_SET) {
-		    render_leaf_datetime(subnode, ns, "start", &event->start);
+		    render_leaf_datetime(writer, ns, "start", &event->start);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-		    render_leaf_datetime(subnode, ns, "end", &event->end);
+		    render_leaf_datetime(writer, ns, "end", &event->end);
 		}
+		end_element(writer);
 		break;
 	    case LMAP_EVENT_TYPE_CALENDAR:
-		subnode = xmlNewChild(node, ns, BAD_CAST "calendar", NULL);
-		if (! subnode) {
-		    continue;
-		}
+		start_element(writer, ns, "calendar");
 		if (event->months) {
-		    render_leaf_months(subnode, ns, "month", event->months);
+		    render_leaf_months(writer, ns, "month", event->months);
 		}
 		if (event->days_of_month) {
-		    render_leaf_days_of_month(subnode, ns, "day-of-month", event->days_of_month);
+		    render_leaf_days_of_month(writer, ns, "day-of-month", event->days_of_month);
 		}
 		if (event->days_of_week) {
-		    render_leaf_days_of_week(subnode, ns, "day-of-week", event->days_of_week);
+		    render_leaf_days_of_week(writer, ns, "day-of-week", event->days_of_week);
 		}
 		if (event->hours) {
-		    render_leaf_hours(subnode, ns, "hour", event->hours);
+		    render_leaf_hours(writer, ns, "hour", event->hours);
 		}
 		if (event->minutes) {
-		    render_leaf_minsecs(subnode, ns, "minute", event->minutes);
+		    render_leaf_minsecs(writer, ns, "minute", event->minutes);
 		}
 		if (event->seconds) {
-		    render_leaf_minsecs(subnode, ns, "second", event->seconds);
+		    render_leaf_minsecs(writer, ns, "second", event->seconds);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_TIMEZONE_OFFSET_SET) {
 		    char buf[42];
@@ -2439,182 +2753,249 @@ render_events(struct event *event, xmlNodePtr root, xmlNsPtr ns, int what)
 		    offset = (offset < 0) ? -offset : offset;
 		    snprintf(buf, sizeof(buf), "%c%02d:%02d",
 			     c, offset / 60, offset % 60);
-		    render_leaf(subnode, ns, "timezone-offset", buf);
+		    render_leaf(writer, ns, "timezone-offset", buf);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_START_SET) {
-		    render_leaf_datetime(subnode, ns, "start", &event->start);
+		    render_leaf_datetime(writer, ns, "start", &event->start);
 		}
 		if (event->flags & LMAP_EVENT_FLAG_END_SET) {
-		    render_leaf_datetime(subnode, ns, "end", &event->end);
+		    render_leaf_datetime(writer, ns, "end", &event->end);
 		}
+		end_element(writer);
 		break;
 	    case LMAP_EVENT_TYPE_ONE_OFF:
-		subnode = xmlNewChild(node, ns, BAD_CAST "one-off", NULL);
-		if (! subnode) {
-		    continue;
-		}
+		start_element(writer, ns, "one-off");
 		if (event->flags & LMAP_EVENT_FLAG_START_SET) {
-		    render_leaf_datetime(subnode, ns, "time", &event->start);
+		    render_leaf_datetime(writer, ns, "time", &event->start);
 		}
+		end_element(writer);
 		break;
 	    case LMAP_EVENT_TYPE_STARTUP:
-		render_leaf(node, ns, "startup", "");
+		render_leaf(writer, ns, "startup", "");
 		break;
 	    case LMAP_EVENT_TYPE_IMMEDIATE:
-		render_leaf(node, ns, "immediate", "");
+		render_leaf(writer, ns, "immediate", "");
 		break;
 	    case LMAP_EVENT_TYPE_CONTROLLER_LOST:
-		render_leaf(node, ns, "controller-lost", "");
+		render_leaf(writer, ns, "controller-lost", "");
 		break;
 	    case LMAP_EVENT_TYPE_CONTROLLER_CONNECTED:
-		render_leaf(node, ns, "controller-connected", "");
+		render_leaf(writer, ns, "controller-connected", "");
 		break;
 	    }
 	}
+	end_element(writer);
     }
+    end_element(writer);
 }
 
 static void
-render_row(struct row *row, xmlNodePtr root, xmlNsPtr ns)
+render_row(struct row *row, xmlTextWriterPtr writer, const char *ns)
 {
-    xmlNodePtr node;
     struct value *val;
 
-    node = xmlNewChild(root, ns, BAD_CAST "row", NULL);
-    if (!node) {
-	return;
-    }
+    start_element(writer, ns, "row");
 
     for (val = row->values; val; val = val->next) {
-	render_leaf(node, ns, "value", val->value ? val->value : "");
+	render_leaf(writer, ns, "value", val->value ? val->value : "");
     }
+    end_element(writer);
 }
 
 static void
-render_table(struct table *tab, xmlNodePtr root, xmlNsPtr ns)
+render_table(struct table *tab, xmlTextWriterPtr writer, const char *ns)
 {
-    xmlNodePtr node;
     struct registry *reg;
     struct value *val;
     struct row *row;
 
-    node = xmlNewChild(root, ns, BAD_CAST "table", NULL);
-    if (!node) {
-	return;
-    }
+    start_element(writer, ns, "table");
 
     for (reg = tab->registries; reg; reg = reg->next) {
-	render_registry(reg, node, ns);
+	render_registry(reg, writer, ns);
     }
 
     for (val = tab->columns; val; val = val->next) {
-	render_leaf(node, ns, "column", val->value ? val->value : "");
+	render_leaf(writer, ns, "column", val->value ? val->value : "");
     }
 
     for (row = tab->rows; row; row = row->next) {
-	render_row(row, node, ns);
+	render_row(row, writer, ns);
     }
+    end_element(writer);
 }
 
 static void
-render_result(struct result *res, xmlNodePtr root, xmlNsPtr ns)
+render_result(struct result *res, xmlTextWriterPtr writer, const char *ns)
 {
-    xmlNodePtr node;
     struct option *option;
     struct tag *tag;
     struct table *tab;
 
-    node = xmlNewChild(root, ns, BAD_CAST "result", NULL);
-    if (!node) {
-	return;
-    }
+    start_element(writer, ns, "result");
 
-    render_leaf(node, ns, "schedule", res->schedule);
-    render_leaf(node, ns, "action", res->action);
-    render_leaf(node, ns, "task", res->task);
+    render_leaf(writer, ns, "schedule", res->schedule);
+    render_leaf(writer, ns, "action", res->action);
+    render_leaf(writer, ns, "task", res->task);
     for (option = res->options; option; option = option->next) {
-	render_option(option, node, ns);
+	render_option(option, writer, ns);
     }
     for (tag = res->tags; tag; tag = tag->next) {
-	render_leaf(node, ns, "tag", tag->tag);
+	render_leaf(writer, ns, "tag", tag->tag);
     }
 
     if (res->event) {
-	render_leaf_datetime(node, ns, "event", &res->event);
+	render_leaf_datetime(writer, ns, "event", &res->event);
     }
 
     if (res->start) {
-	render_leaf_datetime(node, ns, "start", &res->start);
+	render_leaf_datetime(writer, ns, "start", &res->start);
     }
 
     if (res->end) {
-	render_leaf_datetime(node, ns, "end", &res->end);
+	render_leaf_datetime(writer, ns, "end", &res->end);
     }
 
     if (res->cycle_number) {
-	render_leaf(node, ns, "cycle-number", res->cycle_number);
+	render_leaf(writer, ns, "cycle-number", res->cycle_number);
     }
 
     if (res->flags & LMAP_RESULT_FLAG_STATUS_SET) {
-	render_leaf_int32(node, ns, "status", res->status);
+	render_leaf_int32(writer, ns, "status", res->status);
     }
 
     for (tab = res->tables; tab; tab = tab->next) {
-	render_table(tab, node, ns);
+	render_table(tab, writer, ns);
     }
+    end_element(writer);
 }
 
-static char*
-render_control(struct lmap *lmap, int what)
+
+static int
+render_control(struct lmap *lmap, FILE *file, int what, int flags)
 {
-    xmlDocPtr doc;
-    xmlNodePtr root, node;
-    xmlNsPtr ns = NULL;
-    char *config = NULL;
-    xmlChar *p = NULL;
-    int len = 0;
+    xmlTextWriterPtr writer;
+    const char *ns = LMAPC_XML_PREFIX;
 
     assert(lmap);
 
-    doc = xmlNewDoc(BAD_CAST "1.0");
-    if (doc == NULL) {
-	goto exit;
+    writer = writer_open(file, flags);
+    if (! writer) {
+	return -1;
     }
 
-    root = xmlNewNode(NULL, BAD_CAST
-		      ((what & RENDER_CONFIG_FALSE) ? "data" : "config"));
-    if (! root) {
-	goto exit;
-    }
-    xmlDocSetRootElement(doc, root);
+    start_root(writer, (what & RENDER_CONFIG_FALSE) ? "data" : "config",
+	       LMAPC_XML_PREFIX, LMAPC_XML_NAMESPACE);
+    start_element(writer, ns, "lmap");
+    render_capabilities(lmap->capabilities, writer, ns, what);
+    render_agent(lmap->agent, writer, ns, what);
+    render_tasks(lmap->tasks, writer, ns, what);
+    render_schedules(lmap->schedules, writer, ns, what);
+    render_suppressions(lmap->supps, writer, ns, what);
+    render_events(lmap->events, writer, ns, what);
+    end_element(writer);
+    end_element(writer);
 
-    ns = xmlNewNs(root, BAD_CAST LMAPC_XML_NAMESPACE, BAD_CAST LMAPC_XML_PREFIX);
-    if (ns == NULL) {
-	goto exit;
-    }
+    return writer_close(writer, file);
+}
 
-    node = xmlNewChild(root, ns, BAD_CAST "lmap", NULL);
-    if (! node) {
-	goto exit;
+typedef int (write_func)(struct lmap *lmap, FILE *file, int flags);
+
+/* Collects the output of a write function in a string. */
+
+static char *
+render_string(struct lmap *lmap, write_func *write_doc)
+{
+    FILE *f;
+    char *doc = NULL;
+    size_t len = 0;
+    int ret;
+
+    f = open_memstream(&doc, &len);
+    if (! f) {
+	lmap_err("failed to open memory stream: %s", strerror(errno));
+	return NULL;
+    }
+    ret = write_doc(lmap, f, 0);
+    if (fclose(f) != 0) {
+	ret = -1;
+    }
+    if (ret) {
+	free(doc);
+	return NULL;
     }
+    return doc;
+}
+
+/**
+ * @brief Writes an XML rendering of the lmap configuration to a FILE
+ *
+ * The document is written while the lmap config is walked, without
+ * building it in memory first.
+ *
+ * @param lmap The pointer to the lmap config to be rendered.
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without indentation
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_xml_write_config(struct lmap *lmap, FILE *file, int flags)
+{
+    return render_control(lmap, file, RENDER_CONFIG_TRUE, flags);
+}
+
+/**
+ * @brief Writes an XML rendering of the lmap state to a FILE
+ *
+ * @param lmap The pointer to the lmap state to be rendered.
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without indentation
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_xml_write_state(struct lmap *lmap, FILE *file, int flags)
+{
+    return render_control(lmap, file,
+			  (RENDER_CONFIG_TRUE | RENDER_CONFIG_FALSE), flags);
+}
+
+/**
+ * @brief Writes an XML rendering of the lmap report to a FILE
+ *
+ * The results are written one by one as the list is walked.
+ *
+ * @param lmap The pointer to the lmap report to be rendered.
+ * @param file The FILE to write to.
+ * @param flags LMAP_IO_FLAG_COMPACT for output without indentation
+ * @return 0 on success, -1 on error
+ */
+
+int
+lmap_xml_write_report(struct lmap *lmap, FILE *file, int flags)
+{
+    xmlTextWriterPtr writer;
+    const char *ns = LMAPR_XML_PREFIX;
+    struct result *res;
+
+    assert(lmap);
 
-    render_capabilities(lmap->capabilities, node, ns, what);
-    render_agent(lmap->agent, node, ns, what);
-    render_tasks(lmap->tasks, node, ns, what);
-    render_schedules(lmap->schedules, node, ns, what);
-    render_suppressions(lmap->supps, node, ns, what);
-    render_events(lmap->events, node, ns, what);
+    writer = writer_open(file, flags);
+    if (! writer) {
+	return -1;
+    }
 
-    xmlDocDumpFormatMemoryEnc(doc, &p, &len, "UTF-8", 1);
-    if (p) {
-	config = strdup((char *) p);
-	xmlFree(p);
+    start_root(writer, "rpc", LMAPR_XML_PREFIX, LMAPR_XML_NAMESPACE);
+    start_element(writer, ns, "report");
+    render_agent_report(lmap->agent, writer, ns);
+    for (res = lmap->results; res; res = res->next) {
+	render_result(res, writer, ns);
     }
+    end_element(writer);
+    end_element(writer);
 
-exit:
-    if (doc) xmlFreeDoc(doc);
-    xmlCleanupParser();
-    return config;
+    return writer_close(writer, file);
 }
 
 /**
@@ -2631,7 +3012,7 @@ exit:
 char *
 lmap_xml_render_config(struct lmap *lmap)
 {
-    return render_control(lmap, RENDER_CONFIG_TRUE);
+    return render_string(lmap, lmap_xml_write_config);
 }
 
 /**
@@ -2648,7 +3029,7 @@ lmap_xml_render_config(struct lmap *lmap)
 char *
 lmap_xml_render_state(struct lmap *lmap)
 {
-    return render_control(lmap, (RENDER_CONFIG_TRUE | RENDER_CONFIG_FALSE));
+    return render_string(lmap, lmap_xml_write_state);
 }
 
 /**
@@ -2665,50 +3046,7 @@ lmap_xml_render_state(struct lmap *lmap)
 char *
 lmap_xml_render_report(struct lmap *lmap)
 {
-    xmlDocPtr doc;
-    xmlNodePtr root, node;
-    xmlNsPtr ns = NULL;
-    char *report = NULL;
-    xmlChar *p = NULL;
-    int len = 0;
-    struct result *res;
-
-    assert(lmap);
-
-    doc = xmlNewDoc(BAD_CAST "1.0");
-    if (doc == NULL) {
-	goto exit;
-    }
-
-    root = xmlNewNode(NULL, BAD_CAST "rpc");
-    if (! root) {
-	goto exit;
-    }
-    xmlDocSetRootElement(doc, root);
-
-    ns = xmlNewNs(root, BAD_CAST LMAPR_XML_NAMESPACE, BAD_CAST LMAPR_XML_PREFIX);
-    if (ns == NULL) {
-	goto exit;
-    }
-
-    node = xmlNewChild(root, ns, BAD_CAST "report", NULL);
-    if (! node) {
-	goto exit;
-    }
-    render_agent_report(lmap->agent, node, ns);
-    for (res = lmap->results; res; res = res->next) {
-	render_result(res, node, ns);
-    }
-    xmlDocDumpFormatMemoryEnc(doc, &p, &len, "UTF-8", 1);
-    if (p) {
-	report = strdup((char *) p);
-	xmlFree(p);
-    }
-
-exit:
-    if (doc) xmlFreeDoc(doc);
-    xmlCleanupParser();
-    return report;
+    return render_string(lmap, lmap_xml_write_report);
 }
 
 int
@@ -2722,4 +3060,16 @@ lmap_xml_parse_task_results_fd(int fd, struct result *result)
     return -1;
 }
 
+int
+lmap_xml_parse_task_results_mem(const char *buf, size_t len, struct result *result)
+{
+    /* FIXME: implement this */
+    UNUSED(buf);
+    UNUSED(len);
+    UNUSED(result);
+
+    lmap_err("parsing of structured task output in XML not implemented yet!");
+    return -1;
+}
+
 #endif /* ifdef WITH_XML */
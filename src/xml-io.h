@@ -18,6 +18,8 @@
 #ifndef LMAP_XML_IO_H
 #define LMAP_XML_IO_H
 
+#include <stdio.h>
+
 #include "lmap.h"
 
 #define LMAPC_XML_NAMESPACE	"urn:ietf:params:xml:ns:yang:ietf-lmap-control"
@@ -37,9 +39,14 @@ extern int lmap_xml_parse_state_string(struct lmap *lmap, const char *string);
 extern int lmap_xml_parse_report_file(struct lmap *lmap, const char *file);
 extern int lmap_xml_parse_report_string(struct lmap *lmap, const char *string);
 extern int lmap_xml_parse_task_results_fd(int fd, struct result *result);
+extern int lmap_xml_parse_task_results_mem(const char *buf, size_t len, struct result *result);
 
 extern char * lmap_xml_render_config(struct lmap *lmap);
 extern char * lmap_xml_render_state(struct lmap *lmap);
 extern char * lmap_xml_render_report(struct lmap *lmap);
 
+extern int lmap_xml_write_config(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_xml_write_state(struct lmap *lmap, FILE *file, int flags);
+extern int lmap_xml_write_report(struct lmap *lmap, FILE *file, int flags);
+
 #endif
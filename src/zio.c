@@ -0,0 +1,260 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "utils.h"
+#include "zio.h"
+
+#define ZIO_BUFSIZE	65536
+
+struct zio {
+#ifdef WITH_ZLIB
+    gzFile gz;
+#else
+    int fd;
+#endif
+};
+
+/**
+ * @brief Opens a file for reading, decompressing it if needed
+ *
+ * The file descriptor is not closed by lmapd_zio_close(), and must not
+ * be used while the struct zio is open.
+ *
+ * @param fd file descriptor open for reading
+ * @return pointer to a struct zio on success, NULL on error
+ */
+
+struct zio *
+lmapd_zio_open(int fd)
+{
+    struct zio *zio;
+#ifdef WITH_ZLIB
+    int zfd;
+#endif
+
+    zio = calloc(1, sizeof(*zio));
+    if (! zio) {
+	lmap_err("failed to allocate memory");
+	return NULL;
+    }
+#ifdef WITH_ZLIB
+    zfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    zio->gz = (zfd == -1) ? NULL : gzdopen(zfd, "rb");
+    if (! zio->gz) {
+	lmap_err("failed to open compressed stream: %s", strerror(errno));
+	if (zfd != -1) {
+	    (void) close(zfd);
+	}
+	free(zio);
+	return NULL;
+    }
+    (void) gzbuffer(zio->gz, ZIO_BUFSIZE);
+#else
+    zio->fd = fd;
+#endif
+    return zio;
+}
+
+/**
+ * @brief Reads (decompressed) data
+ *
+ * @return the number of bytes read, 0 at the end of the file, -1 on
+ * error
+ */
+
+ssize_t
+lmapd_zio_read(struct zio *zio, void *buf, size_t len)
+{
+#ifdef WITH_ZLIB
+    int n, err;
+    const char *msg;
+
+    if (len > ZIO_BUFSIZE) {
+	len = ZIO_BUFSIZE;
+    }
+    n = gzread(zio->gz, buf, (unsigned int) len);
+    if (n < 0) {
+	msg = gzerror(zio->gz, &err);
+	if (err == Z_ERRNO) {
+	    return -1;
+	}
+	lmap_err("failed to decompress: %s", msg);
+	errno = EIO;
+	return -1;
+    }
+    return n;
+#else
+    ssize_t n;
+
+    do {
+	n = read(zio->fd, buf, len);
+    } while (n == -1 && errno == EINTR);
+    return n;
+#endif
+}
+
+void
+lmapd_zio_close(struct zio *zio)
+{
+    if (! zio) {
+	return;
+    }
+#ifdef WITH_ZLIB
+    (void) gzclose_r(zio->gz);
+#endif
+    free(zio);
+}
+
+static ssize_t
+zio_cookie_read(void *cookie, char *buf, size_t len)
+{
+    return lmapd_zio_read(cookie, buf, len);
+}
+
+static int
+zio_cookie_close(void *cookie)
+{
+    lmapd_zio_close(cookie);
+    return 0;
+}
+
+/**
+ * @brief Opens a stdio stream on a file, decompressing it if needed
+ *
+ * Like fdopen(fd, "r"): the file descriptor is closed by fclose().
+ *
+ * @param fd file descriptor open for reading
+ * @return the stream on success, NULL on error
+ */
+
+FILE *
+lmapd_zio_fdopen(int fd)
+{
+#ifdef WITH_ZLIB
+    struct zio *zio;
+    FILE *file;
+    const cookie_io_functions_t funcs = {
+	.read = zio_cookie_read,
+	.close = zio_cookie_close,
+    };
+
+    zio = lmapd_zio_open(fd);
+    if (! zio) {
+	return NULL;
+    }
+    file = fopencookie(zio, "r", funcs);
+    if (! file) {
+	lmapd_zio_close(zio);
+	return NULL;
+    }
+    (void) close(fd);
+    return file;
+#else
+    (void) zio_cookie_read;
+    (void) zio_cookie_close;
+    return fdopen(fd, "r");
+#endif
+}
+
+/**
+ * @brief Whether a file starts with the gzip magic number
+ *
+ * @param fd file descriptor open for reading, the offset is not changed
+ * @return 1 if it does, 0 otherwise
+ */
+
+int
+lmapd_zio_is_gzip(int fd)
+{
+    unsigned char magic[2];
+
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+	&& magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+/**
+ * @brief Writes a gzip compressed copy of a file
+ *
+ * The whole file is read, regardless of its offset, which is not
+ * changed. The file descriptors are not closed.
+ *
+ * @param infd file descriptor to read the data from
+ * @param outfd file descriptor to write the compressed data to
+ * @return 0 on success, -1 on error (errno is ENOTSUP when built
+ * without zlib)
+ */
+
+int
+lmapd_zio_gzip(int infd, int outfd)
+{
+#ifdef WITH_ZLIB
+    gzFile gz;
+    int zfd, ret = 0;
+    ssize_t n;
+    off_t off = 0;
+    char *buf;
+
+    buf = malloc(ZIO_BUFSIZE);
+    zfd = fcntl(outfd, F_DUPFD_CLOEXEC, 0);
+    gz = (zfd == -1 || ! buf) ? NULL : gzdopen(zfd, "wb");
+    if (! gz) {
+	if (zfd != -1) {
+	    (void) close(zfd);
+	}
+	free(buf);
+	return -1;
+    }
+    (void) gzbuffer(gz, ZIO_BUFSIZE);
+
+    for (;;) {
+	n = pread(infd, buf, ZIO_BUFSIZE, off);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    ret = (n == 0) ? 0 : -1;
+	    break;
+	}
+	if (gzwrite(gz, buf, (unsigned int) n) != n) {
+	    ret = -1;
+	    break;
+	}
+	off += n;
+    }
+    if (gzclose_w(gz) != Z_OK) {
+	ret = -1;
+    }
+    free(buf);
+    return ret;
+#else
+    (void) infd;
+    (void) outfd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
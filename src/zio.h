@@ -0,0 +1,40 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LMAP_ZIO_H
+#define LMAP_ZIO_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Result data files in the queue may be gzip compressed, see
+ * lmap_schedule_set_incoming_compression(). Readers use these
+ * functions, which decompress while reading, and read files that are
+ * not compressed (or everything, when built without zlib) as they are.
+ */
+
+struct zio;
+
+extern struct zio *lmapd_zio_open(int fd);
+extern ssize_t lmapd_zio_read(struct zio *zio, void *buf, size_t len);
+extern void lmapd_zio_close(struct zio *zio);
+extern FILE *lmapd_zio_fdopen(int fd);
+extern int lmapd_zio_is_gzip(int fd);
+extern int lmapd_zio_gzip(int infd, int outfd);
+
+#endif
@@ -0,0 +1,573 @@
+/*
+ * This file is part of lmapd.
+ *
+ * lmapd is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lmapd is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lmapd. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro benchmarks for some of the hot paths of lmapd. They are not
+ * part of the test suite, run them by hand:
+ *
+ *   bench-lmapd [benchmark...]
+ *
+ * Without arguments, all benchmarks are executed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "lmap.h"
+#include "lmapd.h"
+#include "lmap-io.h"
+#include "runner.h"
+#include "pidtab.h"
+#include "workspace.h"
+#include "snapshot.h"
+#include "utils.h"
+#include "csv.h"
+
+static void vlog(int level, const char *func, const char *format, va_list args)
+{
+    (void) level;
+    (void) func;
+    (void) format;
+    (void) args;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, unsigned long ops, double secs)
+{
+    printf("%-24s %10lu ops %10.3f ms %12.0f ops/s\n",
+	   name, ops, secs * 1e3, secs > 0 ? ops / secs : 0.0);
+}
+
+/*
+ * Create an lmapd with a queue in a temporary directory and a
+ * config of nsched parallel schedules having nact actions each.
+ */
+
+static struct lmapd *
+bench_lmapd_new(char *queue, int nsched, int nact)
+{
+    struct lmapd *lmapd;
+    struct task *task;
+    char name[64];
+    int i, j;
+
+    lmapd = lmapd_new();
+    lmapd->lmap = lmap_new();
+    lmapd->lmap->capabilities = lmap_capability_new();
+    if (! mkdtemp(queue) || lmapd_set_queue_path(lmapd, queue)) {
+	perror("mkdtemp");
+	exit(EXIT_FAILURE);
+    }
+
+    task = lmap_task_new();
+    lmap_task_set_name(task, "true");
+    lmap_task_set_program(task, "/bin/true");
+    lmap_add_task(lmapd->lmap, task);
+    task = lmap_task_new();
+    lmap_task_set_name(task, "true");
+    lmap_task_set_program(task, "/bin/true");
+    lmap_capability_add_task(lmapd->lmap->capabilities, task);
+
+    for (i = 0; i < nsched; i++) {
+	struct schedule *sched = lmap_schedule_new();
+	snprintf(name, sizeof(name), "schedule-%d", i);
+	lmap_schedule_set_name(sched, name);
+	lmap_schedule_set_start(sched, "start");
+	lmap_schedule_set_exec_mode(sched, "parallel");
+	for (j = 0; j < nact; j++) {
+	    struct action *act = lmap_action_new();
+	    snprintf(name, sizeof(name), "action-%d", j);
+	    lmap_action_set_name(act, name);
+	    lmap_action_set_task(act, "true");
+	    lmap_schedule_add_action(sched, act);
+	}
+	lmap_add_schedule(lmapd->lmap, sched);
+    }
+
+    lmapd->base = event_base_new();
+    (void) lmapd_workspace_init(lmapd);
+    return lmapd;
+}
+
+static void
+bench_lmapd_free(struct lmapd *lmapd, const char *queue)
+{
+    (void) lmapd_workspace_clean(lmapd);
+    (void) rmdir(queue);
+    event_base_free(lmapd->base);
+    lmapd_free(lmapd);
+}
+
+/*
+ * Fork one child per action that exits immediately, wait until all
+ * of them are zombies, and measure how long lmapd_cleanup() takes to
+ * reap them all.
+ */
+
+static void
+bench_reap(void)
+{
+    const int nsched = 100, nact = 20;
+    char queue[] = "/tmp/bench-lmapd-XXXXXX";
+    struct lmapd *lmapd;
+    struct schedule *sched;
+    struct action *act;
+    unsigned long n = 0;
+    int fds[2], running;
+    char c;
+    double t;
+
+    lmapd = bench_lmapd_new(queue, nsched, nact);
+
+    if (pipe(fds) == -1) {
+	perror("pipe");
+	exit(EXIT_FAILURE);
+    }
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	sched->state = LMAP_SCHEDULE_STATE_RUNNING;
+	for (act = sched->actions; act; act = act->next) {
+	    pid_t pid = fork();
+	    if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	    }
+	    if (pid == 0) {
+		_exit(0);
+	    }
+	    act->pid = pid;
+	    act->state = LMAP_ACTION_STATE_RUNNING;
+	    lmapd_pidtab_add(lmapd->pidtab, pid, sched, act);
+	    n++;
+	}
+    }
+    /* the read returns EOF once all children closed the pipe */
+    close(fds[1]);
+    while (read(fds[0], &c, 1) > 0)
+	;
+    close(fds[0]);
+
+    t = now();
+    do {
+	lmapd_cleanup(lmapd);
+	running = 0;
+	for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	    running |= (sched->state == LMAP_SCHEDULE_STATE_RUNNING);
+	}
+    } while (running);
+    report("reap", n, now() - t);
+
+    bench_lmapd_free(lmapd, queue);
+}
+
+/*
+ * Compare pid lookups through the pid table with a linear scan of
+ * all schedules and actions.
+ */
+
+static void
+bench_pid_lookup(void)
+{
+    const int nsched = 100, nact = 20, rounds = 100;
+    char queue[] = "/tmp/bench-lmapd-XXXXXX";
+    struct lmapd *lmapd;
+    struct schedule *sched, *s;
+    struct action *act, *a;
+    unsigned long n = 0;
+    pid_t pid = 1000;
+    int i, found = 0;
+    double t;
+
+    lmapd = bench_lmapd_new(queue, nsched, nact);
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	for (act = sched->actions; act; act = act->next) {
+	    act->pid = pid++;
+	    lmapd_pidtab_add(lmapd->pidtab, act->pid, sched, act);
+	}
+    }
+
+    t = now();
+    for (i = 0; i < rounds; i++) {
+	for (pid = 1000; pid < 1000 + nsched * nact; pid++, n++) {
+	    found += (lmapd_pidtab_find(lmapd->pidtab, pid, &s) != NULL);
+	}
+    }
+    report("pid-lookup-table", n, now() - t);
+
+    n = 0;
+    t = now();
+    for (i = 0; i < rounds; i++) {
+	for (pid = 1000; pid < 1000 + nsched * nact; pid++, n++) {
+	    for (s = lmapd->lmap->schedules; s; s = s->next) {
+		for (a = s->actions; a && a->pid != pid; a = a->next)
+		    ;
+		if (a) {
+		    found++;
+		    break;
+		}
+	    }
+	}
+    }
+    report("pid-lookup-scan", n, now() - t);
+
+    if (found != 2 * rounds * nsched * nact) {
+	fprintf(stderr, "pid-lookup: lookups failed\n");
+    }
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	for (act = sched->actions; act; act = act->next) {
+	    act->pid = 0;
+	}
+    }
+    bench_lmapd_free(lmapd, queue);
+}
+
+/*
+ * Start all actions of all schedules and reap them again, once with
+ * posix_spawn() and once with fork(). A ballast of touched memory
+ * makes the daemon look like one with a large configuration, which
+ * is what makes fork() expensive.
+ */
+
+static void
+bench_spawn_mode(const char *name, int flags)
+{
+    const int nsched = 50, nact = 20;
+    const size_t ballast_size = 64 * 1024 * 1024;
+    char queue[] = "/tmp/bench-lmapd-XXXXXX";
+    struct lmapd *lmapd;
+    struct schedule *sched;
+    unsigned long n = 0;
+    char *ballast;
+    int running;
+    double t;
+
+    ballast = malloc(ballast_size);
+    if (! ballast) {
+	perror("malloc");
+	exit(EXIT_FAILURE);
+    }
+    memset(ballast, 1, ballast_size);
+
+    lmapd = bench_lmapd_new(queue, nsched, nact);
+    lmapd->flags |= flags;
+    lmap_link(lmapd->lmap);
+
+    t = now();
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	lmapd_schedule_exec(lmapd, sched);
+	n += nact;
+    }
+    do {
+	/* children are reaped by the pidfd events or by lmapd_cleanup() */
+	(void) event_base_loop(lmapd->base, EVLOOP_NONBLOCK);
+	lmapd_cleanup(lmapd);
+	running = 0;
+	for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	    running |= (sched->state == LMAP_SCHEDULE_STATE_RUNNING);
+	}
+    } while (running);
+    report(name, n, now() - t);
+
+    bench_lmapd_free(lmapd, queue);
+    free(ballast);
+}
+
+static void
+bench_spawn(void)
+{
+    bench_spawn_mode("spawn-posix-spawn", 0);
+    bench_spawn_mode("spawn-fork", LMAPD_FLAG_FORK);
+}
+
+/*
+ * Load the state of 10k schedules and actions from a snapshot, and
+ * compare it with parsing the same state from a state document.
+ */
+
+static void
+bench_snapshot(void)
+{
+    const int nsched = 500, nact = 19, rounds = 10;
+    char queue[] = "/tmp/bench-lmapd-XXXXXX";
+    char run[] = "/tmp/bench-lmapd-XXXXXX";
+    char snapfile[PATH_MAX], statefile[PATH_MAX];
+    struct lmapd *lmapd;
+    struct schedule *sched;
+    struct action *act;
+    unsigned long n = 0;
+    char *doc;
+    FILE *f;
+    int i;
+    double t;
+
+    lmapd = bench_lmapd_new(queue, nsched, nact);
+    if (! mkdtemp(run) || lmapd_set_run_path(lmapd, run)) {
+	perror("mkdtemp");
+	exit(EXIT_FAILURE);
+    }
+    lmapd->lmap->agent = lmap_agent_new();
+    for (sched = lmapd->lmap->schedules; sched; sched = sched->next) {
+	sched->cnt_invocations = 42;
+	sched->last_invocation = time(NULL);
+	for (act = sched->actions; act; act = act->next) {
+	    act->cnt_invocations = 42;
+	    act->last_invocation = act->last_completion = time(NULL);
+	    act->usage.user_time = 1000;
+	}
+    }
+
+    t = now();
+    for (i = 0; i < rounds; i++) {
+	if (lmapd_snapshot_write(lmapd)) {
+	    fprintf(stderr, "snapshot: write failed\n");
+	    exit(EXIT_FAILURE);
+	}
+	n += nsched * (nact + 1);
+    }
+    report("snapshot-write", n, now() - t);
+
+    n = 0;
+    t = now();
+    for (i = 0; i < rounds; i++) {
+	if (lmapd_snapshot_read(lmapd)) {
+	    fprintf(stderr, "snapshot: read failed\n");
+	    exit(EXIT_FAILURE);
+	}
+	n += nsched * (nact + 1);
+    }
+    report("snapshot-load", n, now() - t);
+
+    snprintf(statefile, sizeof(statefile), "%s/%s%s",
+	     run, LMAPD_STATUS_FILE, lmap_io_engine_ext());
+    doc = lmap_io_render_state(lmapd->lmap);
+    f = fopen(statefile, "w");
+    if (! doc || ! f || fputs(doc, f) == EOF || fclose(f) == EOF) {
+	fprintf(stderr, "snapshot: writing the state document failed\n");
+	exit(EXIT_FAILURE);
+    }
+    free(doc);
+
+    n = 0;
+    t = now();
+    for (i = 0; i < rounds; i++) {
+	struct lmap *lmap = lmap_new();
+	if (lmap_io_parse_state_file(lmap, statefile)) {
+	    fprintf(stderr, "snapshot: parsing the state document failed\n");
+	    exit(EXIT_FAILURE);
+	}
+	lmap_free(lmap);
+	n += nsched * (nact + 1);
+    }
+    report("snapshot-state-parse", n, now() - t);
+
+    snprintf(snapfile, sizeof(snapfile), "%s/%s", run, LMAPD_SNAPSHOT_FILE);
+    (void) unlink(snapfile);
+    (void) unlink(statefile);
+    (void) rmdir(run);
+    bench_lmapd_free(lmapd, queue);
+}
+
+/*
+ * Fill a directory with n empty .meta/.data pairs, plus some entries
+ * that the workspace operations skip.
+ */
+
+static void
+bench_queue_fill(const char *dir, int pairs)
+{
+    char filename[PATH_MAX];
+    int i, fd;
+
+    for (i = 0; i < pairs; i++) {
+	snprintf(filename, sizeof(filename), "%s/%d-sink-a.meta", dir, i);
+	fd = open(filename, O_WRONLY | O_CREAT, 0600);
+	if (fd == -1 || close(fd)) {
+	    perror(filename);
+	    exit(EXIT_FAILURE);
+	}
+	filename[strlen(filename) - 4] = '\0';
+	strcat(filename, "data");
+	fd = open(filename, O_WRONLY | O_CREAT, 0600);
+	if (fd == -1 || close(fd)) {
+	    perror(filename);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    for (i = 0; i < pairs / 100; i++) {
+	snprintf(filename, sizeof(filename), "%s/_private-%d", dir, i);
+	(void) mkdir(filename, 0700);
+	snprintf(filename, sizeof(filename), "%s/.hidden-%d", dir, i);
+	(void) mkdir(filename, 0700);
+    }
+}
+
+/*
+ * Move, measure and clean a queue directory of 100k entries, as a
+ * schedule with a large backlog of incoming results would.
+ */
+
+static void
+bench_queue(void)
+{
+    const int pairs = 50000;
+    char queue[] = "/tmp/bench-lmapd-XXXXXX";
+    char incoming[PATH_MAX];
+    struct lmapd *lmapd;
+    struct schedule *src, *sink;
+    double t;
+
+    lmapd = bench_lmapd_new(queue, 2, 1);
+    src = lmapd->lmap->schedules;
+    sink = src->next;
+
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+    bench_queue_fill(incoming, pairs);
+    t = now();
+    (void) lmapd_workspace_schedule_move(lmapd, sink);
+    report("queue-schedule-move", 2 * pairs, now() - t);
+
+    t = now();
+    (void) lmapd_workspace_update(lmapd);
+    report("queue-measure", 2 * pairs, now() - t);
+
+    t = now();
+    (void) lmapd_workspace_schedule_clean(lmapd, sink);
+    report("queue-schedule-clean", 2 * pairs, now() - t);
+
+    bench_queue_fill(src->actions->workspace, pairs);
+    t = now();
+    (void) lmapd_workspace_action_move(lmapd, src, src->actions, sink, 0);
+    report("queue-action-move", 2 * pairs, now() - t);
+
+    t = now();
+    (void) lmapd_workspace_action_clean(lmapd, src->actions);
+    report("queue-action-clean", 2 * pairs, now() - t);
+
+    bench_lmapd_free(lmapd, queue);
+}
+
+/*
+ * Scan a 100k row CSV table, as a task with a large result would
+ * write it, with the stdio based csv_next() and the buffer scanner.
+ */
+
+static void
+bench_csv(void)
+{
+    const int rows = 100000;
+    char *data = NULL, *s;
+    size_t len = 0, flen;
+    const char *field;
+    struct csv_scanner scan;
+    unsigned long fields;
+    FILE *f;
+    double t;
+    int i, n;
+
+    f = open_memstream(&data, &len);
+    if (! f) {
+	perror("open_memstream");
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < rows; i++) {
+	fprintf(f, "%d;1700000000.%06d;192.0.2.%d;%d;%d.%03d;",
+		i, i % 1000000, i % 256, 64 + i % 1400, i % 100, i % 1000);
+	csv_start(f, ';', i % 10 ? "ok" : "timed out, \"no reply\"");
+	csv_append(f, ';', "example.net");
+	csv_end(f);
+    }
+    fclose(f);
+
+    f = fmemopen(data, len, "r");
+    if (! f) {
+	perror("fmemopen");
+	exit(EXIT_FAILURE);
+    }
+    fields = 0;
+    t = now();
+    while (!feof(f)) {
+	s = csv_next(f, ';');
+	if (s) {
+	    fields++;
+	    free(s);
+	}
+    }
+    report("csv-next", fields, now() - t);
+    fclose(f);
+
+    fields = 0;
+    t = now();
+    csv_scan_init(&scan, data, len);
+    while (! csv_scan_eof(&scan)) {
+	n = csv_scan_next(&scan, ';', &field, &flen);
+	if (n > 0) {
+	    fields++;
+	}
+    }
+    csv_scan_done(&scan);
+    report("csv-scan", fields, now() - t);
+
+    free(data);
+}
+
+static const struct {
+    const char *name;
+    void (*func)(void);
+} benchmarks[] = {
+    { "reap",		bench_reap },
+    { "pid-lookup",	bench_pid_lookup },
+    { "spawn",		bench_spawn },
+    { "snapshot",	bench_snapshot },
+    { "queue",		bench_queue },
+    { "csv",		bench_csv },
+    { NULL, NULL }
+};
+
+int main(int argc, char *argv[])
+{
+    int i, j;
+
+    lmap_set_log_handler(vlog);
+
+    for (i = 0; benchmarks[i].name; i++) {
+	if (argc < 2) {
+	    benchmarks[i].func();
+	    continue;
+	}
+	for (j = 1; j < argc; j++) {
+	    if (! strcmp(argv[j], benchmarks[i].name)) {
+		benchmarks[i].func();
+	    }
+	}
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -19,12 +19,16 @@
 #include <stdio.h>
 #include <check.h>
 #include <inttypes.h>
+#include <string.h>
+#include <errno.h>
 
 #include "lmap.h"
 #include "utils.h"
 #include "xml-io.h"
 #include "json-io.h"
 #include "csv.h"
+#include "jsonw.h"
+#include "lmap-io.h"
 
 static const char testdata_dir[] = "test/data";
 
@@ -82,6 +86,22 @@ START_TEST(test_lmap_agent)
     ck_assert_int_eq(lmap_agent_valid(NULL, agent), 1);
     ck_assert_int_eq(lmap_agent_set_controller_timeout(agent, "42"), 0);
     ck_assert_int_eq(agent->controller_timeout, 42);
+    ck_assert_int_eq(lmap_agent_set_max_concurrent_actions(agent, "-1"), -1);
+    ck_assert_int_eq(agent->flags & LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET, 0);
+    ck_assert_int_eq(lmap_agent_set_max_concurrent_actions(agent, "4"), 0);
+    ck_assert_int_eq(agent->max_concurrent_actions, 4);
+    ck_assert_int_eq(agent->flags & LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET,
+		     LMAP_AGENT_FLAG_MAX_CONCURRENT_ACTIONS_SET);
+    ck_assert_int_eq(agent->commit_window, 50);
+    ck_assert_int_eq(lmap_agent_set_durability(agent, "sync"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal durability 'sync'");
+    ck_assert_int_eq(agent->flags & LMAP_AGENT_FLAG_DURABILITY_SET, 0);
+    ck_assert_int_eq(lmap_agent_set_durability(agent, "group"), 0);
+    ck_assert_int_eq(agent->durability, LMAP_AGENT_DURABILITY_GROUP);
+    ck_assert_int_eq(lmap_agent_set_commit_window(agent, "200"), 0);
+    ck_assert_int_eq(agent->commit_window, 200);
+    ck_assert_int_eq(agent->flags & LMAP_AGENT_FLAG_COMMIT_WINDOW_SET,
+		     LMAP_AGENT_FLAG_COMMIT_WINDOW_SET);
     ck_assert_int_eq(lmap_agent_set_group_id(agent, "foo"), 0);
     ck_assert_int_eq(lmap_agent_set_group_id(agent, "bar"), 0);
     ck_assert_str_eq(agent->group_id, "bar");
@@ -355,6 +375,131 @@ START_TEST(test_lmap_event_calendar)
 }
 END_TEST
 
+/*
+ * Verify that lmap_event_calendar_next() finds exactly the points in
+ * time matched by lmap_event_calendar_match() by sweeping the
+ * interval [start, end) in steps of step seconds.
+ */
+
+static void
+calendar_sweep(struct event *event, time_t start, time_t end, time_t step)
+{
+    time_t t, next = 0;
+    int have_next;
+
+    have_next = (lmap_event_calendar_next(event, start - 1, &next) == 0);
+    for (t = start; t < end; t += step) {
+	if (lmap_event_calendar_match(event, &t) == 1) {
+	    ck_assert_int_eq(have_next, 1);
+	    ck_assert_int_eq(next, t);
+	    have_next = (lmap_event_calendar_next(event, t, &next) == 0);
+	}
+    }
+    ck_assert(!have_next || next >= end);
+}
+
+static struct event *
+calendar_new(const char *months[], const char *days_of_month[],
+	     const char *days_of_week[], const char *hours[],
+	     const char *minutes[], const char *seconds[])
+{
+    int i;
+    struct event *event = lmap_event_new();
+
+    ck_assert_int_eq(lmap_event_set_name(event, "calendar"), 0);
+    ck_assert_int_eq(lmap_event_set_type(event, "calendar"), 0);
+    for (i = 0; months[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_month(event, months[i]), 0);
+    }
+    for (i = 0; days_of_month[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_day_of_month(event, days_of_month[i]), 0);
+    }
+    for (i = 0; days_of_week[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_day_of_week(event, days_of_week[i]), 0);
+    }
+    for (i = 0; hours[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_hour(event, hours[i]), 0);
+    }
+    for (i = 0; minutes[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_minute(event, minutes[i]), 0);
+    }
+    for (i = 0; seconds[i]; i++) {
+	ck_assert_int_eq(lmap_event_add_second(event, seconds[i]), 0);
+    }
+    ck_assert_int_eq(lmap_event_valid(NULL, event), 1);
+    return event;
+}
+
+START_TEST(test_lmap_event_calendar_next)
+{
+    const char *tz[] = {
+	"UTC+00:00",
+	"CET-1CEST,M3.5.0,M10.5.0/3",
+	"XYZ+03:45",
+    };
+    const char *any[] = { "*", NULL };
+    const char *zero[] = { "0", NULL };
+    const time_t start = 1451606400;		/* 2016-01-01T00:00:00Z */
+    const time_t end = start + 3 * 365 * 86400;
+    struct event *event;
+    time_t next;
+
+    setenv("TZ", tz[_i], 1);
+    tzset();
+
+    /* every day at 04:30:00 */
+    event = calendar_new(any, any, any, (const char *[]) { "4", NULL },
+			 (const char *[]) { "30", NULL }, zero);
+    calendar_sweep(event, start, end, 60);
+    lmap_event_free(event);
+
+    /* mondays and fridays at 00:00, 00:15, 12:00 and 12:15 */
+    event = calendar_new(any, any,
+			 (const char *[]) { "monday", "friday", NULL },
+			 (const char *[]) { "0", "12", NULL },
+			 (const char *[]) { "0", "15", NULL }, zero);
+    calendar_sweep(event, start, end, 60);
+    lmap_event_free(event);
+
+    /* leap days only */
+    event = calendar_new((const char *[]) { "february", NULL },
+			 (const char *[]) { "29", NULL }, any,
+			 (const char *[]) { "23", NULL },
+			 (const char *[]) { "59", NULL }, zero);
+    calendar_sweep(event, start, end, 60);
+    lmap_event_free(event);
+
+    /* every quarter past and quarter to on the 31st of a month */
+    event = calendar_new(any, (const char *[]) { "31", NULL }, any, any,
+			 (const char *[]) { "15", "45", NULL }, zero);
+    calendar_sweep(event, start, end, 60);
+    lmap_event_free(event);
+
+    /* inside the daylight saving time transitions of most of europe */
+    event = calendar_new((const char *[]) { "march", "october", NULL }, any,
+			 (const char *[]) { "sunday", NULL },
+			 (const char *[]) { "2", NULL }, any,
+			 (const char *[]) { "30", NULL });
+    calendar_sweep(event, start + 30, end, 60);
+    lmap_event_free(event);
+
+    /* second resolution */
+    event = calendar_new(any, any, any, any, any,
+			 (const char *[]) { "5", "17", "59", NULL });
+    calendar_sweep(event, start, start + 2 * 86400, 1);
+    lmap_event_free(event);
+
+    /* never matches */
+    event = calendar_new((const char *[]) { "february", NULL },
+			 (const char *[]) { "30", NULL }, any, any, any, any);
+    ck_assert_int_eq(lmap_event_calendar_next(event, start, &next), -1);
+    lmap_event_free(event);
+
+    setenv("TZ", "UTC+00:00", 1);
+    tzset();
+}
+END_TEST
+
 START_TEST(test_lmap_event_one_off)
 {
     struct event *event = lmap_event_new();
@@ -451,6 +596,14 @@ START_TEST(test_lmap_schedule)
     ck_assert_int_eq(schedule->mode, LMAP_SCHEDULE_EXEC_MODE_PARALLEL);
     ck_assert_int_eq(lmap_schedule_set_exec_mode(schedule, "pipelined"), 0);
     ck_assert_int_eq(schedule->mode, LMAP_SCHEDULE_EXEC_MODE_PIPELINED);
+    ck_assert_int_eq(schedule->priority, 0);
+    ck_assert_int_eq(lmap_schedule_set_priority(schedule, "-5"), 0);
+    ck_assert_int_eq(schedule->priority, -5);
+    ck_assert_int_eq(schedule->flags & LMAP_SCHEDULE_FLAG_PRIORITY_SET,
+		     LMAP_SCHEDULE_FLAG_PRIORITY_SET);
+    ck_assert_int_eq(lmap_schedule_set_stagger(schedule, "foo"), -1);
+    ck_assert_int_eq(lmap_schedule_set_stagger(schedule, "250"), 0);
+    ck_assert_int_eq(schedule->stagger, 250);
     ck_assert_int_eq(lmap_schedule_add_tag(schedule, "a"), 0);
     ck_assert_int_eq(lmap_schedule_add_tag(schedule, "b"), 0);
     ck_assert_int_eq(lmap_schedule_add_tag(schedule, "b"), -1);
@@ -461,6 +614,29 @@ START_TEST(test_lmap_schedule)
     for (c = 0, tag = schedule->tags; tag; c++, tag = tag->next) {
     }
     ck_assert_int_eq(c, 3);
+    ck_assert_int_eq(lmap_schedule_set_incoming_max_bytes(schedule, "10k"), -1);
+    ck_assert_int_eq(lmap_schedule_set_incoming_max_bytes(schedule, "1048576"), 0);
+    ck_assert_uint_eq(schedule->incoming_max_bytes, 1048576);
+    ck_assert_int_eq(lmap_schedule_set_incoming_max_files(schedule, "100"), 0);
+    ck_assert_uint_eq(schedule->incoming_max_files, 100);
+    ck_assert_int_eq(lmap_schedule_set_incoming_overflow(schedule, "oldest"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal incoming overflow policy 'oldest'");
+    ck_assert(!(schedule->flags & LMAP_SCHEDULE_FLAG_OVERFLOW_SET));
+    ck_assert_int_eq(lmap_schedule_set_incoming_overflow(schedule, "refuse"), 0);
+    ck_assert(schedule->flags & LMAP_SCHEDULE_FLAG_OVERFLOW_SET);
+    ck_assert_int_eq(schedule->incoming_overflow, LMAP_SCHEDULE_OVERFLOW_REFUSE);
+    ck_assert_int_eq(lmap_schedule_set_incoming_compression(schedule, "zstd"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal incoming compression 'zstd'");
+    ck_assert(!(schedule->flags & LMAP_SCHEDULE_FLAG_COMPRESSION_SET));
+    ck_assert_int_eq(lmap_schedule_set_incoming_compression(schedule, "none"), 0);
+    ck_assert(schedule->flags & LMAP_SCHEDULE_FLAG_COMPRESSION_SET);
+    ck_assert_int_eq(schedule->incoming_compression, LMAP_SCHEDULE_COMPRESSION_NONE);
+    ck_assert_int_eq(lmap_schedule_set_incoming_format(schedule, "segments"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal incoming format 'segments'");
+    ck_assert(!(schedule->flags & LMAP_SCHEDULE_FLAG_FORMAT_SET));
+    ck_assert_int_eq(lmap_schedule_set_incoming_format(schedule, "log"), 0);
+    ck_assert(schedule->flags & LMAP_SCHEDULE_FLAG_FORMAT_SET);
+    ck_assert_int_eq(schedule->incoming_format, LMAP_SCHEDULE_FORMAT_LOG);
 
     lmap_schedule_free(schedule);
 }
@@ -494,11 +670,53 @@ START_TEST(test_lmap_action)
     for (c = 0, tag = action->tags; tag; c++, tag = tag->next) {
     }
     ck_assert_int_eq(c, 3);
+    ck_assert_int_eq(lmap_action_set_timeout(action, "10s"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal uint32 value '10s'");
+    ck_assert(!(action->flags & LMAP_ACTION_FLAG_TIMEOUT_SET));
+    ck_assert_int_eq(lmap_action_set_timeout(action, "10"), 0);
+    ck_assert(action->flags & LMAP_ACTION_FLAG_TIMEOUT_SET);
+    ck_assert_uint_eq(action->timeout, 10);
+    ck_assert_int_eq(action->output_fd, -1);
+    ck_assert_int_eq(lmap_action_set_output_memory_limit(action, "10k"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal uint64 value '10k'");
+    ck_assert_int_eq(lmap_action_set_output_memory_limit(action, "65536"), 0);
+    ck_assert_uint_eq(action->output_memory_limit, 65536);
 
     lmap_action_free(action);
 }
 END_TEST
 
+START_TEST(test_lmap_usage)
+{
+    struct usage total, usage;
+
+    memset(&total, 0, sizeof(total));
+    memset(&usage, 0, sizeof(usage));
+    ck_assert_int_eq(lmap_usage_isset(&total), 0);
+    ck_assert_int_eq(lmap_usage_set_user_time(&usage, "1500"), 0);
+    ck_assert_int_eq(lmap_usage_set_system_time(&usage, "1s"), -1);
+    ck_assert_str_eq(last_error_msg, "illegal uint64 value '1s'");
+    ck_assert_int_eq(lmap_usage_set_system_time(&usage, "500"), 0);
+    ck_assert_int_eq(lmap_usage_set_max_rss(&usage, "2048"), 0);
+    ck_assert_int_eq(lmap_usage_set_block_input(&usage, "8"), 0);
+    ck_assert_int_eq(lmap_usage_set_block_output(&usage, "16"), 0);
+    ck_assert_int_eq(lmap_usage_set_voluntary_switches(&usage, "3"), 0);
+    ck_assert_int_eq(lmap_usage_set_involuntary_switches(&usage, "4"), 0);
+    ck_assert_int_eq(lmap_usage_isset(&usage), 1);
+
+    lmap_usage_add(&total, &usage);
+    usage.max_rss = 1024;
+    lmap_usage_add(&total, &usage);
+    ck_assert_uint_eq(total.user_time, 3000);
+    ck_assert_uint_eq(total.system_time, 1000);
+    ck_assert_uint_eq(total.max_rss, 2048);
+    ck_assert_uint_eq(total.block_input, 16);
+    ck_assert_uint_eq(total.block_output, 32);
+    ck_assert_uint_eq(total.voluntary_switches, 6);
+    ck_assert_uint_eq(total.involuntary_switches, 8);
+}
+END_TEST
+
 START_TEST(test_lmap_lmap)
 {
     struct lmap *lmap;
@@ -531,6 +749,215 @@ START_TEST(test_lmap_lmap)
 }
 END_TEST
 
+START_TEST(test_lmap_link_events)
+{
+    int i;
+    struct lmap *lmap;
+    struct event *ev_a, *ev_b, *ev_c;
+    struct schedule *sched[3];
+    struct supp *supp;
+    const char *names[] = { "s1", "s2", "s3" };
+
+    lmap = lmap_new();
+    ck_assert_ptr_ne(lmap, NULL);
+
+    ev_a = lmap_event_new();
+    ck_assert_int_eq(lmap_event_set_name(ev_a, "a"), 0);
+    ck_assert_int_eq(lmap_add_event(lmap, ev_a), 0);
+    ev_b = lmap_event_new();
+    ck_assert_int_eq(lmap_event_set_name(ev_b, "b"), 0);
+    ck_assert_int_eq(lmap_add_event(lmap, ev_b), 0);
+    ev_c = lmap_event_new();
+    ck_assert_int_eq(lmap_event_set_name(ev_c, "c"), 0);
+    ck_assert_int_eq(lmap_add_event(lmap, ev_c), 0);
+
+    for (i = 0; i < 3; i++) {
+	sched[i] = lmap_schedule_new();
+	ck_assert_int_eq(lmap_schedule_set_name(sched[i], names[i]), 0);
+	ck_assert_int_eq(lmap_schedule_set_start(sched[i], "a"), 0);
+	ck_assert_int_eq(lmap_add_schedule(lmap, sched[i]), 0);
+    }
+    ck_assert_int_eq(lmap_schedule_set_end(sched[1], "b"), 0);
+
+    supp = lmap_supp_new();
+    ck_assert_int_eq(lmap_supp_set_name(supp, "p"), 0);
+    ck_assert_int_eq(lmap_supp_set_start(supp, "b"), 0);
+    ck_assert_int_eq(lmap_supp_set_end(supp, "undefined"), 0);
+    ck_assert_int_eq(lmap_add_supp(lmap, supp), 0);
+
+    /* linking twice must replace, not append */
+    ck_assert_int_eq(lmap_link_events(lmap), 0);
+    ck_assert_int_eq(lmap_link_events(lmap), 0);
+
+    for (i = 0; i < 3; i++) {
+	ck_assert_ptr_eq(ev_a->start_schedules[i], sched[i]);
+    }
+    ck_assert_ptr_eq(ev_a->start_schedules[3], NULL);
+    ck_assert_ptr_eq(ev_a->end_schedules[0], NULL);
+    ck_assert_ptr_eq(ev_a->start_supps[0], NULL);
+    ck_assert_ptr_eq(ev_b->start_schedules[0], NULL);
+    ck_assert_ptr_eq(ev_b->end_schedules[0], sched[1]);
+    ck_assert_ptr_eq(ev_b->end_schedules[1], NULL);
+    ck_assert_ptr_eq(ev_b->start_supps[0], supp);
+    ck_assert_ptr_eq(ev_b->start_supps[1], NULL);
+    ck_assert_ptr_eq(ev_b->end_supps[0], NULL);
+    ck_assert_ptr_eq(ev_c->start_schedules[0], NULL);
+    ck_assert_ptr_eq(ev_c->end_schedules[0], NULL);
+    ck_assert_ptr_eq(ev_c->start_supps[0], NULL);
+    ck_assert_ptr_eq(ev_c->end_supps[0], NULL);
+
+    lmap_free(lmap);
+}
+END_TEST
+
+START_TEST(test_lmap_link)
+{
+    struct lmap *lmap;
+    struct task *task, *cap;
+    struct option *option;
+    struct schedule *sched, *sink;
+    struct action *act_a, *act_b;
+
+    lmap = lmap_new();
+    ck_assert_ptr_ne(lmap, NULL);
+    lmap->capabilities = lmap_capability_new();
+    ck_assert_ptr_ne(lmap->capabilities, NULL);
+
+    cap = lmap_task_new();
+    ck_assert_int_eq(lmap_task_set_name(cap, "cap"), 0);
+    ck_assert_int_eq(lmap_task_set_program(cap, "/bin/echo"), 0);
+    ck_assert_int_eq(lmap_capability_add_task(lmap->capabilities, cap), 0);
+
+    task = lmap_task_new();
+    ck_assert_int_eq(lmap_task_set_name(task, "echo"), 0);
+    ck_assert_int_eq(lmap_task_set_program(task, "/bin/echo"), 0);
+    option = lmap_option_new();
+    ck_assert_int_eq(lmap_option_set_id(option, "o1"), 0);
+    ck_assert_int_eq(lmap_option_set_name(option, "-n"), 0);
+    ck_assert_int_eq(lmap_task_add_option(task, option), 0);
+    ck_assert_int_eq(lmap_add_task(lmap, task), 0);
+
+    task = lmap_task_new();
+    ck_assert_int_eq(lmap_task_set_name(task, "evil"), 0);
+    ck_assert_int_eq(lmap_task_set_program(task, "/bin/rm"), 0);
+    ck_assert_int_eq(lmap_add_task(lmap, task), 0);
+
+    sink = lmap_schedule_new();
+    ck_assert_int_eq(lmap_schedule_set_name(sink, "sink"), 0);
+    ck_assert_int_eq(lmap_add_schedule(lmap, sink), 0);
+
+    sched = lmap_schedule_new();
+    ck_assert_int_eq(lmap_schedule_set_name(sched, "sched"), 0);
+    act_a = lmap_action_new();
+    ck_assert_int_eq(lmap_action_set_name(act_a, "a"), 0);
+    ck_assert_int_eq(lmap_action_set_task(act_a, "echo"), 0);
+    ck_assert_int_eq(lmap_action_add_destination(act_a, "sink"), 0);
+    ck_assert_int_eq(lmap_action_add_destination(act_a, "nowhere"), 0);
+    option = lmap_option_new();
+    ck_assert_int_eq(lmap_option_set_id(option, "o2"), 0);
+    ck_assert_int_eq(lmap_option_set_name(option, "--foo"), 0);
+    ck_assert_int_eq(lmap_option_set_value(option, "bar"), 0);
+    ck_assert_int_eq(lmap_action_add_option(act_a, option), 0);
+    ck_assert_int_eq(lmap_schedule_add_action(sched, act_a), 0);
+    act_b = lmap_action_new();
+    ck_assert_int_eq(lmap_action_set_name(act_b, "b"), 0);
+    ck_assert_int_eq(lmap_action_set_task(act_b, "evil"), 0);
+    ck_assert_int_eq(lmap_schedule_add_action(sched, act_b), 0);
+    ck_assert_int_eq(lmap_add_schedule(lmap, sched), 0);
+
+    ck_assert_int_eq(lmap_link(lmap), 0);
+    ck_assert_str_eq(last_error_msg, "task 'evil' does not match capabilities");
+
+    ck_assert_ptr_eq(act_a->linked_task, lmap_find_task(lmap, "echo"));
+    ck_assert_ptr_eq(act_a->capability, cap);
+    ck_assert_ptr_eq(act_a->destination_schedules[0], sink);
+    ck_assert_ptr_eq(act_a->destination_schedules[1], NULL);
+    ck_assert_ptr_ne(act_a->argv, NULL);
+    ck_assert_str_eq(act_a->argv[0], "/bin/echo");
+    ck_assert_str_eq(act_a->argv[1], "-n");
+    ck_assert_str_eq(act_a->argv[2], "--foo");
+    ck_assert_str_eq(act_a->argv[3], "bar");
+    ck_assert_ptr_eq(act_a->argv[4], NULL);
+
+    ck_assert_ptr_ne(act_b->linked_task, NULL);
+    ck_assert_ptr_eq(act_b->capability, NULL);
+    ck_assert_ptr_eq(act_b->argv, NULL);
+
+    lmap_free(lmap);
+}
+END_TEST
+
+START_TEST(test_lmap_equal)
+{
+    int i;
+    struct lmap *lmap;
+    struct schedule *sched[2];
+    struct action *action[2];
+    struct supp *supp[2];
+    struct event *event[2];
+
+    for (i = 0; i < 2; i++) {
+	sched[i] = lmap_schedule_new();
+	ck_assert_int_eq(lmap_schedule_set_name(sched[i], "s"), 0);
+	ck_assert_int_eq(lmap_schedule_set_start(sched[i], "now"), 0);
+	action[i] = lmap_action_new();
+	ck_assert_int_eq(lmap_action_set_name(action[i], "a"), 0);
+	ck_assert_int_eq(lmap_action_set_task(action[i], "echo"), 0);
+	ck_assert_int_eq(lmap_schedule_add_action(sched[i], action[i]), 0);
+	supp[i] = lmap_supp_new();
+	ck_assert_int_eq(lmap_supp_set_name(supp[i], "p"), 0);
+	ck_assert_int_eq(lmap_supp_add_match(supp[i], "*"), 0);
+	event[i] = lmap_event_new();
+	ck_assert_int_eq(lmap_event_set_name(event[i], "e"), 0);
+	ck_assert_int_eq(lmap_event_set_type(event[i], "periodic"), 0);
+	ck_assert_int_eq(lmap_event_set_interval(event[i], "60"), 0);
+    }
+
+    /* state does not matter */
+    sched[0]->cnt_invocations = 3;
+    sched[0]->state = LMAP_SCHEDULE_STATE_RUNNING;
+    sched[0]->flags |= LMAP_SCHEDULE_FLAG_STARTED;
+    action[0]->cnt_failures = 1;
+    action[0]->flags |= LMAP_ACTION_FLAG_QUEUED;
+    supp[0]->state = LMAP_SUPP_STATE_ACTIVE;
+    ck_assert_int_eq(lmap_schedule_equal(sched[0], sched[1]), 1);
+    ck_assert_int_eq(lmap_supp_equal(supp[0], supp[1]), 1);
+    ck_assert_int_eq(lmap_event_equal(event[0], event[1]), 1);
+
+    ck_assert_int_eq(lmap_action_set_timeout(action[1], "10"), 0);
+    ck_assert_int_eq(lmap_schedule_equal(sched[0], sched[1]), 0);
+    ck_assert_int_eq(lmap_action_set_timeout(action[0], "10"), 0);
+    ck_assert_int_eq(lmap_schedule_equal(sched[0], sched[1]), 1);
+    ck_assert_int_eq(lmap_schedule_add_tag(sched[0], "x"), 0);
+    ck_assert_int_eq(lmap_schedule_equal(sched[0], sched[1]), 0);
+    ck_assert_int_eq(lmap_supp_add_match(supp[1], "x"), 0);
+    ck_assert_int_eq(lmap_supp_equal(supp[0], supp[1]), 0);
+    ck_assert_int_eq(lmap_event_set_interval(event[1], "30"), 0);
+    ck_assert_int_eq(lmap_event_equal(event[0], event[1]), 0);
+
+    lmap = lmap_new();
+    ck_assert_ptr_ne(lmap, NULL);
+    ck_assert_int_eq(lmap_add_schedule(lmap, sched[0]), 0);
+    ck_assert_int_eq(lmap_add_supp(lmap, supp[0]), 0);
+    ck_assert_int_eq(lmap_add_event(lmap, event[0]), 0);
+    ck_assert_ptr_eq(lmap_find_supp(lmap, "p"), supp[0]);
+    ck_assert_int_eq(lmap_remove_schedule(lmap, sched[1]), -1);
+    ck_assert_int_eq(lmap_remove_schedule(lmap, sched[0]), 0);
+    ck_assert_int_eq(lmap_remove_supp(lmap, supp[0]), 0);
+    ck_assert_int_eq(lmap_remove_event(lmap, event[0]), 0);
+    ck_assert_ptr_eq(lmap->schedules, NULL);
+    ck_assert_ptr_eq(lmap_find_supp(lmap, "p"), NULL);
+    ck_assert_ptr_eq(lmap->events, NULL);
+    lmap_free(lmap);
+
+    for (i = 0; i < 2; i++) {
+	lmap_schedule_free(sched[i]);
+	lmap_supp_free(supp[i]);
+	lmap_event_free(event[i]);
+    }
+}
+END_TEST
+
 START_TEST(test_lmap_val)
 {
     struct value *val = lmap_value_new();
@@ -1912,6 +2339,17 @@ START_TEST(test_parser_state_agent)
 	"      <lmapc:agent-id>550e8400-e29b-41d4-a716-446655440000</lmapc:agent-id>"
 	"      <lmapc:agent-id>550e8400-e29b-41d4-a716-446655440000</lmapc:agent-id>"
 	"      <lmapc:last-started>2016-02-21T22:13:40+01:00</lmapc:last-started>"
+	"      <lmapc:admission-queue-depth>2</lmapc:admission-queue-depth>"
+	"      <lmapc:admissions>7</lmapc:admissions>"
+	"      <lmapc:admission-wait>1500</lmapc:admission-wait>"
+	"      <lmapc:admission-max-wait>900</lmapc:admission-max-wait>"
+	"      <lmapc:event-loop-lag>120</lmapc:event-loop-lag>"
+	"      <lmapc:event-loop-max-lag>250000</lmapc:event-loop-max-lag>"
+	"      <lmapc:commits>3</lmapc:commits>"
+	"      <lmapc:commit-latency>800</lmapc:commit-latency>"
+	"      <lmapc:commit-max-latency>4100</lmapc:commit-max-latency>"
+	"      <lmapc:commit-batch>2</lmapc:commit-batch>"
+	"      <lmapc:commit-max-batch>5</lmapc:commit-max-batch>"
         "    </lmapc:agent>"
         "  </lmapc:lmap>"
         "</data>";
@@ -1922,6 +2360,17 @@ START_TEST(test_parser_state_agent)
         "    <lmapc:agent>\n"
 	"      <lmapc:agent-id>550e8400-e29b-41d4-a716-446655440000</lmapc:agent-id>\n"
 	"      <lmapc:last-started>2016-02-21T21:13:40+00:00</lmapc:last-started>\n"
+	"      <lmapc:admission-queue-depth>2</lmapc:admission-queue-depth>\n"
+	"      <lmapc:admissions>7</lmapc:admissions>\n"
+	"      <lmapc:admission-wait>1500</lmapc:admission-wait>\n"
+	"      <lmapc:admission-max-wait>900</lmapc:admission-max-wait>\n"
+	"      <lmapc:event-loop-lag>120</lmapc:event-loop-lag>\n"
+	"      <lmapc:event-loop-max-lag>250000</lmapc:event-loop-max-lag>\n"
+	"      <lmapc:commits>3</lmapc:commits>\n"
+	"      <lmapc:commit-latency>800</lmapc:commit-latency>\n"
+	"      <lmapc:commit-max-latency>4100</lmapc:commit-max-latency>\n"
+	"      <lmapc:commit-batch>2</lmapc:commit-batch>\n"
+	"      <lmapc:commit-max-batch>5</lmapc:commit-max-batch>\n"
         "    </lmapc:agent>\n"
         "  </lmapc:lmap>\n"
         "</data>\n";
@@ -1930,7 +2379,18 @@ START_TEST(test_parser_state_agent)
 	"  \"ietf-lmap-control:lmap\":{\n"
 	"    \"agent\":{\n"
 	"      \"agent-id\":\"550e8400-e29b-41d4-a716-446655440000\",\n"
-	"      \"last-started\":\"2016-02-21T21:13:40+00:00\"\n"
+	"      \"last-started\":\"2016-02-21T21:13:40+00:00\",\n"
+	"      \"admission-queue-depth\":2,\n"
+	"      \"admissions\":7,\n"
+	"      \"admission-wait\":\"1500\",\n"
+	"      \"admission-max-wait\":\"900\",\n"
+	"      \"event-loop-lag\":\"120\",\n"
+	"      \"event-loop-max-lag\":\"250000\",\n"
+	"      \"commits\":3,\n"
+	"      \"commit-latency\":\"800\",\n"
+	"      \"commit-max-latency\":\"4100\",\n"
+	"      \"commit-batch\":2,\n"
+	"      \"commit-max-batch\":5\n"
 	"    }\n"
 	"  }\n"
 	"}";
@@ -2230,6 +2690,272 @@ START_TEST(test_parser_state_actions)
 }
 END_TEST
 
+START_TEST(test_parser_state_usage)
+{
+    const char *a =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">"
+        "  <lmapc:lmap>"
+        "    <lmapc:schedules>"
+        "      <lmapc:schedule>"
+        "        <lmapc:name>demo</lmapc:name>"
+        "        <lmapc:resource-usage>"
+        "          <lmapc:user-time>2500</lmapc:user-time>"
+        "          <lmapc:max-rss>4096</lmapc:max-rss>"
+        "        </lmapc:resource-usage>"
+        "        <lmapc:action>"
+        "          <lmapc:name>mtr</lmapc:name>"
+        "          <lmapc:last-resource-usage>"
+        "            <lmapc:user-time>1200</lmapc:user-time>"
+        "            <lmapc:system-time>300</lmapc:system-time>"
+        "            <lmapc:max-rss>4096</lmapc:max-rss>"
+        "            <lmapc:block-input>1</lmapc:block-input>"
+        "            <lmapc:block-output>2</lmapc:block-output>"
+        "            <lmapc:voluntary-context-switches>3</lmapc:voluntary-context-switches>"
+        "            <lmapc:involuntary-context-switches>4</lmapc:involuntary-context-switches>"
+        "          </lmapc:last-resource-usage>"
+        "        </lmapc:action>"
+	"      </lmapc:schedule>"
+	"    </lmapc:schedules>"
+        "  </lmapc:lmap>"
+        "</data>";
+    const char *x =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">\n"
+        "  <lmapc:lmap>\n"
+        "    <lmapc:schedules>\n"
+        "      <lmapc:schedule>\n"
+        "        <lmapc:name>demo</lmapc:name>\n"
+        "        <lmapc:state>enabled</lmapc:state>\n"
+        "        <lmapc:storage>0</lmapc:storage>\n"
+        "        <lmapc:invocations>0</lmapc:invocations>\n"
+        "        <lmapc:suppressions>0</lmapc:suppressions>\n"
+        "        <lmapc:overlaps>0</lmapc:overlaps>\n"
+        "        <lmapc:failures>0</lmapc:failures>\n"
+        "        <lmapc:resource-usage>\n"
+        "          <lmapc:user-time>2500</lmapc:user-time>\n"
+        "          <lmapc:system-time>0</lmapc:system-time>\n"
+        "          <lmapc:max-rss>4096</lmapc:max-rss>\n"
+        "          <lmapc:block-input>0</lmapc:block-input>\n"
+        "          <lmapc:block-output>0</lmapc:block-output>\n"
+        "          <lmapc:voluntary-context-switches>0</lmapc:voluntary-context-switches>\n"
+        "          <lmapc:involuntary-context-switches>0</lmapc:involuntary-context-switches>\n"
+        "        </lmapc:resource-usage>\n"
+	"        <lmapc:action>\n"
+        "          <lmapc:name>mtr</lmapc:name>\n"
+        "          <lmapc:state>enabled</lmapc:state>\n"
+        "          <lmapc:storage>0</lmapc:storage>\n"
+        "          <lmapc:invocations>0</lmapc:invocations>\n"
+        "          <lmapc:suppressions>0</lmapc:suppressions>\n"
+        "          <lmapc:overlaps>0</lmapc:overlaps>\n"
+        "          <lmapc:failures>0</lmapc:failures>\n"
+        "          <lmapc:last-resource-usage>\n"
+        "            <lmapc:user-time>1200</lmapc:user-time>\n"
+        "            <lmapc:system-time>300</lmapc:system-time>\n"
+        "            <lmapc:max-rss>4096</lmapc:max-rss>\n"
+        "            <lmapc:block-input>1</lmapc:block-input>\n"
+        "            <lmapc:block-output>2</lmapc:block-output>\n"
+        "            <lmapc:voluntary-context-switches>3</lmapc:voluntary-context-switches>\n"
+        "            <lmapc:involuntary-context-switches>4</lmapc:involuntary-context-switches>\n"
+        "          </lmapc:last-resource-usage>\n"
+        "        </lmapc:action>\n"
+	"      </lmapc:schedule>\n"
+	"    </lmapc:schedules>\n"
+        "  </lmapc:lmap>\n"
+        "</data>\n";
+    const char *ja =
+	"{\n"
+	"  \"ietf-lmap-control:lmap\":{\n"
+	"    \"schedules\":{\n"
+	"      \"schedule\":[\n"
+	"        {\n"
+	"          \"name\":\"demo\",\n"
+	"          \"state\":\"enabled\",\n"
+	"          \"storage\":\"0\",\n"
+	"          \"invocations\":0,\n"
+	"          \"suppressions\":0,\n"
+	"          \"overlaps\":0,\n"
+	"          \"failures\":0,\n"
+	"          \"resource-usage\":{\n"
+	"            \"user-time\":\"2500\",\n"
+	"            \"system-time\":\"0\",\n"
+	"            \"max-rss\":\"4096\",\n"
+	"            \"block-input\":\"0\",\n"
+	"            \"block-output\":\"0\",\n"
+	"            \"voluntary-context-switches\":\"0\",\n"
+	"            \"involuntary-context-switches\":\"0\"\n"
+	"          },\n"
+	"          \"action\":[\n"
+	"            {\n"
+	"              \"name\":\"mtr\",\n"
+	"              \"state\":\"enabled\",\n"
+	"              \"storage\":\"0\",\n"
+	"              \"invocations\":0,\n"
+	"              \"suppressions\":0,\n"
+	"              \"overlaps\":0,\n"
+	"              \"failures\":0,\n"
+	"              \"last-resource-usage\":{\n"
+	"                \"user-time\":\"1200\",\n"
+	"                \"system-time\":\"300\",\n"
+	"                \"max-rss\":\"4096\",\n"
+	"                \"block-input\":\"1\",\n"
+	"                \"block-output\":\"2\",\n"
+	"                \"voluntary-context-switches\":\"3\",\n"
+	"                \"involuntary-context-switches\":\"4\"\n"
+	"              }\n"
+	"            }\n"
+	"          ]\n"
+	"        }\n"
+	"      ]\n"
+	"    }\n"
+	"  }\n"
+	"}";
+
+    xx_test_roundtrip_state(a, x, ja, ja);
+}
+END_TEST
+
+START_TEST(test_parser_state_timeouts)
+{
+    const char *a =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">"
+        "  <lmapc:lmap>"
+        "    <lmapc:schedules>"
+        "      <lmapc:schedule>"
+        "        <lmapc:name>demo</lmapc:name>"
+        "        <lmapc:timeouts>2</lmapc:timeouts>"
+        "        <lmapc:action>"
+        "          <lmapc:name>mtr</lmapc:name>"
+        "          <lmapc:timeouts>1</lmapc:timeouts>"
+        "        </lmapc:action>"
+	"      </lmapc:schedule>"
+	"    </lmapc:schedules>"
+        "  </lmapc:lmap>"
+        "</data>";
+    const char *x =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">\n"
+        "  <lmapc:lmap>\n"
+        "    <lmapc:schedules>\n"
+        "      <lmapc:schedule>\n"
+        "        <lmapc:name>demo</lmapc:name>\n"
+        "        <lmapc:state>enabled</lmapc:state>\n"
+        "        <lmapc:storage>0</lmapc:storage>\n"
+        "        <lmapc:invocations>0</lmapc:invocations>\n"
+        "        <lmapc:suppressions>0</lmapc:suppressions>\n"
+        "        <lmapc:overlaps>0</lmapc:overlaps>\n"
+        "        <lmapc:failures>0</lmapc:failures>\n"
+        "        <lmapc:timeouts>2</lmapc:timeouts>\n"
+	"        <lmapc:action>\n"
+        "          <lmapc:name>mtr</lmapc:name>\n"
+        "          <lmapc:state>enabled</lmapc:state>\n"
+        "          <lmapc:storage>0</lmapc:storage>\n"
+        "          <lmapc:invocations>0</lmapc:invocations>\n"
+        "          <lmapc:suppressions>0</lmapc:suppressions>\n"
+        "          <lmapc:overlaps>0</lmapc:overlaps>\n"
+        "          <lmapc:failures>0</lmapc:failures>\n"
+        "          <lmapc:timeouts>1</lmapc:timeouts>\n"
+        "        </lmapc:action>\n"
+	"      </lmapc:schedule>\n"
+	"    </lmapc:schedules>\n"
+        "  </lmapc:lmap>\n"
+        "</data>\n";
+    const char *ja =
+	"{\n"
+	"  \"ietf-lmap-control:lmap\":{\n"
+	"    \"schedules\":{\n"
+	"      \"schedule\":[\n"
+	"        {\n"
+	"          \"name\":\"demo\",\n"
+	"          \"state\":\"enabled\",\n"
+	"          \"storage\":\"0\",\n"
+	"          \"invocations\":0,\n"
+	"          \"suppressions\":0,\n"
+	"          \"overlaps\":0,\n"
+	"          \"failures\":0,\n"
+	"          \"timeouts\":2,\n"
+	"          \"action\":[\n"
+	"            {\n"
+	"              \"name\":\"mtr\",\n"
+	"              \"state\":\"enabled\",\n"
+	"              \"storage\":\"0\",\n"
+	"              \"invocations\":0,\n"
+	"              \"suppressions\":0,\n"
+	"              \"overlaps\":0,\n"
+	"              \"failures\":0,\n"
+	"              \"timeouts\":1\n"
+	"            }\n"
+	"          ]\n"
+	"        }\n"
+	"      ]\n"
+	"    }\n"
+	"  }\n"
+	"}";
+
+    xx_test_roundtrip_state(a, x, ja, ja);
+}
+END_TEST
+
+START_TEST(test_parser_state_quota)
+{
+    const char *a =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">"
+        "  <lmapc:lmap>"
+        "    <lmapc:schedules>"
+        "      <lmapc:schedule>"
+        "        <lmapc:name>demo</lmapc:name>"
+        "        <lmapc:incoming-quota-hits>3</lmapc:incoming-quota-hits>"
+        "        <lmapc:incoming-evicted-bytes>8192</lmapc:incoming-evicted-bytes>"
+	"      </lmapc:schedule>"
+	"    </lmapc:schedules>"
+        "  </lmapc:lmap>"
+        "</data>";
+    const char *x =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<data xmlns:lmapc=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">\n"
+        "  <lmapc:lmap>\n"
+        "    <lmapc:schedules>\n"
+        "      <lmapc:schedule>\n"
+        "        <lmapc:name>demo</lmapc:name>\n"
+        "        <lmapc:state>enabled</lmapc:state>\n"
+        "        <lmapc:storage>0</lmapc:storage>\n"
+        "        <lmapc:invocations>0</lmapc:invocations>\n"
+        "        <lmapc:suppressions>0</lmapc:suppressions>\n"
+        "        <lmapc:overlaps>0</lmapc:overlaps>\n"
+        "        <lmapc:failures>0</lmapc:failures>\n"
+        "        <lmapc:incoming-quota-hits>3</lmapc:incoming-quota-hits>\n"
+        "        <lmapc:incoming-evicted-bytes>8192</lmapc:incoming-evicted-bytes>\n"
+	"      </lmapc:schedule>\n"
+	"    </lmapc:schedules>\n"
+        "  </lmapc:lmap>\n"
+        "</data>\n";
+    const char *ja =
+	"{\n"
+	"  \"ietf-lmap-control:lmap\":{\n"
+	"    \"schedules\":{\n"
+	"      \"schedule\":[\n"
+	"        {\n"
+	"          \"name\":\"demo\",\n"
+	"          \"state\":\"enabled\",\n"
+	"          \"storage\":\"0\",\n"
+	"          \"invocations\":0,\n"
+	"          \"suppressions\":0,\n"
+	"          \"overlaps\":0,\n"
+	"          \"failures\":0,\n"
+	"          \"incoming-quota-hits\":3,\n"
+	"          \"incoming-evicted-bytes\":\"8192\"\n"
+	"        }\n"
+	"      ]\n"
+	"    }\n"
+	"  }\n"
+	"}";
+
+    xx_test_roundtrip_state(a, x, ja, ja);
+}
+END_TEST
+
 START_TEST(test_parser_report)
 {
     const char *a =
@@ -2600,6 +3326,240 @@ START_TEST(test_csv_key_value)
 }
 END_TEST
 
+/*
+ * Renders the fields of a CSV buffer, '|' marks a missing field. The
+ * trailing ones are dropped since a FILE only detects the end of the
+ * data when reading past it.
+ */
+
+static char *
+csv_render_trim(char *buf)
+{
+    size_t len = strlen(buf);
+
+    while (len > 0 && buf[len-1] == '|') {
+	buf[--len] = 0;
+    }
+    return buf;
+}
+
+static char *
+csv_render_next(const char *data, const char delimiter)
+{
+    FILE *f, *out;
+    char *buf = NULL, *s;
+    size_t len = 0;
+
+    f = fmemopen((void *) data, strlen(data), "r");
+    ck_assert_ptr_ne(f, NULL);
+    out = open_memstream(&buf, &len);
+    ck_assert_ptr_ne(out, NULL);
+    while (!feof(f)) {
+	s = csv_next(f, delimiter);
+	if (! s) {
+	    ck_assert_int_eq(errno, 0);
+	    if (feof(f)) {
+		break;
+	    }
+	    fputc('|', out);
+	    continue;
+	}
+	fprintf(out, "[%s]", s);
+	free(s);
+    }
+    fclose(f);
+    fclose(out);
+    return csv_render_trim(buf);
+}
+
+static char *
+csv_render_scan(const char *data, const char delimiter)
+{
+    struct csv_scanner scan;
+    FILE *out;
+    char *buf = NULL;
+    const char *field;
+    size_t len = 0, flen;
+    int n;
+
+    out = open_memstream(&buf, &len);
+    ck_assert_ptr_ne(out, NULL);
+    csv_scan_init(&scan, data, strlen(data));
+    while (! csv_scan_eof(&scan)) {
+	n = csv_scan_next(&scan, delimiter, &field, &flen);
+	ck_assert_int_ge(n, 0);
+	if (n == 0) {
+	    fputc('|', out);
+	    continue;
+	}
+	fprintf(out, "[%.*s]", (int) flen, field);
+    }
+    csv_scan_done(&scan);
+    fclose(out);
+    return csv_render_trim(buf);
+}
+
+START_TEST(test_csv_scan)
+{
+    int i;
+    char *a, *b;
+    const char *data[] = {
+	"0;1;2\n3;4;5;6\n",
+	"a;;b\n\n\nc",
+	"  lead;\t tab ; trail  \n",
+	"\"quoted;field\";\"with \"\"quotes\"\"\";x\n",
+	"\"\";\"\"\"\";\"a\"b\"\n\"open\n",
+	"\"last\"\n\"row\"\nplain\r\n",
+	"a field that is well over sixteen bytes long;"
+	"\"and a quoted one; also longer than sixteen bytes\"\n"
+	"\"escaped \"\"quotes\"\" past the first sixteen bytes\";z",
+	"trailing;",
+	"\"",
+	"",
+    };
+
+    for (i = 0; i < (int) (sizeof(data)/sizeof(data[0])); i++) {
+	a = csv_render_next(data[i], ';');
+	b = csv_render_scan(data[i], ';');
+	ck_assert_str_eq(b, a);
+	free(a);
+	free(b);
+    }
+
+    b = csv_render_scan(data[3], ';');
+    ck_assert_str_eq(b, "[quoted;field][with \"quotes\"][x]");
+    free(b);
+}
+END_TEST
+
+START_TEST(test_csv_scan_key_value)
+{
+    struct csv_scanner scan;
+    const char *data = "\n\nkey;value\n\"k;2\";\"v \"\"2\"\"\"\nalone\n";
+    char *key, *value;
+
+    csv_scan_init(&scan, data, strlen(data));
+    ck_assert_int_eq(csv_scan_next_key_value(&scan, ';', &key, &value), 0);
+    ck_assert_str_eq(key, "key");
+    ck_assert_str_eq(value, "value");
+    free(key);
+    free(value);
+    ck_assert_int_eq(csv_scan_next_key_value(&scan, ';', &key, &value), 0);
+    ck_assert_str_eq(key, "k;2");
+    ck_assert_str_eq(value, "v \"2\"");
+    free(key);
+    free(value);
+    ck_assert_int_eq(csv_scan_next_key_value(&scan, ';', &key, &value), 0);
+    ck_assert_str_eq(key, "alone");
+    ck_assert_ptr_eq(value, NULL);
+    free(key);
+    ck_assert_int_eq(csv_scan_next_key_value(&scan, ';', &key, &value), 0);
+    ck_assert_ptr_eq(key, NULL);
+    ck_assert_ptr_eq(value, NULL);
+    ck_assert(csv_scan_eof(&scan));
+    csv_scan_done(&scan);
+}
+END_TEST
+
+START_TEST(test_jsonw)
+{
+    FILE *f;
+    char *buf = NULL;
+    size_t len = 0;
+    struct jsonw w;
+    int compact;
+    const char *expect[2] = {
+	"{\n"
+	"  \"a\":\"x\\/y\\\"\\n\\u0001\",\n"
+	"  \"b\":[\n"
+	"    1,\n"
+	"    -2,\n"
+	"    true,\n"
+	"    null,\n"
+	"    {\n"
+	"    }\n"
+	"  ],\n"
+	"  \"c\":{\n"
+	"    \"d\":false\n"
+	"  }\n"
+	"}",
+	"{\"a\":\"x\\/y\\\"\\n\\u0001\",\"b\":[1,-2,true,null,{}],\"c\":{\"d\":false}}"
+    };
+
+    for (compact = 0; compact < 2; compact++) {
+	f = open_memstream(&buf, &len);
+	ck_assert_ptr_ne(f, NULL);
+	lmap_jsonw_init(&w, f, compact ? LMAP_JSONW_COMPACT : 0);
+	lmap_jsonw_object_start(&w, NULL);
+	lmap_jsonw_string(&w, "a", "x/y\"\n\001");
+	lmap_jsonw_array_start(&w, "b");
+	lmap_jsonw_int64(&w, NULL, 1);
+	lmap_jsonw_int64(&w, NULL, -2);
+	lmap_jsonw_boolean(&w, NULL, 1);
+	lmap_jsonw_null(&w, NULL);
+	lmap_jsonw_object_start(&w, NULL);
+	lmap_jsonw_object_end(&w);
+	lmap_jsonw_array_end(&w);
+	lmap_jsonw_object_start(&w, "c");
+	ck_assert_int_eq(lmap_jsonw_finish(&w), -1);
+	lmap_jsonw_boolean(&w, "d", 0);
+	lmap_jsonw_object_end(&w);
+	lmap_jsonw_object_end(&w);
+	ck_assert_int_eq(lmap_jsonw_finish(&w), 0);
+	fclose(f);
+	ck_assert_str_eq(buf, expect[compact]);
+	free(buf);
+	buf = NULL;
+    }
+}
+END_TEST
+
+START_TEST(test_write_config)
+{
+    FILE *f;
+    char *buf = NULL, *doc;
+    size_t len = 0;
+    struct lmap *lmap;
+    const char *a =
+	"<config xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\">\n"
+	"  <lmap xmlns=\"urn:ietf:params:xml:ns:yang:ietf-lmap-control\">\n"
+	"    <agent>\n"
+	"      <agent-id>550e8400-e29b-41d4-a716-446655440000</agent-id>\n"
+	"      <measurement-point>a &amp;&amp; b &lt;c&gt;</measurement-point>\n"
+	"      <report-agent-id>true</report-agent-id>\n"
+	"    </agent>\n"
+	"  </lmap>\n"
+	"</config>\n";
+
+    lmap = lmap_new();
+    ck_assert_ptr_ne(lmap, NULL);
+    ck_assert_int_eq(lmap_xml_parse_config_string(lmap, a), 0);
+    doc = lmap_xml_render_config(lmap);
+    ck_assert_ptr_ne(doc, NULL);
+    ck_assert_ptr_ne(strstr(doc, "<lmapc:measurement-point>a &amp;&amp; b &lt;c&gt;<"), NULL);
+
+    /* the same document, without the intermediate string */
+    f = open_memstream(&buf, &len);
+    ck_assert_ptr_ne(f, NULL);
+    ck_assert_int_eq(lmap_xml_write_config(lmap, f, 0), 0);
+    fclose(f);
+    ck_assert_str_eq(buf, doc);
+    free(buf);
+    buf = NULL;
+
+    f = open_memstream(&buf, &len);
+    ck_assert_ptr_ne(f, NULL);
+    ck_assert_int_eq(lmap_xml_write_config(lmap, f, LMAP_IO_FLAG_COMPACT), 0);
+    fclose(f);
+    ck_assert_ptr_ne(strstr(buf, "<lmapc:agent><lmapc:agent-id>"), NULL);
+    ck_assert_int_lt(strlen(buf), strlen(doc));
+    free(buf);
+
+    free(doc);
+    lmap_free(lmap);
+}
+END_TEST
+
 START_TEST(test_load_config_xml)
 {
     struct lmap *lmap;
@@ -2633,7 +3593,7 @@ END_TEST
 static Suite * lmap_suite(void)
 {
     Suite *s;
-    TCase *tc_core, *tc_parser, *tc_csv, *tc_file;
+    TCase *tc_core, *tc_parser, *tc_csv, *tc_write, *tc_file;
 
     s = suite_create("lmap");
 
@@ -2650,11 +3610,16 @@ static Suite * lmap_suite(void)
     tcase_add_test(tc_core, test_lmap_event);
     tcase_add_test(tc_core, test_lmap_event_periodic);
     tcase_add_test(tc_core, test_lmap_event_calendar);
+    tcase_add_loop_test(tc_core, test_lmap_event_calendar_next, 0, 3);
     tcase_add_test(tc_core, test_lmap_event_one_off);
     tcase_add_test(tc_core, test_lmap_task);
     tcase_add_test(tc_core, test_lmap_schedule);
     tcase_add_test(tc_core, test_lmap_action);
+    tcase_add_test(tc_core, test_lmap_usage);
     tcase_add_test(tc_core, test_lmap_lmap);
+    tcase_add_test(tc_core, test_lmap_link_events);
+    tcase_add_test(tc_core, test_lmap_link);
+    tcase_add_test(tc_core, test_lmap_equal);
     tcase_add_test(tc_core, test_lmap_val);
     tcase_add_test(tc_core, test_lmap_row);
     tcase_add_test(tc_core, test_lmap_table);
@@ -2679,6 +3644,9 @@ static Suite * lmap_suite(void)
     tcase_add_test(tc_parser, test_parser_state_capability_tasks);
     tcase_add_test(tc_parser, test_parser_state_schedules);
     tcase_add_test(tc_parser, test_parser_state_actions);
+    tcase_add_test(tc_parser, test_parser_state_usage);
+    tcase_add_test(tc_parser, test_parser_state_timeouts);
+    tcase_add_test(tc_parser, test_parser_state_quota);
     tcase_add_test(tc_parser, test_parser_report);
     tcase_add_test(tc_parser, test_parser_report_table);
     suite_add_tcase(s, tc_parser);
@@ -2686,8 +3654,15 @@ static Suite * lmap_suite(void)
     tc_csv = tcase_create("Csv");
     tcase_add_test(tc_csv, test_csv);
     tcase_add_test(tc_csv, test_csv_key_value);
+    tcase_add_test(tc_csv, test_csv_scan);
+    tcase_add_test(tc_csv, test_csv_scan_key_value);
     suite_add_tcase(s, tc_csv);
 
+    tc_write = tcase_create("Writer");
+    tcase_add_test(tc_write, test_jsonw);
+    tcase_add_test(tc_write, test_write_config);
+    suite_add_tcase(s, tc_write);
+
     /* Other I/O test case */
     tc_file = tcase_create("File I/O");
     tcase_add_test(tc_file, test_load_config_xml);
@@ -17,14 +17,25 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <check.h>
 #include <unistd.h>
 #include <signal.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
 
 #include "lmap.h"
 #include "lmapd.h"
 #include "runner.h"
 #include "utils.h"
+#include "snapshot.h"
+#include "workers.h"
+#include "workspace.h"
+#include "lmap-io.h"
+#include "zio.h"
+#include "rlog.h"
 
 static char last_error_msg[1024];
 
@@ -79,10 +90,1245 @@ START_TEST(test_lmapd_run)
 }
 END_TEST
 
+/*
+ * A configuration with the schedule "schedule" of the actions "first"
+ * and "second", the latter with the given timeout.
+ */
+
+static struct lmap *
+config_lmap(const char *timeout)
+{
+    struct lmap *lmap;
+    struct schedule *sched;
+    struct action *act;
+
+    lmap = lmap_new();
+    ck_assert_ptr_ne(lmap, NULL);
+    sched = lmap_schedule_new();
+    lmap_schedule_set_name(sched, "schedule");
+    lmap_schedule_set_start(sched, "start");
+    act = lmap_action_new();
+    lmap_action_set_name(act, "first");
+    lmap_action_set_task(act, "task");
+    lmap_schedule_add_action(sched, act);
+    act = lmap_action_new();
+    lmap_action_set_name(act, "second");
+    lmap_action_set_task(act, "task");
+    lmap_action_set_timeout(act, timeout);
+    lmap_schedule_add_action(sched, act);
+    lmap_add_schedule(lmap, sched);
+    return lmap;
+}
+
+/*
+ * The queue fixture: an lmapd with the configuration of config_lmap()
+ * plus a schedule "sink" to deliver to, and its queue in a temporary
+ * directory. The tests adjust the configuration as needed and then
+ * set up the workspace with lmapd_workspace_init().
+ */
+
+#define QUEUE_TEMPLATE	"/tmp/check-lmapd-XXXXXX"
+
+static struct {
+    char path[sizeof(QUEUE_TEMPLATE)];
+    struct lmapd *lmapd;
+    struct schedule *sink;
+} queue;
+
+static void
+queue_setup(void)
+{
+    struct schedule *sink;
+
+    strcpy(queue.path, QUEUE_TEMPLATE);
+    ck_assert_ptr_ne(mkdtemp(queue.path), NULL);
+    queue.lmapd = lmapd_new();
+    ck_assert_ptr_ne(queue.lmapd, NULL);
+    ck_assert_int_eq(lmapd_set_queue_path(queue.lmapd, queue.path), 0);
+    queue.lmapd->lmap = config_lmap("10");
+    sink = lmap_schedule_new();
+    ck_assert_ptr_ne(sink, NULL);
+    lmap_schedule_set_name(sink, "sink");
+    lmap_schedule_set_start(sink, "start");
+    lmap_add_schedule(queue.lmapd->lmap, sink);
+    queue.sink = sink;
+}
+
+/* lmap_free() releases neither the capabilities nor their tasks */
+static void
+queue_capability_free(struct capability *cap)
+{
+    struct task *task;
+
+    if (! cap) {
+	return;
+    }
+    while ((task = cap->tasks)) {
+	cap->tasks = task->next;
+	lmap_task_free(task);
+    }
+    lmap_capability_free(cap);
+}
+
+static void
+queue_teardown(void)
+{
+    ck_assert_int_eq(lmapd_workspace_clean(queue.lmapd), 0);
+    ck_assert_int_eq(rmdir(queue.path), 0);
+    queue_capability_free(queue.lmapd->lmap->capabilities);
+    lmapd_free(queue.lmapd);
+    queue.lmapd = NULL;
+    queue.sink = NULL;
+}
+
+START_TEST(test_lmapd_snapshot)
+{
+    struct lmapd *lmapd;
+    struct schedule *sched;
+    struct action *act;
+    char run[] = "/tmp/check-lmapd-XXXXXX";
+    char filename[PATH_MAX];
+    struct stat st;
+    uint64_t size;
+    int fd;
+
+    ck_assert_ptr_ne(mkdtemp(run), NULL);
+    lmapd = lmapd_new();
+    ck_assert_ptr_ne(lmapd, NULL);
+    ck_assert_int_eq(lmapd_set_run_path(lmapd, run), 0);
+
+    /* no snapshot yet */
+    lmapd->lmap = config_lmap("10");
+    ck_assert_int_eq(lmapd_snapshot_read(lmapd), 0);
+
+    sched = lmapd->lmap->schedules;
+    sched->cnt_invocations = 3;
+    sched->last_invocation = 1234;
+    sched->usage.user_time = 42;
+    for (act = sched->actions; act; act = act->next) {
+	act->cnt_invocations = 3;
+	act->cnt_failures = 1;
+	act->last_status = 7;
+	act->usage.max_rss = 1024;
+    }
+    ck_assert_int_eq(lmapd_snapshot_write(lmapd), 0);
+
+    /* the second action changed, its state is not restored */
+    lmap_free(lmapd->lmap);
+    lmapd->lmap = config_lmap("20");
+    ck_assert_int_eq(lmapd_snapshot_read(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    ck_assert_int_eq(sched->cnt_invocations, 3);
+    ck_assert_int_eq(sched->last_invocation, 1234);
+    ck_assert_int_eq(sched->usage.user_time, 42);
+    act = sched->actions;
+    ck_assert_int_eq(act->cnt_invocations, 3);
+    ck_assert_int_eq(act->cnt_failures, 1);
+    ck_assert_int_eq(act->last_status, 7);
+    ck_assert_int_eq(act->usage.max_rss, 1024);
+    act = act->next;
+    ck_assert_int_eq(act->cnt_invocations, 0);
+    ck_assert_int_eq(act->cnt_failures, 0);
+    ck_assert_int_eq(act->last_status, 0);
+    ck_assert_int_eq(act->usage.max_rss, 0);
+
+    /* a snapshot with trailing garbage is ignored as a whole, none of
+     * its records are applied */
+    snprintf(filename, sizeof(filename), "%s/%s", run, LMAPD_SNAPSHOT_FILE);
+    fd = open(filename, O_RDWR);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(fstat(fd, &st), 0);
+    size = (uint64_t) st.st_size + 8;
+    ck_assert_int_eq(pwrite(fd, &size, sizeof(size), 16), sizeof(size));
+    ck_assert_int_eq(pwrite(fd, &size, sizeof(size), st.st_size), sizeof(size));
+    ck_assert_int_eq(close(fd), 0);
+    lmap_free(lmapd->lmap);
+    lmapd->lmap = config_lmap("10");
+    ck_assert_int_eq(lmapd_snapshot_read(lmapd), -1);
+    ck_assert_int_eq(lmapd->lmap->schedules->cnt_invocations, 0);
+    ck_assert_int_eq(lmapd->lmap->schedules->actions->cnt_invocations, 0);
+
+    /* a truncated snapshot is ignored */
+    ck_assert_int_eq(truncate(filename, 100), 0);
+    lmap_free(lmapd->lmap);
+    lmapd->lmap = config_lmap("10");
+    ck_assert_int_eq(lmapd_snapshot_read(lmapd), -1);
+    ck_assert_int_eq(lmapd->lmap->schedules->cnt_invocations, 0);
+
+    ck_assert_int_eq(unlink(filename), 0);
+    ck_assert_int_eq(rmdir(run), 0);
+    lmapd_free(lmapd);
+}
+END_TEST
+
+static void
+storage_file(const char *dir, const char *name, size_t size)
+{
+    char filename[PATH_MAX];
+    char buf[4096];
+    int fd;
+
+    memset(buf, 'x', sizeof(buf));
+    snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ck_assert_int_ne(fd, -1);
+    for (; size; size -= (size > sizeof(buf)) ? sizeof(buf) : size) {
+	ck_assert_int_gt(write(fd, buf, size > sizeof(buf) ? sizeof(buf) : size), 0);
+    }
+    ck_assert_int_eq(close(fd), 0);
+}
+
+START_TEST(test_lmapd_storage)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job;
+    uint64_t s1, s2, s3;
+
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+
+    /* the output of an action is measured, moved, then cleaned */
+    storage_file(act->workspace, "1-schedule-first.data", 100000);
+    storage_file(act->workspace, "1-schedule-first.meta", 100);
+    storage_file(act->workspace, "_state", 5000);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_measure(job, sched, act), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_move(job, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_clean(job, sched, act), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    s1 = sched->storage;
+    s2 = act->storage;
+    s3 = sink->storage;
+    ck_assert_uint_gt(s1, 0);
+    ck_assert_uint_eq(s1, s2);
+    ck_assert_uint_gt(s3, s2);
+
+    /* which is what a full scan finds */
+    ck_assert_int_eq(lmapd_workspace_update(lmapd), 0);
+    ck_assert_uint_eq(sched->storage, s1);
+    ck_assert_uint_eq(act->storage, s2);
+    ck_assert_uint_eq(sink->storage, s3);
+
+    /* the destination consumes its input */
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_schedule_move(job, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_schedule_clean(job, sink), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert_uint_eq(sink->storage, 0);
+    ck_assert_int_eq(lmapd_workspace_update(lmapd), 0);
+    ck_assert_uint_eq(sink->storage, 0);
+
+    ck_assert_int_eq(lmapd_workspace_clean(lmapd), 0);
+    ck_assert_uint_eq(sched->storage, 0);
+    ck_assert_uint_eq(act->storage, 0);
+}
+END_TEST
+
+START_TEST(test_lmapd_workspace_fd)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched;
+    struct action *act;
+    struct stat st;
+    char filename[PATH_MAX];
+    int fd;
+
+    sched = lmapd->lmap->schedules;
+    lmap_schedule_set_name(sched, "a/b");
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    act = sched->actions;
+    ck_assert_int_ne(sched->workspace_fd, -1);
+    ck_assert_int_ne(sched->incoming_fd, -1);
+    ck_assert_int_ne(act->workspace_fd, -1);
+    ck_assert_str_eq(sched->safe_name, "a%2Fb");
+    ck_assert_str_eq(act->safe_name, "first");
+
+    /* files are opened relative to the cached descriptor */
+    act->last_invocation = 42;
+    fd = lmapd_workspace_action_open_data(sched, act, O_WRONLY | O_CREAT);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(close(fd), 0);
+    snprintf(filename, sizeof(filename), "%s/42-a%%2Fb-first.data", act->workspace);
+    ck_assert_int_eq(stat(filename, &st), 0);
+
+    /* or by path without one */
+    ck_assert_int_eq(close(act->workspace_fd), 0);
+    act->workspace_fd = -1;
+    fd = lmapd_workspace_action_open_meta(sched, act, O_WRONLY | O_CREAT);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(close(fd), 0);
+    snprintf(filename, sizeof(filename), "%s/42-a%%2Fb-first.meta", act->workspace);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+    ck_assert_int_ne(stat(filename, &st), 0);
+}
+END_TEST
+
+static int
+queue_has(const char *dir, const char *name)
+{
+    char filename[PATH_MAX];
+    struct stat st;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+    return lstat(filename, &st) == 0;
+}
+
+START_TEST(test_lmapd_queue_move)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sched->workspace);
+
+    /* only complete, visible pairs are moved */
+    storage_file(incoming, "1.meta", 10);
+    storage_file(incoming, "1.data", 10);
+    storage_file(incoming, "2.meta", 10);
+    storage_file(incoming, ".3.meta", 10);
+    storage_file(incoming, ".3.data", 10);
+    snprintf(filename, sizeof(filename), "%s/4.meta", incoming);
+    ck_assert_int_eq(mkdir(filename, 0700), 0);
+    storage_file(incoming, "4.data", 10);
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sched), 0);
+    ck_assert(queue_has(sched->workspace, "1.meta"));
+    ck_assert(queue_has(sched->workspace, "1.data"));
+    ck_assert(! queue_has(incoming, "1.meta"));
+    ck_assert(! queue_has(incoming, "1.data"));
+    ck_assert(queue_has(incoming, "2.meta"));
+    ck_assert(queue_has(incoming, ".3.meta"));
+    ck_assert(queue_has(incoming, "4.meta"));
+    ck_assert(queue_has(incoming, "4.data"));
+    ck_assert(! queue_has(sched->workspace, "4.data"));
+
+    /* cleaning keeps directories and private files */
+    storage_file(sched->workspace, "_private", 10);
+    storage_file(sched->workspace, ".hidden", 10);
+    ck_assert_int_eq(lmapd_workspace_schedule_clean(lmapd, sched), 0);
+    ck_assert(! queue_has(sched->workspace, "1.meta"));
+    ck_assert(! queue_has(sched->workspace, "1.data"));
+    ck_assert(! queue_has(sched->workspace, ".hidden"));
+    ck_assert(queue_has(sched->workspace, "_private"));
+    ck_assert(queue_has(sched->workspace, "_incoming"));
+    ck_assert(queue_has(sched->workspace, "first"));
+}
+END_TEST
+
+START_TEST(test_lmapd_queue_batch)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched;
+    char incoming[PATH_MAX];
+    char name[32];
+    int i;
+
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sched->workspace);
+
+    /* several batches, every 7th entry incomplete */
+    for (i = 0; i < 300; i++) {
+	snprintf(name, sizeof(name), "%d.meta", i);
+	storage_file(incoming, name, 10);
+	if (i % 7) {
+	    snprintf(name, sizeof(name), "%d.data", i);
+	    storage_file(incoming, name, 10);
+	}
+    }
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sched), 0);
+    for (i = 0; i < 300; i++) {
+	snprintf(name, sizeof(name), "%d.meta", i);
+	ck_assert(queue_has(sched->workspace, name) == (i % 7 != 0));
+	ck_assert(queue_has(incoming, name) == (i % 7 == 0));
+	snprintf(name, sizeof(name), "%d.data", i);
+	ck_assert(queue_has(sched->workspace, name) == (i % 7 != 0));
+	ck_assert(! queue_has(incoming, name));
+    }
+
+    /* a .meta that cannot be linked rolls back the link of its .data */
+    storage_file(incoming, "x.meta", 10);
+    storage_file(incoming, "x.data", 10);
+    storage_file(sched->workspace, "x.meta", 10);
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sched), 0);
+    ck_assert(queue_has(incoming, "x.meta"));
+    ck_assert(queue_has(incoming, "x.data"));
+    ck_assert(! queue_has(sched->workspace, "x.data"));
+
+    ck_assert_int_eq(lmapd_workspace_schedule_clean(lmapd, sched), 0);
+    for (i = 0; i < 300; i++) {
+	snprintf(name, sizeof(name), "%d.data", i);
+	ck_assert(! queue_has(sched->workspace, name));
+    }
+    ck_assert(! queue_has(sched->workspace, "x.meta"));
+}
+END_TEST
+
+START_TEST(test_lmapd_queue_quota)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job;
+    uint64_t storage;
+    char incoming[PATH_MAX];
+
+    ck_assert_int_eq(lmap_schedule_set_incoming_max_files(sink, "4"), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* the queue is indexed when the workspace is set up */
+    storage_file(incoming, "9-sink-a.meta", 10);
+    storage_file(incoming, "9-sink-a.data", 10);
+    storage_file(incoming, "10-sink-a.meta", 10);
+    storage_file(incoming, "10-sink-a.data", 10);
+    storage_file(incoming, "11-sink-a.meta", 10);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    ck_assert_int_eq(lmapd_workspace_update(lmapd), 0);
+
+    /* a full queue drops its oldest entries */
+    storage_file(act->workspace, "12-schedule-first.meta", 10);
+    storage_file(act->workspace, "12-schedule-first.data", 10);
+    storage = sink->storage;
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_move(job, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_clean(job, sched, act), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert(! queue_has(incoming, "9-sink-a.meta"));
+    ck_assert(! queue_has(incoming, "9-sink-a.data"));
+    ck_assert(queue_has(incoming, "10-sink-a.meta"));
+    ck_assert(queue_has(incoming, "11-sink-a.meta"));
+    ck_assert(queue_has(incoming, "12-schedule-first.meta"));
+    ck_assert(queue_has(incoming, "12-schedule-first.data"));
+    ck_assert_uint_eq(sink->cnt_quota_hits, 1);
+    ck_assert_uint_gt(sink->evicted_bytes, 0);
+    ck_assert_uint_eq(sink->storage, storage);
+    ck_assert_int_eq(lmapd_workspace_update(lmapd), 0);
+    ck_assert_uint_eq(sink->storage, storage);
+
+    /* or refuses new results */
+    ck_assert_int_eq(lmap_schedule_set_incoming_overflow(sink, "refuse"), 0);
+    storage = sink->evicted_bytes;
+    storage_file(act->workspace, "13-schedule-first.meta", 10);
+    storage_file(act->workspace, "13-schedule-first.data", 10);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), -1);
+    ck_assert(! queue_has(incoming, "13-schedule-first.meta"));
+    ck_assert(queue_has(incoming, "10-sink-a.meta"));
+    ck_assert_uint_eq(sink->cnt_quota_hits, 2);
+    ck_assert_uint_eq(sink->evicted_bytes, storage);
+
+    /* until the queue is consumed */
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    ck_assert(queue_has(incoming, "13-schedule-first.meta"));
+    ck_assert_uint_eq(sink->cnt_quota_hits, 2);
+
+    /* a result larger than the quota never fits */
+    ck_assert_int_eq(lmap_schedule_set_incoming_overflow(sink, "drop-oldest"), 0);
+    ck_assert_int_eq(lmap_schedule_set_incoming_max_bytes(sink, "100"), 0);
+    storage_file(act->workspace, "14-schedule-first.meta", 10);
+    storage_file(act->workspace, "14-schedule-first.data", 10);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), -1);
+    ck_assert(! queue_has(incoming, "14-schedule-first.meta"));
+    ck_assert_uint_eq(sink->cnt_quota_hits, 3);
+}
+END_TEST
+
+static void
+text_file(const char *dir, const char *name, const char *text)
+{
+    char filename[PATH_MAX];
+    FILE *file;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+    file = fopen(filename, "w");
+    ck_assert_ptr_ne(file, NULL);
+    ck_assert_int_ge(fputs(text, file), 0);
+    ck_assert_int_eq(fclose(file), 0);
+}
+
+static void
+log_results(const char *dir, int first, int count)
+{
+    char name[NAME_MAX], text[128];
+    int i;
+
+    for (i = first; i < first + count; i++) {
+	snprintf(name, sizeof(name), "%d-schedule-first.meta", i);
+	snprintf(text, sizeof(text), "schedule;schedule\naction;first\nstatus;%d\n", i);
+	text_file(dir, name, text);
+	snprintf(name, sizeof(name), "%d-schedule-first.data", i);
+	snprintf(text, sizeof(text), "%d;value\n", i);
+	text_file(dir, name, text);
+    }
+}
+
+/* the name of a sealed segment in dir, other than skip */
+static void
+find_segment(const char *dir, const char *skip, char *name, size_t size)
+{
+    DIR *d;
+    struct dirent *dp;
+    size_t len;
+
+    name[0] = 0;
+    d = opendir(dir);
+    ck_assert_ptr_ne(d, NULL);
+    while ((dp = readdir(d))) {
+	len = strlen(dp->d_name);
+	if (len > 4 && strcmp(dp->d_name + len - 4, LMAPD_RLOG_SUFFIX) == 0
+	    && (! skip || strcmp(dp->d_name, skip))) {
+	    snprintf(name, size, "%s/%s", dir, dp->d_name);
+	}
+    }
+    closedir(d);
+    ck_assert(name[0]);
+}
+
+START_TEST(test_lmapd_queue_log)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job;
+    struct result *res;
+    struct rlog log;
+    struct rlog_record rec;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    char segment[PATH_MAX], other[PATH_MAX];
+    char cwd[PATH_MAX];
+    off_t off = 0;
+    int fd, n;
+
+    ck_assert_int_eq(lmap_schedule_set_incoming_format(sink, "log"), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* results are appended to the active segment, other files linked */
+    log_results(act->workspace, 1, 2);
+    text_file(act->workspace, "other", "x");
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_move(job, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_clean(job, sched, act), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert(queue_has(incoming, LMAPD_RLOG_ACTIVE_NAME));
+    ck_assert(queue_has(incoming, "other"));
+    ck_assert(! queue_has(incoming, "1-schedule-first.meta"));
+    ck_assert(! queue_has(incoming, "1-schedule-first.data"));
+    ck_assert_uint_gt(sink->storage, 0);
+
+    log_results(act->workspace, 3, 1);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+
+    /* moving the queue seals the segment */
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sink), 0);
+    ck_assert(! queue_has(incoming, LMAPD_RLOG_ACTIVE_NAME));
+    find_segment(sink->workspace, NULL, segment, sizeof(segment));
+    ck_assert_int_eq(lmapd_rlog_open(&log, AT_FDCWD, segment), 0);
+    ck_assert_ptr_ne(log.index, NULL);
+    ck_assert_uint_eq(log.count, 3);
+    for (n = 1; lmapd_rlog_next(&log, &rec) == 1; n++) {
+	snprintf(filename, sizeof(filename), "%d-schedule-first", n);
+	ck_assert_uint_eq(rec.name_len, strlen(filename));
+	ck_assert(memcmp(rec.name, filename, rec.name_len) == 0);
+	ck_assert_uint_eq(rec.data_len, 8);
+	if (n == 2) {
+	    off = rec.data - (const char *) log.map;
+	}
+    }
+    ck_assert_int_eq(n, 4);
+    lmapd_rlog_close(&log);
+
+    /* and read as results */
+    ck_assert_ptr_ne(getcwd(cwd, sizeof(cwd)), NULL);
+    ck_assert_int_eq(chdir(sink->workspace), 0);
+    ck_assert_int_eq(lmapd_workspace_read_results(lmapd, LMAP_FT_CSV), 0);
+    ck_assert_int_eq(chdir(cwd), 0);
+    for (n = 0, res = lmapd->lmap->results; res; res = res->next, n++) {
+	ck_assert_str_eq(res->action, "first");
+	ck_assert_ptr_ne(res->tables, NULL);
+    }
+    ck_assert_int_eq(n, 3);
+
+    /* a damaged record is skipped, the index finds the next one */
+    fd = open(segment, O_WRONLY);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(pwrite(fd, "X", 1, off), 1);
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(lmapd_rlog_open(&log, AT_FDCWD, segment), 0);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), 1);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), -1);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), 1);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), 0);
+    lmapd_rlog_close(&log);
+
+    /* a partial record at the end is dropped when sealing */
+    log_results(act->workspace, 4, 2);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+    snprintf(filename, sizeof(filename), "%s/" LMAPD_RLOG_ACTIVE_NAME, incoming);
+    fd = open(filename, O_WRONLY);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(ftruncate(fd, lseek(fd, 0, SEEK_END) - 3), 0);
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sink), 0);
+    find_segment(sink->workspace, strrchr(segment, '/') + 1, other, sizeof(other));
+    ck_assert_int_eq(lmapd_rlog_open(&log, AT_FDCWD, other), 0);
+    ck_assert_uint_eq(log.count, 1);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), 1);
+    ck_assert_uint_eq(rec.data_len, 8);
+    ck_assert_int_eq(lmapd_rlog_next(&log, &rec), 0);
+    lmapd_rlog_close(&log);
+}
+END_TEST
+
+START_TEST(test_lmapd_queue_durable)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job, *after;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* staging moves everything but the .meta files */
+    log_results(act->workspace, 1, 2);
+    job = lmapd_workspace_job_new();
+    after = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_ptr_ne(after, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_stage(job, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_publish(after, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_clean(after, sched, act), 0);
+    lmapd_workspace_job_after(job, after);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    ck_assert(queue_has(incoming, "1-schedule-first.data"));
+    ck_assert(queue_has(incoming, "2-schedule-first.data"));
+    ck_assert(! queue_has(incoming, "1-schedule-first.meta"));
+    ck_assert(! queue_has(incoming, "2-schedule-first.meta"));
+    ck_assert(queue_has(act->workspace, "1-schedule-first.meta"));
+
+    /* once durable, the .meta files with their data are published */
+    ck_assert_int_eq(lmapd_workspace_sync(queue.path), 0);
+    snprintf(filename, sizeof(filename), "%s/2-schedule-first.data", incoming);
+    ck_assert_int_eq(unlink(filename), 0);
+    lmapd_workspace_job_run(after);
+    lmapd_workspace_job_account(after, lmapd->lmap);
+    ck_assert(queue_has(incoming, "1-schedule-first.meta"));
+    ck_assert(! queue_has(incoming, "2-schedule-first.meta"));
+    ck_assert(! queue_has(act->workspace, "1-schedule-first.meta"));
+    ck_assert_uint_gt(sink->storage, 0);
+    lmapd_workspace_job_free(job);
+    lmapd_workspace_job_free(after);
+}
+END_TEST
+
+#ifdef WITH_ZLIB
+START_TEST(test_lmapd_queue_compress)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job;
+    struct stat st;
+    FILE *file;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    char buf[4096];
+    size_t n, total = 0;
+    int fd;
+
+    ck_assert_int_eq(lmap_schedule_set_incoming_compression(sink, "gzip"), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* .data files are compressed on delivery, .meta files are not */
+    storage_file(act->workspace, "1-schedule-first.data", 100000);
+    storage_file(act->workspace, "1-schedule-first.meta", 100);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_move(job, sched, act, sink), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    snprintf(filename, sizeof(filename), "%s/1-schedule-first.data", incoming);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_int_lt(st.st_size, 100000);
+    ck_assert_uint_lt(sink->storage, 100000);
+    ck_assert(queue_has(incoming, "1-schedule-first.meta"));
+
+    /* and read back as they were */
+    fd = open(filename, O_RDONLY);
+    ck_assert_int_ne(fd, -1);
+    ck_assert(lmapd_zio_is_gzip(fd));
+    file = lmapd_zio_fdopen(fd);
+    ck_assert_ptr_ne(file, NULL);
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+	ck_assert(buf[0] == 'x' && buf[n - 1] == 'x');
+	total += n;
+    }
+    ck_assert_int_eq(fclose(file), 0);
+    ck_assert_uint_eq(total, 100000);
+
+    /* a compressed file is not compressed again */
+    ck_assert_int_eq(lmapd_workspace_schedule_move(lmapd, sink), 0);
+    snprintf(filename, sizeof(filename), "%s/1-schedule-first.data", sink->workspace);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    n = st.st_size;
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+    snprintf(buf, sizeof(buf), "%s/1-schedule-first.data", act->workspace);
+    ck_assert_int_eq(link(filename, buf), 0);
+    storage_file(act->workspace, "1-schedule-first.meta", 100);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    snprintf(filename, sizeof(filename), "%s/1-schedule-first.data", incoming);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_uint_eq(st.st_size, n);
+    ck_assert_uint_eq(st.st_nlink, 3);
+}
+END_TEST
+#endif
+
+#ifdef HAVE_MEMFD_CREATE
+static void
+output_write(struct schedule *sched, struct action *act, uint64_t invocation)
+{
+    int fd;
+
+    act->last_invocation = invocation;
+    fd = lmapd_workspace_action_open_output(sched, act);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_ne(act->output_fd, -1);
+    ck_assert_int_eq(write(fd, "output\n", 7), 7);
+    ck_assert_int_eq(close(fd), 0);
+}
+
+START_TEST(test_lmapd_output_memory)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *act;
+    struct workspace_job *job;
+    struct stat st;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    char moved[PATH_MAX];
+    char buf[64];
+    FILE *file;
+#ifdef WITH_ZLIB
+    int fd;
+#endif
+
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    sched = lmapd->lmap->schedules;
+    act = sched->actions;
+    ck_assert_int_eq(lmap_action_set_output_memory_limit(act, "1000"), 0);
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* delivered from memory, never written to the workspace */
+    output_write(sched, act, 2);
+    ck_assert(! queue_has(act->workspace, "2-schedule-first.data"));
+    storage_file(act->workspace, "2-schedule-first.meta", 100);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_move(job, sched, act, sink), 0);
+    ck_assert_int_eq(lmapd_workspace_job_action_clean(job, sched, act), 0);
+    ck_assert_int_eq(act->output_fd, -1);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    snprintf(filename, sizeof(filename), "%s/2-schedule-first.data", incoming);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_int_eq(st.st_size, 7);
+    ck_assert(queue_has(incoming, "2-schedule-first.meta"));
+    ck_assert(! queue_has(act->workspace, "2-schedule-first.meta"));
+    ck_assert_uint_gt(sink->storage, 0);
+
+    /* the synchronous move delivers it as well */
+    output_write(sched, act, 3);
+    storage_file(act->workspace, "3-schedule-first.meta", 100);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    ck_assert(queue_has(incoming, "3-schedule-first.data"));
+    ck_assert(queue_has(incoming, "3-schedule-first.meta"));
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+    ck_assert_int_eq(act->output_fd, -1);
+
+    /* spilled to the workspace */
+    output_write(sched, act, 4);
+    ck_assert_int_eq(lmapd_workspace_action_spill(sched, act), 0);
+    ck_assert_int_eq(act->output_fd, -1);
+    snprintf(filename, sizeof(filename), "%s/4-schedule-first.data", act->workspace);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_int_eq(st.st_size, 7);
+
+    output_write(sched, act, 5);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_spill(job, sched, act), 0);
+    ck_assert_int_eq(act->output_fd, -1);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert(queue_has(act->workspace, "5-schedule-first.data"));
+    ck_assert_uint_gt(act->storage, 0);
+
+    /* a move picks up the spilled file */
+    storage_file(act->workspace, "5-schedule-first.meta", 100);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    ck_assert(queue_has(incoming, "5-schedule-first.data"));
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+
+#ifdef WITH_ZLIB
+    /* compressed on delivery from memory as well */
+    ck_assert_int_eq(lmap_schedule_set_incoming_compression(sink, "gzip"), 0);
+    output_write(sched, act, 6);
+    storage_file(act->workspace, "6-schedule-first.meta", 100);
+    ck_assert_int_eq(lmapd_workspace_action_move(lmapd, sched, act, sink, 0), 0);
+    snprintf(filename, sizeof(filename), "%s/6-schedule-first.data", incoming);
+    fd = open(filename, O_RDONLY);
+    ck_assert_int_ne(fd, -1);
+    ck_assert(lmapd_zio_is_gzip(fd));
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+#endif
+
+    /* written while the action runs, the rest once it completed */
+    output_write(sched, act, 7);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_flush(job, sched, act, 7), 0);
+    ck_assert_int_ne(act->output_fd, -1);
+    ck_assert_uint_eq(act->output_spilled, 0);
+    ck_assert(act->flags & LMAP_ACTION_FLAG_FLUSHING);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert_uint_eq(act->output_spilled, 7);
+    ck_assert(!(act->flags & LMAP_ACTION_FLAG_FLUSHING));
+
+    /* a failed flush is not accounted, the next one picks up where
+     * the .data file ends */
+    ck_assert_int_eq(write(act->output_fd, "more\n", 5), 5);
+    snprintf(filename, sizeof(filename), "%s/7-schedule-first.data", act->workspace);
+    snprintf(moved, sizeof(moved), "%s/moved", act->workspace);
+    ck_assert_int_eq(rename(filename, moved), 0);
+    ck_assert_int_eq(symlink("/nonexistent", filename), 0);
+    job = lmapd_workspace_job_new();
+    ck_assert_ptr_ne(job, NULL);
+    ck_assert_int_eq(lmapd_workspace_job_action_flush(job, sched, act, 12), 0);
+    lmapd_workspace_job_run(job);
+    lmapd_workspace_job_account(job, lmapd->lmap);
+    lmapd_workspace_job_free(job);
+    ck_assert_uint_eq(act->output_spilled, 7);
+    ck_assert(!(act->flags & LMAP_ACTION_FLAG_FLUSHING));
+    ck_assert_int_eq(unlink(filename), 0);
+    ck_assert_int_eq(rename(moved, filename), 0);
+
+    ck_assert_int_eq(write(act->output_fd, "end\n", 4), 4);
+    ck_assert_int_eq(lmapd_workspace_action_spill(sched, act), 0);
+    ck_assert_uint_eq(act->output_spilled, 0);
+    file = fopen(filename, "r");
+    ck_assert_ptr_ne(file, NULL);
+    ck_assert_uint_eq(fread(buf, 1, sizeof(buf), file), 16);
+    ck_assert_int_eq(memcmp(buf, "output\nmore\nend\n", 16), 0);
+    ck_assert_int_eq(fclose(file), 0);
+    ck_assert_int_eq(lmapd_workspace_action_clean(lmapd, act), 0);
+}
+END_TEST
+#endif
+
+/*
+ * Adds an action running a shell script to a schedule of the queue
+ * fixture, with a task of its own and an optional destination.
+ */
+
+static struct action *
+queue_script(struct schedule *sched, const char *name,
+	     const char *program, const char *script, const char *destination)
+{
+    struct lmap *lmap = queue.lmapd->lmap;
+    struct task *task, *cap;
+    struct option *opt;
+    struct action *act;
+
+    if (! lmap->capabilities) {
+	lmap->capabilities = lmap_capability_new();
+	ck_assert_ptr_ne(lmap->capabilities, NULL);
+    }
+    cap = lmap_task_new();
+    ck_assert_ptr_ne(cap, NULL);
+    lmap_task_set_name(cap, name);
+    lmap_task_set_program(cap, program);
+    ck_assert_int_eq(lmap_capability_add_task(lmap->capabilities, cap), 0);
+
+    task = lmap_task_new();
+    ck_assert_ptr_ne(task, NULL);
+    lmap_task_set_name(task, name);
+    lmap_task_set_program(task, program);
+    opt = lmap_option_new();
+    ck_assert_ptr_ne(opt, NULL);
+    lmap_option_set_id(opt, "script");
+    lmap_option_set_name(opt, "-c");
+    lmap_option_set_value(opt, script);
+    ck_assert_int_eq(lmap_task_add_option(task, opt), 0);
+    ck_assert_int_eq(lmap_add_task(lmap, task), 0);
+
+    act = lmap_action_new();
+    ck_assert_ptr_ne(act, NULL);
+    lmap_action_set_name(act, name);
+    lmap_action_set_task(act, name);
+    if (destination) {
+	lmap_action_add_destination(act, destination);
+    }
+    ck_assert_int_eq(lmap_schedule_add_action(sched, act), 0);
+    return act;
+}
+
+/*
+ * Executes a schedule of the queue fixture and runs the event loop,
+ * without workers, until the schedule finished.
+ */
+
+static void
+queue_exec(struct schedule *sched)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    int i;
+
+    lmapd->base = event_base_new();
+    ck_assert_ptr_ne(lmapd->base, NULL);
+    lmapd_schedule_exec(lmapd, sched);
+    for (i = 0; i < 10000 && sched->state == LMAP_SCHEDULE_STATE_RUNNING; i++) {
+	/* reaps the children not watched by a pidfd */
+	lmapd_cleanup(lmapd);
+	(void) event_base_loop(lmapd->base, EVLOOP_NONBLOCK);
+	usleep(1000);
+    }
+    ck_assert_int_ne(sched->state, LMAP_SCHEDULE_STATE_RUNNING);
+    ck_assert_int_eq(lmapd->running, 0);
+    event_base_free(lmapd->base);
+    lmapd->base = NULL;
+}
+
+/* the number of files in dir ending in suffix, the last one in name */
+static int
+queue_count(const char *dir, const char *suffix, char *name, size_t size)
+{
+    DIR *d;
+    struct dirent *dp;
+    size_t len, slen = strlen(suffix);
+    int n = 0;
+
+    d = opendir(dir);
+    ck_assert_ptr_ne(d, NULL);
+    while ((dp = readdir(d))) {
+	len = strlen(dp->d_name);
+	if (len > slen && strcmp(dp->d_name + len - slen, suffix) == 0) {
+	    if (name) {
+		snprintf(name, size, "%s/%s", dir, dp->d_name);
+	    }
+	    n++;
+	}
+    }
+    closedir(d);
+    return n;
+}
+
+START_TEST(test_lmapd_pipeline)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *gen, *mid, *off, *last;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    char buf[64];
+    FILE *file;
+
+    sched = lmap_schedule_new();
+    ck_assert_ptr_ne(sched, NULL);
+    lmap_schedule_set_name(sched, "pipe");
+    lmap_schedule_set_start(sched, "start");
+    ck_assert_int_eq(lmap_schedule_set_exec_mode(sched, "pipelined"), 0);
+    lmap_add_schedule(lmapd->lmap, sched);
+    gen = queue_script(sched, "gen", "/bin/sh", "echo hello", "sink");
+    mid = queue_script(sched, "mid", "/bin/sh", "tr a-z A-Z; exit 3", NULL);
+    off = queue_script(sched, "off", "/bin/sh", "echo bypassed", "sink");
+    last = queue_script(sched, "last", "/bin/sh", "sed 's/^/>/'", "sink");
+    off->state = LMAP_ACTION_STATE_DISABLED;
+    ck_assert_int_eq(lmap_link(lmapd->lmap), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    queue_exec(sched);
+
+    /* every stage has its own status */
+    ck_assert_uint_eq(gen->cnt_invocations, 1);
+    ck_assert_int_eq(gen->last_status, 0);
+    ck_assert_uint_eq(mid->cnt_invocations, 1);
+    ck_assert_int_eq(mid->last_status, 3);
+    ck_assert_uint_eq(mid->cnt_failures, 1);
+    ck_assert_uint_eq(off->cnt_invocations, 0);
+    ck_assert_uint_eq(last->cnt_invocations, 1);
+    ck_assert_int_eq(last->last_status, 0);
+    ck_assert_uint_eq(sched->cnt_invocations, 1);
+
+    /* the stages are connected around the disabled action, and only
+     * the last one delivers its results */
+    ck_assert_int_eq(queue_count(incoming, ".meta", NULL, 0), 1);
+    ck_assert_int_eq(queue_count(incoming, ".data", filename, sizeof(filename)), 1);
+    ck_assert_ptr_ne(strstr(filename, "-pipe-last.data"), NULL);
+    file = fopen(filename, "r");
+    ck_assert_ptr_ne(file, NULL);
+    ck_assert_ptr_ne(fgets(buf, sizeof(buf), file), NULL);
+    ck_assert_str_eq(buf, ">HELLO\n");
+    ck_assert_int_eq(fclose(file), 0);
+    ck_assert_int_eq(queue_count(gen->workspace, ".meta", NULL, 0), 0);
+}
+END_TEST
+
+START_TEST(test_lmapd_spawn_failure)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched;
+    struct action *missing, *next;
+    int i;
+
+    sched = lmap_schedule_new();
+    ck_assert_ptr_ne(sched, NULL);
+    lmap_schedule_set_name(sched, "seq");
+    lmap_schedule_set_start(sched, "start");
+    ck_assert_int_eq(lmap_schedule_set_exec_mode(sched, "sequential"), 0);
+    lmap_add_schedule(lmapd->lmap, sched);
+    missing = queue_script(sched, "missing", "/nonexistent/program", "true", NULL);
+    next = queue_script(sched, "next", "/bin/sh", "true", NULL);
+    ck_assert_int_eq(lmap_link(lmapd->lmap), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+
+    /* a program that cannot be executed is a failed run, whether it
+     * is spawned or forked, and the schedule goes on */
+    for (i = 1; i <= 2; i++) {
+	if (i == 2) {
+	    lmapd->flags |= LMAPD_FLAG_FORK;
+	}
+	queue_exec(sched);
+	ck_assert_uint_eq(missing->cnt_invocations, i);
+	ck_assert_uint_eq(missing->cnt_failures, i);
+	ck_assert_int_eq(missing->last_status, EXIT_FAILURE);
+	ck_assert_int_eq(missing->last_failed_status, EXIT_FAILURE);
+	ck_assert_int_eq(missing->state, LMAP_ACTION_STATE_ENABLED);
+	ck_assert_uint_eq(next->cnt_invocations, i);
+	ck_assert_int_eq(next->last_status, 0);
+	ck_assert_uint_eq(sched->cnt_invocations, i);
+    }
+}
+END_TEST
+
+#ifdef HAVE_MEMFD_CREATE
+START_TEST(test_lmapd_output_limit)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *big;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    struct stat st;
+
+    sched = lmap_schedule_new();
+    ck_assert_ptr_ne(sched, NULL);
+    lmap_schedule_set_name(sched, "big");
+    lmap_schedule_set_start(sched, "start");
+    lmap_add_schedule(lmapd->lmap, sched);
+    big = queue_script(sched, "big", "/bin/sh",
+		       "head -c 20000 /dev/zero; sleep 1; head -c 30000 /dev/zero",
+		       "sink");
+    ck_assert_int_eq(lmap_action_set_output_memory_limit(big, "1000"), 0);
+    ck_assert_int_eq(lmap_link(lmapd->lmap), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* the output beyond the limit went to the workspace in two parts */
+    queue_exec(sched);
+    ck_assert_int_eq(big->last_status, 0);
+    ck_assert_int_eq(big->output_fd, -1);
+    ck_assert_int_eq(queue_count(incoming, ".data", filename, sizeof(filename)), 1);
+    ck_assert_int_eq(stat(filename, &st), 0);
+    ck_assert_int_eq(st.st_size, 50000);
+}
+END_TEST
+
+START_TEST(test_lmapd_output_flush_failure)
+{
+    struct lmapd *lmapd = queue.lmapd;
+    struct schedule *sched, *sink = queue.sink;
+    struct action *big;
+    char incoming[PATH_MAX];
+    char filename[PATH_MAX];
+    char buf[4096];
+    size_t n, len = 0, nul = 0, i;
+    FILE *file;
+
+    sched = lmap_schedule_new();
+    ck_assert_ptr_ne(sched, NULL);
+    lmap_schedule_set_name(sched, "big");
+    lmap_schedule_set_start(sched, "start");
+    lmap_add_schedule(lmapd->lmap, sched);
+
+    /* the flushes fail while the .data file is replaced by a symlink,
+     * after the first flush released the memory of its part */
+    big = queue_script(sched, "big", "/bin/sh",
+		       "yes | head -c 20000; sleep 1; f=$(ls *.data);"
+		       " mv $f moved; ln -s /nonexistent $f;"
+		       " yes | head -c 5000; sleep 1;"
+		       " rm $f; mv moved $f; yes | head -c 30000",
+		       "sink");
+    ck_assert_int_eq(lmap_action_set_output_memory_limit(big, "1000"), 0);
+    ck_assert_int_eq(lmap_link(lmapd->lmap), 0);
+    ck_assert_int_eq(lmapd_workspace_init(lmapd), 0);
+    snprintf(incoming, sizeof(incoming), "%s/_incoming", sink->workspace);
+
+    /* the output is delivered complete */
+    queue_exec(sched);
+    ck_assert_int_eq(big->last_status, 0);
+    ck_assert_int_eq(queue_count(incoming, ".data", filename, sizeof(filename)), 1);
+    file = fopen(filename, "r");
+    ck_assert_ptr_ne(file, NULL);
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+	for (i = 0; i < n; i++) {
+	    nul += (buf[i] == '\0');
+	}
+	len += n;
+    }
+    ck_assert_int_eq(fclose(file), 0);
+    ck_assert_uint_eq(len, 55000);
+    ck_assert_uint_eq(nul, 0);
+}
+END_TEST
+#endif
+
+/*
+ * Jobs of the workers test: every job records when it ran and when
+ * it completed, in the list of its key.
+ */
+
+#define WORKERS_JOBS	40
+
+struct workers_log {
+    int work[WORKERS_JOBS];
+    int done[WORKERS_JOBS];
+    int nwork, ndone;
+};
+
+struct workers_job {
+    struct workers_log *log;
+    int seq;
+};
+
+static void workers_work(void *arg)
+{
+    struct workers_job *job = arg;
+
+    /* give the other workers a chance to overtake */
+    if (job->seq % 3 == 0) {
+	usleep(1000);
+    }
+    job->log->work[job->log->nwork++] = job->seq;
+}
+
+static void workers_done(void *arg, int cancelled)
+{
+    struct workers_job *job = arg;
+
+    ck_assert_int_eq(cancelled, 0);
+    job->log->done[job->log->ndone++] = job->seq;
+    free(job);
+}
+
+START_TEST(test_lmapd_workers)
+{
+    struct event_base *base;
+    struct workers *workers;
+    struct workers_log logs[2];
+    struct workers_job *job;
+    int i, k;
+
+    memset(logs, 0, sizeof(logs));
+    base = event_base_new();
+    ck_assert_ptr_ne(base, NULL);
+    workers = lmapd_workers_new(base, 4);
+    ck_assert_ptr_ne(workers, NULL);
+
+    for (i = 0; i < WORKERS_JOBS; i++) {
+	for (k = 0; k < 2; k++) {
+	    job = calloc(1, sizeof(*job));
+	    ck_assert_ptr_ne(job, NULL);
+	    job->log = &logs[k];
+	    job->seq = i;
+	    ck_assert_int_eq(lmapd_workers_submit(workers, &logs[k],
+				workers_work, workers_done, job), 0);
+	}
+    }
+    while (logs[0].ndone < WORKERS_JOBS || logs[1].ndone < WORKERS_JOBS) {
+	ck_assert_int_eq(event_base_loop(base, EVLOOP_ONCE), 0);
+    }
+
+    /* jobs of the same key ran and completed in order */
+    for (k = 0; k < 2; k++) {
+	ck_assert_int_eq(logs[k].nwork, WORKERS_JOBS);
+	for (i = 0; i < WORKERS_JOBS; i++) {
+	    ck_assert_int_eq(logs[k].work[i], i);
+	    ck_assert_int_eq(logs[k].done[i], i);
+	}
+    }
+    lmapd_workers_free(workers);
+
+    /* without workers, jobs complete right away */
+    memset(logs, 0, sizeof(logs));
+    job = calloc(1, sizeof(*job));
+    ck_assert_ptr_ne(job, NULL);
+    job->log = &logs[0];
+    ck_assert_int_eq(lmapd_workers_submit(NULL, NULL, workers_work,
+					  workers_done, job), 1);
+    ck_assert_int_eq(logs[0].ndone, 1);
+
+    event_base_free(base);
+}
+END_TEST
+
 static Suite * lmap_suite(void)
 {
     Suite *s;
-    TCase *tc_core;
+    TCase *tc_core, *tc_queue;
 
     s = suite_create("lmapd");
 
@@ -92,8 +1338,35 @@ static Suite * lmap_suite(void)
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_lmapd);
     tcase_add_test(tc_core, test_lmapd_run);
+    tcase_add_test(tc_core, test_lmapd_snapshot);
+    tcase_add_test(tc_core, test_lmapd_workers);
     suite_add_tcase(s, tc_core);
 
+    /* Queue test case */
+    tc_queue = tcase_create("Queue");
+
+    tcase_add_checked_fixture(tc_queue, queue_setup, queue_teardown);
+    tcase_add_test(tc_queue, test_lmapd_storage);
+    tcase_add_test(tc_queue, test_lmapd_workspace_fd);
+    tcase_add_test(tc_queue, test_lmapd_queue_move);
+    tcase_add_test(tc_queue, test_lmapd_queue_batch);
+    tcase_add_test(tc_queue, test_lmapd_queue_quota);
+    tcase_add_test(tc_queue, test_lmapd_queue_log);
+    tcase_add_test(tc_queue, test_lmapd_queue_durable);
+#ifdef WITH_ZLIB
+    tcase_add_test(tc_queue, test_lmapd_queue_compress);
+#endif
+#ifdef HAVE_MEMFD_CREATE
+    tcase_add_test(tc_queue, test_lmapd_output_memory);
+#endif
+    tcase_add_test(tc_queue, test_lmapd_pipeline);
+    tcase_add_test(tc_queue, test_lmapd_spawn_failure);
+#ifdef HAVE_MEMFD_CREATE
+    tcase_add_test(tc_queue, test_lmapd_output_limit);
+    tcase_add_test(tc_queue, test_lmapd_output_flush_failure);
+#endif
+    suite_add_tcase(s, tc_queue);
+
     return s;
 }
 